@@ -7,11 +7,11 @@ with a C++ backend and Python interface.
 from ._version import __version__
 
 try:
-    from ._nbody_core import Body, Kosmos, G_CONST, AU
+    from ._nbody_core import Body, Kosmos, Ensemble, ForceSolver, Integrator, Precision, CollisionMode, SpaceFillingCurve, Trajectory, G_CONST, AU
 except ImportError as e:
     raise ImportError(
         "Could not import C++ extension module. "
         "Please build the package with: pip install ."
     ) from e
 
-__all__ = ["Body", "Kosmos", "G_CONST", "AU", "__version__"]
+__all__ = ["Body", "Kosmos", "Ensemble", "ForceSolver", "Integrator", "Precision", "CollisionMode", "SpaceFillingCurve", "Trajectory", "G_CONST", "AU", "__version__"]
@@ -1,9 +1,13 @@
 from setuptools import setup, Extension
 from pybind11.setup_helpers import Pybind11Extension, build_ext
+import os
 import sys
 
 __version__ = "0.1.0"
 
+# NBODY_PROFILE=1 pip install . builds with the hot path instrumentation
+profile_macros = [("NBODY_PROFILE", "1")] if os.environ.get("NBODY_PROFILE") == "1" else []
+
 # C++ source files
 ext_modules = [
     Pybind11Extension(
@@ -11,11 +15,30 @@ ext_modules = [
         [
             "src/bindings.cpp",
             "src/body/body.cpp",
+            "src/particles/particles.cpp",
             "src/kosmos/kosmos.cpp",
+            "src/kosmos/frame_buffer.cpp",
+            "src/kosmos/block_timestep.cpp",
+            "src/kosmos/collisions.cpp",
+            "src/kosmos/adaptive.cpp",
+            "src/kosmos/diagnostics.cpp",
+            "src/kosmos/ensemble.cpp",
+            "src/io/trajectory.cpp",
+            "src/io/checkpoint.cpp",
+            "src/forces/direct.cpp",
+            "src/forces/jerk.cpp",
+            "src/forces/symmetric.cpp",
+            "src/forces/tiled.cpp",
+            "src/forces/morton.cpp",
+            "src/forces/quadtree.cpp",
+            "src/forces/barnes_hut.cpp",
+            "src/forces/fmm.cpp",
+            "src/forces/precision.cpp",
+            "src/profile/profiler.cpp",
         ],
         include_dirs=["src"],
         cxx_std=11,
-        define_macros=[("VERSION_INFO", __version__)],
+        define_macros=[("VERSION_INFO", __version__)] + profile_macros,
         extra_compile_args=["-fopenmp"],  # Enable OpenMP multithreading
         extra_link_args=["-fopenmp"],     # Link with OpenMP library
     ),
@@ -1,22 +1,389 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include "body/body.hpp"
 #include "kosmos/kosmos.hpp"
+#include "kosmos/ensemble.hpp"
+#include "io/trajectory.hpp"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
 
 namespace py = pybind11;
 
+namespace {
+
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> DoubleArray;
+
+// what a numpy view hangs on to: the python kosmos, so it cannot be freed
+// under the view, and the pin that stops add_body from moving the arrays
+struct ViewOwner {
+    py::object kosmos;
+};
+
+AlignedArray & particle_array(Particles & particles, const std::string & name) {
+    if (name == "x") return particles.x;
+    if (name == "y") return particles.y;
+    if (name == "v_x") return particles.v_x;
+    if (name == "v_y") return particles.v_y;
+    if (name == "a_x") return particles.a_x;
+    if (name == "a_y") return particles.a_y;
+    if (name == "mass") return particles.mass;
+    if (name == "radius") return particles.radius;
+    throw std::invalid_argument("unknown array '" + name + "', expected one of x y v_x v_y a_x a_y mass radius");
+}
+
+// numpy array aliasing one of the soa arrays, no copy
+py::array_t<double> make_view(py::object self, const std::string & name, bool writable) {
+    Kosmos & kosmos = self.cast<Kosmos &>();
+    AlignedArray & array = particle_array(kosmos.get_particles(), name);
+
+    // throws while the worker runs or another thread steps, the array is
+    // only looked at once it is pinned
+    kosmos.pin_arrays();
+    py::capsule base(new ViewOwner{self}, [](void * ptr) {
+        ViewOwner * owner = static_cast<ViewOwner *>(ptr);
+        owner->kosmos.cast<Kosmos &>().unpin_arrays();
+        delete owner;
+    });
+    py::array_t<double> view({static_cast<py::ssize_t>(array.size())}, {static_cast<py::ssize_t>(sizeof(double))},
+                             array.data(), base);
+
+    if (!writable) {
+        view.attr("flags").attr("writeable") = false;
+    } else if (name != "v_x" && name != "v_y" && name != "radius") {
+        // positions and masses can now change outside step, drop the cached forces
+        kosmos.invalidate_forces();
+    }
+    return view;
+}
+
+void copy_column(const DoubleArray & column, const char * name, py::ssize_t n, AlignedArray & out) {
+    if (column.ndim() != 1 || column.shape(0) != n) {
+        throw std::invalid_argument(std::string(name) + " must be a 1d array as long as mass");
+    }
+    std::copy(column.data(), column.data() + n, out.begin());
+}
+
+// bulk constructor input, velocities and radii default to zero
+Particles particles_from_arrays(const DoubleArray & mass, const DoubleArray & x, const DoubleArray & y,
+                                const py::object & v_x, const py::object & v_y,
+                                const py::object & radius = py::none()) {
+    if (mass.ndim() != 1) {
+        throw std::invalid_argument("mass must be a 1d array");
+    }
+    const py::ssize_t n = mass.shape(0);
+    Particles particles;
+    particles.resize(static_cast<std::size_t>(n));
+    copy_column(mass, "mass", n, particles.mass);
+    copy_column(x, "x", n, particles.x);
+    copy_column(y, "y", n, particles.y);
+    if (!v_x.is_none()) {
+        copy_column(v_x.cast<DoubleArray>(), "v_x", n, particles.v_x);
+    }
+    if (!v_y.is_none()) {
+        copy_column(v_y.cast<DoubleArray>(), "v_y", n, particles.v_y);
+    }
+    if (!radius.is_none()) {
+        copy_column(radius.cast<DoubleArray>(), "radius", n, particles.radius);
+    }
+    return particles;
+}
+
+// tracers from 1d arrays, velocities default to zero, mass stays zero
+Particles tracers_from_arrays(const DoubleArray & x, const DoubleArray & y, const py::object & v_x,
+                              const py::object & v_y) {
+    if (x.ndim() != 1) {
+        throw std::invalid_argument("x must be a 1d array");
+    }
+    const py::ssize_t n = x.shape(0);
+    Particles tracers;
+    tracers.resize(static_cast<std::size_t>(n));
+    std::copy(x.data(), x.data() + n, tracers.x.begin());
+    const char * names[] = {"y", "v_x", "v_y"};
+    const py::object columns[] = {y, v_x, v_y};
+    AlignedArray * outs[] = {&tracers.y, &tracers.v_x, &tracers.v_y};
+    for (int c = 0; c < 3; ++c) {
+        if (columns[c].is_none()) {
+            continue;
+        }
+        const DoubleArray column = columns[c].cast<DoubleArray>();
+        if (column.ndim() != 1 || column.shape(0) != n) {
+            throw std::invalid_argument(std::string(names[c]) + " must be a 1d array as long as x");
+        }
+        std::copy(column.data(), column.data() + n, outs[c]->begin());
+    }
+    return tracers;
+}
+
+// copy of one soa array for a snapshot, the simulation keeps moving after the callback
+py::array_t<double> snapshot_array(const AlignedArray & array) {
+    return py::array_t<double>(static_cast<py::ssize_t>(array.size()), array.data());
+}
+
+// run with the gil released, it is only taken back to hand a snapshot to callback
+long long run_released(Kosmos & kosmos, long long num_steps, double time_delta, long long sample_every,
+                       py::object callback) {
+    Kosmos::SampleCallback sample;
+    if (!callback.is_none()) {
+        sample = [&callback](const Kosmos & k) {
+            py::gil_scoped_acquire acquire;
+            const Particles & particles = k.get_particles_by_id();
+            py::dict snapshot;
+            snapshot["step"] = k.get_step_count();
+            snapshot["time"] = k.get_time();
+            snapshot["x"] = snapshot_array(particles.x);
+            snapshot["y"] = snapshot_array(particles.y);
+            snapshot["v_x"] = snapshot_array(particles.v_x);
+            snapshot["v_y"] = snapshot_array(particles.v_y);
+            py::object keep_going = callback(snapshot);
+            // None counts as carry on, so plain print style callbacks work
+            return keep_going.is_none() || static_cast<bool>(py::bool_(keep_going));
+        };
+    }
+    py::gil_scoped_release release;
+    return kosmos.run(num_steps, time_delta, sample_every, sample);
+}
+
+// adaptive run with the gil released, the report comes back as a dict of
+// numpy arrays (dt, energy_error per accepted step) and (time, dt, energy_error) tuples
+py::dict advance_released(Kosmos & kosmos, double end_time, double eta, double length, double energy_tolerance,
+                          double min_dt, double max_dt, double initial_dt) {
+    AdaptiveOptions options;
+    options.eta = eta;
+    options.length = length;
+    options.energy_tolerance = energy_tolerance;
+    options.min_dt = min_dt;
+    options.max_dt = max_dt;
+    options.initial_dt = initial_dt;
+    AdaptiveReport report;
+    {
+        py::gil_scoped_release release;
+        report = kosmos.advance(end_time, options);
+    }
+    py::list rejected;
+    for (const RejectedStep & step : report.rejected) {
+        rejected.append(py::make_tuple(step.time, step.time_delta, step.energy_error));
+    }
+    py::dict result;
+    result["dt"] = py::array_t<double>(static_cast<py::ssize_t>(report.dt_history.size()), report.dt_history.data());
+    result["energy_error"] = py::array_t<double>(static_cast<py::ssize_t>(report.energy_errors.size()),
+                                                 report.energy_errors.data());
+    result["rejected"] = rejected;
+    result["finished"] = report.finished;
+    return result;
+}
+
+py::dict diagnostics_dict(const Diagnostics & d) {
+    py::dict result;
+    result["step"] = d.step;
+    result["time"] = d.time;
+    result["kinetic"] = d.kinetic;
+    result["potential"] = d.potential;
+    result["energy"] = d.get_energy();
+    result["momentum_x"] = d.momentum_x;
+    result["momentum_y"] = d.momentum_y;
+    result["angular_momentum"] = d.angular_momentum;
+    return result;
+}
+
+// profiler stats, one dict per phase plus the step time distribution
+py::dict profile_stats_dict(const ProfileStats & stats) {
+    py::dict phases;
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        const PhaseStats & phase = stats.phases[p];
+        py::dict entry;
+        entry["calls"] = phase.calls;
+        entry["total"] = phase.total;
+        entry["max"] = phase.max;
+        entry["imbalance"] = phase.imbalance;
+        entry["worker_busy"] = phase.worker_busy;
+        if (phase.cycles >= 0) {
+            entry["cycles"] = phase.cycles;
+            entry["instructions"] = phase.instructions;
+            entry["cache_misses"] = phase.cache_misses;
+        }
+        phases[phase_name(static_cast<Phase>(p))] = entry;
+    }
+    const py::ssize_t n = static_cast<py::ssize_t>(stats.recent.size());
+    py::array_t<long long> step(n);
+    py::array_t<double> seconds(n);
+    for (py::ssize_t k = 0; k < n; ++k) {
+        step.mutable_at(k) = stats.recent[k].step;
+        seconds.mutable_at(k) = stats.recent[k].seconds;
+    }
+    py::dict result;
+    result["enabled"] = stats.enabled;
+    result["hardware_counters"] = stats.hardware_counters;
+    result["threads"] = stats.threads;
+    result["steps"] = stats.steps;
+    result["step_mean"] = stats.step_mean;
+    result["step_min"] = stats.step_min;
+    result["step_max"] = stats.step_max;
+    result["step_p50"] = stats.step_p50;
+    result["step_p99"] = stats.step_p99;
+    result["recent_steps"] = step;
+    result["recent_seconds"] = seconds;
+    result["phases"] = phases;
+    return result;
+}
+
+// the collision log as numpy columns, oldest event first
+py::dict collision_events_dict(const Kosmos & kosmos) {
+    const std::vector<CollisionEvent> events = kosmos.get_collision_events();
+    const py::ssize_t n = static_cast<py::ssize_t>(events.size());
+    py::array_t<long long> step(n);
+    py::array_t<uint32_t> first(n), second(n);
+    py::array_t<double> time(n), x(n), y(n), relative_speed(n);
+    py::list kind;
+    for (py::ssize_t k = 0; k < n; ++k) {
+        const CollisionEvent & e = events[k];
+        step.mutable_at(k) = e.step;
+        time.mutable_at(k) = e.time;
+        first.mutable_at(k) = e.first;
+        second.mutable_at(k) = e.second;
+        x.mutable_at(k) = e.x;
+        y.mutable_at(k) = e.y;
+        relative_speed.mutable_at(k) = e.relative_speed;
+        kind.append(collision_mode_name(e.kind));
+    }
+    py::dict result;
+    result["step"] = step;
+    result["time"] = time;
+    result["first"] = first;
+    result["second"] = second;
+    result["kind"] = kind;
+    result["x"] = x;
+    result["y"] = y;
+    result["relative_speed"] = relative_speed;
+    return result;
+}
+
+// recorded diagnostics as one numpy array per field
+py::dict diagnostics_history_dict(const Kosmos & kosmos) {
+    const std::vector<Diagnostics> & history = kosmos.get_diagnostics_history();
+    const py::ssize_t n = static_cast<py::ssize_t>(history.size());
+    py::array_t<long long> step(n);
+    py::array_t<double> time(n), kinetic(n), potential(n), energy(n), momentum_x(n), momentum_y(n), angular(n);
+    for (py::ssize_t k = 0; k < n; ++k) {
+        const Diagnostics & d = history[k];
+        step.mutable_at(k) = d.step;
+        time.mutable_at(k) = d.time;
+        kinetic.mutable_at(k) = d.kinetic;
+        potential.mutable_at(k) = d.potential;
+        energy.mutable_at(k) = d.get_energy();
+        momentum_x.mutable_at(k) = d.momentum_x;
+        momentum_y.mutable_at(k) = d.momentum_y;
+        angular.mutable_at(k) = d.angular_momentum;
+    }
+    py::dict result;
+    result["step"] = step;
+    result["time"] = time;
+    result["kinetic"] = kinetic;
+    result["potential"] = potential;
+    result["energy"] = energy;
+    result["momentum_x"] = momentum_x;
+    result["momentum_y"] = momentum_y;
+    result["angular_momentum"] = angular;
+    return result;
+}
+
+// newest background frame as a dict of copies, None before the first one
+py::object latest_frame_dict(Kosmos & kosmos) {
+    const Frame * frame = kosmos.latest_frame();
+    if (frame == nullptr) {
+        return py::none();
+    }
+    py::dict snapshot;
+    snapshot["step"] = frame->step;
+    snapshot["time"] = frame->time;
+    snapshot["x"] = snapshot_array(frame->particles.x);
+    snapshot["y"] = snapshot_array(frame->particles.y);
+    snapshot["v_x"] = snapshot_array(frame->particles.v_x);
+    snapshot["v_y"] = snapshot_array(frame->particles.v_y);
+    snapshot["mass"] = snapshot_array(frame->particles.mass);
+    return snapshot;
+}
+
+// read-only numpy view into a trajectory mapping, owner keeps the mapping alive
+py::array mapped_view(py::object owner, const py::dtype & dtype, std::size_t count, std::size_t stride,
+                      const void * data) {
+    py::array view(dtype, {static_cast<py::ssize_t>(count)}, {static_cast<py::ssize_t>(stride)}, data, owner);
+    view.attr("flags").attr("writeable") = false;
+    return view;
+}
+
+py::dtype value_dtype(const TrajectoryReader & reader) {
+    return reader.is_float32() ? py::dtype::of<float>() : py::dtype::of<double>();
+}
+
+unsigned fields_from_names(const std::vector<std::string> & names) {
+    unsigned fields = 0;
+    for (const std::string & name : names) {
+        fields |= trajectory_field_from_name(name);
+    }
+    return fields;
+}
+
+void configure(Kosmos & kosmos, double theta, bool quadrupole, int fmm_order) {
+    kosmos.set_theta(theta);
+    kosmos.set_quadrupole(quadrupole);
+    kosmos.set_fmm_order(fmm_order);
+}
+
+
+// systems for an ensemble from (systems, bodies) arrays, or one system from 1d
+// arrays. velocities default to zero
+std::size_t add_ensemble_arrays(Ensemble & ensemble, const DoubleArray & mass, const DoubleArray & x,
+                                const DoubleArray & y, const py::object & v_x, const py::object & v_y) {
+    if (mass.ndim() != 1 && mass.ndim() != 2) {
+        throw std::invalid_argument("mass must be a (systems, bodies) or a 1d array");
+    }
+    const py::ssize_t count = mass.ndim() == 2 ? mass.shape(0) : 1;
+    const py::ssize_t n = mass.ndim() == 2 ? mass.shape(1) : mass.shape(0);
+    const std::vector<double> zeros(static_cast<std::size_t>(count * n), 0.0);
+    std::vector<DoubleArray> given; // keeps the converted arrays alive
+    const double * columns[4];
+    const char * names[] = {"x", "y", "v_x", "v_y"};
+    const py::object arrays[] = {x, y, v_x, v_y};
+    for (int c = 0; c < 4; ++c) {
+        if (arrays[c].is_none()) {
+            columns[c] = zeros.data();
+            continue;
+        }
+        given.push_back(arrays[c].cast<DoubleArray>());
+        const DoubleArray & column = given.back();
+        if (column.ndim() != mass.ndim() || column.size() != mass.size() ||
+            (column.ndim() == 2 && column.shape(1) != n)) {
+            throw std::invalid_argument(std::string(names[c]) + " must have the shape of mass");
+        }
+        columns[c] = column.data();
+    }
+    return ensemble.add_systems(static_cast<std::size_t>(count), static_cast<std::size_t>(n), mass.data(),
+                                columns[0], columns[1], columns[2], columns[3]);
+}
+
+template <typename T>
+py::array_t<T> vector_array(const std::vector<T> & values) {
+    return py::array_t<T>(static_cast<py::ssize_t>(values.size()), values.data());
+}
+} // namespace
+
 PYBIND11_MODULE(_nbody_core, m) {
     m.doc() = "N-body gravitational simulator - C++ core module";
     
     // Body class bindings
     py::class_<Body>(m, "Body")
-        .def(py::init<double, double, double, double, double>(),
+        .def(py::init<double, double, double, double, double, double>(),
              py::arg("mass"),
              py::arg("x"),
              py::arg("y"),
              py::arg("v_x") = 0.0,
              py::arg("v_y") = 0.0,
-             "Create a body with mass, position (x, y), and velocity (v_x, v_y)")
+             py::arg("radius") = 0.0,
+             "Create a body with mass, position (x, y), velocity (v_x, v_y) and collision radius")
         
         // Getters
         .def("get_mass", &Body::get_mass, "Get body mass in kg")
@@ -28,12 +395,14 @@ PYBIND11_MODULE(_nbody_core, m) {
         .def("get_a_y", &Body::get_a_y, "Get y acceleration in m/s²")
         .def("get_f_x", &Body::get_f_x, "Get x force in N")
         .def("get_f_y", &Body::get_f_y, "Get y force in N")
+        .def("get_radius", &Body::get_radius, "Get collision radius in meters (0 = a point)")
         
         // Setters
         .def("set_x", &Body::set_x, py::arg("x"), "Set x position in meters")
         .def("set_y", &Body::set_y, py::arg("y"), "Set y position in meters")
         .def("set_v_x", &Body::set_v_x, py::arg("v_x"), "Set x velocity in m/s")
         .def("set_v_y", &Body::set_v_y, py::arg("v_y"), "Set y velocity in m/s")
+        .def("set_radius", &Body::set_radius, py::arg("radius"), "Set collision radius in meters")
         
         // String representation
         .def("__repr__", [](const Body &b) {
@@ -41,24 +410,442 @@ PYBIND11_MODULE(_nbody_core, m) {
                    " pos=(" + std::to_string(b.get_x()) + ", " + std::to_string(b.get_y()) + ")>";
         });
     
+    // Force solver choices
+    py::enum_<Precision>(m, "Precision")
+        .value("DOUBLE", Precision::Double, "Direct sum pairs in double")
+        .value("MIXED", Precision::Mixed, "Float pairs around a local origin, double sums, for large statistical runs");
+
+    py::enum_<ForceSolver>(m, "ForceSolver")
+        .value("DIRECT", ForceSolver::Direct, "Exact all pairs sum, O(N^2)")
+        .value("DIRECT_SYMMETRIC", ForceSolver::DirectSymmetric, "Exact, each pair visited once with Newton's third law")
+        .value("BARNES_HUT", ForceSolver::BarnesHut, "Quadtree, O(N log N), accuracy set by theta")
+        .value("FMM", ForceSolver::FMM, "Fast multipole method, O(N), accuracy set by fmm_order");
+    
+    // Integrator choices
+    py::enum_<Integrator>(m, "Integrator")
+        .value("VERLET", Integrator::Verlet, "2nd order kick drift kick, one force pass per step")
+        .value("FOREST_RUTH", Integrator::ForestRuth, "4th order symplectic, three force passes per step")
+        .value("YOSHIDA6", Integrator::Yoshida6, "6th order symplectic, seven force passes per step")
+        .value("HERMITE4", Integrator::Hermite4, "4th order predictor-corrector with jerks, always the direct sum");
+    
+    // What touching bodies do
+    py::enum_<CollisionMode>(m, "CollisionMode")
+        .value("OFF", CollisionMode::Off, "Bodies pass through each other")
+        .value("MERGE", CollisionMode::Merge, "Touching bodies merge, mass, momentum and volume add up")
+        .value("BOUNCE", CollisionMode::Bounce, "Approaching bodies bounce along the line of centres");
+
+    // Curve the storage gets sorted along
+    py::enum_<SpaceFillingCurve>(m, "SpaceFillingCurve")
+        .value("MORTON", SpaceFillingCurve::Morton, "Z order, the same keys the tree is built from")
+        .value("HILBERT", SpaceFillingCurve::Hilbert, "Hilbert order, no jumps between neighbouring keys");
+
     // Kosmos class bindings
     py::class_<Kosmos>(m, "Kosmos")
-        .def(py::init<const std::vector<Body>&>(),
+        .def(py::init([](const std::vector<Body> &bodies, ForceSolver solver, double theta, bool quadrupole, int fmm_order) {
+                 std::unique_ptr<Kosmos> kosmos(new Kosmos(bodies, solver));
+                 configure(*kosmos, theta, quadrupole, fmm_order);
+                 return kosmos.release();
+             }),
              py::arg("bodies"),
-             "Create a simulation with initial bodies")
+             py::arg("solver") = ForceSolver::Direct,
+             py::arg("theta") = 0.5,
+             py::arg("quadrupole") = false,
+             py::arg("fmm_order") = 6,
+             "Create a simulation with initial bodies and a force solver")
+        
+        .def(py::init([](const DoubleArray &mass, const DoubleArray &x, const DoubleArray &y,
+                         const py::object &v_x, const py::object &v_y,
+                         ForceSolver solver, double theta, bool quadrupole, int fmm_order, const py::object &radius) {
+                 std::unique_ptr<Kosmos> kosmos(
+                     new Kosmos(particles_from_arrays(mass, x, y, v_x, v_y, radius), solver));
+                 configure(*kosmos, theta, quadrupole, fmm_order);
+                 return kosmos.release();
+             }),
+             py::arg("mass"),
+             py::arg("x"),
+             py::arg("y"),
+             py::arg("v_x") = py::none(),
+             py::arg("v_y") = py::none(),
+             py::arg("solver") = ForceSolver::Direct,
+             py::arg("theta") = 0.5,
+             py::arg("quadrupole") = false,
+             py::arg("fmm_order") = 6,
+             py::arg("radius") = py::none(),
+             "Create a simulation from 1d arrays of masses, positions and (optionally) velocities and radii")
         
-        .def("step", &Kosmos::step, 
+        .def("step", (void (Kosmos::*)(double)) &Kosmos::step, 
              py::arg("time_delta"),
+             py::call_guard<py::gil_scoped_release>(),
              "Advance simulation by time_delta seconds")
         
+        .def("step", (void (Kosmos::*)(double, ForceSolver)) &Kosmos::step,
+             py::arg("time_delta"),
+             py::arg("solver"),
+             py::call_guard<py::gil_scoped_release>(),
+             "Advance simulation by time_delta seconds using the given force solver for this step only")
+        
+        .def("run", &run_released,
+             py::arg("n_steps"),
+             py::arg("time_delta"),
+             py::arg("sample_every") = 1,
+             py::arg("callback") = py::none(),
+             "Advance simulation by n_steps steps of time_delta seconds without holding the GIL. "
+             "Every sample_every steps callback gets a dict of step, time and copies of x, y, v_x, v_y, "
+             "returning False stops the run. Returns the number of steps taken")
+        
+        .def("advance", &advance_released,
+             py::arg("end_time"),
+             py::arg("eta") = 0.02,
+             py::arg("length") = SOFTENING_LENGTH,
+             py::arg("energy_tolerance") = 0.0,
+             py::arg("min_dt") = 0.0,
+             py::arg("max_dt") = std::numeric_limits<double>::infinity(),
+             py::arg("initial_dt") = 0.0,
+             "Step until end_time, picking each time step from eta * sqrt(length / max|a|) and/or "
+             "a relative energy tolerance per step (steps above it are undone and retried smaller). "
+             "Returns a dict with the dt and energy_error of every accepted step, the rejected steps "
+             "as (time, dt, energy_error) and whether end_time was reached")
+        
+        .def("cancel", &Kosmos::cancel,
+             "Stop a run going on in another thread after its current step")
+        
+        .def("save_checkpoint", &Kosmos::save_checkpoint,
+             py::arg("path"),
+             py::call_guard<py::gil_scoped_release>(),
+             "Write the full simulation state (bodies, cached forces, time, step count, solver settings) to path")
+        .def("load_checkpoint", &Kosmos::load_checkpoint,
+             py::arg("path"),
+             py::call_guard<py::gil_scoped_release>(),
+             "Replace the simulation state with a checkpoint, the state is kept if the file is damaged")
+        .def_static("from_checkpoint", [](const std::string &path) {
+                 std::unique_ptr<Kosmos> kosmos(new Kosmos(std::vector<Body>()));
+                 {
+                     py::gil_scoped_release release;
+                     kosmos->load_checkpoint(path);
+                 }
+                 return kosmos.release();
+             },
+             py::arg("path"),
+             py::return_value_policy::take_ownership,
+             "Create a simulation from a checkpoint file")
+        
+        .def("attach_trajectory",
+             [](Kosmos &k, const std::string &path, const std::vector<std::string> &fields, long long every, bool float32) {
+                 k.attach_trajectory(path, fields_from_names(fields), every, float32);
+             },
+             py::arg("path"),
+             py::arg("fields") = std::vector<std::string>{"x", "y"},
+             py::arg("every") = 1,
+             py::arg("float32") = false,
+             "Stream a frame of the given fields to path now and then every `every` steps, written in the background")
+        .def("detach_trajectory", &Kosmos::detach_trajectory,
+             py::call_guard<py::gil_scoped_release>(),
+             "Finish the pending writes, add the index and close the trajectory file")
+        
+        // background mode, the worker thread never touches python objects
+        .def("start", &Kosmos::start,
+             py::arg("time_delta"),
+             py::arg("publish_every") = 1,
+             "Keep stepping by time_delta in a background thread, publishing a frame every publish_every steps")
+        .def("stop", &Kosmos::stop,
+             py::call_guard<py::gil_scoped_release>(),
+             "Stop the background thread and wait for it, the simulation keeps the state it reached")
+        .def("pause", &Kosmos::pause, "Pause the background thread after its current step")
+        .def("resume", &Kosmos::resume, "Resume a paused background thread")
+        .def("latest_frame", &latest_frame_dict,
+             "Newest background frame as a dict of step, time and copies of x, y, v_x, v_y, mass, or None")
+        .def_property_readonly("running", &Kosmos::is_running,
+                               "True while the background thread is active")
+        .def_property_readonly("paused", &Kosmos::is_paused,
+                               "True while the background thread is paused")
+        .def_property_readonly("frames_published", &Kosmos::get_frames_published,
+                               "Frames the background thread published since start")
+        .def_property_readonly("frames_dropped", &Kosmos::get_frames_dropped,
+                               "Frames replaced before any reader picked them up")
+        
+        .def("add_body", &Kosmos::add_body,
+             py::arg("body"),
+             "Add a body to the simulation")
+        
+        .def("add_tracer", &Kosmos::add_tracer,
+             py::arg("body"),
+             "Add a massless tracer (its mass is ignored), it feels the bodies but does not pull on them")
+        .def("add_tracers", [](Kosmos &k, const DoubleArray &x, const DoubleArray &y,
+                               const py::object &v_x, const py::object &v_y) {
+                 k.add_tracers(tracers_from_arrays(x, y, v_x, v_y));
+             },
+             py::arg("x"),
+             py::arg("y"),
+             py::arg("v_x") = py::none(),
+             py::arg("v_y") = py::none(),
+             "Add massless tracers from 1d arrays of positions and (optionally) velocities")
+        .def("set_tracer", &Kosmos::set_tracer,
+             py::arg("index"),
+             py::arg("body"),
+             "Replace a tracer")
+        .def("clear_tracers", &Kosmos::clear_tracers, "Remove every tracer")
+        .def("get_tracers", &Kosmos::get_tracers, "Get list of all tracers (mass 0)")
+        .def_property_readonly("num_tracers", &Kosmos::get_tracer_count)
+        .def_property_readonly("tracer_state", [](const Kosmos &k) {
+                                   const Particles &tracers = k.get_tracer_particles();
+                                   py::dict state;
+                                   state["x"] = snapshot_array(tracers.x);
+                                   state["y"] = snapshot_array(tracers.y);
+                                   state["v_x"] = snapshot_array(tracers.v_x);
+                                   state["v_y"] = snapshot_array(tracers.v_y);
+                                   return state;
+                               },
+                               "Copies of the tracer x, y, v_x, v_y arrays")
+
+        .def("set_body", &Kosmos::set_body,
+             py::arg("index"),
+             py::arg("body"),
+             "Replace the body at index")
+        
+        .def("invalidate_forces", &Kosmos::invalidate_forces,
+             "Recompute accelerations on the next step, call after writing through a view")
+        
+        // zero copy numpy views, they keep the kosmos alive and block add_body while they exist
+        .def("view", &make_view,
+             py::arg("name"),
+             py::arg("writable") = false,
+             "NumPy array aliasing one of x, y, v_x, v_y, a_x, a_y, mass, radius without copying, in storage order")
+        .def_property_readonly("x", [](py::object self) { return make_view(self, "x", false); },
+                               "Read-only view of x positions in meters")
+        .def_property_readonly("y", [](py::object self) { return make_view(self, "y", false); },
+                               "Read-only view of y positions in meters")
+        .def_property_readonly("v_x", [](py::object self) { return make_view(self, "v_x", false); },
+                               "Read-only view of x velocities in m/s")
+        .def_property_readonly("v_y", [](py::object self) { return make_view(self, "v_y", false); },
+                               "Read-only view of y velocities in m/s")
+        .def_property_readonly("a_x", [](py::object self) { return make_view(self, "a_x", false); },
+                               "Read-only view of x accelerations in m/s²")
+        .def_property_readonly("a_y", [](py::object self) { return make_view(self, "a_y", false); },
+                               "Read-only view of y accelerations in m/s²")
+        .def_property_readonly("mass", [](py::object self) { return make_view(self, "mass", false); },
+                               "Read-only view of masses in kg")
+        .def_property_readonly("radius", [](py::object self) { return make_view(self, "radius", false); },
+                               "Read-only view of collision radii in meters")
+        
+        .def_property_readonly("time", &Kosmos::get_time,
+                               "Simulated time in seconds")
+        .def_property_readonly("step_count", &Kosmos::get_step_count,
+                               "Number of steps taken")
+        
+        .def_property("solver", &Kosmos::get_force_solver, &Kosmos::set_force_solver,
+                      "Force solver used by step")
+        .def_property("theta", &Kosmos::get_theta, &Kosmos::set_theta,
+                      "Barnes-Hut opening angle, smaller is more accurate")
+        .def_property("quadrupole", &Kosmos::get_quadrupole, &Kosmos::set_quadrupole,
+                      "Add quadrupole moments to Barnes-Hut cells")
+        .def_property("fmm_order", &Kosmos::get_fmm_order, &Kosmos::set_fmm_order,
+                      "FMM expansion order p, higher is more accurate")
+        .def_property("tile_size", &Kosmos::get_tile_size, &Kosmos::set_tile_size,
+                      "Direct solver source tile, set 0 to auto tune, reads back the size in use")
+        .def_property("precision", &Kosmos::get_precision, &Kosmos::set_precision,
+                      "Direct solver pair precision, Precision.MIXED trades ~1e-6 force error for speed")
+        .def_property("integrator", &Kosmos::get_integrator, &Kosmos::set_integrator,
+                      "Integrator used by step, higher order allows bigger steps for the same error")
+        .def_property("max_level", &Kosmos::get_max_level, &Kosmos::set_max_level,
+                      "Block time steps: bodies step with time_delta / 2^level, level <= max_level (0 = off)")
+        .def_property("eta", &Kosmos::get_eta, &Kosmos::set_eta,
+                      "Block time step accuracy, the step is eta * |a| / |da/dt|")
+        .def_property_readonly("level_counts", &Kosmos::get_level_counts,
+                               "Bodies on each level during the last block step")
+        .def_property("collision_mode", &Kosmos::get_collision_mode, &Kosmos::set_collision_mode,
+                      "What touching bodies do, merges shrink the body arrays (views taken before keep the old length)")
+        .def_property("restitution", &Kosmos::get_restitution, &Kosmos::set_restitution,
+                      "Share of the closing speed a bounce gives back, 1 = elastic")
+        .def_property("collision_log_capacity", &Kosmos::get_collision_log_capacity,
+                      &Kosmos::set_collision_log_capacity,
+                      "Newest collision events kept, setting it drops the ones kept so far")
+        .def_property_readonly("collision_count", &Kosmos::get_collision_count,
+                               "Collisions so far, including the ones the log no longer holds")
+        .def_property_readonly("collision_events", &collision_events_dict,
+                               "Logged collisions as a dict of numpy arrays (step, time, first, second, kind, ...)")
+        .def("clear_collision_events", &Kosmos::clear_collision_events,
+             "Empty the collision log and zero the count")
+        .def_property("reorder_every", &Kosmos::get_reorder_every, &Kosmos::set_reorder_every,
+                      "Sort the body storage along reorder_curve every this many steps (0 = never)")
+        .def_property("reorder_curve", &Kosmos::get_reorder_curve, &Kosmos::set_reorder_curve,
+                      "Space filling curve reorder sorts along")
+        .def("reorder", &Kosmos::reorder,
+             "Sort the body storage along reorder_curve now, fails while a numpy view is alive")
+        .def_property_readonly("reorder_count", &Kosmos::get_reorder_count,
+                               "Reorders so far")
+        .def_property_readonly("ids", &Kosmos::get_ids,
+                               "Body ids in get_bodies order, a body keeps its id for life")
+        .def_property_readonly("storage_ids", &Kosmos::get_storage_ids,
+                               "Body id at each storage slot, the order of the numpy views")
+        .def_property_readonly("force_evaluations", &Kosmos::get_force_evaluations,
+                               "Body accelerations computed so far")
+        .def("diagnostics", [](Kosmos &k) { return diagnostics_dict(k.get_diagnostics()); },
+             "Kinetic, potential and total energy, momentum and angular momentum right now as a dict")
+        .def_property("diagnostics_every", &Kosmos::get_diagnostics_every, &Kosmos::set_diagnostics_every,
+                      "Record diagnostics every this many steps (0 = off), the potential is summed in the force pass")
+        .def_property_readonly("diagnostics_history", &diagnostics_history_dict,
+                               "Recorded diagnostics as a dict of numpy arrays (step, time, energy, ...)")
+        .def_property("phase_timing", &Kosmos::get_phase_timing, &Kosmos::set_phase_timing,
+                      "Time every phase of step (forces, kicks, drift), off by default")
+        .def_property_readonly("phase_times", [](const Kosmos &k) {
+            const PhaseTimes & times = k.get_phase_times();
+            py::dict result;
+            result["forces"] = times.forces;
+            result["kick_drift"] = times.kick_drift;
+            result["kick"] = times.kick;
+            result["total"] = times.total;
+            result["reorder"] = times.reorder;
+            result["steps"] = times.steps;
+            return result;
+        }, "Seconds spent in each phase since the last reset_phase_times, while phase_timing is on")
+        .def("reset_phase_times", &Kosmos::reset_phase_times,
+             "Zero the phase timers")
+        .def("stats", [](const Kosmos &k) { return profile_stats_dict(k.stats()); },
+             "Per phase and per step timings, thread imbalance and hardware counters (needs an NBODY_PROFILE build)")
+        .def("reset_stats", &Kosmos::reset_stats,
+             "Forget everything the profiler recorded")
+        .def("write_trace", &Kosmos::write_trace, py::arg("path"),
+             "Write the recorded phases as chrome trace json (chrome://tracing, perfetto)")
+        .def("enable_hardware_counters", &Kosmos::enable_hardware_counters,
+             "Count cycles, instructions and cache misses per phase, False if perf_event is unavailable")
+        .def("clear_diagnostics_history", &Kosmos::clear_diagnostics_history,
+             "Forget the recorded diagnostics")
+        .def_property_readonly("energy_drift", &Kosmos::get_energy_drift,
+                               "Relative total energy change between the first and last recorded diagnostics")
+        
         .def("get_bodies", &Kosmos::get_bodies,
              "Get list of all bodies in the simulation")
         
         .def("__repr__", [](const Kosmos &k) {
-            return "<Kosmos with " + std::to_string(k.get_bodies().size()) + " bodies>";
+            return "<Kosmos with " + std::to_string(k.get_body_count()) + " bodies>";
+        });
+    
+    // Ensemble class bindings
+    py::class_<Ensemble>(m, "Ensemble")
+        .def(py::init<>(), "Create an empty ensemble of independent small systems")
+        .def(py::init([](const DoubleArray &mass, const DoubleArray &x, const DoubleArray &y,
+                         const py::object &v_x, const py::object &v_y) {
+                 std::unique_ptr<Ensemble> ensemble(new Ensemble());
+                 add_ensemble_arrays(*ensemble, mass, x, y, v_x, v_y);
+                 return ensemble.release();
+             }),
+             py::arg("mass"),
+             py::arg("x"),
+             py::arg("y"),
+             py::arg("v_x") = py::none(),
+             py::arg("v_y") = py::none(),
+             "Create an ensemble from (systems, bodies) arrays of masses, positions and (optionally) velocities")
+        .def("add_system", &Ensemble::add_system, py::arg("bodies"),
+             "Append one system given as a list of bodies, returns its index")
+        .def("add_systems", &add_ensemble_arrays,
+             py::arg("mass"),
+             py::arg("x"),
+             py::arg("y"),
+             py::arg("v_x") = py::none(),
+             py::arg("v_y") = py::none(),
+             "Append (systems, bodies) arrays (or one 1d system), returns the index of the first new system")
+        .def("clear", &Ensemble::clear, "Remove every system")
+        .def("run", &Ensemble::run,
+             py::arg("num_steps"),
+             py::arg("time_delta"),
+             py::call_guard<py::gil_scoped_release>(),
+             "Step every system num_steps times, the systems are spread over the OpenMP threads")
+        .def("run_until", [](Ensemble &e, const py::object &end_times, double time_delta) {
+                 std::vector<double> ends;
+                 if (py::isinstance<py::float_>(end_times) || py::isinstance<py::int_>(end_times)) {
+                     ends.assign(e.get_system_count(), end_times.cast<double>());
+                 } else {
+                     ends = end_times.cast<std::vector<double>>();
+                 }
+                 py::gil_scoped_release release;
+                 e.run_until(ends, time_delta);
+             },
+             py::arg("end_times"),
+             py::arg("time_delta"),
+             "Step every system to its end time (one per system, or one for all), the last step cut to land on it")
+        .def_property("integrator", &Ensemble::get_integrator, &Ensemble::set_integrator,
+                      "VERLET, FOREST_RUTH or YOSHIDA6")
+        .def_property_readonly("num_systems", &Ensemble::get_system_count)
+        .def_property_readonly("num_bodies", &Ensemble::get_body_count)
+        .def_property_readonly("system_steps", &Ensemble::get_system_steps,
+                               "Steps taken summed over all systems")
+        .def_property_readonly("offsets", [](const Ensemble &e) { return vector_array(e.get_offsets()); },
+                               "First body of every system in the packed arrays, plus the total")
+        .def_property_readonly("x", [](const Ensemble &e) { return vector_array(e.get_x()); },
+                               "Copy of every x, system after system (reshape to (systems, bodies) when all match)")
+        .def_property_readonly("y", [](const Ensemble &e) { return vector_array(e.get_y()); })
+        .def_property_readonly("v_x", [](const Ensemble &e) { return vector_array(e.get_v_x()); })
+        .def_property_readonly("v_y", [](const Ensemble &e) { return vector_array(e.get_v_y()); })
+        .def_property_readonly("mass", [](const Ensemble &e) { return vector_array(e.get_mass()); })
+        .def_property_readonly("times", [](const Ensemble &e) { return vector_array(e.get_times()); },
+                               "Simulated time of every system in seconds")
+        .def_property_readonly("step_counts", [](const Ensemble &e) { return vector_array(e.get_step_counts()); })
+        .def("energies", [](const Ensemble &e) { return vector_array(e.get_energies()); },
+             "Total energy of every system")
+        .def("diagnostics", [](const Ensemble &e, std::size_t system) {
+                 return diagnostics_dict(e.get_diagnostics(system));
+             },
+             py::arg("system"), "Energy, momentum and angular momentum of one system")
+        .def("get_bodies", &Ensemble::get_bodies, py::arg("system"), "Bodies of one system")
+        .def("set_body", &Ensemble::set_body, py::arg("system"), py::arg("index"), py::arg("body"),
+             "Replace one body of one system")
+        .def("__len__", &Ensemble::get_system_count)
+        .def("__repr__", [](const Ensemble &e) {
+            return "<Ensemble of " + std::to_string(e.get_system_count()) + " systems, " +
+                   std::to_string(e.get_body_count()) + " bodies>";
         });
+
+    // Trajectory files, memory mapped, every array is a read-only view into the file
+    py::class_<TrajectoryReader>(m, "Trajectory")
+        .def(py::init<const std::string &>(),
+             py::arg("path"),
+             "Open a trajectory file written by Kosmos.attach_trajectory")
+        .def("__len__", &TrajectoryReader::get_num_frames)
+        .def_property_readonly("num_bodies", &TrajectoryReader::get_num_bodies)
+        .def_property_readonly("float32", &TrajectoryReader::is_float32)
+        .def_property_readonly("every", &TrajectoryReader::get_every)
+        .def_property_readonly("indexed", &TrajectoryReader::has_index,
+                               "False if the file was not closed cleanly and frames were counted instead")
+        .def_property_readonly("fields", [](const TrajectoryReader &r) {
+            std::vector<std::string> names;
+            for (unsigned flag = 1; flag < (1u << TRAJ_NUM_FIELDS); flag <<= 1) {
+                if (r.get_fields() & flag) {
+                    names.push_back(trajectory_field_name(static_cast<TrajectoryField>(flag)));
+                }
+            }
+            return names;
+        }, "Names of the stored fields")
+        .def_property_readonly("steps", [](py::object self) {
+            const TrajectoryReader &r = self.cast<const TrajectoryReader &>();
+            return mapped_view(self, py::dtype::of<int64_t>(), r.get_num_frames(), r.get_index_stride(), r.steps_data());
+        }, "Step number of every frame")
+        .def_property_readonly("times", [](py::object self) {
+            const TrajectoryReader &r = self.cast<const TrajectoryReader &>();
+            return mapped_view(self, py::dtype::of<double>(), r.get_num_frames(), r.get_index_stride(), r.times_data());
+        }, "Simulated time of every frame in seconds")
+        .def("frame", [](py::object self, std::size_t k) {
+            const TrajectoryReader &r = self.cast<const TrajectoryReader &>();
+            py::dict frame;
+            frame["step"] = r.get_step(k);
+            frame["time"] = r.get_time(k);
+            const std::size_t value_size = r.is_float32() ? 4 : 8;
+            for (unsigned flag = 1; flag < (1u << TRAJ_NUM_FIELDS); flag <<= 1) {
+                TrajectoryField field = static_cast<TrajectoryField>(flag);
+                if (r.has_field(field)) {
+                    frame[trajectory_field_name(field)] =
+                        mapped_view(self, value_dtype(r), r.get_num_bodies(), value_size, r.field_data(k, field));
+                }
+            }
+            return frame;
+        }, py::arg("index"), "Dict of step, time and one array per stored field for frame index")
+        .def("series", [](py::object self, const std::string &field, std::size_t body) {
+            const TrajectoryReader &r = self.cast<const TrajectoryReader &>();
+            return mapped_view(self, value_dtype(r), r.get_num_frames(), r.get_frame_size(),
+                               r.series_data(trajectory_field_from_name(field), body));
+        }, py::arg("field"), py::arg("body"), "One field of one body over every frame, strided view into the file");
     
     // Constants
     m.attr("G_CONST") = 6.67430e-11; // big G
 m.attr("AU") = 1.496e11; // AU
+    m.attr("profiling_enabled") = profiling_compiled_in();
 }
@@ -1,7 +1,7 @@
 #include "body.hpp"
 
-Body::Body(double mass, double x, double y, double v_x, double v_y) 
-    : mass(mass), x(x), y(y), v_x(v_x), v_y(v_y), a_x(0), a_y(0), f_x(0), f_y(0) {
+Body::Body(double mass, double x, double y, double v_x, double v_y, double radius) 
+    : mass(mass), x(x), y(y), v_x(v_x), v_y(v_y), a_x(0), a_y(0), f_x(0), f_y(0), radius(radius) {
         // construct the intristic properties, no force or a yet because no "universe" exists
 }
 
@@ -41,6 +41,10 @@ double Body::get_f_y() const {
     return f_y;
 }
 
+double Body::get_radius() const {
+    return radius;
+}
+
 void Body::add_force(double f_x, double f_y) {
     this->f_x += f_x;
     this->f_y += f_y;
@@ -78,6 +82,10 @@ void Body::set_a_y(double a_y) {
     this->a_y = a_y;
 }
 
+void Body::set_radius(double radius) {
+    this->radius = radius;
+}
+
 void Body::compute_acceleration() { // heart of physics: f = ma -> a = f/m
     a_x = f_x / mass;
     a_y = f_y / mass;
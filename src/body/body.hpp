@@ -8,8 +8,9 @@ class Body {
         double v_x, v_y; // velocity in x and y vectors
         double a_x, a_y; // acceleration in x and y vectors
         double f_x, f_y; // force in x and y vectors
+        double radius; // collision radius in meters, 0 = a point that never collides
 
-        Body(double mass, double x, double y, double v_x=0, double v_y = 0);
+        Body(double mass, double x, double y, double v_x=0, double v_y = 0, double radius = 0);
         // getters
         double get_mass() const;
         double get_x() const;
@@ -20,6 +21,7 @@ class Body {
         double get_a_y() const;
         double get_f_x() const;
         double get_f_y() const;
+        double get_radius() const;
 
         // setters
         void set_x(double x);
@@ -30,6 +32,7 @@ class Body {
         void set_f_y(double f_y);
         void set_a_x(double a_x);
         void set_a_y(double a_y);
+        void set_radius(double radius);
 
         // more complex setters
         void add_force(double f_x, double f_y);
@@ -0,0 +1,199 @@
+#include "barnes_hut.hpp"
+#include "direct.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// squared distance from a point to an axis aligned box, zero inside it
+double distance_sq_to_box(double px, double py, double lo_x, double lo_y, double hi_x, double hi_y) {
+    double dx = std::max(std::max(lo_x - px, 0.0), px - hi_x);
+    double dy = std::max(std::max(lo_y - py, 0.0), py - hi_y);
+    return dx * dx + dy * dy;
+}
+
+// acceleration from a cell quadrupole, G (Q R / R^5 - 5/2 (R Q R) R / R^7)
+// with R pointing from the cell center of mass to the target
+void add_quadrupole(const QuadNode & node, double tx, double ty, double & a_x, double & a_y) {
+    double rx = tx - node.com_x;
+    double ry = ty - node.com_y;
+    double r2 = rx * rx + ry * ry;
+    double inv_r2 = 1.0 / r2;
+    double inv_r5 = inv_r2 * inv_r2 / std::sqrt(r2);
+    double qr_x = node.q_xx * rx + node.q_xy * ry;
+    double qr_y = node.q_xy * rx + node.q_yy * ry;
+    double rqr = rx * qr_x + ry * qr_y;
+    double radial = 2.5 * rqr * inv_r2;
+    a_x += G_CONST * inv_r5 * (qr_x - radial * rx);
+    a_y += G_CONST * inv_r5 * (qr_y - radial * ry);
+}
+
+// potential of the same quadrupole, -G (R Q R) / (2 R^5)
+double quadrupole_potential(const QuadNode & node, double tx, double ty) {
+    double rx = tx - node.com_x;
+    double ry = ty - node.com_y;
+    double r2 = rx * rx + ry * ry;
+    double rqr = node.q_xx * rx * rx + 2.0 * node.q_xy * rx * ry + node.q_yy * ry * ry;
+    return -0.5 * G_CONST * rqr / (r2 * r2 * std::sqrt(r2));
+}
+
+} // namespace
+
+void BarnesHutSolver::set_theta(double theta) {
+    if (!(theta >= 0.0)) {
+        throw std::invalid_argument("theta must be >= 0");
+    }
+    this->theta = theta;
+}
+
+void BarnesHutSolver::accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                                    double * a_x, double * a_y, const unsigned char * active, double * potential) {
+    tree.build(x, y, mass, n, leaf_size);
+    double energy = 0.0;
+    if (n == 0) {
+        if (potential != nullptr) {
+            *potential = 0.0;
+        }
+        return;
+    }
+
+    const std::vector<QuadNode> & nodes = tree.nodes;
+    const std::vector<int> & leaves = tree.leaves;
+    const double inv_theta = theta > 0.0 ? 1.0 / theta : HUGE_VAL;
+
+    #pragma omp parallel reduction(+:energy)
+    {
+        // interaction list shared by every target in a leaf: bodies of opened
+        // leaves plus accepted cells as point masses, fed to the simd kernel
+        std::vector<double> list_x, list_y, list_mass;
+        std::vector<int> quad_cells;
+        std::vector<int> stack;
+        std::vector<double> group_a_x, group_a_y, group_phi;
+        std::vector<double> active_x, active_y;
+        std::vector<int> active_slot;
+        NBODY_PROFILE_WORKER(profiler);
+
+        #pragma omp for schedule(dynamic, 4) nowait
+        for (std::size_t l = 0; l < leaves.size(); ++l) {
+            const QuadNode & group = nodes[leaves[l]];
+            int count = group.end - group.begin;
+            const double * gx = tree.x.data() + group.begin;
+            const double * gy = tree.y.data() + group.begin;
+
+            // with a mask only the active targets of the group take part
+            if (active != nullptr) {
+                active_x.clear();
+                active_y.clear();
+                active_slot.clear();
+                for (int k = 0; k < count; ++k) {
+                    if (active[tree.order[group.begin + k]]) {
+                        active_x.push_back(gx[k]);
+                        active_y.push_back(gy[k]);
+                        active_slot.push_back(k);
+                    }
+                }
+                if (active_slot.empty()) continue;
+                count = static_cast<int>(active_slot.size());
+                gx = active_x.data();
+                gy = active_y.data();
+            }
+
+            // tight box around the targets of this group
+            double lo_x = gx[0], hi_x = gx[0], lo_y = gy[0], hi_y = gy[0];
+            for (int k = 1; k < count; ++k) {
+                lo_x = std::min(lo_x, gx[k]);
+                hi_x = std::max(hi_x, gx[k]);
+                lo_y = std::min(lo_y, gy[k]);
+                hi_y = std::max(hi_y, gy[k]);
+            }
+
+            list_x.clear();
+            list_y.clear();
+            list_mass.clear();
+            quad_cells.clear();
+            stack.assign(1, 0);
+            // where the group's own bodies start in the list, they leave themselves out of phi
+            std::ptrdiff_t own = NOT_A_SOURCE;
+            while (!stack.empty()) {
+                const int index = stack.back();
+                stack.pop_back();
+                const QuadNode & node = nodes[index];
+                if (node.mass == 0.0) continue;
+
+                // open unless d > size / theta + offset of the com from the box center,
+                // d being measured to the nearest target of the group
+                double offset = std::sqrt((node.com_x - node.center_x) * (node.com_x - node.center_x) +
+                                          (node.com_y - node.center_y) * (node.com_y - node.center_y));
+                double open_radius = 2.0 * node.half_size * inv_theta + offset;
+                double d2 = distance_sq_to_box(node.com_x, node.com_y, lo_x, lo_y, hi_x, hi_y);
+
+                if (d2 > open_radius * open_radius) {
+                    list_x.push_back(node.com_x);
+                    list_y.push_back(node.com_y);
+                    list_mass.push_back(node.mass);
+                    if (quadrupole) {
+                        quad_cells.push_back(index);
+                    }
+                } else if (node.first_child < 0) {
+                    if (index == leaves[l]) {
+                        own = static_cast<std::ptrdiff_t>(list_x.size());
+                    }
+                    list_x.insert(list_x.end(), tree.x.begin() + node.begin, tree.x.begin() + node.end);
+                    list_y.insert(list_y.end(), tree.y.begin() + node.begin, tree.y.begin() + node.end);
+                    list_mass.insert(list_mass.end(), tree.mass.begin() + node.begin, tree.mass.begin() + node.end);
+                } else {
+                    for (int c = node.first_child; c < node.first_child + node.num_children; ++c) {
+                        stack.push_back(c);
+                    }
+                }
+            }
+
+            group_a_x.resize(count);
+            group_a_y.resize(count);
+            if (potential != nullptr) {
+                group_phi.resize(count);
+                if (active == nullptr) {
+                    direct_accelerations_potentials(gx, gy, count, list_x.data(), list_y.data(), list_mass.data(),
+                                                    list_x.size(), group_a_x.data(), group_a_y.data(),
+                                                    group_phi.data(), own);
+                } else {
+                    // the picked targets are no longer in step with the group's
+                    // bodies in the list, one call each with its own offset
+                    for (int k = 0; k < count; ++k) {
+                        direct_accelerations_potentials(gx + k, gy + k, 1, list_x.data(), list_y.data(),
+                                                        list_mass.data(), list_x.size(), &group_a_x[k],
+                                                        &group_a_y[k], &group_phi[k],
+                                                        own == NOT_A_SOURCE ? own : own + active_slot[k]);
+                    }
+                }
+            } else {
+                direct_accelerations(gx, gy, count, list_x.data(), list_y.data(), list_mass.data(), list_x.size(),
+                                     group_a_x.data(), group_a_y.data());
+            }
+
+            for (int k = 0; k < count; ++k) {
+                for (int cell : quad_cells) {
+                    add_quadrupole(nodes[cell], gx[k], gy[k], group_a_x[k], group_a_y[k]);
+                }
+                const int slot = active != nullptr ? active_slot[k] : k;
+                const uint32_t body = tree.order[group.begin + slot];
+                a_x[body] = group_a_x[k];
+                a_y[body] = group_a_y[k];
+                if (potential != nullptr) {
+                    double phi = group_phi[k];
+                    for (int cell : quad_cells) {
+                        phi += quadrupole_potential(nodes[cell], gx[k], gy[k]);
+                    }
+                    const double m = mass[body];
+                    energy += 0.5 * m * phi;
+                }
+            }
+        }
+    }
+    if (potential != nullptr) {
+        *potential = energy;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef BARNES_HUT_HPP
+#define BARNES_HUT_HPP
+#include "quadtree.hpp"
+#include "../profile/profiler.hpp"
+#include <cstddef>
+
+// O(N log N) tree code: far away cells act as a single body at their center
+// of mass (optionally plus a quadrupole correction) when size / distance < theta
+class BarnesHutSolver {
+    public:
+        BarnesHutSolver(double theta = 0.5, bool quadrupole = false, int leaf_size = 16)
+            : theta(theta), quadrupole(quadrupole), leaf_size(leaf_size), profiler(nullptr) {}
+
+        // build the tree over the bodies and write the acceleration of every body,
+        // or with an active mask only of the bodies whose entry is non zero
+        // (the rest of a_x / a_y is left alone, every body still acts as a source).
+        // with potential set the walk also sums the potential energy of the
+        // targets into it (the total one without a mask)
+        void accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                           double * a_x, double * a_y, const unsigned char * active = nullptr,
+                           double * potential = nullptr);
+
+        double get_theta() const {
+            return theta;
+        }
+        void set_theta(double theta);
+        bool get_quadrupole() const {
+            return quadrupole;
+        }
+        void set_quadrupole(bool quadrupole) {
+            this->quadrupole = quadrupole;
+        }
+        const QuadTree & get_tree() const {
+            return tree;
+        }
+        // worker scopes in the parallel regions report here in NBODY_PROFILE builds
+        void set_profiler(Profiler * profiler) {
+            this->profiler = profiler;
+        }
+
+    private:
+        double theta; // opening angle, 0 is the exact direct sum
+        bool quadrupole; // add quadrupole terms to accepted cells
+        int leaf_size;
+        QuadTree tree; // node pool is kept between builds
+        Profiler * profiler;
+};
+
+#endif
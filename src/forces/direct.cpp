@@ -0,0 +1,252 @@
+#include "direct.hpp"
+#include "../constants.h"
+#include <cmath>
+
+#include "simd_math.hpp"
+
+namespace {
+
+typedef void (*DirectKernel)(const double *, const double *, std::size_t,
+                             const double *, const double *, const double *, std::size_t,
+                             double *, double *, double *, bool, std::ptrdiff_t);
+
+// every kernel comes in two flavours, with Potential the same loop also sums
+// m_j / s into phi (one more fma per pair), without it the code is unchanged.
+// the target's own entry (source i + self) is masked out of phi by its index,
+// subtracting G m^2 / eps afterwards instead would, for a sun next to a few
+// planets, cancel away most of the digits
+
+template <bool Potential>
+void direct_scalar(const double * tx, const double * ty, std::size_t n_targets,
+                   const double * sx, const double * sy, const double * sm, std::size_t n_sources,
+                   double * a_x, double * a_y, double * phi, bool accumulate, std::ptrdiff_t self) {
+    for (std::size_t i = 0; i < n_targets; ++i) {
+        const double x_i = tx[i];
+        const double y_i = ty[i];
+        const std::size_t s = self_index(i, self);
+        double acc_x = 0.0;
+        double acc_y = 0.0;
+        double pot = 0.0;
+
+        #pragma omp simd reduction(+:acc_x, acc_y, pot)
+        for (std::size_t j = 0; j < n_sources; ++j) {
+            double dx = sx[j] - x_i;
+            double dy = sy[j] - y_i;
+            double distance_sq = dx * dx + dy * dy + SOFTENING_LENGTH_SQ;
+            double inv_distance = 1.0 / std::sqrt(distance_sq);
+            double scale = sm[j] * inv_distance * inv_distance * inv_distance;
+            acc_x += scale * dx;
+            acc_y += scale * dy;
+            if (Potential) {
+                pot += j != s ? sm[j] * inv_distance : 0.0;
+            }
+        }
+
+        a_x[i] = (accumulate ? a_x[i] : 0.0) + G_CONST * acc_x;
+        a_y[i] = (accumulate ? a_y[i] : 0.0) + G_CONST * acc_y;
+        if (Potential) {
+            phi[i] = (accumulate ? phi[i] : 0.0) - G_CONST * pot;
+        }
+    }
+}
+
+#ifdef NBODY_X86_SIMD
+
+template <bool Potential>
+__attribute__((target("avx2,fma")))
+void direct_avx2(const double * tx, const double * ty, std::size_t n_targets,
+                 const double * sx, const double * sy, const double * sm, std::size_t n_sources,
+                 double * a_x, double * a_y, double * phi, bool accumulate, std::ptrdiff_t self) {
+    const __m256d eps_sq = _mm256_set1_pd(SOFTENING_LENGTH_SQ);
+    const __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+    const std::size_t n_vec = n_sources & ~static_cast<std::size_t>(3);
+
+    for (std::size_t i = 0; i < n_targets; ++i) {
+        const __m256d x_i = _mm256_set1_pd(tx[i]);
+        const __m256d y_i = _mm256_set1_pd(ty[i]);
+        const std::size_t s = self_index(i, self);
+        __m256d acc_x = _mm256_setzero_pd();
+        __m256d acc_y = _mm256_setzero_pd();
+        __m256d pot = _mm256_setzero_pd();
+
+        for (std::size_t j = 0; j < n_vec; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(sx + j), x_i);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(sy + j), y_i);
+            __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, eps_sq));
+            __m256d inv = rsqrt_avx2(r2);
+            __m256d m_j = _mm256_loadu_pd(sm + j);
+            __m256d scale = _mm256_mul_pd(m_j, _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+            acc_x = _mm256_fmadd_pd(scale, dx, acc_x);
+            acc_y = _mm256_fmadd_pd(scale, dy, acc_y);
+            if (Potential) {
+                const long long lane = s - j < 4 ? static_cast<long long>(s - j) : -1;
+                __m256d is_self = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_set1_epi64x(lane), lanes));
+                pot = _mm256_add_pd(pot, _mm256_andnot_pd(is_self, _mm256_mul_pd(m_j, inv)));
+            }
+        }
+
+        double sum_x = hsum_avx2(acc_x);
+        double sum_y = hsum_avx2(acc_y);
+        double sum_pot = Potential ? hsum_avx2(pot) : 0.0;
+        for (std::size_t j = n_vec; j < n_sources; ++j) {
+            double dx = sx[j] - tx[i];
+            double dy = sy[j] - ty[i];
+            double inv = 1.0 / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+            double scale = sm[j] * inv * inv * inv;
+            sum_x += scale * dx;
+            sum_y += scale * dy;
+            sum_pot += j != s ? sm[j] * inv : 0.0;
+        }
+
+        a_x[i] = (accumulate ? a_x[i] : 0.0) + G_CONST * sum_x;
+        a_y[i] = (accumulate ? a_y[i] : 0.0) + G_CONST * sum_y;
+        if (Potential) {
+            phi[i] = (accumulate ? phi[i] : 0.0) - G_CONST * sum_pot;
+        }
+    }
+}
+
+template <bool Potential>
+__attribute__((target("avx512f")))
+void direct_avx512(const double * tx, const double * ty, std::size_t n_targets,
+                   const double * sx, const double * sy, const double * sm, std::size_t n_sources,
+                   double * a_x, double * a_y, double * phi, bool accumulate, std::ptrdiff_t self) {
+    const __m512d eps_sq = _mm512_set1_pd(SOFTENING_LENGTH_SQ);
+    const std::size_t n_vec = n_sources & ~static_cast<std::size_t>(7);
+    const std::size_t n_tail = n_sources - n_vec;
+    // masked loads pick up the last < 8 sources, masked lanes read as zero mass
+    const __mmask8 tail_mask = static_cast<__mmask8>((1u << n_tail) - 1u);
+
+    for (std::size_t i = 0; i < n_targets; ++i) {
+        const __m512d x_i = _mm512_set1_pd(tx[i]);
+        const __m512d y_i = _mm512_set1_pd(ty[i]);
+        const std::size_t s = self_index(i, self);
+        __m512d acc_x = _mm512_setzero_pd();
+        __m512d acc_y = _mm512_setzero_pd();
+        __m512d pot = _mm512_setzero_pd();
+
+        for (std::size_t j = 0; j < n_vec; j += 8) {
+            __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(sx + j), x_i);
+            __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(sy + j), y_i);
+            __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, eps_sq));
+            __m512d inv = rsqrt_avx512(r2);
+            __m512d m_j = _mm512_loadu_pd(sm + j);
+            __m512d scale = _mm512_mul_pd(m_j, _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)));
+            acc_x = _mm512_fmadd_pd(scale, dx, acc_x);
+            acc_y = _mm512_fmadd_pd(scale, dy, acc_y);
+            if (Potential) {
+                const __mmask8 others = s - j < 8 ? static_cast<__mmask8>(~(1u << (s - j))) : 0xFF;
+                pot = _mm512_mask3_fmadd_pd(m_j, inv, pot, others);
+            }
+        }
+
+        if (n_tail > 0) {
+            __m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(tail_mask, sx + n_vec), x_i);
+            __m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(tail_mask, sy + n_vec), y_i);
+            __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, eps_sq));
+            __m512d inv = rsqrt_avx512(r2);
+            __m512d m_j = _mm512_maskz_loadu_pd(tail_mask, sm + n_vec);
+            __m512d scale = _mm512_mul_pd(m_j, _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)));
+            acc_x = _mm512_fmadd_pd(scale, dx, acc_x);
+            acc_y = _mm512_fmadd_pd(scale, dy, acc_y);
+            if (Potential) {
+                const __mmask8 others = s - n_vec < 8 ? static_cast<__mmask8>(~(1u << (s - n_vec))) : 0xFF;
+                pot = _mm512_mask3_fmadd_pd(m_j, inv, pot, others);
+            }
+        }
+
+        a_x[i] = (accumulate ? a_x[i] : 0.0) + G_CONST * hsum_avx512(acc_x);
+        a_y[i] = (accumulate ? a_y[i] : 0.0) + G_CONST * hsum_avx512(acc_y);
+        if (Potential) {
+            phi[i] = (accumulate ? phi[i] : 0.0) - G_CONST * hsum_avx512(pot);
+        }
+    }
+}
+
+#endif // NBODY_X86_SIMD
+
+template <bool Potential>
+DirectKernel kernel_for(SimdLevel level) {
+    if (!cpu_supports(level)) {
+        return direct_scalar<Potential>;
+    }
+#ifdef NBODY_X86_SIMD
+    switch (level) {
+        case SimdLevel::AVX512:
+            return direct_avx512<Potential>;
+        case SimdLevel::AVX2:
+            return direct_avx2<Potential>;
+        default:
+            break;
+    }
+#endif
+    return direct_scalar<Potential>;
+}
+
+} // namespace
+
+SimdLevel detect_simd_level() {
+    static const SimdLevel level = cpu_supports(SimdLevel::AVX512) ? SimdLevel::AVX512
+                                 : cpu_supports(SimdLevel::AVX2) ? SimdLevel::AVX2
+                                 : SimdLevel::Scalar;
+    return level;
+}
+
+const char * simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX512:
+            return "avx512";
+        case SimdLevel::AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+void direct_accelerations(const double * target_x, const double * target_y, std::size_t n_targets,
+                          const double * source_x, const double * source_y, const double * source_mass,
+                          std::size_t n_sources, double * a_x, double * a_y) {
+    static const DirectKernel kernel = kernel_for<false>(detect_simd_level());
+    kernel(target_x, target_y, n_targets, source_x, source_y, source_mass, n_sources, a_x, a_y, nullptr, false, NOT_A_SOURCE);
+}
+
+void direct_accelerations_add(const double * target_x, const double * target_y, std::size_t n_targets,
+                              const double * source_x, const double * source_y, const double * source_mass,
+                              std::size_t n_sources, double * a_x, double * a_y) {
+    static const DirectKernel kernel = kernel_for<false>(detect_simd_level());
+    kernel(target_x, target_y, n_targets, source_x, source_y, source_mass, n_sources, a_x, a_y, nullptr, true, NOT_A_SOURCE);
+}
+
+void direct_accelerations_potentials(const double * target_x, const double * target_y, std::size_t n_targets,
+                                     const double * source_x, const double * source_y, const double * source_mass,
+                                     std::size_t n_sources, double * a_x, double * a_y, double * phi,
+                                     std::ptrdiff_t self) {
+    static const DirectKernel kernel = kernel_for<true>(detect_simd_level());
+    kernel(target_x, target_y, n_targets, source_x, source_y, source_mass, n_sources, a_x, a_y, phi, false, self);
+}
+
+void direct_accelerations_potentials_add(const double * target_x, const double * target_y, std::size_t n_targets,
+                                         const double * source_x, const double * source_y, const double * source_mass,
+                                         std::size_t n_sources, double * a_x, double * a_y, double * phi,
+                                         std::ptrdiff_t self) {
+    static const DirectKernel kernel = kernel_for<true>(detect_simd_level());
+    kernel(target_x, target_y, n_targets, source_x, source_y, source_mass, n_sources, a_x, a_y, phi, true, self);
+}
+
+void direct_accelerations(SimdLevel level,
+                          const double * target_x, const double * target_y, std::size_t n_targets,
+                          const double * source_x, const double * source_y, const double * source_mass,
+                          std::size_t n_sources, double * a_x, double * a_y) {
+    kernel_for<false>(level)(target_x, target_y, n_targets, source_x, source_y, source_mass, n_sources,
+                             a_x, a_y, nullptr, false, NOT_A_SOURCE);
+}
+
+double potential_energy(const double * mass, const double * phi, std::size_t n) {
+    // 1/2 sum m_i phi_i counts every pair once
+    double energy = 0.0;
+    #pragma omp parallel for reduction(+:energy)
+    for (std::size_t i = 0; i < n; ++i) {
+        energy += mass[i] * phi[i];
+    }
+    return 0.5 * energy;
+}
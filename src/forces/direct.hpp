@@ -0,0 +1,63 @@
+#ifndef DIRECT_HPP
+#define DIRECT_HPP
+#include <cstddef>
+#include <cstdint>
+
+// instruction sets the direct all pairs kernel can run with
+enum class SimdLevel {
+    Scalar, // portable c++, whatever the compiler makes of it
+    AVX2, // 4 doubles per instruction, needs avx2 + fma
+    AVX512 // 8 doubles per instruction, needs avx512f
+};
+
+// best level this cpu supports, checked once and cached
+SimdLevel detect_simd_level();
+const char * simd_level_name(SimdLevel level);
+
+// acceleration on every target from every source, a = sum G m_j r / (r^2 + eps^2)^1.5
+// targets and sources may be the same arrays: softening makes the self term
+// exactly zero so there is no i == j branch. results overwrite a_x / a_y.
+// single threaded, callers split the targets across threads
+void direct_accelerations(const double * target_x, const double * target_y, std::size_t n_targets,
+                          const double * source_x, const double * source_y, const double * source_mass,
+                          std::size_t n_sources, double * a_x, double * a_y);
+
+// same sum added onto whatever is already in a_x / a_y, lets callers split
+// the sources into tiles and accumulate one tile at a time
+void direct_accelerations_add(const double * target_x, const double * target_y, std::size_t n_targets,
+                              const double * source_x, const double * source_y, const double * source_mass,
+                              std::size_t n_sources, double * a_x, double * a_y);
+
+// self offset for targets that are not among the sources
+const std::ptrdiff_t NOT_A_SOURCE = PTRDIFF_MIN / 2;
+
+// index of target i among the sources for a self offset, past every source
+// when it is not one
+inline std::size_t self_index(std::size_t i, std::ptrdiff_t self) {
+    return static_cast<std::size_t>(static_cast<std::ptrdiff_t>(i) + self);
+}
+
+// both of the above that also write the potential of every target,
+// phi = -G sum m_j / (r^2 + eps^2)^0.5 over every source but the target itself,
+// which is source i + self (an index outside the sources, e.g. NOT_A_SOURCE,
+// means none). other bodies at exactly the same spot still count, G m_j / eps
+void direct_accelerations_potentials(const double * target_x, const double * target_y, std::size_t n_targets,
+                                     const double * source_x, const double * source_y, const double * source_mass,
+                                     std::size_t n_sources, double * a_x, double * a_y, double * phi,
+                                     std::ptrdiff_t self);
+void direct_accelerations_potentials_add(const double * target_x, const double * target_y, std::size_t n_targets,
+                                         const double * source_x, const double * source_y, const double * source_mass,
+                                         std::size_t n_sources, double * a_x, double * a_y, double * phi,
+                                         std::ptrdiff_t self);
+
+// total potential energy, 1/2 sum m_i phi_i
+double potential_energy(const double * mass, const double * phi, std::size_t n);
+
+// same as direct_accelerations with an explicit instruction set, used by tests and benchmarks
+// falls back to Scalar if the cpu cannot run the requested level
+void direct_accelerations(SimdLevel level,
+                          const double * target_x, const double * target_y, std::size_t n_targets,
+                          const double * source_x, const double * source_y, const double * source_mass,
+                          std::size_t n_sources, double * a_x, double * a_y);
+
+#endif
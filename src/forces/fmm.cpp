@@ -0,0 +1,375 @@
+#include "fmm.hpp"
+#include "direct.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+#include <stdexcept>
+
+namespace {
+
+const int MAX_ORDER = 20;
+
+// coefficient index of x^a y^b, grouped by total order a + b
+inline int term(int a, int b) {
+    int n = a + b;
+    return n * (n + 1) / 2 + b;
+}
+
+// dx^a and dy^b for a, b <= order
+inline void powers(double dx, double dy, int order, double * px, double * py) {
+    px[0] = 1.0;
+    py[0] = 1.0;
+    for (int k = 1; k <= order; ++k) {
+        px[k] = px[k - 1] * dx;
+        py[k] = py[k - 1] * dy;
+    }
+}
+
+// taylor coefficients b_k = d^k(1/|R|) / k! up to total order p, from the recurrence
+// |k| R^2 b_k + (2|k| - 1) sum_i R_i b_{k-e_i} + (|k| - 1) sum_i b_{k-2e_i} = 0
+void derivatives(double rx, double ry, int order, double * b) {
+    double r2 = rx * rx + ry * ry;
+    double inv_r2 = 1.0 / r2;
+    b[0] = std::sqrt(inv_r2);
+    for (int n = 1; n <= order; ++n) {
+        for (int by = 0; by <= n; ++by) {
+            int bx = n - by;
+            double sum = 0.0;
+            if (bx >= 1) sum += (2 * n - 1) * rx * b[term(bx - 1, by)];
+            if (by >= 1) sum += (2 * n - 1) * ry * b[term(bx, by - 1)];
+            if (bx >= 2) sum += (n - 1) * b[term(bx - 2, by)];
+            if (by >= 2) sum += (n - 1) * b[term(bx, by - 2)];
+            b[term(bx, by)] = -sum * inv_r2 / n;
+        }
+    }
+}
+
+} // namespace
+
+FmmSolver::FmmSolver(int order, double theta, int leaf_size)
+    : order(1), theta(0.5), leaf_size(leaf_size), num_terms(0), profiler(nullptr) {
+    set_order(order);
+    set_theta(theta);
+}
+
+void FmmSolver::set_order(int order) {
+    if (order < 1 || order > MAX_ORDER) {
+        throw std::invalid_argument("fmm order must be between 1 and 20");
+    }
+    this->order = order;
+    num_terms = (order + 1) * (order + 2) / 2;
+    binomials.assign((order + 1) * (order + 1), 0.0);
+    for (int n = 0; n <= order; ++n) {
+        binomials[n * (order + 1)] = 1.0;
+        for (int k = 1; k <= n; ++k) {
+            binomials[n * (order + 1) + k] = binomials[(n - 1) * (order + 1) + k - 1] +
+                                             (k < n ? binomials[(n - 1) * (order + 1) + k] : 0.0);
+        }
+    }
+}
+
+void FmmSolver::set_theta(double theta) {
+    if (!(theta > 0.0 && theta < 1.0)) {
+        throw std::invalid_argument("fmm theta must be in (0, 1)");
+    }
+    this->theta = theta;
+}
+
+void FmmSolver::accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                              double * a_x, double * a_y, double * potential) {
+    tree.build(x, y, mass, n, leaf_size);
+    if (potential != nullptr) {
+        *potential = 0.0;
+    }
+    if (n == 0) return;
+
+    const std::size_t num_nodes = tree.nodes.size();
+    multipoles.assign(num_nodes * num_terms, 0.0);
+    locals.assign(num_nodes * num_terms, 0.0);
+    near_leaves.resize(num_nodes);
+    for (std::size_t i = 0; i < num_nodes; ++i) {
+        near_leaves[i].clear();
+    }
+
+    // everything runs in units of the root box so the expansion
+    // coefficients stay O(mass) whatever the length scale is
+    const double scale = tree.side;
+
+    upward_pass();
+
+    // every target subtree below the frontier walks the whole source tree on its
+    // own, so threads only ever write locals and lists inside their own subtree
+    int max_depth = 0;
+    for (const QuadNode & node : tree.nodes) {
+        max_depth = std::max(max_depth, node.depth);
+    }
+    const std::size_t wanted = 8 * static_cast<std::size_t>(omp_get_max_threads());
+    std::vector<int> frontier;
+    for (int depth = 0; depth <= max_depth; ++depth) {
+        frontier.clear();
+        for (std::size_t i = 0; i < num_nodes; ++i) {
+            const QuadNode & node = tree.nodes[i];
+            if (node.depth == depth || (node.depth < depth && node.first_child < 0)) {
+                frontier.push_back(static_cast<int>(i));
+            }
+        }
+        if (frontier.size() >= wanted) break;
+    }
+
+    #pragma omp parallel
+    {
+        NBODY_PROFILE_WORKER(profiler);
+        #pragma omp for schedule(dynamic) nowait
+        for (std::size_t f = 0; f < frontier.size(); ++f) {
+            interact(frontier[f], 0, scale);
+        }
+    }
+
+    downward_pass();
+    evaluate_leaves(a_x, a_y, scale, potential);
+}
+
+void FmmSolver::upward_pass() {
+    const std::vector<QuadNode> & nodes = tree.nodes;
+    const double scale = tree.side;
+    int max_depth = 0;
+    for (const QuadNode & node : nodes) {
+        max_depth = std::max(max_depth, node.depth);
+    }
+    std::vector<std::vector<int>> by_depth(max_depth + 1);
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        by_depth[nodes[i].depth].push_back(static_cast<int>(i));
+    }
+
+    // deepest level first, a level only reads the one below it
+    for (int depth = max_depth; depth >= 0; --depth) {
+        const std::vector<int> & level = by_depth[depth];
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (std::size_t l = 0; l < level.size(); ++l) {
+            const QuadNode & node = nodes[level[l]];
+            double * m = &multipoles[static_cast<std::size_t>(level[l]) * num_terms];
+            double px[MAX_ORDER + 1], py[MAX_ORDER + 1];
+
+            if (node.first_child < 0) {
+                // p2m, M_k = sum m d^k
+                for (int k = node.begin; k < node.end; ++k) {
+                    powers((tree.x[k] - node.center_x) / scale, (tree.y[k] - node.center_y) / scale, order, px, py);
+                    for (int n = 0; n <= order; ++n) {
+                        for (int b = 0; b <= n; ++b) {
+                            m[term(n - b, b)] += tree.mass[k] * px[n - b] * py[b];
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // m2m, M_k += sum_{j <= k} C(k, j) h^(k - j) M_child_j
+            for (int c = node.first_child; c < node.first_child + node.num_children; ++c) {
+                const QuadNode & child = nodes[c];
+                const double * mc = &multipoles[static_cast<std::size_t>(c) * num_terms];
+                powers((child.center_x - node.center_x) / scale, (child.center_y - node.center_y) / scale, order, px, py);
+                for (int n = 0; n <= order; ++n) {
+                    for (int kb = 0; kb <= n; ++kb) {
+                        int ka = n - kb;
+                        double sum = 0.0;
+                        for (int ja = 0; ja <= ka; ++ja) {
+                            for (int jb = 0; jb <= kb; ++jb) {
+                                sum += binomials[ka * (order + 1) + ja] * binomials[kb * (order + 1) + jb] *
+                                       px[ka - ja] * py[kb - jb] * mc[term(ja, jb)];
+                            }
+                        }
+                        m[term(ka, kb)] += sum;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// dual tree walk: well separated pairs go through m2l, touching leaves
+// become p2p pairs, otherwise the bigger cell is split
+void FmmSolver::interact(int target, int source, double scale) {
+    const QuadNode & a = tree.nodes[target];
+    const QuadNode & b = tree.nodes[source];
+    if (b.mass == 0.0) return;
+
+    const double r_a = a.half_size * M_SQRT2;
+    const double r_b = b.half_size * M_SQRT2;
+    const double dx = a.center_x - b.center_x;
+    const double dy = a.center_y - b.center_y;
+    const double limit = (r_a + r_b) / theta;
+
+    if (dx * dx + dy * dy > limit * limit) {
+        m2l(target, source, scale);
+    } else if (a.first_child < 0 && b.first_child < 0) {
+        near_leaves[target].push_back(source);
+    } else if (b.first_child < 0 || (a.first_child >= 0 && a.half_size >= b.half_size)) {
+        for (int c = a.first_child; c < a.first_child + a.num_children; ++c) {
+            interact(c, source, scale);
+        }
+    } else {
+        for (int c = b.first_child; c < b.first_child + b.num_children; ++c) {
+            interact(target, c, scale);
+        }
+    }
+}
+
+// L_n += sum_k (-1)^|k| M_k C(k + n, n) b_{k+n}(c_target - c_source), |k| + |n| <= p
+// the -G is applied when the locals are evaluated
+void FmmSolver::m2l(int target, int source, double scale) {
+    const QuadNode & a = tree.nodes[target];
+    const QuadNode & b = tree.nodes[source];
+    const double * m = &multipoles[static_cast<std::size_t>(source) * num_terms];
+    double * l = &locals[static_cast<std::size_t>(target) * num_terms];
+
+    double deriv[(MAX_ORDER + 1) * (MAX_ORDER + 2) / 2];
+    derivatives((a.center_x - b.center_x) / scale, (a.center_y - b.center_y) / scale, order, deriv);
+
+    const int stride = order + 1;
+    for (int nn = 0; nn <= order; ++nn) {
+        for (int nb = 0; nb <= nn; ++nb) {
+            int na = nn - nb;
+            double sum = 0.0;
+            for (int kn = 0; kn <= order - nn; ++kn) {
+                double sign = (kn & 1) ? -1.0 : 1.0;
+                for (int kb = 0; kb <= kn; ++kb) {
+                    int ka = kn - kb;
+                    sum += sign * m[term(ka, kb)] * binomials[(ka + na) * stride + na] *
+                           binomials[(kb + nb) * stride + nb] * deriv[term(ka + na, kb + nb)];
+                }
+            }
+            l[term(na, nb)] += sum;
+        }
+    }
+}
+
+void FmmSolver::downward_pass() {
+    const std::vector<QuadNode> & nodes = tree.nodes;
+    const double scale = tree.side;
+    int max_depth = 0;
+    for (const QuadNode & node : nodes) {
+        max_depth = std::max(max_depth, node.depth);
+    }
+    std::vector<std::vector<int>> by_depth(max_depth + 1);
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        by_depth[nodes[i].depth].push_back(static_cast<int>(i));
+    }
+
+    // l2l, parents push their locals down one level at a time
+    // L_child_j += sum_{n >= j} C(n, j) h^(n - j) L_n
+    for (int depth = 0; depth < max_depth; ++depth) {
+        const std::vector<int> & level = by_depth[depth];
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (std::size_t l = 0; l < level.size(); ++l) {
+            const QuadNode & node = nodes[level[l]];
+            const double * lp = &locals[static_cast<std::size_t>(level[l]) * num_terms];
+            double px[MAX_ORDER + 1], py[MAX_ORDER + 1];
+            for (int c = node.first_child; node.first_child >= 0 && c < node.first_child + node.num_children; ++c) {
+                const QuadNode & child = nodes[c];
+                double * lc = &locals[static_cast<std::size_t>(c) * num_terms];
+                powers((child.center_x - node.center_x) / scale, (child.center_y - node.center_y) / scale, order, px, py);
+                for (int jn = 0; jn <= order; ++jn) {
+                    for (int jb = 0; jb <= jn; ++jb) {
+                        int ja = jn - jb;
+                        double sum = 0.0;
+                        for (int nn = jn; nn <= order; ++nn) {
+                            for (int nb = jb; nb <= nn; ++nb) {
+                                int na = nn - nb;
+                                if (na < ja) continue;
+                                sum += binomials[na * (order + 1) + ja] * binomials[nb * (order + 1) + jb] *
+                                       px[na - ja] * py[nb - jb] * lp[term(na, nb)];
+                            }
+                        }
+                        lc[term(ja, jb)] += sum;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void FmmSolver::evaluate_leaves(double * a_x, double * a_y, double scale, double * potential) {
+    const std::vector<QuadNode> & nodes = tree.nodes;
+    const std::vector<int> & leaves = tree.leaves;
+    const double far_factor = G_CONST / (scale * scale);
+    double energy = 0.0;
+
+    #pragma omp parallel reduction(+:energy)
+    {
+        std::vector<double> list_x, list_y, list_mass;
+        std::vector<double> group_a_x, group_a_y, group_phi;
+        double px[MAX_ORDER + 1], py[MAX_ORDER + 1];
+        NBODY_PROFILE_WORKER(profiler);
+
+        #pragma omp for schedule(dynamic, 4) nowait
+        for (std::size_t l = 0; l < leaves.size(); ++l) {
+            const int index = leaves[l];
+            const QuadNode & leaf = nodes[index];
+            const int count = leaf.end - leaf.begin;
+            const double * gx = tree.x.data() + leaf.begin;
+            const double * gy = tree.y.data() + leaf.begin;
+            const double * gm = tree.mass.data() + leaf.begin;
+            const double * lc = &locals[static_cast<std::size_t>(index) * num_terms];
+
+            // p2p with every touching leaf, self included
+            list_x.clear();
+            list_y.clear();
+            list_mass.clear();
+            std::ptrdiff_t own = NOT_A_SOURCE;
+            for (int source : near_leaves[index]) {
+                const QuadNode & near = nodes[source];
+                if (source == index) {
+                    own = static_cast<std::ptrdiff_t>(list_x.size());
+                }
+                list_x.insert(list_x.end(), tree.x.begin() + near.begin, tree.x.begin() + near.end);
+                list_y.insert(list_y.end(), tree.y.begin() + near.begin, tree.y.begin() + near.end);
+                list_mass.insert(list_mass.end(), tree.mass.begin() + near.begin, tree.mass.begin() + near.end);
+            }
+            group_a_x.resize(count);
+            group_a_y.resize(count);
+            if (potential != nullptr) {
+                group_phi.resize(count);
+                direct_accelerations_potentials(gx, gy, count, list_x.data(), list_y.data(), list_mass.data(),
+                                                list_x.size(), group_a_x.data(), group_a_y.data(), group_phi.data(),
+                                                own);
+            } else {
+                direct_accelerations(gx, gy, count, list_x.data(), list_y.data(), list_mass.data(), list_x.size(),
+                                     group_a_x.data(), group_a_y.data());
+            }
+
+            // l2p, a = -grad phi = G / s^2 sum_n n_i L_n e^(n - e_i)
+            for (int k = 0; k < count; ++k) {
+                powers((gx[k] - leaf.center_x) / scale, (gy[k] - leaf.center_y) / scale, order, px, py);
+                double far_x = 0.0, far_y = 0.0;
+                for (int n = 1; n <= order; ++n) {
+                    for (int b = 0; b <= n; ++b) {
+                        int a = n - b;
+                        double coefficient = lc[term(a, b)];
+                        if (a > 0) far_x += a * coefficient * px[a - 1] * py[b];
+                        if (b > 0) far_y += b * coefficient * px[a] * py[b - 1];
+                    }
+                }
+                const uint32_t body = tree.order[leaf.begin + k];
+                a_x[body] = group_a_x[k] + far_factor * far_x;
+                a_y[body] = group_a_y[k] + far_factor * far_y;
+
+                if (potential != nullptr) {
+                    // phi = -G / s sum_n L_n e^n, the n = 0 term included
+                    double far_phi = 0.0;
+                    for (int n = 0; n <= order; ++n) {
+                        for (int b = 0; b <= n; ++b) {
+                            far_phi += lc[term(n - b, b)] * px[n - b] * py[b];
+                        }
+                    }
+                    const double m = gm[k];
+                    const double phi = group_phi[k] - G_CONST / scale * far_phi;
+                    energy += 0.5 * m * phi;
+                }
+            }
+        }
+    }
+    if (potential != nullptr) {
+        *potential = energy;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef FMM_HPP
+#define FMM_HPP
+#include "quadtree.hpp"
+#include "../profile/profiler.hpp"
+#include <cstddef>
+#include <vector>
+
+// fast multipole method on the same quadtree as barnes hut, O(N)
+// multipoles and locals are cartesian taylor series of 1/r in (x, y) up to
+// total order p. the kernel is 3d newtonian gravity restricted to the plane,
+// which is not harmonic in 2d, so the complex log expansions of the classic
+// 2d fmm do not apply. error falls off roughly like theta^(p+1)
+class FmmSolver {
+    public:
+        FmmSolver(int order = 6, double theta = 0.5, int leaf_size = 64);
+
+        // build the tree over the bodies and write the acceleration of every body,
+        // with potential set the total potential energy goes there as well
+        void accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                           double * a_x, double * a_y, double * potential = nullptr);
+
+        int get_order() const {
+            return order;
+        }
+        void set_order(int order);
+        double get_theta() const {
+            return theta;
+        }
+        void set_theta(double theta);
+        // worker scopes in the parallel regions report here in NBODY_PROFILE builds
+        void set_profiler(Profiler * profiler) {
+            this->profiler = profiler;
+        }
+
+    private:
+        int order; // expansion order p
+        double theta; // cells interact through expansions when (r_a + r_b) < theta d
+        int leaf_size;
+        int num_terms; // (p + 1)(p + 2) / 2 coefficients per expansion
+        QuadTree tree;
+        std::vector<double> multipoles, locals; // num_terms per node
+        std::vector<std::vector<int>> near_leaves; // p2p sources for each node that is a leaf
+        std::vector<double> binomials; // pascal triangle up to 2p
+        Profiler * profiler;
+
+        void upward_pass();
+        void interact(int target, int source, double scale);
+        void m2l(int target, int source, double scale);
+        void downward_pass();
+        void evaluate_leaves(double * a_x, double * a_y, double scale, double * potential);
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "jerk.hpp"
+#include "../constants.h"
+#include <cmath>
+
+void direct_accelerations_jerks(const double * x, const double * y, const double * v_x, const double * v_y,
+                                const double * mass, std::size_t n,
+                                double * a_x, double * a_y, double * j_x, double * j_y, double * potential) {
+    double energy = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:energy)
+    for (std::size_t i = 0; i < n; ++i) {
+        const double x_i = x[i];
+        const double y_i = y[i];
+        const double v_x_i = v_x[i];
+        const double v_y_i = v_y[i];
+        double acc_x = 0.0, acc_y = 0.0;
+        double jerk_x = 0.0, jerk_y = 0.0;
+        double pot = 0.0;
+
+        // the self term has r = v = 0, so it adds nothing and needs no branch,
+        // only the potential has to skip it (by index, a second body on the
+        // same spot still counts)
+        #pragma omp simd reduction(+:acc_x, acc_y, jerk_x, jerk_y, pot)
+        for (std::size_t j = 0; j < n; ++j) {
+            double dx = x[j] - x_i;
+            double dy = y[j] - y_i;
+            double dv_x = v_x[j] - v_x_i;
+            double dv_y = v_y[j] - v_y_i;
+            double inv = 1.0 / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+            double scale = mass[j] * inv * inv * inv;
+            double rv = 3.0 * (dx * dv_x + dy * dv_y) * inv * inv;
+            acc_x += scale * dx;
+            acc_y += scale * dy;
+            jerk_x += scale * (dv_x - rv * dx);
+            jerk_y += scale * (dv_y - rv * dy);
+            pot += j != i ? mass[j] * inv : 0.0;
+        }
+
+        a_x[i] = G_CONST * acc_x;
+        a_y[i] = G_CONST * acc_y;
+        j_x[i] = G_CONST * jerk_x;
+        j_y[i] = G_CONST * jerk_y;
+        energy -= 0.5 * mass[i] * G_CONST * pot;
+    }
+    if (potential != nullptr) {
+        *potential = energy;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef JERK_HPP
+#define JERK_HPP
+#include <cstddef>
+
+// acceleration and its time derivative (jerk) on every body from every other,
+// the exact all pairs sum the hermite integrator needs:
+//   a = sum G m_j r / s^3
+//   j = sum G m_j (v / s^3 - 3 (r.v) r / s^5), s^2 = r^2 + eps^2
+// with r and v of body j relative to body i. threaded over the targets,
+// overwrites a_x, a_y, j_x and j_y, and the total potential energy if asked
+void direct_accelerations_jerks(const double * x, const double * y, const double * v_x, const double * v_y,
+                                const double * mass, std::size_t n,
+                                double * a_x, double * a_y, double * j_x, double * j_y,
+                                double * potential = nullptr);
+
+#endif
@@ -0,0 +1,158 @@
+#include "morton.hpp"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+namespace {
+
+// spread the low 32 bits of v so there is a zero between each of them
+uint64_t spread_bits(uint64_t v) {
+    v &= 0xFFFFFFFFull;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    v = (v | (v << 2)) & 0x3333333333333333ull;
+    v = (v | (v << 1)) & 0x5555555555555555ull;
+    return v;
+}
+
+uint64_t quantize(double value, double min, double side) {
+    const double cells = 4294967296.0; // 2^32
+    double scaled = (value - min) / side * cells;
+    if (!(scaled > 0.0)) return 0; // also catches nan
+    if (scaled >= cells - 1.0) return 0xFFFFFFFFull;
+    return static_cast<uint64_t>(scaled);
+}
+
+} // namespace
+
+uint64_t morton_encode(double x, double y, double min_x, double min_y, double side) {
+    return spread_bits(quantize(x, min_x, side)) | (spread_bits(quantize(y, min_y, side)) << 1);
+}
+
+void morton_keys(const double * x, const double * y, std::size_t n,
+                 double min_x, double min_y, double side, std::vector<uint64_t> & keys) {
+    keys.resize(n);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < n; ++i) {
+        keys[i] = morton_encode(x[i], y[i], min_x, min_y, side);
+    }
+}
+
+uint64_t hilbert_encode(double x, double y, double min_x, double min_y, double side) {
+    uint32_t cx = static_cast<uint32_t>(quantize(x, min_x, side));
+    uint32_t cy = static_cast<uint32_t>(quantize(y, min_y, side));
+    // top bit down: which quadrant, then turn the rest into that quadrant's frame
+    uint64_t key = 0;
+    for (uint32_t s = 1u << 31; s > 0; s >>= 1) {
+        const uint32_t rx = (cx & s) ? 1 : 0;
+        const uint32_t ry = (cy & s) ? 1 : 0;
+        key += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                cx = ~cx;
+                cy = ~cy;
+            }
+            std::swap(cx, cy);
+        }
+    }
+    return key;
+}
+
+void hilbert_keys(const double * x, const double * y, std::size_t n,
+                  double min_x, double min_y, double side, std::vector<uint64_t> & keys) {
+    keys.resize(n);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < n; ++i) {
+        keys[i] = hilbert_encode(x[i], y[i], min_x, min_y, side);
+    }
+}
+
+void curve_keys(SpaceFillingCurve curve, const double * x, const double * y, std::size_t n,
+                double min_x, double min_y, double side, std::vector<uint64_t> & keys) {
+    if (curve == SpaceFillingCurve::Hilbert) {
+        hilbert_keys(x, y, n, min_x, min_y, side, keys);
+    } else {
+        morton_keys(x, y, n, min_x, min_y, side, keys);
+    }
+}
+
+void bounding_square(const double * x, const double * y, std::size_t n,
+                     double & min_x, double & min_y, double & side) {
+    double lo_x = HUGE_VAL, lo_y = HUGE_VAL;
+    double hi_x = -HUGE_VAL, hi_y = -HUGE_VAL;
+    #pragma omp parallel for reduction(min:lo_x, lo_y) reduction(max:hi_x, hi_y)
+    for (std::size_t i = 0; i < n; ++i) {
+        lo_x = std::min(lo_x, x[i]);
+        lo_y = std::min(lo_y, y[i]);
+        hi_x = std::max(hi_x, x[i]);
+        hi_y = std::max(hi_y, y[i]);
+    }
+    if (n == 0) {
+        lo_x = lo_y = 0.0;
+        hi_x = hi_y = 1.0;
+    }
+    side = std::max(hi_x - lo_x, hi_y - lo_y);
+    if (!(side > 0.0)) side = 1.0; // single body or all bodies on one spot
+    side *= 1.0 + 1e-9;
+    min_x = lo_x;
+    min_y = lo_y;
+}
+
+void radix_sort(std::vector<uint64_t> & keys, std::vector<uint32_t> & values) {
+    const std::size_t n = keys.size();
+    const int radix = 256;
+    std::vector<uint64_t> key_buffer(n);
+    std::vector<uint32_t> value_buffer(n);
+    const int max_threads = omp_get_max_threads();
+    std::vector<std::size_t> histogram(static_cast<std::size_t>(max_threads) * radix);
+
+    for (int pass = 0; pass < 8; ++pass) {
+        const int shift = pass * 8;
+        bool skip = false;
+
+        #pragma omp parallel num_threads(max_threads)
+        {
+            const int thread = omp_get_thread_num();
+            const int num_threads = omp_get_num_threads();
+            const std::size_t begin = n * thread / num_threads;
+            const std::size_t end = n * (thread + 1) / num_threads;
+            std::size_t * counts = &histogram[static_cast<std::size_t>(thread) * radix];
+
+            std::fill(counts, counts + radix, 0);
+            for (std::size_t i = begin; i < end; ++i) {
+                ++counts[(keys[i] >> shift) & 0xFF];
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // exclusive scan bucket major, thread minor keeps the sort stable
+                std::size_t offset = 0;
+                for (int bucket = 0; bucket < radix; ++bucket) {
+                    std::size_t bucket_total = 0;
+                    for (int t = 0; t < num_threads; ++t) {
+                        std::size_t count = histogram[static_cast<std::size_t>(t) * radix + bucket];
+                        histogram[static_cast<std::size_t>(t) * radix + bucket] = offset;
+                        offset += count;
+                        bucket_total += count;
+                    }
+                    if (bucket_total == n) skip = true;
+                }
+            }
+
+            if (!skip) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::size_t dest = counts[(keys[i] >> shift) & 0xFF]++;
+                    key_buffer[dest] = keys[i];
+                    value_buffer[dest] = values[i];
+                }
+            }
+        }
+
+        if (!skip) {
+            keys.swap(key_buffer);
+            values.swap(value_buffer);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef MORTON_HPP
+#define MORTON_HPP
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// the curves a set of points can be ordered along
+enum class SpaceFillingCurve {
+    Morton, // z-order, cheapest keys, jumps between quadrants
+    Hilbert // no jumps, a little better locality for a little more work
+};
+
+// z-order (morton) keys: 32 bits of x and y interleaved, x in the even bits
+// keys are relative to a square box given by its lower corner and side length
+uint64_t morton_encode(double x, double y, double min_x, double min_y, double side);
+
+// morton keys for n points, computed in parallel
+void morton_keys(const double * x, const double * y, std::size_t n,
+                 double min_x, double min_y, double side, std::vector<uint64_t> & keys);
+
+// hilbert curve keys on the same 2^32 x 2^32 grid. unlike z-order the curve
+// never jumps, consecutive keys are always neighbouring cells, for about 32
+// more steps of bit twiddling per point
+uint64_t hilbert_encode(double x, double y, double min_x, double min_y, double side);
+void hilbert_keys(const double * x, const double * y, std::size_t n,
+                  double min_x, double min_y, double side, std::vector<uint64_t> & keys);
+// keys along either curve
+void curve_keys(SpaceFillingCurve curve, const double * x, const double * y, std::size_t n,
+                double min_x, double min_y, double side, std::vector<uint64_t> & keys);
+
+// square box around all points, side is padded a little so nothing sits on the edge
+void bounding_square(const double * x, const double * y, std::size_t n,
+                     double & min_x, double & min_y, double & side);
+
+// stable parallel lsd radix sort of keys, values are permuted alongside
+// bytes that are equal in every key are skipped
+void radix_sort(std::vector<uint64_t> & keys, std::vector<uint32_t> & values);
+
+#endif
@@ -0,0 +1,261 @@
+#include "precision.hpp"
+#include "../constants.h"
+#include <cmath>
+
+#include "simd_math.hpp"
+
+namespace {
+
+typedef void (*LocalKernel)(const float *, const float *, std::size_t,
+                            const float *, const float *, const float *, std::size_t,
+                            double *, double *, double *, std::ptrdiff_t);
+
+// the plain loop for any Real, the compiler vectorizes it for whatever the
+// baseline instruction set is. sums stay in Real for one source block only
+template <typename Real, bool Potential>
+void local_scalar(const Real * tx, const Real * ty, std::size_t n_targets,
+                  const Real * sx, const Real * sy, const Real * sgm, std::size_t n_sources,
+                  double * a_x, double * a_y, double * phi, std::ptrdiff_t self) {
+    const Real eps_sq = static_cast<Real>(SOFTENING_LENGTH_SQ);
+    for (std::size_t i = 0; i < n_targets; ++i) {
+        const Real x_i = tx[i];
+        const Real y_i = ty[i];
+        const std::size_t s = self_index(i, self);
+        Real acc_x = 0;
+        Real acc_y = 0;
+        Real pot = 0;
+
+        #pragma omp simd reduction(+:acc_x, acc_y, pot)
+        for (std::size_t j = 0; j < n_sources; ++j) {
+            Real dx = sx[j] - x_i;
+            Real dy = sy[j] - y_i;
+            Real inv = Real(1) / std::sqrt(dx * dx + dy * dy + eps_sq);
+            // gm first, (gm / r) / r / r never leaves the float range
+            Real scale = sgm[j] * inv * inv * inv;
+            acc_x += scale * dx;
+            acc_y += scale * dy;
+            if (Potential) {
+                pot += j != s ? sgm[j] * inv : Real(0);
+            }
+        }
+
+        a_x[i] += static_cast<double>(acc_x);
+        a_y[i] += static_cast<double>(acc_y);
+        if (Potential) {
+            phi[i] -= static_cast<double>(pot);
+        }
+    }
+}
+
+#ifdef NBODY_X86_SIMD
+
+// 8 floats per instruction, the rsqrt estimate (12 bits) plus one newton step
+// is as good as float gets
+template <bool Potential>
+__attribute__((target("avx2,fma")))
+void local_avx2(const float * tx, const float * ty, std::size_t n_targets,
+                const float * sx, const float * sy, const float * sgm, std::size_t n_sources,
+                double * a_x, double * a_y, double * phi, std::ptrdiff_t self) {
+    const __m256 eps_sq = _mm256_set1_ps(static_cast<float>(SOFTENING_LENGTH_SQ));
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three_halves = _mm256_set1_ps(1.5f);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const std::size_t n_vec = n_sources & ~static_cast<std::size_t>(7);
+
+    for (std::size_t i = 0; i < n_targets; ++i) {
+        const __m256 x_i = _mm256_set1_ps(tx[i]);
+        const __m256 y_i = _mm256_set1_ps(ty[i]);
+        const std::size_t s = self_index(i, self);
+        __m256 acc_x = _mm256_setzero_ps();
+        __m256 acc_y = _mm256_setzero_ps();
+        __m256 pot = _mm256_setzero_ps();
+
+        for (std::size_t j = 0; j < n_vec; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(sx + j), x_i);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(sy + j), y_i);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, eps_sq));
+            __m256 inv = _mm256_rsqrt_ps(r2);
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), three_halves));
+            __m256 gm = _mm256_load_ps(sgm + j);
+            __m256 gm_inv = _mm256_mul_ps(gm, inv);
+            __m256 scale = _mm256_mul_ps(_mm256_mul_ps(gm_inv, inv), inv);
+            acc_x = _mm256_fmadd_ps(scale, dx, acc_x);
+            acc_y = _mm256_fmadd_ps(scale, dy, acc_y);
+            if (Potential) {
+                const int lane = s - j < 8 ? static_cast<int>(s - j) : -1;
+                __m256 is_self = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_set1_epi32(lane), lanes));
+                pot = _mm256_add_ps(pot, _mm256_andnot_ps(is_self, gm_inv));
+            }
+        }
+
+        // lanes are summed in double, they each hold an eighth of the block
+        alignas(32) float lanes_x[8], lanes_y[8], lanes_pot[8];
+        _mm256_store_ps(lanes_x, acc_x);
+        _mm256_store_ps(lanes_y, acc_y);
+        _mm256_store_ps(lanes_pot, pot);
+        double sum_x = 0.0, sum_y = 0.0, sum_pot = 0.0;
+        for (int l = 0; l < 8; ++l) {
+            sum_x += lanes_x[l];
+            sum_y += lanes_y[l];
+            sum_pot += lanes_pot[l];
+        }
+        for (std::size_t j = n_vec; j < n_sources; ++j) {
+            float dx = sx[j] - tx[i];
+            float dy = sy[j] - ty[i];
+            float inv = 1.0f / std::sqrt(dx * dx + dy * dy + static_cast<float>(SOFTENING_LENGTH_SQ));
+            float scale = sgm[j] * inv * inv * inv;
+            sum_x += scale * dx;
+            sum_y += scale * dy;
+            sum_pot += j != s ? sgm[j] * inv : 0.0f;
+        }
+
+        a_x[i] += sum_x;
+        a_y[i] += sum_y;
+        if (Potential) {
+            phi[i] -= sum_pot;
+        }
+    }
+}
+
+// the 16 float lanes summed in double
+__attribute__((target("avx512f")))
+static inline double hsum_wide_avx512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    double sum = 0.0;
+    for (int l = 0; l < 16; ++l) {
+        sum += lanes[l];
+    }
+    return sum;
+}
+
+// 16 floats per instruction, masked loads for the last < 16 sources
+template <bool Potential>
+__attribute__((target("avx512f")))
+void local_avx512(const float * tx, const float * ty, std::size_t n_targets,
+                  const float * sx, const float * sy, const float * sgm, std::size_t n_sources,
+                  double * a_x, double * a_y, double * phi, std::ptrdiff_t self) {
+    const __m512 eps_sq = _mm512_set1_ps(static_cast<float>(SOFTENING_LENGTH_SQ));
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three_halves = _mm512_set1_ps(1.5f);
+    const std::size_t n_vec = n_sources & ~static_cast<std::size_t>(15);
+    const std::size_t n_tail = n_sources - n_vec;
+    const __mmask16 tail_mask = static_cast<__mmask16>((1u << n_tail) - 1u);
+
+    for (std::size_t i = 0; i < n_targets; ++i) {
+        const __m512 x_i = _mm512_set1_ps(tx[i]);
+        const __m512 y_i = _mm512_set1_ps(ty[i]);
+        const std::size_t s = self_index(i, self);
+        __m512 acc_x = _mm512_setzero_ps();
+        __m512 acc_y = _mm512_setzero_ps();
+        __m512 pot = _mm512_setzero_ps();
+
+        for (std::size_t j = 0; j < n_sources; j += 16) {
+            // full mask except on the tail, where the missing lanes read as zero mass
+            const __mmask16 mask = j < n_vec ? static_cast<__mmask16>(0xFFFF) : tail_mask;
+            __m512 dx = _mm512_sub_ps(_mm512_maskz_load_ps(mask, sx + j), x_i);
+            __m512 dy = _mm512_sub_ps(_mm512_maskz_load_ps(mask, sy + j), y_i);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, eps_sq));
+            __m512 inv = _mm512_maskz_rsqrt14_ps(static_cast<__mmask16>(0xFFFF), r2);
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), three_halves));
+            __m512 gm = _mm512_maskz_load_ps(mask, sgm + j);
+            __m512 gm_inv = _mm512_mul_ps(gm, inv);
+            __m512 scale = _mm512_mul_ps(_mm512_mul_ps(gm_inv, inv), inv);
+            acc_x = _mm512_fmadd_ps(scale, dx, acc_x);
+            acc_y = _mm512_fmadd_ps(scale, dy, acc_y);
+            if (Potential) {
+                const __mmask16 others = s - j < 16 ? static_cast<__mmask16>(~(1u << (s - j))) : 0xFFFF;
+                pot = _mm512_mask_add_ps(pot, others, pot, gm_inv);
+            }
+        }
+
+        a_x[i] += hsum_wide_avx512(acc_x);
+        a_y[i] += hsum_wide_avx512(acc_y);
+        if (Potential) {
+            phi[i] -= hsum_wide_avx512(pot);
+        }
+    }
+}
+
+#endif // NBODY_X86_SIMD
+
+template <bool Potential>
+LocalKernel float_kernel(SimdLevel level) {
+    if (!cpu_supports(level)) {
+        return local_scalar<float, Potential>;
+    }
+#ifdef NBODY_X86_SIMD
+    switch (level) {
+        case SimdLevel::AVX512:
+            return local_avx512<Potential>;
+        case SimdLevel::AVX2:
+            return local_avx2<Potential>;
+        default:
+            break;
+    }
+#endif
+    return local_scalar<float, Potential>;
+}
+
+} // namespace
+
+const char * precision_name(Precision precision) {
+    return precision == Precision::Mixed ? "mixed" : "double";
+}
+
+template <typename Real>
+void LocalBlock<Real>::load(const double * x, const double * y, const double * mass, std::size_t n,
+                            double origin_x, double origin_y) {
+    // grow only, and never below 16 so the masked simd loads stay inside
+    if (this->x.size() < n || this->x.empty()) {
+        const std::size_t capacity = n + 16;
+        this->x.resize(capacity);
+        this->y.resize(capacity);
+        gm.resize(capacity);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        // the difference is taken in double, only what is left gets rounded
+        this->x[i] = static_cast<Real>(x[i] - origin_x);
+        this->y[i] = static_cast<Real>(y[i] - origin_y);
+    }
+    if (mass != nullptr) {
+        for (std::size_t i = 0; i < n; ++i) {
+            gm[i] = static_cast<Real>(G_CONST * mass[i]);
+        }
+    }
+    size = n;
+}
+
+template <>
+void local_accelerations_add<float>(const LocalBlock<float> & targets, const LocalBlock<float> & sources,
+                                    double * a_x, double * a_y, double * phi, std::ptrdiff_t self) {
+    static const LocalKernel plain = float_kernel<false>(detect_simd_level());
+    static const LocalKernel with_potential = float_kernel<true>(detect_simd_level());
+    (phi != nullptr ? with_potential : plain)(targets.x.data(), targets.y.data(), targets.size,
+                                              sources.x.data(), sources.y.data(), sources.gm.data(), sources.size,
+                                              a_x, a_y, phi, self);
+}
+
+void local_accelerations_add(SimdLevel level, const LocalBlock<float> & targets, const LocalBlock<float> & sources,
+                             double * a_x, double * a_y, double * phi, std::ptrdiff_t self) {
+    const LocalKernel kernel = phi != nullptr ? float_kernel<true>(level) : float_kernel<false>(level);
+    kernel(targets.x.data(), targets.y.data(), targets.size, sources.x.data(), sources.y.data(), sources.gm.data(),
+           sources.size, a_x, a_y, phi, self);
+}
+
+// double goes through the portable loop, it is there to tell the cost of the
+// local origin apart from the cost of float
+template <>
+void local_accelerations_add<double>(const LocalBlock<double> & targets, const LocalBlock<double> & sources,
+                                     double * a_x, double * a_y, double * phi, std::ptrdiff_t self) {
+    if (phi != nullptr) {
+        local_scalar<double, true>(targets.x.data(), targets.y.data(), targets.size, sources.x.data(),
+                                   sources.y.data(), sources.gm.data(), sources.size, a_x, a_y, phi, self);
+    } else {
+        local_scalar<double, false>(targets.x.data(), targets.y.data(), targets.size, sources.x.data(),
+                                    sources.y.data(), sources.gm.data(), sources.size, a_x, a_y, phi, self);
+    }
+}
+
+template struct LocalBlock<float>;
+template struct LocalBlock<double>;
@@ -0,0 +1,47 @@
+#ifndef PRECISION_HPP
+#define PRECISION_HPP
+#include "../particles/aligned_allocator.hpp"
+#include "direct.hpp"
+#include <cstddef>
+#include <vector>
+
+// scalar type the direct force pass does its pair math in. positions,
+// velocities and the integrator stay double either way, a float position
+// could not even hold one day of motion of a planet 30 AU out
+enum class Precision {
+    Double, // everything in double, the reference
+    Mixed // float pairs on positions relative to a local origin, double sums per target
+};
+
+const char * precision_name(Precision precision);
+
+// a run of bodies copied into Real, relative to an origin near them. pairs of
+// bodies close to each other (the ones with the big forces) keep their
+// digits even when the whole group sits an AU away from the coordinate
+// origin. the mass is stored as G m, that keeps m / r^3 well inside the float
+// range for anything from a moon to a sun at 1 km to 100 AU
+template <typename Real>
+struct LocalBlock {
+    std::vector<Real, AlignedAllocator<Real, 64>> x, y, gm;
+    std::size_t size;
+
+    LocalBlock() : size(0) {}
+    void load(const double * x, const double * y, const double * mass, std::size_t n,
+              double origin_x, double origin_y);
+};
+
+// acceleration on every target of one block from every source of another,
+// both loaded around the same origin. the pair terms and the sum over this
+// block run in Real, the result is added onto the double a_x / a_y (and phi,
+// left alone when null). target i is source i + self and is left out of phi,
+// like direct_accelerations_potentials
+template <typename Real>
+void local_accelerations_add(const LocalBlock<Real> & targets, const LocalBlock<Real> & sources,
+                             double * a_x, double * a_y, double * phi, std::ptrdiff_t self = NOT_A_SOURCE);
+
+// the float version with an explicit instruction set, used by tests,
+// falls back to the portable loop if the cpu cannot run the requested level
+void local_accelerations_add(SimdLevel level, const LocalBlock<float> & targets, const LocalBlock<float> & sources,
+                             double * a_x, double * a_y, double * phi, std::ptrdiff_t self = NOT_A_SOURCE);
+
+#endif
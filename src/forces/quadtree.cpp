@@ -0,0 +1,219 @@
+#include "quadtree.hpp"
+#include "morton.hpp"
+#include <algorithm>
+#include <omp.h>
+
+namespace {
+
+const int MAX_DEPTH = 32; // one level per bit of the morton key
+
+// everything the recursive build needs to read, shared between threads
+struct BuildInput {
+    const uint64_t * keys;
+    const double * x;
+    const double * y;
+    const double * mass;
+    int leaf_size;
+};
+
+bool splittable(const QuadNode & node, const BuildInput & input) {
+    return node.end - node.begin > input.leaf_size && node.depth < MAX_DEPTH;
+}
+
+// quadrant of a key below a node at the given depth, bit 0 is x and bit 1 is y
+int quadrant(uint64_t key, int depth) {
+    return static_cast<int>((key >> (62 - 2 * depth)) & 3);
+}
+
+// append the non empty children of pool[index] as one contiguous block
+void split(std::vector<QuadNode> & pool, int index, const BuildInput & input) {
+    const QuadNode parent = pool[index];
+    const int first = static_cast<int>(pool.size());
+    const double child_half = 0.5 * parent.half_size;
+    int begin = parent.begin;
+
+    for (int q = 0; q < 4; ++q) {
+        // keys are sorted so each quadrant is a contiguous run
+        const uint64_t * end_ptr = std::partition_point(input.keys + begin, input.keys + parent.end,
+            [&](uint64_t key) { return quadrant(key, parent.depth) <= q; });
+        int end = static_cast<int>(end_ptr - input.keys);
+        if (end > begin) {
+            QuadNode child = QuadNode();
+            child.center_x = parent.center_x + ((q & 1) ? child_half : -child_half);
+            child.center_y = parent.center_y + ((q & 2) ? child_half : -child_half);
+            child.half_size = child_half;
+            child.first_child = -1;
+            child.num_children = 0;
+            child.begin = begin;
+            child.end = end;
+            child.depth = parent.depth + 1;
+            pool.push_back(child);
+        }
+        begin = end;
+    }
+
+    pool[index].first_child = first;
+    pool[index].num_children = static_cast<int>(pool.size()) - first;
+}
+
+void leaf_moments(QuadNode & node, const BuildInput & input) {
+    double m = 0.0, mx = 0.0, my = 0.0;
+    for (int k = node.begin; k < node.end; ++k) {
+        m += input.mass[k];
+        mx += input.mass[k] * input.x[k];
+        my += input.mass[k] * input.y[k];
+    }
+    node.mass = m;
+    node.com_x = m > 0.0 ? mx / m : node.center_x;
+    node.com_y = m > 0.0 ? my / m : node.center_y;
+
+    double q_xx = 0.0, q_xy = 0.0, q_yy = 0.0;
+    for (int k = node.begin; k < node.end; ++k) {
+        double dx = input.x[k] - node.com_x;
+        double dy = input.y[k] - node.com_y;
+        q_xx += input.mass[k] * (2.0 * dx * dx - dy * dy);
+        q_xy += input.mass[k] * 3.0 * dx * dy;
+        q_yy += input.mass[k] * (2.0 * dy * dy - dx * dx);
+    }
+    node.q_xx = q_xx;
+    node.q_xy = q_xy;
+    node.q_yy = q_yy;
+}
+
+// moments of a node from its children, quadrupoles shifted with the parallel axis theorem
+void internal_moments(std::vector<QuadNode> & pool, int index) {
+    QuadNode & node = pool[index];
+    double m = 0.0, mx = 0.0, my = 0.0;
+    for (int c = node.first_child; c < node.first_child + node.num_children; ++c) {
+        m += pool[c].mass;
+        mx += pool[c].mass * pool[c].com_x;
+        my += pool[c].mass * pool[c].com_y;
+    }
+    node.mass = m;
+    node.com_x = m > 0.0 ? mx / m : node.center_x;
+    node.com_y = m > 0.0 ? my / m : node.center_y;
+
+    double q_xx = 0.0, q_xy = 0.0, q_yy = 0.0;
+    for (int c = node.first_child; c < node.first_child + node.num_children; ++c) {
+        const QuadNode & child = pool[c];
+        double sx = child.com_x - node.com_x;
+        double sy = child.com_y - node.com_y;
+        q_xx += child.q_xx + child.mass * (2.0 * sx * sx - sy * sy);
+        q_xy += child.q_xy + child.mass * 3.0 * sx * sy;
+        q_yy += child.q_yy + child.mass * (2.0 * sy * sy - sx * sx);
+    }
+    node.q_xx = q_xx;
+    node.q_xy = q_xy;
+    node.q_yy = q_yy;
+}
+
+void build_subtree(std::vector<QuadNode> & pool, int index, const BuildInput & input) {
+    if (!splittable(pool[index], input)) {
+        leaf_moments(pool[index], input);
+        return;
+    }
+    split(pool, index, input);
+    const int first = pool[index].first_child;
+    const int count = pool[index].num_children;
+    for (int c = first; c < first + count; ++c) {
+        build_subtree(pool, c, input);
+    }
+    internal_moments(pool, index);
+}
+
+} // namespace
+
+void QuadTree::build(const double * x_in, const double * y_in, const double * mass_in, std::size_t n, int leaf_size) {
+    // sort the bodies along the morton curve
+    bounding_square(x_in, y_in, n, min_x, min_y, side);
+    morton_keys(x_in, y_in, n, min_x, min_y, side, keys);
+    order.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+    radix_sort(keys, order);
+
+    x.resize(n);
+    y.resize(n);
+    mass.resize(n);
+    #pragma omp parallel for
+    for (std::size_t k = 0; k < n; ++k) {
+        x[k] = x_in[order[k]];
+        y[k] = y_in[order[k]];
+        mass[k] = mass_in[order[k]];
+    }
+
+    BuildInput input = {keys.data(), x.data(), y.data(), mass.data(), std::max(leaf_size, 1)};
+
+    QuadNode root = QuadNode();
+    root.half_size = 0.5 * side;
+    root.center_x = min_x + root.half_size;
+    root.center_y = min_y + root.half_size;
+    root.first_child = -1;
+    root.begin = 0;
+    root.end = static_cast<int>(n);
+    nodes.clear();
+    nodes.push_back(root);
+
+    // split the top of the tree serially until there are enough subtrees to go around
+    const std::size_t wanted = 8 * static_cast<std::size_t>(omp_get_max_threads());
+    std::vector<int> frontier(1, 0);
+    std::vector<int> top_internal;
+    bool expanded = true;
+    while (expanded && frontier.size() < wanted) {
+        expanded = false;
+        std::vector<int> next;
+        for (int index : frontier) {
+            if (splittable(nodes[index], input)) {
+                split(nodes, index, input);
+                top_internal.push_back(index);
+                for (int c = nodes[index].first_child; c < nodes[index].first_child + nodes[index].num_children; ++c) {
+                    next.push_back(c);
+                }
+                expanded = true;
+            } else {
+                next.push_back(index);
+            }
+        }
+        frontier.swap(next);
+    }
+
+    // each frontier node grows its subtree in a private pool
+    std::vector<std::vector<QuadNode>> subtrees(frontier.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t f = 0; f < frontier.size(); ++f) {
+        subtrees[f].push_back(nodes[frontier[f]]);
+        build_subtree(subtrees[f], 0, input);
+    }
+
+    // splice: local index k > 0 lands at base + k - 1, local root replaces the frontier node
+    for (std::size_t f = 0; f < frontier.size(); ++f) {
+        const std::vector<QuadNode> & local = subtrees[f];
+        const int base = static_cast<int>(nodes.size());
+        for (std::size_t k = 0; k < local.size(); ++k) {
+            QuadNode node = local[k];
+            if (node.first_child >= 0) {
+                node.first_child += base - 1;
+            }
+            if (k == 0) {
+                nodes[frontier[f]] = node;
+            } else {
+                nodes.push_back(node);
+            }
+        }
+    }
+
+    // the serially split top levels get their moments last, children before parents
+    for (auto it = top_internal.rbegin(); it != top_internal.rend(); ++it) {
+        internal_moments(nodes, *it);
+    }
+
+    // leaves in body order, handy as target groups
+    leaves.clear();
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].first_child < 0) {
+            leaves.push_back(static_cast<int>(i));
+        }
+    }
+    std::sort(leaves.begin(), leaves.end(), [&](int a, int b) { return nodes[a].begin < nodes[b].begin; });
+}
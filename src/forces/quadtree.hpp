@@ -0,0 +1,46 @@
+#ifndef QUADTREE_HPP
+#define QUADTREE_HPP
+#include "../particles/aligned_allocator.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// one cell of the quadtree, children of a node sit next to each other in the pool
+struct QuadNode {
+    double center_x, center_y, half_size; // geometric box
+    double com_x, com_y, mass; // monopole, center of mass
+    double q_xx, q_xy, q_yy; // traceless quadrupole about the center of mass
+    int first_child; // pool index of the first child, -1 for leaves
+    int num_children;
+    int begin, end; // bodies [begin, end) in tree order
+    int depth;
+};
+
+// flat, pool allocated quadtree over a set of bodies
+// bodies are sorted along a morton curve so every node owns a contiguous
+// range of the sorted copies, the tree is rebuilt from scratch on each build
+class QuadTree {
+    public:
+        std::vector<QuadNode> nodes; // root is nodes[0]
+        std::vector<int> leaves; // pool indices of all leaves, in morton order
+        std::vector<uint32_t> order; // tree position -> original body index
+        AlignedArray x, y, mass; // bodies copied into tree order
+
+        // side of the root square and its lower corner
+        double min_x, min_y, side;
+
+        QuadTree() : min_x(0.0), min_y(0.0), side(1.0) {}
+
+        // top levels are split serially, the subtrees below are built in
+        // parallel into their own pools and spliced into nodes afterwards
+        void build(const double * x, const double * y, const double * mass, std::size_t n, int leaf_size = 16);
+
+        std::size_t size() const {
+            return order.size();
+        }
+
+    private:
+        std::vector<uint64_t> keys;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SIMD_MATH_HPP
+#define SIMD_MATH_HPP
+#include "direct.hpp"
+#include <cfloat>
+
+// shared helpers for the hand written simd kernels, each one is compiled for
+// its own instruction set with a target attribute so no -m flags are needed
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NBODY_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#ifdef NBODY_X86_SIMD
+
+// 1/sqrt(r2) for 4 doubles: single precision estimate (12 bits) then two
+// newton steps y = y (1.5 - 0.5 r2 y^2) which get it to ~1e-14 relative.
+// the estimate needs r2 in a float, up to FLT_MAX m^2 (r ~1.8e19 m, ~1900
+// light years). lanes beyond that would narrow to inf and come back as 0,
+// they take the exact 1 / sqrt instead, like the avx512 path gets them right
+__attribute__((target("avx2,fma")))
+static inline __m256d rsqrt_avx2(__m256d r2) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d three_halves = _mm256_set1_pd(1.5);
+    __m256d y = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+    __m256d half_r2 = _mm256_mul_pd(half, r2);
+    y = _mm256_mul_pd(y, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(y, y), three_halves));
+    y = _mm256_mul_pd(y, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(y, y), three_halves));
+    const __m256d too_far = _mm256_cmp_pd(r2, _mm256_set1_pd(FLT_MAX), _CMP_GT_OQ);
+    if (_mm256_movemask_pd(too_far) != 0) {
+        const __m256d exact = _mm256_div_pd(_mm256_set1_pd(1.0), _mm256_sqrt_pd(r2));
+        y = _mm256_blendv_pd(y, exact, too_far);
+    }
+    return y;
+}
+
+__attribute__((target("avx2,fma")))
+static inline double hsum_avx2(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+// avx512 has a 14 bit double rsqrt, two newton steps take it to full precision
+__attribute__((target("avx512f")))
+static inline __m512d rsqrt_avx512(__m512d r2) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d three_halves = _mm512_set1_pd(1.5);
+    __m512d y = _mm512_maskz_rsqrt14_pd(static_cast<__mmask8>(0xFF), r2);
+    __m512d half_r2 = _mm512_mul_pd(half, r2);
+    y = _mm512_mul_pd(y, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(y, y), three_halves));
+    y = _mm512_mul_pd(y, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(y, y), three_halves));
+    return y;
+}
+
+__attribute__((target("avx512f")))
+static inline double hsum_avx512(__m512d v) {
+    alignas(64) double lanes[8];
+    _mm512_store_pd(lanes, v);
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+#endif // NBODY_X86_SIMD
+
+// true if this cpu can run kernels built for level
+inline bool cpu_supports(SimdLevel level) {
+#ifdef NBODY_X86_SIMD
+    switch (level) {
+        case SimdLevel::AVX512:
+            return __builtin_cpu_supports("avx512f");
+        case SimdLevel::AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        default:
+            return true;
+    }
+#else
+    return level == SimdLevel::Scalar;
+#endif
+}
+
+#endif
@@ -0,0 +1,404 @@
+#include "symmetric.hpp"
+#include "simd_math.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+namespace {
+
+// one row of the pair triangle: body i against sources [j_begin, j_end)
+// i's share goes to buf[i], each j gets the opposite pull scaled by m_i
+typedef void (*RowKernel)(const double *, const double *, const double *, std::size_t,
+                          std::size_t, std::size_t, double *, double *, double &);
+
+// two rows i and i + 1 against the same sources, every source chunk and its
+// buffer slots are loaded and stored once for both rows
+typedef void (*RowPairKernel)(const double *, const double *, const double *, std::size_t,
+                              std::size_t, std::size_t, double *, double *, double &);
+
+// with Potential the kernels also add m_i m_j / s of every pair they visit to
+// energy (G and the sign are applied by the caller), without it nothing changes
+
+template <bool Potential>
+void row_scalar(const double * x, const double * y, const double * mass, std::size_t i,
+                std::size_t j_begin, std::size_t j_end, double * buf_x, double * buf_y, double & energy) {
+    const double x_i = x[i];
+    const double y_i = y[i];
+    const double m_i = mass[i];
+    double acc_x = 0.0;
+    double acc_y = 0.0;
+    double pot = 0.0;
+    for (std::size_t j = j_begin; j < j_end; ++j) {
+        double dx = x[j] - x_i;
+        double dy = y[j] - y_i;
+        double inv = 1.0 / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+        double inv3 = inv * inv * inv;
+        acc_x += mass[j] * inv3 * dx;
+        acc_y += mass[j] * inv3 * dy;
+        buf_x[j] -= m_i * inv3 * dx;
+        buf_y[j] -= m_i * inv3 * dy;
+        if (Potential) {
+            pot += mass[j] * inv;
+        }
+    }
+    buf_x[i] += acc_x;
+    buf_y[i] += acc_y;
+    if (Potential) {
+        energy += m_i * pot;
+    }
+}
+
+template <bool Potential>
+void row_pair_scalar(const double * x, const double * y, const double * mass, std::size_t i,
+                     std::size_t j_begin, std::size_t j_end, double * buf_x, double * buf_y, double & energy) {
+    row_scalar<Potential>(x, y, mass, i, j_begin, j_end, buf_x, buf_y, energy);
+    row_scalar<Potential>(x, y, mass, i + 1, j_begin, j_end, buf_x, buf_y, energy);
+}
+
+#ifdef NBODY_X86_SIMD
+
+template <bool Potential>
+__attribute__((target("avx2,fma")))
+void row_avx2(const double * x, const double * y, const double * mass, std::size_t i,
+              std::size_t j_begin, std::size_t j_end, double * buf_x, double * buf_y, double & energy) {
+    const __m256d eps_sq = _mm256_set1_pd(SOFTENING_LENGTH_SQ);
+    const __m256d x_i = _mm256_set1_pd(x[i]);
+    const __m256d y_i = _mm256_set1_pd(y[i]);
+    const __m256d m_i = _mm256_set1_pd(mass[i]);
+    __m256d acc_x = _mm256_setzero_pd();
+    __m256d acc_y = _mm256_setzero_pd();
+    __m256d pot = _mm256_setzero_pd();
+
+    std::size_t j = j_begin;
+    for (; j + 4 <= j_end; j += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), x_i);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), y_i);
+        __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, eps_sq));
+        __m256d inv = rsqrt_avx2(r2);
+        __m256d inv3 = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+        __m256d m_j = _mm256_loadu_pd(mass + j);
+        __m256d s_j = _mm256_mul_pd(m_j, inv3);
+        if (Potential) {
+            pot = _mm256_fmadd_pd(m_j, inv, pot);
+        }
+        __m256d s_i = _mm256_mul_pd(m_i, inv3);
+        acc_x = _mm256_fmadd_pd(s_j, dx, acc_x);
+        acc_y = _mm256_fmadd_pd(s_j, dy, acc_y);
+        _mm256_storeu_pd(buf_x + j, _mm256_fnmadd_pd(s_i, dx, _mm256_loadu_pd(buf_x + j)));
+        _mm256_storeu_pd(buf_y + j, _mm256_fnmadd_pd(s_i, dy, _mm256_loadu_pd(buf_y + j)));
+    }
+
+    buf_x[i] += hsum_avx2(acc_x);
+    buf_y[i] += hsum_avx2(acc_y);
+    if (Potential) {
+        energy += mass[i] * hsum_avx2(pot);
+    }
+    if (j < j_end) {
+        row_scalar<Potential>(x, y, mass, i, j, j_end, buf_x, buf_y, energy);
+    }
+}
+
+template <bool Potential>
+__attribute__((target("avx2,fma")))
+void row_pair_avx2(const double * x, const double * y, const double * mass, std::size_t i,
+                   std::size_t j_begin, std::size_t j_end, double * buf_x, double * buf_y, double & energy) {
+    const __m256d eps_sq = _mm256_set1_pd(SOFTENING_LENGTH_SQ);
+    const __m256d x_0 = _mm256_set1_pd(x[i]);
+    const __m256d y_0 = _mm256_set1_pd(y[i]);
+    const __m256d m_0 = _mm256_set1_pd(mass[i]);
+    const __m256d x_1 = _mm256_set1_pd(x[i + 1]);
+    const __m256d y_1 = _mm256_set1_pd(y[i + 1]);
+    const __m256d m_1 = _mm256_set1_pd(mass[i + 1]);
+    __m256d acc_x0 = _mm256_setzero_pd(), acc_y0 = _mm256_setzero_pd();
+    __m256d acc_x1 = _mm256_setzero_pd(), acc_y1 = _mm256_setzero_pd();
+    __m256d pot0 = _mm256_setzero_pd(), pot1 = _mm256_setzero_pd();
+
+    std::size_t j = j_begin;
+    for (; j + 4 <= j_end; j += 4) {
+        const __m256d x_j = _mm256_loadu_pd(x + j);
+        const __m256d y_j = _mm256_loadu_pd(y + j);
+        const __m256d m_j = _mm256_loadu_pd(mass + j);
+
+        __m256d dx0 = _mm256_sub_pd(x_j, x_0);
+        __m256d dy0 = _mm256_sub_pd(y_j, y_0);
+        __m256d dx1 = _mm256_sub_pd(x_j, x_1);
+        __m256d dy1 = _mm256_sub_pd(y_j, y_1);
+        __m256d inv0 = rsqrt_avx2(_mm256_fmadd_pd(dx0, dx0, _mm256_fmadd_pd(dy0, dy0, eps_sq)));
+        __m256d inv1 = rsqrt_avx2(_mm256_fmadd_pd(dx1, dx1, _mm256_fmadd_pd(dy1, dy1, eps_sq)));
+        __m256d inv3_0 = _mm256_mul_pd(inv0, _mm256_mul_pd(inv0, inv0));
+        __m256d inv3_1 = _mm256_mul_pd(inv1, _mm256_mul_pd(inv1, inv1));
+        if (Potential) {
+            pot0 = _mm256_fmadd_pd(m_j, inv0, pot0);
+            pot1 = _mm256_fmadd_pd(m_j, inv1, pot1);
+        }
+
+        __m256d s_j0 = _mm256_mul_pd(m_j, inv3_0);
+        __m256d s_j1 = _mm256_mul_pd(m_j, inv3_1);
+        acc_x0 = _mm256_fmadd_pd(s_j0, dx0, acc_x0);
+        acc_y0 = _mm256_fmadd_pd(s_j0, dy0, acc_y0);
+        acc_x1 = _mm256_fmadd_pd(s_j1, dx1, acc_x1);
+        acc_y1 = _mm256_fmadd_pd(s_j1, dy1, acc_y1);
+
+        __m256d s_0 = _mm256_mul_pd(m_0, inv3_0);
+        __m256d s_1 = _mm256_mul_pd(m_1, inv3_1);
+        __m256d b_x = _mm256_loadu_pd(buf_x + j);
+        __m256d b_y = _mm256_loadu_pd(buf_y + j);
+        b_x = _mm256_fnmadd_pd(s_1, dx1, _mm256_fnmadd_pd(s_0, dx0, b_x));
+        b_y = _mm256_fnmadd_pd(s_1, dy1, _mm256_fnmadd_pd(s_0, dy0, b_y));
+        _mm256_storeu_pd(buf_x + j, b_x);
+        _mm256_storeu_pd(buf_y + j, b_y);
+    }
+
+    buf_x[i] += hsum_avx2(acc_x0);
+    buf_y[i] += hsum_avx2(acc_y0);
+    buf_x[i + 1] += hsum_avx2(acc_x1);
+    buf_y[i + 1] += hsum_avx2(acc_y1);
+    if (Potential) {
+        energy += mass[i] * hsum_avx2(pot0) + mass[i + 1] * hsum_avx2(pot1);
+    }
+    if (j < j_end) {
+        row_pair_scalar<Potential>(x, y, mass, i, j, j_end, buf_x, buf_y, energy);
+    }
+}
+
+template <bool Potential>
+__attribute__((target("avx512f")))
+void row_avx512(const double * x, const double * y, const double * mass, std::size_t i,
+                std::size_t j_begin, std::size_t j_end, double * buf_x, double * buf_y, double & energy) {
+    const __m512d eps_sq = _mm512_set1_pd(SOFTENING_LENGTH_SQ);
+    const __m512d x_i = _mm512_set1_pd(x[i]);
+    const __m512d y_i = _mm512_set1_pd(y[i]);
+    const __m512d m_i = _mm512_set1_pd(mass[i]);
+    __m512d acc_x = _mm512_setzero_pd();
+    __m512d acc_y = _mm512_setzero_pd();
+    __m512d pot = _mm512_setzero_pd();
+
+    for (std::size_t j = j_begin; j < j_end; j += 8) {
+        // the last chunk is masked, masked lanes have zero mass and are not stored
+        const std::size_t left = j_end - j;
+        const __mmask8 mask = left >= 8 ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << left) - 1u);
+        __m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, x + j), x_i);
+        __m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, y + j), y_i);
+        __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, eps_sq));
+        __m512d inv = rsqrt_avx512(r2);
+        __m512d inv3 = _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv));
+        __m512d m_j = _mm512_maskz_loadu_pd(mask, mass + j);
+        __m512d s_j = _mm512_mul_pd(m_j, inv3);
+        if (Potential) {
+            pot = _mm512_fmadd_pd(m_j, inv, pot);
+        }
+        __m512d s_i = _mm512_mul_pd(m_i, inv3);
+        acc_x = _mm512_fmadd_pd(s_j, dx, acc_x);
+        acc_y = _mm512_fmadd_pd(s_j, dy, acc_y);
+        _mm512_mask_storeu_pd(buf_x + j, mask, _mm512_fnmadd_pd(s_i, dx, _mm512_maskz_loadu_pd(mask, buf_x + j)));
+        _mm512_mask_storeu_pd(buf_y + j, mask, _mm512_fnmadd_pd(s_i, dy, _mm512_maskz_loadu_pd(mask, buf_y + j)));
+    }
+
+    buf_x[i] += hsum_avx512(acc_x);
+    buf_y[i] += hsum_avx512(acc_y);
+    if (Potential) {
+        energy += mass[i] * hsum_avx512(pot);
+    }
+}
+
+template <bool Potential>
+__attribute__((target("avx512f")))
+void row_pair_avx512(const double * x, const double * y, const double * mass, std::size_t i,
+                     std::size_t j_begin, std::size_t j_end, double * buf_x, double * buf_y, double & energy) {
+    const __m512d eps_sq = _mm512_set1_pd(SOFTENING_LENGTH_SQ);
+    const __m512d x_0 = _mm512_set1_pd(x[i]);
+    const __m512d y_0 = _mm512_set1_pd(y[i]);
+    const __m512d m_0 = _mm512_set1_pd(mass[i]);
+    const __m512d x_1 = _mm512_set1_pd(x[i + 1]);
+    const __m512d y_1 = _mm512_set1_pd(y[i + 1]);
+    const __m512d m_1 = _mm512_set1_pd(mass[i + 1]);
+    __m512d acc_x0 = _mm512_setzero_pd(), acc_y0 = _mm512_setzero_pd();
+    __m512d acc_x1 = _mm512_setzero_pd(), acc_y1 = _mm512_setzero_pd();
+    __m512d pot0 = _mm512_setzero_pd(), pot1 = _mm512_setzero_pd();
+
+    for (std::size_t j = j_begin; j < j_end; j += 8) {
+        const std::size_t left = j_end - j;
+        const __mmask8 mask = left >= 8 ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << left) - 1u);
+        const __m512d x_j = _mm512_maskz_loadu_pd(mask, x + j);
+        const __m512d y_j = _mm512_maskz_loadu_pd(mask, y + j);
+        const __m512d m_j = _mm512_maskz_loadu_pd(mask, mass + j);
+
+        __m512d dx0 = _mm512_sub_pd(x_j, x_0);
+        __m512d dy0 = _mm512_sub_pd(y_j, y_0);
+        __m512d dx1 = _mm512_sub_pd(x_j, x_1);
+        __m512d dy1 = _mm512_sub_pd(y_j, y_1);
+        __m512d inv0 = rsqrt_avx512(_mm512_fmadd_pd(dx0, dx0, _mm512_fmadd_pd(dy0, dy0, eps_sq)));
+        __m512d inv1 = rsqrt_avx512(_mm512_fmadd_pd(dx1, dx1, _mm512_fmadd_pd(dy1, dy1, eps_sq)));
+        __m512d inv3_0 = _mm512_mul_pd(inv0, _mm512_mul_pd(inv0, inv0));
+        __m512d inv3_1 = _mm512_mul_pd(inv1, _mm512_mul_pd(inv1, inv1));
+        if (Potential) {
+            pot0 = _mm512_fmadd_pd(m_j, inv0, pot0);
+            pot1 = _mm512_fmadd_pd(m_j, inv1, pot1);
+        }
+
+        __m512d s_j0 = _mm512_mul_pd(m_j, inv3_0);
+        __m512d s_j1 = _mm512_mul_pd(m_j, inv3_1);
+        acc_x0 = _mm512_fmadd_pd(s_j0, dx0, acc_x0);
+        acc_y0 = _mm512_fmadd_pd(s_j0, dy0, acc_y0);
+        acc_x1 = _mm512_fmadd_pd(s_j1, dx1, acc_x1);
+        acc_y1 = _mm512_fmadd_pd(s_j1, dy1, acc_y1);
+
+        __m512d s_0 = _mm512_mul_pd(m_0, inv3_0);
+        __m512d s_1 = _mm512_mul_pd(m_1, inv3_1);
+        __m512d b_x = _mm512_maskz_loadu_pd(mask, buf_x + j);
+        __m512d b_y = _mm512_maskz_loadu_pd(mask, buf_y + j);
+        b_x = _mm512_fnmadd_pd(s_1, dx1, _mm512_fnmadd_pd(s_0, dx0, b_x));
+        b_y = _mm512_fnmadd_pd(s_1, dy1, _mm512_fnmadd_pd(s_0, dy0, b_y));
+        _mm512_mask_storeu_pd(buf_x + j, mask, b_x);
+        _mm512_mask_storeu_pd(buf_y + j, mask, b_y);
+    }
+
+    buf_x[i] += hsum_avx512(acc_x0);
+    buf_y[i] += hsum_avx512(acc_y0);
+    buf_x[i + 1] += hsum_avx512(acc_x1);
+    buf_y[i + 1] += hsum_avx512(acc_y1);
+    if (Potential) {
+        energy += mass[i] * hsum_avx512(pot0) + mass[i + 1] * hsum_avx512(pot1);
+    }
+}
+
+#endif // NBODY_X86_SIMD
+
+template <bool Potential>
+RowKernel row_kernel() {
+#ifdef NBODY_X86_SIMD
+    switch (detect_simd_level()) {
+        case SimdLevel::AVX512:
+            return row_avx512<Potential>;
+        case SimdLevel::AVX2:
+            return row_avx2<Potential>;
+        default:
+            break;
+    }
+#endif
+    return row_scalar<Potential>;
+}
+
+template <bool Potential>
+RowPairKernel row_pair_kernel() {
+#ifdef NBODY_X86_SIMD
+    if (detect_simd_level() == SimdLevel::AVX512) {
+        return row_pair_avx512<Potential>;
+    }
+    if (detect_simd_level() == SimdLevel::AVX2) {
+        return row_pair_avx2<Potential>;
+    }
+#endif
+    return row_pair_scalar<Potential>;
+}
+
+// all pairs of one tile, diagonal tiles only do j > i
+template <bool Potential>
+void tile_pairs(const double * x, const double * y, const double * mass,
+                std::size_t i_begin, std::size_t i_end, std::size_t j_begin, std::size_t j_end, bool diagonal,
+                double * buf_x, double * buf_y, double & energy) {
+    static const RowKernel row = row_kernel<Potential>();
+    static const RowPairKernel row_pair = row_pair_kernel<Potential>();
+    std::size_t i = i_begin;
+    for (; i + 1 < i_end; i += 2) {
+        if (diagonal) {
+            // the (i, i + 1) pair first, then both rows share j > i + 1
+            row(x, y, mass, i, i + 1, i + 2, buf_x, buf_y, energy);
+            row_pair(x, y, mass, i, i + 2, j_end, buf_x, buf_y, energy);
+        } else {
+            row_pair(x, y, mass, i, j_begin, j_end, buf_x, buf_y, energy);
+        }
+    }
+    if (i < i_end) {
+        row(x, y, mass, i, diagonal ? i + 1 : j_begin, j_end, buf_x, buf_y, energy);
+    }
+}
+
+} // namespace
+
+void SymmetricDirectSolver::accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                                          double * a_x, double * a_y, double * potential) {
+    const std::size_t tile = static_cast<std::size_t>(std::max(tile_size, 8));
+    const int max_threads = omp_get_max_threads();
+
+    // a single tile has nothing to share out, accumulate straight into the output
+    if (n <= tile || max_threads == 1) {
+        std::fill(a_x, a_x + n, 0.0);
+        std::fill(a_y, a_y + n, 0.0);
+        double energy = 0.0;
+        if (potential != nullptr) {
+            tile_pairs<true>(x, y, mass, 0, n, 0, n, true, a_x, a_y, energy);
+            *potential = -G_CONST * energy;
+        } else {
+            tile_pairs<false>(x, y, mass, 0, n, 0, n, true, a_x, a_y, energy);
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            a_x[i] *= G_CONST;
+            a_y[i] *= G_CONST;
+        }
+        return;
+    }
+
+    const int num_tiles = static_cast<int>((n + tile - 1) / tile);
+
+    // upper triangle of tile pairs, the diagonal tiles only do j > i
+    if (tiles.size() != static_cast<std::size_t>(num_tiles) * (num_tiles + 1) / 2) {
+        tiles.clear();
+        for (int ti = 0; ti < num_tiles; ++ti) {
+            for (int tj = ti; tj < num_tiles; ++tj) {
+                tiles.push_back(std::make_pair(ti, tj));
+            }
+        }
+    }
+    // one x and one y buffer per thread, padded to a cache line
+    const std::size_t stride = (n + 7) & ~static_cast<std::size_t>(7);
+    if (buffers.size() < 2 * stride * max_threads) {
+        buffers.resize(2 * stride * max_threads);
+    }
+
+    double energy = 0.0;
+    #pragma omp parallel num_threads(max_threads) reduction(+:energy)
+    {
+        const int num_threads = omp_get_num_threads();
+        // each thread only ever touches its own buffer before the tile loop
+        double * buf_x = buffers.data() + 2 * stride * omp_get_thread_num();
+        double * buf_y = buf_x + stride;
+        std::fill(buf_x, buf_x + 2 * stride, 0.0);
+
+        {
+            // the busy time stops before the barrier, waiting there is the imbalance
+            NBODY_PROFILE_WORKER(profiler);
+            #pragma omp for schedule(dynamic) nowait
+            for (std::size_t t = 0; t < tiles.size(); ++t) {
+                const std::size_t i_begin = tiles[t].first * tile;
+                const std::size_t i_end = std::min(i_begin + tile, n);
+                const std::size_t j_begin = tiles[t].second * tile;
+                const std::size_t j_end = std::min(j_begin + tile, n);
+                const bool diagonal = tiles[t].first == tiles[t].second;
+                if (potential != nullptr) {
+                    tile_pairs<true>(x, y, mass, i_begin, i_end, j_begin, j_end, diagonal, buf_x, buf_y, energy);
+                } else {
+                    tile_pairs<false>(x, y, mass, i_begin, i_end, j_begin, j_end, diagonal, buf_x, buf_y, energy);
+                }
+            }
+        }
+        #pragma omp barrier
+
+        // sum the per thread buffers, G is applied once here
+        #pragma omp for
+        for (std::size_t i = 0; i < n; ++i) {
+            double sum_x = 0.0;
+            double sum_y = 0.0;
+            for (int t = 0; t < num_threads; ++t) {
+                sum_x += buffers[2 * stride * t + i];
+                sum_y += buffers[2 * stride * t + stride + i];
+            }
+            a_x[i] = G_CONST * sum_x;
+            a_y[i] = G_CONST * sum_y;
+        }
+    }
+    if (potential != nullptr) {
+        *potential = -G_CONST * energy;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SYMMETRIC_HPP
+#define SYMMETRIC_HPP
+#include "../particles/aligned_allocator.hpp"
+#include "../profile/profiler.hpp"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// direct sum that visits every unordered pair once and applies +-F to both
+// bodies (newton's third law), half the pair work of the row by row kernel.
+// pairs are grouped into square tiles handed out to threads, each thread adds
+// into its own force buffer and the buffers are summed at the end, no atomics
+class SymmetricDirectSolver {
+    public:
+        explicit SymmetricDirectSolver(int tile_size = 512) : tile_size(tile_size), profiler(nullptr) {}
+
+        // with potential set the pairs also sum the total potential energy into it
+        void accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                           double * a_x, double * a_y, double * potential = nullptr);
+        // worker scopes in the parallel regions report here in NBODY_PROFILE builds
+        void set_profiler(Profiler * profiler) {
+            this->profiler = profiler;
+        }
+
+    private:
+        int tile_size;
+        AlignedArray buffers; // per thread x and y accumulators, back to back
+        std::vector<std::pair<int, int>> tiles; // (i tile, j tile) with i <= j
+        Profiler * profiler;
+};
+
+#endif
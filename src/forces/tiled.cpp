@@ -0,0 +1,254 @@
+#include "tiled.hpp"
+#include "direct.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <omp.h>
+
+namespace {
+
+// targets per block, their coordinates and sums stay in l1 while a tile streams past
+const std::size_t TARGET_BLOCK = 256;
+// below this every source fits in l2 at once (24 bytes a body), one tile is best
+const std::size_t AUTO_MIN_BODIES = 8192;
+// candidates for the tuner, 12 kB to 384 kB of x, y and mass
+const int TILE_CANDIDATES[] = {512, 1024, 2048, 4096, 8192, 16384};
+// sources per tile in mixed precision, 24 kB of float x, y and G m. it also
+// bounds how many pairs a float sum collects before it goes into the double one
+const std::size_t MIXED_TILE = 2048;
+
+// targets per block for a team of threads, small systems get smaller blocks so
+// every thread still has some
+std::size_t block_size(std::size_t n_targets, std::size_t threads) {
+    return std::min(TARGET_BLOCK, std::max<std::size_t>(16, (n_targets + threads - 1) / threads));
+}
+
+} // namespace
+
+int TiledDirectSolver::get_tile_size() const {
+    if (precision == Precision::Mixed) {
+        return static_cast<int>(MIXED_TILE);
+    }
+    if (tile_size > 0) {
+        return tile_size;
+    }
+    return tuned_tile;
+}
+
+void TiledDirectSolver::set_tile_size(int tile_size) {
+    if (tile_size < 0) {
+        throw std::invalid_argument("tile_size must be >= 0 (0 = auto)");
+    }
+    this->tile_size = tile_size;
+    tuned_for = 0;
+}
+
+void TiledDirectSolver::evaluate_block(const double * target_x, const double * target_y, std::size_t begin,
+                                       std::size_t count, const double * x, const double * y, const double * mass,
+                                       std::size_t n, std::size_t tile, double * a_x, double * a_y,
+                                       double * phi) const {
+    for (std::size_t j = 0; j < n; j += tile) {
+        const std::size_t sources = std::min(tile, n - j);
+        if (phi != nullptr) {
+            if (j == 0) {
+                direct_accelerations_potentials(target_x + begin, target_y + begin, count, x, y, mass, sources,
+                                                a_x + begin, a_y + begin, phi + begin, begin);
+            } else {
+                direct_accelerations_potentials_add(target_x + begin, target_y + begin, count,
+                                                    x + j, y + j, mass + j, sources,
+                                                    a_x + begin, a_y + begin, phi + begin,
+                                                    static_cast<std::ptrdiff_t>(begin) - static_cast<std::ptrdiff_t>(j));
+            }
+        } else if (j == 0) {
+            direct_accelerations(target_x + begin, target_y + begin, count, x, y, mass, sources,
+                                 a_x + begin, a_y + begin);
+        } else {
+            direct_accelerations_add(target_x + begin, target_y + begin, count, x + j, y + j, mass + j, sources,
+                                     a_x + begin, a_y + begin);
+        }
+    }
+}
+
+void TiledDirectSolver::evaluate_mixed_block(const double * target_x, const double * target_y, std::size_t begin,
+                                             std::size_t count, const double * x, const double * y,
+                                             const double * mass, std::size_t n, LocalBlock<float> & targets,
+                                             LocalBlock<float> & sources, double * a_x, double * a_y,
+                                             double * phi) const {
+    // the origin is the middle of the block's bounding box, so pairs
+    // inside and near the block are differences of small numbers
+    double min_x = target_x[begin], max_x = min_x, min_y = target_y[begin], max_y = min_y;
+    for (std::size_t i = begin + 1; i < begin + count; ++i) {
+        min_x = std::min(min_x, target_x[i]);
+        max_x = std::max(max_x, target_x[i]);
+        min_y = std::min(min_y, target_y[i]);
+        max_y = std::max(max_y, target_y[i]);
+    }
+    const double origin_x = 0.5 * (min_x + max_x);
+    const double origin_y = 0.5 * (min_y + max_y);
+    targets.load(target_x + begin, target_y + begin, nullptr, count, origin_x, origin_y);
+
+    std::fill(a_x + begin, a_x + begin + count, 0.0);
+    std::fill(a_y + begin, a_y + begin + count, 0.0);
+    if (phi != nullptr) {
+        std::fill(phi + begin, phi + begin + count, 0.0);
+    }
+    // converting a tile costs one subtraction per source for a whole
+    // block of targets, next to the block * tile pairs it is noise
+    for (std::size_t j = 0; j < n; j += MIXED_TILE) {
+        const std::size_t count_j = std::min(MIXED_TILE, n - j);
+        sources.load(x + j, y + j, mass + j, count_j, origin_x, origin_y);
+        local_accelerations_add(targets, sources, a_x + begin, a_y + begin, phi != nullptr ? phi + begin : nullptr,
+                                static_cast<std::ptrdiff_t>(begin) - static_cast<std::ptrdiff_t>(j));
+    }
+}
+
+void TiledDirectSolver::evaluate(const double * target_x, const double * target_y, std::size_t n_targets,
+                                 const double * x, const double * y, const double * mass, std::size_t n,
+                                 std::size_t tile, double * a_x, double * a_y, double * phi) const {
+    if (precision == Precision::Mixed) {
+        evaluate_mixed(target_x, target_y, n_targets, x, y, mass, n, a_x, a_y, phi);
+        return;
+    }
+    const std::size_t block = block_size(n_targets, static_cast<std::size_t>(omp_get_max_threads()));
+    const std::size_t num_blocks = (n_targets + block - 1) / block;
+
+    // static so a thread gets the same targets every step, the same split
+    // Particles::first_touch used, which keeps its pages on its own numa node
+    #pragma omp parallel proc_bind(close)
+    {
+        NBODY_PROFILE_WORKER(profiler);
+        #pragma omp for schedule(static) nowait
+        for (std::size_t b = 0; b < num_blocks; ++b) {
+            const std::size_t begin = b * block;
+            evaluate_block(target_x, target_y, begin, std::min(block, n_targets - begin), x, y, mass, n, tile,
+                           a_x, a_y, phi);
+        }
+    }
+}
+
+void TiledDirectSolver::evaluate_mixed(const double * target_x, const double * target_y, std::size_t n_targets,
+                                       const double * x, const double * y, const double * mass, std::size_t n,
+                                       double * a_x, double * a_y, double * phi) const {
+    const std::size_t block = block_size(n_targets, static_cast<std::size_t>(omp_get_max_threads()));
+    const std::size_t num_blocks = (n_targets + block - 1) / block;
+
+    #pragma omp parallel proc_bind(close)
+    {
+        NBODY_PROFILE_WORKER(profiler);
+        LocalBlock<float> targets, sources;
+        #pragma omp for schedule(static) nowait
+        for (std::size_t b = 0; b < num_blocks; ++b) {
+            const std::size_t begin = b * block;
+            evaluate_mixed_block(target_x, target_y, begin, std::min(block, n_targets - begin), x, y, mass, n,
+                                 targets, sources, a_x, a_y, phi);
+        }
+    }
+}
+
+int TiledDirectSolver::tune(const double * x, const double * y, const double * mass, std::size_t n) {
+    // enough target blocks to keep every thread busy a few times over, against all sources
+    const std::size_t sample = std::min(n, 4 * TARGET_BLOCK * static_cast<std::size_t>(omp_get_max_threads()));
+    int best_tile = static_cast<int>(n);
+    double best_seconds = -1.0;
+    tune_a_x.resize(sample);
+    tune_a_y.resize(sample);
+
+    for (int candidate : TILE_CANDIDATES) {
+        if (static_cast<std::size_t>(candidate) >= n) {
+            break;
+        }
+        auto start = std::chrono::high_resolution_clock::now();
+        evaluate(x, y, sample, x, y, mass, n, candidate, tune_a_x.data(), tune_a_y.data());
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (best_seconds < 0.0 || seconds < best_seconds) {
+            best_seconds = seconds;
+            best_tile = candidate;
+        }
+    }
+    return best_tile;
+}
+
+std::size_t TiledDirectSolver::choose_tile(const double * x, const double * y, const double * mass, std::size_t n) {
+    if (precision == Precision::Mixed) {
+        return MIXED_TILE;
+    }
+    if (tile_size > 0) {
+        return static_cast<std::size_t>(tile_size);
+    }
+    if (n <= AUTO_MIN_BODIES) {
+        tuned_tile = static_cast<int>(n);
+        tuned_for = n;
+    } else if (tuned_for == 0 || n > 2 * tuned_for || 2 * n < tuned_for) {
+        // retune only when the system size changed a lot, the tuning runs are real work
+        tuned_tile = tune(x, y, mass, n);
+        tuned_for = n;
+    }
+    return static_cast<std::size_t>(std::max(tuned_tile, 1));
+}
+
+std::size_t TiledDirectSolver::current_tile(std::size_t n) const {
+    // the tuner needs real work to time, so only use a tile it already picked
+    return tile_size > 0 ? static_cast<std::size_t>(tile_size)
+         : tuned_tile > 0 ? static_cast<std::size_t>(tuned_tile) : std::max<std::size_t>(n, 1);
+}
+
+void TiledDirectSolver::accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                                      double * a_x, double * a_y, double * potential) {
+    const std::size_t tile = choose_tile(x, y, mass, n);
+    if (potential == nullptr) {
+        evaluate(x, y, n, x, y, mass, n, tile, a_x, a_y);
+        return;
+    }
+    phi.resize(n);
+    evaluate(x, y, n, x, y, mass, n, tile, a_x, a_y, phi.data());
+    *potential = potential_energy(mass, phi.data(), n);
+}
+
+void TiledDirectSolver::accelerations(const double * target_x, const double * target_y, std::size_t n_targets,
+                                      const double * x, const double * y, const double * mass, std::size_t n,
+                                      double * a_x, double * a_y) {
+    evaluate(target_x, target_y, n_targets, x, y, mass, n, current_tile(n), a_x, a_y);
+}
+
+void TiledDirectSolver::prepare(const double * x, const double * y, const double * mass, std::size_t n,
+                                bool with_potential) {
+    choose_tile(x, y, mass, n);
+    if (with_potential) {
+        phi.resize(n);
+    }
+}
+
+TiledDirectSolver::TargetRange TiledDirectSolver::target_range(std::size_t n_targets, int thread,
+                                                               int threads) const {
+    // schedule(static) hands out ceil(blocks / threads) blocks per thread in order
+    TargetRange range;
+    range.block = block_size(n_targets, static_cast<std::size_t>(threads));
+    const std::size_t num_blocks = (n_targets + range.block - 1) / range.block;
+    const std::size_t chunk = (num_blocks + threads - 1) / threads;
+    range.begin = std::min(n_targets, static_cast<std::size_t>(thread) * chunk * range.block);
+    range.end = std::min(n_targets, range.begin + chunk * range.block);
+    return range;
+}
+
+void TiledDirectSolver::evaluate_range(const double * target_x, const double * target_y, const TargetRange & range,
+                                       const double * x, const double * y, const double * mass, std::size_t n,
+                                       double * a_x, double * a_y, bool with_potential) {
+    double * potentials = with_potential ? phi.data() : nullptr;
+    if (precision == Precision::Mixed) {
+        LocalBlock<float> targets, sources;
+        for (std::size_t begin = range.begin; begin < range.end; begin += range.block) {
+            evaluate_mixed_block(target_x, target_y, begin, std::min(range.block, range.end - begin), x, y, mass, n,
+                                 targets, sources, a_x, a_y, potentials);
+        }
+        return;
+    }
+    const std::size_t tile = current_tile(n);
+    for (std::size_t begin = range.begin; begin < range.end; begin += range.block) {
+        evaluate_block(target_x, target_y, begin, std::min(range.block, range.end - begin), x, y, mass, n, tile,
+                       a_x, a_y, potentials);
+    }
+}
+
+double TiledDirectSolver::potential_sum(const double * mass, std::size_t n) const {
+    return potential_energy(mass, phi.data(), n);
+}
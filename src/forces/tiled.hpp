@@ -0,0 +1,101 @@
+#ifndef TILED_HPP
+#define TILED_HPP
+#include "../particles/aligned_allocator.hpp"
+#include "../profile/profiler.hpp"
+#include "precision.hpp"
+#include <cstddef>
+
+// the row by row direct sum with the sources cut into cache sized tiles.
+// each thread owns a fixed block of targets (static schedule, threads bound
+// close to each other) and walks it over one source tile at a time, so a tile
+// is pulled from memory once per target block instead of once per target.
+// tile_size 0 means auto: small systems use a single tile, bigger ones time a
+// few candidates on the real data once and keep the fastest.
+// with Precision::Mixed every target block is taken around its own centre and
+// the pairs run through the float kernel (fixed tiles, the tuner is for double)
+class TiledDirectSolver {
+    public:
+        // one thread's share of the targets: whole blocks, the same static
+        // split the threaded calls make
+        struct TargetRange {
+            std::size_t begin, end, block;
+        };
+
+        explicit TiledDirectSolver(int tile_size = 0)
+            : tile_size(0), tuned_tile(0), tuned_for(0), precision(Precision::Double), profiler(nullptr) {
+            set_tile_size(tile_size);
+        }
+
+        // with potential set the same pass also sums the total potential energy into it
+        void accelerations(const double * x, const double * y, const double * mass, std::size_t n,
+                           double * a_x, double * a_y, double * potential = nullptr);
+        // a separate set of targets (say the active bodies of a block step) against
+        // all n sources, uses the tile the last full call picked
+        void accelerations(const double * target_x, const double * target_y, std::size_t n_targets,
+                           const double * x, const double * y, const double * mass, std::size_t n,
+                           double * a_x, double * a_y);
+
+        // the same passes for callers that run their own parallel region (the
+        // fused step in kosmos): prepare picks the tile and sizes the potential
+        // buffer before the region, then every thread of the team evaluates its
+        // own target_range, with no threading or synchronization of its own.
+        // with_potential fills the per body potentials (the targets have to be the
+        // sources then, target i is body i), potential_sum adds them up
+        // afterwards. same results as accelerations, bit for bit
+        void prepare(const double * x, const double * y, const double * mass, std::size_t n, bool with_potential);
+        TargetRange target_range(std::size_t n_targets, int thread, int threads) const;
+        void evaluate_range(const double * target_x, const double * target_y, const TargetRange & range,
+                            const double * x, const double * y, const double * mass, std::size_t n,
+                            double * a_x, double * a_y, bool with_potential = false);
+        double potential_sum(const double * mass, std::size_t n) const;
+
+        // sources per tile actually used by the last call (the tuned value in auto mode)
+        int get_tile_size() const;
+        // 0 switches back to auto tuning, throws std::invalid_argument if negative
+        void set_tile_size(int tile_size);
+        bool is_auto() const {
+            return tile_size == 0;
+        }
+        // what set_tile_size got, 0 = auto, whatever the precision
+        int get_requested_tile_size() const {
+            return tile_size;
+        }
+        Precision get_precision() const {
+            return precision;
+        }
+        void set_precision(Precision precision) {
+            this->precision = precision;
+        }
+        // worker scopes in the parallel regions report here in NBODY_PROFILE builds
+        void set_profiler(Profiler * profiler) {
+            this->profiler = profiler;
+        }
+
+    private:
+        int tile_size; // requested, 0 = auto
+        int tuned_tile; // last choice of the auto tuner
+        std::size_t tuned_for; // body count the tuner ran at
+        AlignedArray phi; // per body potentials when the energy is wanted
+        AlignedArray tune_a_x, tune_a_y; // what the tuning runs write, so real forces are never touched
+        Precision precision;
+        Profiler * profiler;
+
+        std::size_t choose_tile(const double * x, const double * y, const double * mass, std::size_t n);
+        std::size_t current_tile(std::size_t n) const;
+        void evaluate_block(const double * target_x, const double * target_y, std::size_t begin, std::size_t count,
+                            const double * x, const double * y, const double * mass, std::size_t n,
+                            std::size_t tile, double * a_x, double * a_y, double * phi) const;
+        void evaluate_mixed_block(const double * target_x, const double * target_y, std::size_t begin,
+                                  std::size_t count, const double * x, const double * y, const double * mass,
+                                  std::size_t n, LocalBlock<float> & targets, LocalBlock<float> & sources,
+                                  double * a_x, double * a_y, double * phi) const;
+        void evaluate(const double * target_x, const double * target_y, std::size_t n_targets,
+                      const double * x, const double * y, const double * mass, std::size_t n,
+                      std::size_t tile, double * a_x, double * a_y, double * phi = nullptr) const;
+        void evaluate_mixed(const double * target_x, const double * target_y, std::size_t n_targets,
+                            const double * x, const double * y, const double * mass, std::size_t n,
+                            double * a_x, double * a_y, double * phi) const;
+        int tune(const double * x, const double * y, const double * mass, std::size_t n);
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "checkpoint.hpp"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = {'N', 'B', 'C', 'K', 'P', 'T', '1', '\0'};
+const int NUM_ARRAYS = 7;
+
+// payload order, the same for save and load
+void particle_arrays(Particles & particles, AlignedArray * arrays[NUM_ARRAYS]) {
+    arrays[0] = &particles.x;
+    arrays[1] = &particles.y;
+    arrays[2] = &particles.v_x;
+    arrays[3] = &particles.v_y;
+    arrays[4] = &particles.a_x;
+    arrays[5] = &particles.a_y;
+    arrays[6] = &particles.mass;
+}
+
+// checksum of the header with its checksum field zeroed, then every array of
+// the bodies, the radii, the ids and the tracers, each only when the file
+// has them (older files have none of them)
+uint64_t checkpoint_checksum(CheckpointHeader header, const double * const arrays[NUM_ARRAYS], std::size_t n,
+                             const double * radii, const uint64_t * ids,
+                             const double * const tracer_arrays[NUM_ARRAYS], std::size_t n_tracers) {
+    header.checksum = 0;
+    uint64_t sum = checksum64(&header, sizeof(header));
+    for (int a = 0; a < NUM_ARRAYS; ++a) {
+        sum = checksum64(arrays[a], n * sizeof(double), sum);
+    }
+    if (radii != nullptr) {
+        sum = checksum64(radii, n * sizeof(double), sum);
+    }
+    if (ids != nullptr) {
+        sum = checksum64(ids, n * sizeof(uint64_t), sum);
+    }
+    for (int a = 0; a < NUM_ARRAYS && n_tracers > 0; ++a) {
+        sum = checksum64(tracer_arrays[a], n_tracers * sizeof(double), sum);
+    }
+    return sum;
+}
+
+void const_particle_arrays(const Particles & particles, const double * arrays[NUM_ARRAYS]) {
+    arrays[0] = particles.x.data();
+    arrays[1] = particles.y.data();
+    arrays[2] = particles.v_x.data();
+    arrays[3] = particles.v_y.data();
+    arrays[4] = particles.a_x.data();
+    arrays[5] = particles.a_y.data();
+    arrays[6] = particles.mass.data();
+}
+
+// one array of the payload into a fresh one, copied with the same static
+// split the force loops use so the pages land next to the threads that use them
+void copy_array(const double * src, std::size_t n, AlignedArray & out) {
+    out.resize(n);
+    double * dst = out.data();
+    #pragma omp parallel for schedule(static) proc_bind(close)
+    for (std::size_t i = 0; i < n; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+// one block of the payload (n rows of every array) into fresh particles,
+// radii from their own array when there is one
+void copy_block(const double * payload, std::size_t n, const double * radii, Particles & out) {
+    Particles restored;
+    AlignedArray * arrays[NUM_ARRAYS];
+    particle_arrays(restored, arrays);
+    for (int a = 0; a < NUM_ARRAYS; ++a) {
+        copy_array(payload + a * n, n, *arrays[a]);
+    }
+    if (radii != nullptr) {
+        copy_array(radii, n, restored.radius);
+    } else {
+        restored.radius.assign(n, 0.0);
+    }
+    std::swap(out, restored);
+}
+
+} // namespace
+
+uint64_t checksum64(const void * data, std::size_t bytes, uint64_t seed) {
+    // four independent multiply-xor lanes so the multiplies overlap, then folded
+    const uint64_t prime_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime_2 = 0xC2B2AE3D27D4EB4FULL;
+    const unsigned char * p = static_cast<const unsigned char *>(data);
+    uint64_t lanes[4] = {seed + prime_1, seed ^ prime_2, seed + 1, seed - prime_1};
+
+    std::size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        for (int l = 0; l < 4; ++l) {
+            uint64_t word;
+            std::memcpy(&word, p + i + 8 * l, sizeof(word));
+            lanes[l] = (lanes[l] ^ (word * prime_2)) * prime_1;
+            lanes[l] ^= lanes[l] >> 29;
+        }
+    }
+    uint64_t sum = bytes * prime_1;
+    for (int l = 0; l < 4; ++l) {
+        sum = (sum ^ lanes[l]) * prime_2;
+    }
+    for (; i < bytes; ++i) {
+        sum = (sum ^ p[i]) * prime_1;
+    }
+    return sum ^ (sum >> 32);
+}
+
+void write_checkpoint(const std::string & path, CheckpointHeader header, const Particles & particles,
+                      const Particles * tracers, const std::vector<uint32_t> * ids) {
+    const std::size_t n = particles.size();
+    if (ids != nullptr && ids->size() != n) {
+        throw std::runtime_error("checkpoint '" + path + "' needs one id per body");
+    }
+    // ids go out as 64 bit words like everything else in the payload
+    const std::vector<uint64_t> wide_ids = ids != nullptr ? std::vector<uint64_t>(ids->begin(), ids->end())
+                                                          : std::vector<uint64_t>();
+    const std::size_t n_ids = ids != nullptr ? n : 0;
+    const std::size_t n_tracers = tracers != nullptr ? tracers->size() : 0;
+    const double * arrays[NUM_ARRAYS];
+    const double * tracer_arrays[NUM_ARRAYS] = {};
+    const_particle_arrays(particles, arrays);
+    if (n_tracers > 0) {
+        const_particle_arrays(*tracers, tracer_arrays);
+    }
+
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.header_size = sizeof(CheckpointHeader);
+    header.num_bodies = n;
+    header.num_tracers = n_tracers;
+    header.flags |= CHECKPOINT_RADII | (ids != nullptr ? CHECKPOINT_IDS : 0);
+    header.payload_offset = sizeof(CheckpointHeader);
+    header.payload_size = (static_cast<uint64_t>(NUM_ARRAYS) * (n + n_tracers) + n + n_ids) * sizeof(double);
+    header.checksum = checkpoint_checksum(header, arrays, n, particles.radius.data(),
+                                          ids != nullptr ? wide_ids.data() : nullptr, tracer_arrays, n_tracers);
+
+    const std::string temporary = path + ".tmp";
+    FILE * file = std::fopen(temporary.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("could not open checkpoint file '" + temporary + "' for writing");
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int a = 0; a < NUM_ARRAYS && ok && n > 0; ++a) {
+        ok = std::fwrite(arrays[a], sizeof(double), n, file) == n;
+    }
+    if (ok && n > 0) {
+        ok = std::fwrite(particles.radius.data(), sizeof(double), n, file) == n;
+    }
+    if (ok && n_ids > 0) {
+        ok = std::fwrite(wide_ids.data(), sizeof(uint64_t), n_ids, file) == n_ids;
+    }
+    for (int a = 0; a < NUM_ARRAYS && ok && n_tracers > 0; ++a) {
+        ok = std::fwrite(tracer_arrays[a], sizeof(double), n_tracers, file) == n_tracers;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("writing checkpoint '" + path + "' failed");
+    }
+}
+
+void read_checkpoint(const std::string & path, CheckpointHeader & header, Particles & particles,
+                     Particles * tracers, std::vector<uint32_t> * ids) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("could not open checkpoint file '" + path + "'");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(CheckpointHeader)) {
+        ::close(fd);
+        throw std::runtime_error("'" + path + "' is too short to be a checkpoint");
+    }
+    const std::size_t file_size = static_cast<std::size_t>(info.st_size);
+    void * mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("could not map checkpoint file '" + path + "'");
+    }
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
+    const char * base = static_cast<const char *>(mapping);
+
+    CheckpointHeader read_header;
+    std::memcpy(&read_header, base, sizeof(read_header));
+    const std::size_t n = static_cast<std::size_t>(read_header.num_bodies);
+    const std::size_t n_tracers = static_cast<std::size_t>(read_header.num_tracers);
+    const std::size_t n_radii = (read_header.flags & CHECKPOINT_RADII) ? n : 0;
+    const std::size_t n_ids = (read_header.flags & CHECKPOINT_IDS) ? n : 0;
+    const std::size_t tracer_start = NUM_ARRAYS * n + n_radii + n_ids; // in words from the payload start
+    const char * problem = nullptr;
+    if (std::memcmp(read_header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        problem = "is not a checkpoint file";
+    } else if (read_header.version != CHECKPOINT_VERSION || read_header.header_size != sizeof(CheckpointHeader)) {
+        problem = "has an unsupported checkpoint version";
+    } else if (n > file_size / sizeof(double) || n_tracers > file_size / sizeof(double)) {
+        // counts no file this size can hold, refused before the size below
+        // multiplies them and wraps around
+        problem = "is truncated or has a bad size";
+    } else if (read_header.payload_offset != sizeof(CheckpointHeader)
+               || read_header.payload_size
+                      != (static_cast<uint64_t>(NUM_ARRAYS) * (n + n_tracers) + n_radii + n_ids) * sizeof(double)
+               || read_header.payload_offset + read_header.payload_size != file_size) {
+        problem = "is truncated or has a bad size";
+    } else {
+        const double * arrays[NUM_ARRAYS];
+        const double * tracer_arrays[NUM_ARRAYS];
+        const double * payload = reinterpret_cast<const double *>(base + read_header.payload_offset);
+        for (int a = 0; a < NUM_ARRAYS; ++a) {
+            arrays[a] = payload + a * n;
+            tracer_arrays[a] = payload + tracer_start + a * n_tracers;
+        }
+        const double * radii = n_radii > 0 ? payload + NUM_ARRAYS * n : nullptr;
+        const uint64_t * file_ids =
+            n_ids > 0 ? reinterpret_cast<const uint64_t *>(payload + NUM_ARRAYS * n + n_radii) : nullptr;
+        if (checkpoint_checksum(read_header, arrays, n, radii, file_ids, tracer_arrays, n_tracers)
+            != read_header.checksum) {
+            problem = "failed its checksum";
+        }
+    }
+    if (problem != nullptr) {
+        munmap(mapping, file_size);
+        throw std::runtime_error("'" + path + "' " + problem);
+    }
+
+    // straight from the mapping into fresh arrays
+    const double * payload = reinterpret_cast<const double *>(base + read_header.payload_offset);
+    Particles restored, restored_tracers;
+    copy_block(payload, n, n_radii > 0 ? payload + NUM_ARRAYS * n : nullptr, restored);
+    if (tracers != nullptr) {
+        copy_block(payload + tracer_start, n_tracers, nullptr, restored_tracers);
+    }
+    std::vector<uint32_t> restored_ids;
+    if (ids != nullptr && n_ids > 0) {
+        const uint64_t * file_ids = reinterpret_cast<const uint64_t *>(payload + NUM_ARRAYS * n + n_radii);
+        restored_ids.assign(file_ids, file_ids + n);
+    }
+    munmap(mapping, file_size);
+
+    header = read_header;
+    std::swap(particles, restored);
+    if (tracers != nullptr) {
+        std::swap(*tracers, restored_tracers);
+    }
+    if (ids != nullptr) {
+        ids->swap(restored_ids);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+#include "../particles/particles.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// checkpoint files: a 128 byte header then x, y, v_x, v_y, a_x, a_y and mass
+// back to back as doubles, one contiguous block that gets mapped and copied
+// straight into the particle arrays on load. then the body radii (files
+// without CHECKPOINT_RADII have none, the bodies load as points), the body
+// ids as 64 bit words (only with CHECKPOINT_IDS, otherwise they are 0..n-1)
+// and the tracers, if any, in the layout of the bodies. the checksum covers
+// the header (with the checksum field zeroed) and the whole payload
+
+const uint32_t CHECKPOINT_VERSION = 1;
+const uint32_t CHECKPOINT_FORCES_VALID = 1; // flags: cached accelerations match the positions
+const uint32_t CHECKPOINT_QUADRUPOLE = 2; // flags: barnes hut quadrupoles on
+const uint32_t CHECKPOINT_RADII = 4; // flags: a radius array follows the bodies, set by write_checkpoint
+const uint32_t CHECKPOINT_IDS = 8; // flags: an id array follows the radii, set when write_checkpoint gets ids
+const uint32_t CHECKPOINT_MIXED_PRECISION = 16; // flags: direct solver in mixed precision, older files are double
+const uint32_t CHECKPOINT_COLLISIONS_SHIFT = 8; // flags: collision mode in bits 8 and 9, 0 = off
+
+// fixed layout, written as is (little endian)
+struct CheckpointHeader {
+    char magic[8]; // "NBCKPT1"
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t num_bodies;
+    uint64_t payload_offset;
+    uint64_t payload_size;
+    uint64_t checksum;
+    // simulation state and settings, filled in by Kosmos
+    int64_t step_count;
+    double time;
+    uint32_t force_solver;
+    uint32_t flags;
+    double theta;
+    int32_t fmm_order;
+    int32_t tile_size;
+    double block_eta; // block time step accuracy, 0 in older files = default
+    int32_t block_max_level; // 0 = block time steps off
+    uint32_t integrator; // 0 = verlet
+    uint64_t num_tracers; // massless tracers after the bodies, 0 in older files
+    double restitution; // collision bounce restitution, 0 in older files = elastic
+    uint32_t next_id; // id the next added body gets, with CHECKPOINT_IDS
+    uint8_t reserved[4]; // zero, room for later settings
+};
+
+// 64 bit checksum of a buffer, word at a time so it keeps up with the disk
+uint64_t checksum64(const void * data, std::size_t bytes, uint64_t seed = 0);
+
+// writes to path + ".tmp" and renames over path, so a crash mid save keeps the
+// old checkpoint. fills in the format fields of header, throws std::runtime_error.
+// ids (one per body) are stored when given
+void write_checkpoint(const std::string & path, CheckpointHeader header, const Particles & particles,
+                      const Particles * tracers = nullptr, const std::vector<uint32_t> * ids = nullptr);
+
+// validates magic, version, sizes and checksum before touching particles,
+// throws std::runtime_error on any problem. tracers (when not null) gets the
+// tracers of the file, none for older ones, ids (when not null) the body ids,
+// empty when the file has none
+void read_checkpoint(const std::string & path, CheckpointHeader & header, Particles & particles,
+                     Particles * tracers = nullptr, std::vector<uint32_t> * ids = nullptr);
+
+#endif
@@ -0,0 +1,355 @@
+#include "trajectory.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char HEADER_MAGIC[8] = {'N', 'B', 'T', 'R', 'A', 'J', '1', '\0'};
+const char TRAILER_MAGIC[8] = {'N', 'B', 'T', 'R', 'I', 'D', 'X', '\0'};
+const uint32_t FORMAT_VERSION = 1;
+const std::size_t FRAME_HEADER_SIZE = 16; // step + time
+const std::size_t CHUNK_BYTES = 4 << 20; // ~4 MB per write
+const std::size_t MAX_QUEUED_CHUNKS = 8;
+
+// written after the index
+struct Trailer {
+    uint64_t num_frames;
+    uint64_t index_offset;
+    char magic[8];
+};
+
+const TrajectoryField ALL_FIELDS[TRAJ_NUM_FIELDS] = {
+    TRAJ_X, TRAJ_Y, TRAJ_V_X, TRAJ_V_Y, TRAJ_A_X, TRAJ_A_Y, TRAJ_MASS
+};
+
+const AlignedArray & field_array(const Particles & particles, TrajectoryField field) {
+    switch (field) {
+        case TRAJ_X: return particles.x;
+        case TRAJ_Y: return particles.y;
+        case TRAJ_V_X: return particles.v_x;
+        case TRAJ_V_Y: return particles.v_y;
+        case TRAJ_A_X: return particles.a_x;
+        case TRAJ_A_Y: return particles.a_y;
+        default: return particles.mass;
+    }
+}
+
+} // namespace
+
+const char * trajectory_field_name(TrajectoryField field) {
+    switch (field) {
+        case TRAJ_X: return "x";
+        case TRAJ_Y: return "y";
+        case TRAJ_V_X: return "v_x";
+        case TRAJ_V_Y: return "v_y";
+        case TRAJ_A_X: return "a_x";
+        case TRAJ_A_Y: return "a_y";
+        case TRAJ_MASS: return "mass";
+    }
+    return "unknown";
+}
+
+TrajectoryField trajectory_field_from_name(const std::string & name) {
+    for (TrajectoryField field : ALL_FIELDS) {
+        if (name == trajectory_field_name(field)) {
+            return field;
+        }
+    }
+    throw std::invalid_argument("unknown trajectory field '" + name + "', expected one of x y v_x v_y a_x a_y mass");
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string & path, std::size_t num_bodies, unsigned fields,
+                                   long long every, bool float32)
+    : file(nullptr), every(every), stalls(0), closing(false), write_failed(false) {
+    fields &= (1u << TRAJ_NUM_FIELDS) - 1;
+    if (fields == 0) {
+        throw std::invalid_argument("a trajectory needs at least one field");
+    }
+    if (every < 1) {
+        throw std::invalid_argument("every must be >= 1");
+    }
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, HEADER_MAGIC, sizeof(HEADER_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.fields = fields;
+    header.value_size = float32 ? 4 : 8;
+    header.every = static_cast<uint32_t>(every);
+    header.num_bodies = num_bodies;
+    header.field_stride = (num_bodies * header.value_size + 7) & ~static_cast<uint64_t>(7);
+    header.frame_size = FRAME_HEADER_SIZE + header.field_stride * __builtin_popcount(fields);
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("could not open trajectory file '" + path + "' for writing");
+    }
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        throw std::runtime_error("could not write the trajectory header to '" + path + "'");
+    }
+
+    frames_per_chunk = std::max<std::size_t>(1, CHUNK_BYTES / header.frame_size);
+    writer = std::thread(&TrajectoryWriter::writer_loop, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    try {
+        close();
+    } catch (...) {
+        // nothing sensible to do with a failed write in a destructor
+    }
+}
+
+void TrajectoryWriter::append(long long step, double time, const Particles & particles) {
+    if (file == nullptr) {
+        throw std::logic_error("trajectory writer is closed");
+    }
+    if (particles.size() != header.num_bodies) {
+        throw std::invalid_argument("body count changed while writing a trajectory");
+    }
+
+    // frame goes straight into the chunk buffer, copied or narrowed field by field
+    const std::size_t offset = chunk.size();
+    chunk.resize(offset + header.frame_size);
+    char * frame = chunk.data() + offset;
+    int64_t step_out = step;
+    std::memcpy(frame, &step_out, sizeof(step_out));
+    std::memcpy(frame + 8, &time, sizeof(time));
+
+    char * block = frame + FRAME_HEADER_SIZE;
+    for (TrajectoryField field : ALL_FIELDS) {
+        if (!(header.fields & field)) {
+            continue;
+        }
+        const AlignedArray & values = field_array(particles, field);
+        if (header.value_size == 4) {
+            float * out = reinterpret_cast<float *>(block);
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                out[i] = static_cast<float>(values[i]);
+            }
+        } else {
+            std::memcpy(block, values.data(), values.size() * sizeof(double));
+        }
+        std::memset(block + values.size() * header.value_size, 0,
+                    header.field_stride - values.size() * header.value_size);
+        block += header.field_stride;
+    }
+
+    IndexEntry entry = {step_out, time};
+    index.push_back(entry);
+    if (chunk.size() >= frames_per_chunk * header.frame_size) {
+        flush_chunk();
+    }
+}
+
+void TrajectoryWriter::flush_chunk() {
+    if (chunk.empty()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (write_failed) {
+        throw std::runtime_error("writing the trajectory file failed");
+    }
+    if (queue.size() >= MAX_QUEUED_CHUNKS) {
+        ++stalls;
+        queue_changed.wait(lock, [this] { return queue.size() < MAX_QUEUED_CHUNKS || write_failed; });
+    }
+    queue.push_back(std::vector<char>());
+    queue.back().swap(chunk);
+    // pick up a buffer the writer is done with so the next chunk does not allocate
+    if (!spare.empty()) {
+        chunk.swap(spare.back());
+        spare.pop_back();
+    }
+    chunk.clear();
+    lock.unlock();
+    queue_changed.notify_all();
+}
+
+void TrajectoryWriter::writer_loop() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true) {
+        queue_changed.wait(lock, [this] { return !queue.empty() || closing; });
+        if (queue.empty()) {
+            return; // closing and drained
+        }
+        std::vector<char> buffer;
+        buffer.swap(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        queue_changed.notify_all();
+
+        bool ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+
+        lock.lock();
+        write_failed = write_failed || !ok;
+        spare.push_back(std::vector<char>());
+        spare.back().swap(buffer);
+    }
+}
+
+void TrajectoryWriter::close() {
+    if (file == nullptr) {
+        return;
+    }
+    // the writer thread has to be joined even if the last chunk cannot be queued
+    bool ok = true;
+    try {
+        flush_chunk();
+    } catch (const std::runtime_error &) {
+        ok = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        closing = true;
+    }
+    queue_changed.notify_all();
+    writer.join();
+
+    // index and trailer, the index starts right after the last frame
+    Trailer trailer;
+    trailer.num_frames = index.size();
+    trailer.index_offset = sizeof(TrajectoryHeader) + index.size() * header.frame_size;
+    std::memcpy(trailer.magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+    ok = ok && !write_failed;
+    if (ok && !index.empty()) {
+        ok = std::fwrite(index.data(), sizeof(IndexEntry), index.size(), file) == index.size();
+    }
+    ok = ok && std::fwrite(&trailer, sizeof(trailer), 1, file) == 1;
+    ok = (std::fclose(file) == 0) && ok;
+    file = nullptr;
+    if (!ok) {
+        throw std::runtime_error("writing the trajectory file failed");
+    }
+}
+
+TrajectoryReader::TrajectoryReader(const std::string & path)
+    : base(nullptr), mapped_size(0), num_frames(0), indexed(false), index_base(nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("could not open trajectory file '" + path + "'");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(TrajectoryHeader)) {
+        ::close(fd);
+        throw std::runtime_error("'" + path + "' is too short to be a trajectory file");
+    }
+    mapped_size = static_cast<std::size_t>(info.st_size);
+    void * mapping = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("could not map trajectory file '" + path + "'");
+    }
+    base = static_cast<const char *>(mapping);
+
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0 || header.version != FORMAT_VERSION
+        || header.frame_size < FRAME_HEADER_SIZE) {
+        munmap(const_cast<char *>(base), mapped_size);
+        throw std::runtime_error("'" + path + "' is not a version 1 trajectory file");
+    }
+    // every offset the reader takes later is built from these, so they have to
+    // be the ones the writer derives from num_bodies, fields and value_size
+    const uint64_t num_fields = __builtin_popcount(header.fields);
+    if ((header.value_size != 4 && header.value_size != 8)
+        || header.num_bodies > header.field_stride / header.value_size
+        || header.field_stride > (UINT64_MAX - FRAME_HEADER_SIZE) / std::max<uint64_t>(num_fields, 1)
+        || header.frame_size != FRAME_HEADER_SIZE + num_fields * header.field_stride) {
+        munmap(const_cast<char *>(base), mapped_size);
+        throw std::runtime_error("'" + path + "' has a trajectory header with inconsistent sizes");
+    }
+
+    // clean close: trust the trailer, otherwise count whole frames
+    const std::size_t body_bytes = mapped_size - sizeof(TrajectoryHeader);
+    if (mapped_size >= sizeof(TrajectoryHeader) + sizeof(Trailer)) {
+        Trailer trailer;
+        std::memcpy(&trailer, base + mapped_size - sizeof(Trailer), sizeof(trailer));
+        const uint64_t index_bytes = trailer.num_frames * FRAME_HEADER_SIZE;
+        if (std::memcmp(trailer.magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) == 0
+            && trailer.num_frames <= body_bytes / header.frame_size
+            && trailer.index_offset == sizeof(TrajectoryHeader) + trailer.num_frames * header.frame_size
+            && trailer.index_offset + index_bytes + sizeof(Trailer) == mapped_size) {
+            indexed = true;
+            num_frames = static_cast<std::size_t>(trailer.num_frames);
+            index_base = base + trailer.index_offset;
+        }
+    }
+    if (!indexed) {
+        num_frames = body_bytes / header.frame_size;
+    }
+    // the kernel reads ahead for us on sequential frame scans
+    madvise(const_cast<char *>(base), mapped_size, MADV_SEQUENTIAL);
+}
+
+TrajectoryReader::~TrajectoryReader() {
+    munmap(const_cast<char *>(base), mapped_size);
+}
+
+const char * TrajectoryReader::frame_ptr(std::size_t frame) const {
+    if (frame >= num_frames) {
+        throw std::out_of_range("trajectory frame out of range");
+    }
+    return base + sizeof(TrajectoryHeader) + frame * header.frame_size;
+}
+
+std::size_t TrajectoryReader::field_offset(TrajectoryField field) const {
+    if (!has_field(field)) {
+        throw std::invalid_argument(std::string("field '") + trajectory_field_name(field) + "' is not in this trajectory");
+    }
+    // blocks are stored in flag order, count the stored fields below this one
+    std::size_t before = __builtin_popcount(header.fields & (static_cast<unsigned>(field) - 1));
+    return FRAME_HEADER_SIZE + before * header.field_stride;
+}
+
+long long TrajectoryReader::get_step(std::size_t frame) const {
+    int64_t step;
+    std::memcpy(&step, frame_ptr(frame), sizeof(step));
+    return step;
+}
+
+double TrajectoryReader::get_time(std::size_t frame) const {
+    double time;
+    std::memcpy(&time, frame_ptr(frame) + 8, sizeof(time));
+    return time;
+}
+
+const int64_t * TrajectoryReader::steps_data() const {
+    const char * first = indexed ? index_base : base + sizeof(TrajectoryHeader);
+    return reinterpret_cast<const int64_t *>(first);
+}
+
+const double * TrajectoryReader::times_data() const {
+    const char * first = indexed ? index_base : base + sizeof(TrajectoryHeader);
+    return reinterpret_cast<const double *>(first + 8);
+}
+
+std::size_t TrajectoryReader::get_index_stride() const {
+    return indexed ? FRAME_HEADER_SIZE : get_frame_size();
+}
+
+const void * TrajectoryReader::field_data(std::size_t frame, TrajectoryField field) const {
+    return frame_ptr(frame) + field_offset(field);
+}
+
+const void * TrajectoryReader::series_data(TrajectoryField field, std::size_t body) const {
+    if (body >= header.num_bodies) {
+        throw std::out_of_range("trajectory body out of range");
+    }
+    return base + sizeof(TrajectoryHeader) + field_offset(field) + body * header.value_size;
+}
+
+double TrajectoryReader::value(std::size_t frame, TrajectoryField field, std::size_t body) const {
+    if (body >= header.num_bodies) {
+        throw std::out_of_range("trajectory body out of range");
+    }
+    const char * data = static_cast<const char *>(field_data(frame, field));
+    if (is_float32()) {
+        return reinterpret_cast<const float *>(data)[body];
+    }
+    return reinterpret_cast<const double *>(data)[body];
+}
@@ -0,0 +1,167 @@
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+#include "../particles/particles.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// binary trajectory files
+//
+// [64 byte header][frame 0][frame 1]...[index][trailer]
+//
+// every frame has the same size: step (int64), time (double), then one block
+// per stored field holding that field for every body (float or double, block
+// padded to 8 bytes). so frame k sits at 64 + k * frame_size and body i of a
+// field is a fixed stride apart from one frame to the next, which is what
+// lets the reader hand out time series without copying. the index (step and
+// time of every frame) and trailer are written on close, a file from a run
+// that died still reads fine, the reader just counts whole frames instead
+
+// fields that can be stored, or them together for the field mask
+enum TrajectoryField {
+    TRAJ_X = 1,
+    TRAJ_Y = 2,
+    TRAJ_V_X = 4,
+    TRAJ_V_Y = 8,
+    TRAJ_A_X = 16,
+    TRAJ_A_Y = 32,
+    TRAJ_MASS = 64
+};
+const int TRAJ_NUM_FIELDS = 7;
+
+const char * trajectory_field_name(TrajectoryField field);
+// "x", "v_y", ... back to the flag, throws std::invalid_argument on anything else
+TrajectoryField trajectory_field_from_name(const std::string & name);
+
+// fixed layout, written as is (little endian, like every machine we run on)
+struct TrajectoryHeader {
+    char magic[8]; // "NBTRAJ1"
+    uint32_t version;
+    uint32_t fields; // TrajectoryField mask
+    uint32_t value_size; // 8 = double, 4 = float
+    uint32_t every; // steps between frames
+    uint64_t num_bodies;
+    uint64_t frame_size; // bytes per frame, header included
+    uint64_t field_stride; // bytes per field block
+    uint8_t reserved[16];
+};
+
+// appends frames from the integrator thread, a background thread does the
+// actual writes so the integrator only copies into a chunk buffer. it only
+// waits if the disk falls behind by more than a few chunks (get_stalls counts it)
+class TrajectoryWriter {
+    public:
+        TrajectoryWriter(const std::string & path, std::size_t num_bodies, unsigned fields = TRAJ_X | TRAJ_Y,
+                         long long every = 1, bool float32 = false);
+        ~TrajectoryWriter();
+        TrajectoryWriter(const TrajectoryWriter &) = delete;
+        TrajectoryWriter & operator=(const TrajectoryWriter &) = delete;
+
+        void append(long long step, double time, const Particles & particles);
+        // drains the queue, writes the index and closes the file, throws if a write failed
+        void close();
+
+        long long get_every() const {
+            return every;
+        }
+        long long get_frames_written() const {
+            return static_cast<long long>(index.size());
+        }
+        long long get_stalls() const {
+            return stalls;
+        }
+
+    private:
+        struct IndexEntry {
+            int64_t step;
+            double time;
+        };
+
+        FILE * file;
+        TrajectoryHeader header;
+        long long every;
+        std::vector<IndexEntry> index;
+        long long stalls;
+
+        std::vector<char> chunk; // being filled by append
+        std::size_t frames_per_chunk;
+        std::deque<std::vector<char>> queue; // full chunks for the writer thread
+        std::vector<std::vector<char>> spare; // written chunks, reused
+        std::mutex queue_mutex;
+        std::condition_variable queue_changed;
+        bool closing;
+        bool write_failed;
+        std::thread writer;
+
+        void flush_chunk();
+        void writer_loop();
+};
+
+// memory maps a trajectory file, every accessor points into the mapping
+class TrajectoryReader {
+    public:
+        // throws std::runtime_error if the file is not a trajectory or its
+        // header sizes do not fit together
+        explicit TrajectoryReader(const std::string & path);
+        ~TrajectoryReader();
+        TrajectoryReader(const TrajectoryReader &) = delete;
+        TrajectoryReader & operator=(const TrajectoryReader &) = delete;
+
+        std::size_t get_num_frames() const {
+            return num_frames;
+        }
+        std::size_t get_num_bodies() const {
+            return static_cast<std::size_t>(header.num_bodies);
+        }
+        unsigned get_fields() const {
+            return header.fields;
+        }
+        bool has_field(TrajectoryField field) const {
+            return (header.fields & field) != 0;
+        }
+        bool is_float32() const {
+            return header.value_size == 4;
+        }
+        long long get_every() const {
+            return header.every;
+        }
+        // false if the file was not closed cleanly and frames were counted instead
+        bool has_index() const {
+            return indexed;
+        }
+        std::size_t get_frame_size() const {
+            return static_cast<std::size_t>(header.frame_size);
+        }
+
+        long long get_step(std::size_t frame) const;
+        double get_time(std::size_t frame) const;
+        // step and time of frame 0, the next frame is get_index_stride bytes further
+        const int64_t * steps_data() const;
+        const double * times_data() const;
+        std::size_t get_index_stride() const;
+
+        // num_bodies values (float or double) of one field in one frame
+        const void * field_data(std::size_t frame, TrajectoryField field) const;
+        // one body's value in frame 0, the next frame is get_frame_size bytes further
+        const void * series_data(TrajectoryField field, std::size_t body) const;
+        double value(std::size_t frame, TrajectoryField field, std::size_t body) const;
+
+    private:
+        const char * base;
+        std::size_t mapped_size;
+        TrajectoryHeader header;
+        std::size_t num_frames;
+        bool indexed;
+        const char * index_base;
+
+        const char * frame_ptr(std::size_t frame) const;
+        std::size_t field_offset(TrajectoryField field) const;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "adaptive.hpp"
+#include <cmath>
+
+double total_energy(const Particles & particles) {
+    const std::size_t n = particles.size();
+    const double * x = particles.x.data();
+    const double * y = particles.y.data();
+    const double * mass = particles.mass.data();
+    double kinetic = 0.0;
+    double potential = 0.0;
+
+    // rows get shorter further down, dynamic keeps the threads even
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:kinetic, potential)
+    for (std::size_t i = 0; i < n; ++i) {
+        kinetic += 0.5 * mass[i] * (particles.v_x[i] * particles.v_x[i] + particles.v_y[i] * particles.v_y[i]);
+        double row = 0.0;
+        #pragma omp simd reduction(+:row)
+        for (std::size_t j = i + 1; j < n; ++j) {
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            row += mass[j] / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+        }
+        potential -= G_CONST * mass[i] * row;
+    }
+    return kinetic + potential;
+}
+
+double acceleration_time_step(const Particles & particles, double eta, double length) {
+    const std::size_t n = particles.size();
+    // largest |a|^2 gives the smallest step, one sqrt at the end
+    double max_a_sq = 0.0;
+    #pragma omp parallel for reduction(max:max_a_sq)
+    for (std::size_t i = 0; i < n; ++i) {
+        double a_sq = particles.a_x[i] * particles.a_x[i] + particles.a_y[i] * particles.a_y[i];
+        max_a_sq = a_sq > max_a_sq ? a_sq : max_a_sq;
+    }
+    if (max_a_sq <= 0.0) {
+        return HUGE_VAL;
+    }
+    return eta * std::sqrt(length / std::sqrt(max_a_sq));
+}
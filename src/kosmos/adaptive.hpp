@@ -0,0 +1,57 @@
+#ifndef ADAPTIVE_HPP
+#define ADAPTIVE_HPP
+#include "../particles/particles.hpp"
+#include "../constants.h"
+#include <limits>
+#include <vector>
+
+// settings for Kosmos::advance, which picks its own global time step.
+// two criteria, either can be switched off (not both):
+//   eta > 0: dt = eta * min_i sqrt(length / |a_i|), the time a body needs to
+//            fall `length` from rest, so the fastest accelerating body sets it
+//   energy_tolerance > 0: a step whose relative energy change is above the
+//            tolerance is undone and retried with a smaller dt, quiet steps
+//            let the next one grow (at most 2x). the potential comes out of
+//            the force pass, so checking costs one O(N) sweep per step
+struct AdaptiveOptions {
+    double eta;
+    double length; // meters, defaults to the softening length
+    double energy_tolerance; // relative |dE / E| per step, 0 = no energy check
+    double min_dt; // never below this (a step at min_dt is kept even if it fails)
+    double max_dt;
+    double initial_dt; // first try, 0 = from the eta criterion
+
+    AdaptiveOptions()
+        : eta(0.02), length(SOFTENING_LENGTH), energy_tolerance(0.0), min_dt(0.0),
+          max_dt(std::numeric_limits<double>::infinity()), initial_dt(0.0) {}
+};
+
+// a step advance threw away
+struct RejectedStep {
+    double time; // simulated time the step started from
+    double time_delta;
+    double energy_error; // the relative energy change that got it rejected
+};
+
+// what advance did, one entry per accepted step
+struct AdaptiveReport {
+    std::vector<double> dt_history;
+    std::vector<double> energy_errors; // relative energy change of each step, 0 without the energy check
+    std::vector<RejectedStep> rejected;
+    bool finished; // reached end_time (false if cancelled)
+
+    AdaptiveReport() : finished(false) {}
+    long long get_steps() const {
+        return static_cast<long long>(dt_history.size());
+    }
+};
+
+// softened kinetic + potential energy of the whole system, the exact all pairs
+// sum with the same softening as the force kernels
+double total_energy(const Particles & particles);
+
+// eta * min_i sqrt(length / |a_i|) over the accelerations in particles,
+// infinity if nothing accelerates
+double acceleration_time_step(const Particles & particles, double eta, double length);
+
+#endif
@@ -0,0 +1,87 @@
+#include "block_timestep.hpp"
+#include <cmath>
+#include <stdexcept>
+
+void BlockTimesteps::set_max_level(int max_level) {
+    if (max_level < 0 || max_level > 20) {
+        throw std::invalid_argument("max_level must be between 0 and 20");
+    }
+    this->max_level = max_level;
+}
+
+void BlockTimesteps::set_eta(double eta) {
+    if (!(eta > 0.0)) {
+        throw std::invalid_argument("eta must be > 0");
+    }
+    this->eta = eta;
+}
+
+void BlockTimesteps::permute(const std::vector<uint32_t> & order) {
+    AlignedArray * arrays[] = {&open_a_x, &open_a_y, &jerk_sq};
+    for (AlignedArray * array : arrays) {
+        if (array->size() != order.size()) {
+            continue;
+        }
+        AlignedArray moved(order.size());
+        for (std::size_t k = 0; k < order.size(); ++k) {
+            moved[k] = (*array)[order[k]];
+        }
+        array->swap(moved);
+    }
+}
+
+void BlockTimesteps::assign_levels(const Particles & particles, double time_delta) {
+    const std::size_t n = particles.size();
+    const bool have_jerk = jerk_sq.size() == n;
+    levels.resize(n);
+    open_a_x.resize(n);
+    open_a_y.resize(n);
+
+    #pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < n; ++i) {
+        // no history yet (first step, new bodies, after a load): start everyone
+        // on the finest level, the jerk measured there sizes the next step
+        int level = max_level;
+        if (have_jerk) {
+            const double a_sq = particles.a_x[i] * particles.a_x[i] + particles.a_y[i] * particles.a_y[i];
+            // time scale on which the acceleration changes, in seconds
+            const double wanted = jerk_sq[i] > 0.0 ? eta * std::sqrt(a_sq / jerk_sq[i]) : HUGE_VAL;
+            double dt = time_delta;
+            level = 0;
+            while (level < max_level && dt > wanted) {
+                dt *= 0.5;
+                ++level;
+            }
+        }
+        levels[i] = level;
+        open_a_x[i] = particles.a_x[i];
+        open_a_y[i] = particles.a_y[i];
+    }
+    if (!have_jerk) {
+        jerk_sq.assign(n, 0.0);
+    }
+
+    // counting sort by level, finest first, so each sub step's active set is a prefix
+    level_counts.assign(max_level + 1, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+        ++level_counts[levels[i]];
+    }
+    at_or_above.assign(max_level + 2, 0);
+    for (int l = max_level; l >= 0; --l) {
+        at_or_above[l] = at_or_above[l + 1] + level_counts[l];
+    }
+    std::vector<std::size_t> next(max_level + 1);
+    for (int l = 0; l <= max_level; ++l) {
+        next[l] = at_or_above[l + 1];
+    }
+    order.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        order[next[levels[i]]++] = static_cast<uint32_t>(i);
+    }
+}
+
+const uint32_t * BlockTimesteps::active(long long substep, std::size_t & count) const {
+    const int lowest = max_level - __builtin_ctzll(static_cast<unsigned long long>(substep + 1));
+    count = at_or_above[lowest < 0 ? 0 : lowest];
+    return order.data();
+}
@@ -0,0 +1,66 @@
+#ifndef BLOCK_TIMESTEP_HPP
+#define BLOCK_TIMESTEP_HPP
+#include "../particles/particles.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// power of two block time steps: body i moves with dt_i = time_delta / 2^level_i
+// inside one step of Kosmos. levels are picked once per step from how fast the
+// acceleration turns over, |a| / |da/dt| (the jerk comes from the change of a
+// over the body's last step). bodies with no jerk yet take the finest level
+class BlockTimesteps {
+    public:
+        BlockTimesteps() : max_level(0), eta(0.02) {}
+
+        // 0 turns block steps off, every body takes the full step
+        int get_max_level() const {
+            return max_level;
+        }
+        void set_max_level(int max_level); // 0 to 20, throws std::invalid_argument
+        double get_eta() const {
+            return eta;
+        }
+        void set_eta(double eta); // > 0, smaller is more accurate
+
+        // picks the levels for the next step and sorts the bodies finest first
+        void assign_levels(const Particles & particles, double time_delta);
+        int level(std::size_t i) const {
+            return levels[i];
+        }
+        // bodies whose step ends after sub step s (of 2^max_level): every body
+        // at or above level max_level - trailing zeros of (s + 1), a prefix of the order
+        const uint32_t * active(long long substep, std::size_t & count) const;
+
+        // a body finished a step of length dt and has its new acceleration
+        void close_step(std::size_t i, double a_x, double a_y, double dt) {
+            double dj_x = a_x - open_a_x[i];
+            double dj_y = a_y - open_a_y[i];
+            jerk_sq[i] = (dj_x * dj_x + dj_y * dj_y) / (dt * dt);
+            open_a_x[i] = a_x;
+            open_a_y[i] = a_y;
+        }
+        // forget the jerk history (bodies added, state replaced)
+        void reset() {
+            jerk_sq.clear();
+        }
+        // the bodies were reordered, slot k now holds what was at order[k]
+        void permute(const std::vector<uint32_t> & order);
+
+        // how many bodies sat on each level during the last step
+        const std::vector<long long> & get_level_counts() const {
+            return level_counts;
+        }
+
+    private:
+        int max_level;
+        double eta;
+        std::vector<int> levels;
+        std::vector<uint32_t> order; // bodies sorted by level, finest first
+        std::vector<std::size_t> at_or_above; // bodies with level >= l, index l
+        std::vector<long long> level_counts;
+        AlignedArray open_a_x, open_a_y; // acceleration at the start of each body's step
+        AlignedArray jerk_sq; // |da/dt|^2 over the body's last step, empty before the first
+};
+
+#endif
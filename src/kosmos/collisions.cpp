@@ -0,0 +1,347 @@
+#include "collisions.hpp"
+#include "../forces/morton.hpp"
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+const char * collision_mode_name(CollisionMode mode) {
+    switch (mode) {
+        case CollisionMode::Merge:
+            return "merge";
+        case CollisionMode::Bounce:
+            return "bounce";
+        default:
+            return "off";
+    }
+}
+
+std::vector<CollisionEvent> CollisionLog::events() const {
+    // once the ring is full next points at the oldest
+    std::vector<CollisionEvent> ordered;
+    ordered.reserve(ring.size());
+    const std::size_t oldest = ring.size() < capacity ? 0 : next;
+    for (std::size_t k = 0; k < ring.size(); ++k) {
+        ordered.push_back(ring[(oldest + k) % ring.size()]);
+    }
+    return ordered;
+}
+
+void CollisionLog::set_capacity(std::size_t capacity) {
+    this->capacity = capacity;
+    ring.clear();
+    ring.shrink_to_fit();
+    next = 0;
+}
+
+void CollisionLog::clear() {
+    ring.clear();
+    next = 0;
+    total = 0;
+}
+
+namespace {
+
+// grid coordinate of a position, clamped so far away bodies stay in range
+int64_t cell_of(double position, double cell) {
+    const double c = std::floor(position / cell);
+    return static_cast<int64_t>(std::max(-4.0e18, std::min(c, 4.0e18)));
+}
+
+} // namespace
+
+void SpatialHash::overlapping_pairs(const Particles & particles, std::vector<std::pair<uint32_t, uint32_t>> & pairs) {
+    pairs.clear();
+    const std::size_t n = particles.size();
+    const double * x = particles.x.data();
+    const double * y = particles.y.data();
+    const double * r = particles.radius.data();
+
+    double r_max = 0.0;
+    #pragma omp parallel for schedule(static) reduction(max : r_max)
+    for (std::size_t i = 0; i < n; ++i) {
+        if (r[i] > r_max) {
+            r_max = r[i];
+        }
+    }
+    if (n < 2 || !(r_max > 0.0)) {
+        cell = 0.0;
+        return;
+    }
+    // touching means d < r_i + r_j <= 2 r_max, so never more than one cell apart
+    cell = 2.0 * r_max;
+
+    std::size_t buckets = 1;
+    while (buckets < 2 * n) {
+        buckets *= 2;
+    }
+    mask = buckets - 1;
+    keys.resize(n);
+    order.resize(n);
+    cell_x.resize(n);
+    cell_y.resize(n);
+    bucket_begin.resize(buckets);
+    bucket_end.resize(buckets);
+
+    #pragma omp parallel
+    {
+        #pragma omp for schedule(static) nowait
+        for (std::size_t i = 0; i < n; ++i) {
+            cell_x[i] = cell_of(x[i], cell);
+            cell_y[i] = cell_of(y[i], cell);
+            keys[i] = bucket(cell_x[i], cell_y[i]);
+            order[i] = static_cast<uint32_t>(i);
+        }
+        #pragma omp for schedule(static)
+        for (std::size_t b = 0; b < buckets; ++b) {
+            bucket_begin[b] = 0;
+            bucket_end[b] = 0;
+        }
+    }
+    radix_sort(keys, order);
+
+    // every run of equal keys is one bucket
+    #pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < n; ++k) {
+        if (k == 0 || keys[k] != keys[k - 1]) {
+            bucket_begin[keys[k]] = static_cast<uint32_t>(k);
+        }
+        if (k + 1 == n || keys[k] != keys[k + 1]) {
+            bucket_end[keys[k]] = static_cast<uint32_t>(k + 1);
+        }
+    }
+
+    // each pair is found once, by its lower index. other cells can share a
+    // bucket, so a partner has to be in the very cell being looked at. the
+    // bodies are walked in bucket order with their data gathered alongside,
+    // neighbours in the walk look up the same buckets while they are cached
+    sorted_x.resize(n);
+    sorted_y.resize(n);
+    sorted_r.resize(n);
+    sorted_cell_x.resize(n);
+    sorted_cell_y.resize(n);
+    #pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < n; ++k) {
+        const uint32_t i = order[k];
+        sorted_x[k] = x[i];
+        sorted_y[k] = y[i];
+        sorted_r[k] = r[i];
+        sorted_cell_x[k] = cell_x[i];
+        sorted_cell_y[k] = cell_y[i];
+    }
+    found.resize(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> & mine = found[omp_get_thread_num()];
+        mine.clear();
+        #pragma omp for schedule(dynamic, 1024)
+        for (std::size_t k = 0; k < n; ++k) {
+            const uint32_t i = order[k];
+            for (int64_t dy = -1; dy <= 1; ++dy) {
+                for (int64_t dx = -1; dx <= 1; ++dx) {
+                    const int64_t nx = sorted_cell_x[k] + dx;
+                    const int64_t ny = sorted_cell_y[k] + dy;
+                    const uint64_t b = bucket(nx, ny);
+                    for (uint32_t m = bucket_begin[b]; m < bucket_end[b]; ++m) {
+                        const uint32_t j = order[m];
+                        if (j <= i || sorted_cell_x[m] != nx || sorted_cell_y[m] != ny) {
+                            continue;
+                        }
+                        const double reach = sorted_r[k] + sorted_r[m];
+                        const double sx = sorted_x[m] - sorted_x[k];
+                        const double sy = sorted_y[m] - sorted_y[k];
+                        if (sx * sx + sy * sy < reach * reach) {
+                            mine.push_back(std::make_pair(i, j));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    for (const std::vector<std::pair<uint32_t, uint32_t>> & list : found) {
+        pairs.insert(pairs.end(), list.begin(), list.end());
+    }
+    // the threads' chunks interleave, sorting makes the result independent of them
+    std::sort(pairs.begin(), pairs.end());
+}
+
+void Collisions::set_restitution(double restitution) {
+    if (!(restitution >= 0.0 && restitution <= 1.0)) {
+        throw std::invalid_argument("restitution must be between 0 and 1");
+    }
+    this->restitution = restitution;
+}
+
+std::size_t Collisions::resolve(Particles & particles, std::vector<uint32_t> & ids, long long step, double time) {
+    last_count = 0;
+    last_merged = 0;
+    last_pushed = 0;
+    if (mode == CollisionMode::Off) {
+        return 0;
+    }
+    grid.overlapping_pairs(particles, pairs);
+    if (pairs.empty()) {
+        return 0;
+    }
+    if (mode == CollisionMode::Merge) {
+        merge(particles, ids, step, time);
+    } else {
+        bounce(particles, ids, step, time);
+    }
+    return last_count;
+}
+
+uint32_t Collisions::find(uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void Collisions::merge(Particles & particles, std::vector<uint32_t> & ids, long long step, double time) {
+    const std::size_t n = particles.size();
+    double * x = particles.x.data();
+    double * y = particles.y.data();
+    double * v_x = particles.v_x.data();
+    double * v_y = particles.v_y.data();
+    double * mass = particles.mass.data();
+    double * radius = particles.radius.data();
+
+    // touching groups, the root of each is its heaviest body (ties: lowest index)
+    parent.resize(n);
+    for (const std::pair<uint32_t, uint32_t> & pair : pairs) {
+        parent[pair.first] = pair.first;
+        parent[pair.second] = pair.second;
+    }
+    for (const std::pair<uint32_t, uint32_t> & pair : pairs) {
+        const uint32_t a = find(pair.first);
+        const uint32_t b = find(pair.second);
+        if (a == b) {
+            continue;
+        }
+        const bool a_wins = mass[a] > mass[b] || (mass[a] == mass[b] && a < b);
+        if (a_wins) {
+            parent[b] = a;
+        } else {
+            parent[a] = b;
+        }
+    }
+
+    // fold every other member into its root one at a time, mass weighted
+    // means chain, so the result is the centre of mass and total momentum
+    absorbed.assign(n, 0);
+    std::size_t first_gone = n;
+    for (const std::pair<uint32_t, uint32_t> & pair : pairs) {
+        const uint32_t ends[2] = {pair.first, pair.second};
+        for (uint32_t k : ends) {
+            const uint32_t root = find(k);
+            if (k == root || absorbed[k]) {
+                continue;
+            }
+            const double total = mass[root] + mass[k];
+            const double w_root = total > 0.0 ? mass[root] / total : 0.5;
+            const double w_k = total > 0.0 ? mass[k] / total : 0.5;
+            const double sx = x[k] - x[root];
+            const double sy = y[k] - y[root];
+            const double d = std::sqrt(sx * sx + sy * sy);
+            CollisionEvent event;
+            event.step = step;
+            event.time = time;
+            event.first = ids[root];
+            event.second = ids[k];
+            event.kind = CollisionMode::Merge;
+            event.x = w_root * x[root] + w_k * x[k];
+            event.y = w_root * y[root] + w_k * y[k];
+            event.relative_speed = d > 0.0 ? ((v_x[root] - v_x[k]) * sx + (v_y[root] - v_y[k]) * sy) / d : 0.0;
+            log.record(event);
+
+            x[root] = event.x;
+            y[root] = event.y;
+            v_x[root] = w_root * v_x[root] + w_k * v_x[k];
+            v_y[root] = w_root * v_y[root] + w_k * v_y[k];
+            mass[root] = total;
+            radius[root] = std::cbrt(radius[root] * radius[root] * radius[root] + radius[k] * radius[k] * radius[k]);
+            absorbed[k] = 1;
+            first_gone = std::min<std::size_t>(first_gone, k);
+            ++last_count;
+        }
+    }
+
+    // close the gaps, the survivors keep their order and the arrays their memory
+    AlignedArray * arrays[] = {&particles.x, &particles.y, &particles.v_x, &particles.v_y,
+                               &particles.a_x, &particles.a_y, &particles.mass, &particles.radius};
+    std::size_t kept = first_gone;
+    for (std::size_t i = first_gone; i < n; ++i) {
+        if (absorbed[i]) {
+            continue;
+        }
+        for (AlignedArray * array : arrays) {
+            (*array)[kept] = (*array)[i];
+        }
+        ids[kept] = ids[i];
+        ++kept;
+    }
+    particles.resize(kept);
+    ids.resize(kept);
+    last_merged = n - kept;
+}
+
+void Collisions::bounce(Particles & particles, const std::vector<uint32_t> & ids, long long step, double time) {
+    double * x = particles.x.data();
+    double * y = particles.y.data();
+    double * v_x = particles.v_x.data();
+    double * v_y = particles.v_y.data();
+    const double * mass = particles.mass.data();
+    const double * radius = particles.radius.data();
+
+    // pair after pair in index order, a body in several contacts sees the
+    // earlier bounces. a pair an earlier push already separated is skipped
+    for (const std::pair<uint32_t, uint32_t> & pair : pairs) {
+        const uint32_t i = pair.first;
+        const uint32_t j = pair.second;
+        const double sx = x[j] - x[i];
+        const double sy = y[j] - y[i];
+        const double d = std::sqrt(sx * sx + sy * sy);
+        const double reach = radius[i] + radius[j];
+        if (!(d < reach)) {
+            continue;
+        }
+        // unit normal from i to j, any direction for two bodies on one spot
+        const double n_x = d > 0.0 ? sx / d : 1.0;
+        const double n_y = d > 0.0 ? sy / d : 0.0;
+        const double total = mass[i] + mass[j];
+        const double w_i = total > 0.0 ? mass[j] / total : 0.5;
+        const double w_j = total > 0.0 ? mass[i] / total : 0.5;
+        const double closing = (v_x[i] - v_x[j]) * n_x + (v_y[i] - v_y[j]) * n_y;
+
+        // only an approaching pair bounces and counts, one that is already
+        // moving apart (created overlapping, say) is just pushed out
+        if (closing > 0.0) {
+            CollisionEvent event;
+            event.step = step;
+            event.time = time;
+            event.first = ids[i];
+            event.second = ids[j];
+            event.kind = CollisionMode::Bounce;
+            event.x = w_j * x[i] + w_i * x[j];
+            event.y = w_j * y[i] + w_i * y[j];
+            event.relative_speed = closing;
+            log.record(event);
+            ++last_count;
+
+            const double dv = (1.0 + restitution) * closing;
+            v_x[i] -= dv * w_i * n_x;
+            v_y[i] -= dv * w_i * n_y;
+            v_x[j] += dv * w_j * n_x;
+            v_y[j] += dv * w_j * n_y;
+        }
+        // back to touching, the centre of mass stays put
+        ++last_pushed;
+        const double overlap = reach - d;
+        x[i] -= overlap * w_i * n_x;
+        y[i] -= overlap * w_i * n_y;
+        x[j] += overlap * w_j * n_x;
+        y[j] += overlap * w_j * n_y;
+    }
+}
@@ -0,0 +1,174 @@
+#ifndef COLLISIONS_HPP
+#define COLLISIONS_HPP
+#include "../particles/particles.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// what happens when two bodies touch, their distance below the sum of their radii
+enum class CollisionMode {
+    Off, // bodies pass through each other, only the softening keeps the force finite
+    Merge, // touching bodies become one: mass and momentum add up, so do the volumes (r^3)
+    Bounce // an approaching pair bounces along the line of centres, overlaps are pushed apart
+};
+
+const char * collision_mode_name(CollisionMode mode);
+
+// one resolved collision between two bodies, named by their ids (see
+// Kosmos::get_ids), which neither merges nor reordering change
+struct CollisionEvent {
+    long long step;
+    double time;
+    uint32_t first; // merge: the body that kept the merged state (the heaviest of its group)
+    uint32_t second; // merge: the body that was absorbed into first
+    CollisionMode kind;
+    double x, y; // centre of mass of the pair at contact
+    double relative_speed; // closing speed along the line of centres before, m/s
+};
+
+// the newest events in a fixed size ring, recording one is a copy into the
+// next slot once the ring has grown to capacity. older ones are overwritten
+// and only counted
+class CollisionLog {
+    std::vector<CollisionEvent> ring;
+    std::size_t capacity;
+    std::size_t next; // slot the next event goes to
+    long long total;
+
+    public:
+        explicit CollisionLog(std::size_t capacity = 4096) : capacity(capacity), next(0), total(0) {}
+
+        void record(const CollisionEvent & event) {
+            ++total;
+            if (capacity == 0) {
+                return;
+            }
+            if (ring.size() < capacity) {
+                ring.push_back(event);
+            } else {
+                ring[next] = event;
+            }
+            next = (next + 1) % capacity;
+        }
+        // oldest first
+        std::vector<CollisionEvent> events() const;
+        long long get_total() const {
+            return total;
+        }
+        // events recorded but no longer in the ring
+        long long get_dropped() const {
+            return total - static_cast<long long>(ring.size());
+        }
+        std::size_t get_capacity() const {
+            return capacity;
+        }
+        void set_capacity(std::size_t capacity); // drops the events kept so far
+        void clear();
+};
+
+// broad phase: a uniform grid with cells twice the largest radius, so two
+// touching bodies always sit in the same or neighbouring cells. the cells are
+// hashed into a table of about 2n buckets and the bodies sorted by bucket
+// (radix_sort), then every body looks through the 9 cells around it. the
+// rebuild is O(n) and runs in parallel, the arrays are kept between calls
+class SpatialHash {
+    std::vector<uint64_t> keys; // bucket of every body, sorted with order
+    std::vector<uint32_t> order; // body indices grouped by bucket
+    std::vector<uint32_t> bucket_begin, bucket_end; // range in order of every bucket
+    std::vector<int64_t> cell_x, cell_y; // grid cell of every body
+    std::vector<int64_t> sorted_cell_x, sorted_cell_y; // the same in bucket order
+    std::vector<double> sorted_x, sorted_y, sorted_r;
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> found; // per thread pairs
+    uint64_t mask; // bucket count - 1, a power of two
+    double cell;
+
+    public:
+        SpatialHash() : mask(0), cell(0.0) {}
+
+        // every pair i < j with d < r_i + r_j, sorted
+        void overlapping_pairs(const Particles & particles, std::vector<std::pair<uint32_t, uint32_t>> & pairs);
+        double get_cell_size() const {
+            return cell;
+        }
+
+    private:
+        // z-order of the low bits of the cell coordinates: neighbouring cells
+        // land in nearby buckets, cells a whole table span apart share one
+        uint64_t bucket(int64_t x, int64_t y) const {
+            return (spread(static_cast<uint32_t>(x)) | spread(static_cast<uint32_t>(y)) << 1) & mask;
+        }
+        static uint64_t spread(uint32_t v) {
+            uint64_t b = v;
+            b = (b | (b << 16)) & 0x0000FFFF0000FFFFull;
+            b = (b | (b << 8)) & 0x00FF00FF00FF00FFull;
+            b = (b | (b << 4)) & 0x0F0F0F0F0F0F0F0Full;
+            b = (b | (b << 2)) & 0x3333333333333333ull;
+            b = (b | (b << 1)) & 0x5555555555555555ull;
+            return b;
+        }
+};
+
+// checks the bodies for contacts after a step and merges or bounces them.
+// bodies with radius 0 are points, two of them never touch
+class Collisions {
+    CollisionMode mode;
+    double restitution;
+    SpatialHash grid;
+    CollisionLog log;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    std::vector<uint32_t> parent; // union find over the bodies of merging pairs
+    std::vector<unsigned char> absorbed;
+    std::size_t last_count; // collisions in the last resolve
+    std::size_t last_merged; // bodies removed by the last resolve
+    std::size_t last_pushed; // overlapping pairs the last resolve pushed apart, bounced or not
+
+    public:
+        Collisions() : mode(CollisionMode::Off), restitution(1.0), last_count(0), last_merged(0),
+                       last_pushed(0) {}
+
+        CollisionMode get_mode() const {
+            return mode;
+        }
+        void set_mode(CollisionMode mode) {
+            this->mode = mode;
+        }
+        // share of the closing speed a bounce gives back, 1 = elastic, 0 = the
+        // pair ends up moving together. throws std::invalid_argument outside [0, 1]
+        double get_restitution() const {
+            return restitution;
+        }
+        void set_restitution(double restitution);
+
+        // finds and resolves every contact, returns how many collisions there
+        // were (bounces count only pairs that were approaching). ids[i] is the
+        // id of body i, the events carry those. a merge keeps the heaviest body
+        // of each touching group (ties: the lowest index) and compacts the
+        // arrays and ids in place, order kept, capacity untouched
+        std::size_t resolve(Particles & particles, std::vector<uint32_t> & ids, long long step, double time);
+        std::size_t get_last_count() const {
+            return last_count;
+        }
+        std::size_t get_last_merged() const {
+            return last_merged;
+        }
+        // the last resolve moved or changed bodies. a pair that was already
+        // separating is pushed out of overlap without counting as a collision
+        bool get_last_changed() const {
+            return last_count > 0 || last_pushed > 0;
+        }
+
+        const CollisionLog & get_log() const {
+            return log;
+        }
+        CollisionLog & get_log() {
+            return log;
+        }
+
+    private:
+        void merge(Particles & particles, std::vector<uint32_t> & ids, long long step, double time);
+        void bounce(Particles & particles, const std::vector<uint32_t> & ids, long long step, double time);
+        uint32_t find(uint32_t i);
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "diagnostics.hpp"
+
+void measure_kinematics(const Particles & particles, Diagnostics & diagnostics) {
+    const std::size_t n = particles.size();
+    double kinetic = 0.0, momentum_x = 0.0, momentum_y = 0.0, angular = 0.0;
+    #pragma omp parallel for reduction(+:kinetic, momentum_x, momentum_y, angular)
+    for (std::size_t i = 0; i < n; ++i) {
+        const double m = particles.mass[i];
+        const double v_x = particles.v_x[i];
+        const double v_y = particles.v_y[i];
+        kinetic += 0.5 * m * (v_x * v_x + v_y * v_y);
+        momentum_x += m * v_x;
+        momentum_y += m * v_y;
+        angular += m * (particles.x[i] * v_y - particles.y[i] * v_x);
+    }
+    diagnostics.kinetic = kinetic;
+    diagnostics.momentum_x = momentum_x;
+    diagnostics.momentum_y = momentum_y;
+    diagnostics.angular_momentum = angular;
+}
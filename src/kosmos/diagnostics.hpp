@@ -0,0 +1,25 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+#include "../particles/particles.hpp"
+
+// conserved quantities of the whole system at one moment. the potential comes
+// out of the force pass (same softening, same solver, so with barnes hut or
+// fmm it carries their error too), the rest from one O(N) sweep
+struct Diagnostics {
+    long long step;
+    double time;
+    double kinetic; // J
+    double potential; // J, softened, every pair once
+    double momentum_x, momentum_y; // kg m / s
+    double angular_momentum; // kg m^2 / s about the origin (z component)
+
+    double get_energy() const {
+        return kinetic + potential;
+    }
+};
+
+// kinetic energy, momentum and angular momentum in one parallel pass,
+// step, time and potential are left to the caller
+void measure_kinematics(const Particles & particles, Diagnostics & diagnostics);
+
+#endif
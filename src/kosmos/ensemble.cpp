@@ -0,0 +1,394 @@
+#include "ensemble.hpp"
+#include "small_kosmos.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <omp.h>
+
+namespace {
+
+// one system seen through pointers into the ensemble arrays
+struct System {
+    double * x;
+    double * y;
+    double * v_x;
+    double * v_y;
+    double * a_x;
+    double * a_y;
+    const double * mass;
+    std::size_t n;
+};
+
+template <int N>
+struct FixedForces {
+    static const std::size_t size = N;
+    static void apply(const System & s) {
+        small_accelerations<N>(s.x, s.y, s.mass, s.a_x, s.a_y);
+    }
+};
+
+// any size, the arithmetic of small_accelerations in plain loops
+struct AnyForces {
+    static const std::size_t size = 0;
+    static void apply(const System & s) {
+        for (std::size_t i = 0; i < s.n; ++i) {
+            s.a_x[i] = 0.0;
+            s.a_y[i] = 0.0;
+        }
+        for (std::size_t i = 0; i < s.n; ++i) {
+            for (std::size_t j = i + 1; j < s.n; ++j) {
+                const double dx = s.x[j] - s.x[i];
+                const double dy = s.y[j] - s.y[i];
+                const double inv = 1.0 / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+                const double inv3 = inv * inv * inv;
+                s.a_x[i] += s.mass[j] * inv3 * dx;
+                s.a_y[i] += s.mass[j] * inv3 * dy;
+                s.a_x[j] -= s.mass[i] * inv3 * dx;
+                s.a_y[j] -= s.mass[i] * inv3 * dy;
+            }
+        }
+        for (std::size_t i = 0; i < s.n; ++i) {
+            s.a_x[i] *= G_CONST;
+            s.a_y[i] *= G_CONST;
+        }
+    }
+};
+
+// kick drift kick, the same arithmetic as SmallKosmos::verlet_step
+template <typename Forces>
+void verlet_step(const System & s, double time_delta) {
+    const std::size_t n = Forces::size > 0 ? Forces::size : s.n;
+    for (std::size_t i = 0; i < n; ++i) {
+        s.v_x[i] += 0.5 * s.a_x[i] * time_delta;
+        s.v_y[i] += 0.5 * s.a_y[i] * time_delta;
+        s.x[i] += s.v_x[i] * time_delta;
+        s.y[i] += s.v_y[i] * time_delta;
+    }
+    Forces::apply(s);
+    for (std::size_t i = 0; i < n; ++i) {
+        s.v_x[i] += 0.5 * s.a_x[i] * time_delta;
+        s.v_y[i] += 0.5 * s.a_y[i] * time_delta;
+    }
+}
+
+template <typename Forces, typename Scheme>
+void advance_system(const System & s, bool forces_valid, long long steps, double last_step, double time_delta) {
+    if (!forces_valid) {
+        Forces::apply(s);
+    }
+    for (long long k = 0; k < steps; ++k) {
+        for (int stage = 0; stage < Scheme::stages; ++stage) {
+            verlet_step<Forces>(s, Scheme::weight(stage) * time_delta);
+        }
+    }
+    if (last_step > 0.0) {
+        for (int stage = 0; stage < Scheme::stages; ++stage) {
+            verlet_step<Forces>(s, Scheme::weight(stage) * last_step);
+        }
+    }
+}
+
+typedef void (*Advance)(const System &, bool, long long, double, double);
+
+// advance_system for a system of n bodies, fixed size up to N, the loop
+// version above that
+template <typename Scheme, int N>
+struct AdvanceTable {
+    static Advance pick(std::size_t n) {
+        return n == static_cast<std::size_t>(N) ? advance_system<FixedForces<N>, Scheme>
+                                                : AdvanceTable<Scheme, N - 1>::pick(n);
+    }
+};
+
+template <typename Scheme>
+struct AdvanceTable<Scheme, 0> {
+    static Advance pick(std::size_t) {
+        return advance_system<AnyForces, Scheme>;
+    }
+};
+
+Advance pick_advance(Integrator integrator, std::size_t n) {
+    switch (integrator) {
+        case Integrator::ForestRuth:
+            return AdvanceTable<ForestRuthScheme, ENSEMBLE_FIXED_MAX>::pick(n);
+        case Integrator::Yoshida6:
+            return AdvanceTable<Yoshida6Scheme, ENSEMBLE_FIXED_MAX>::pick(n);
+        default:
+            return AdvanceTable<VerletScheme, ENSEMBLE_FIXED_MAX>::pick(n);
+    }
+}
+
+} // namespace
+
+std::size_t Ensemble::append(std::size_t n) {
+    if (n == 0) {
+        throw std::invalid_argument("an ensemble system needs at least one body");
+    }
+    // the next system starts on a fresh cache line (8 doubles)
+    const std::size_t first = begin.back();
+    const std::size_t end = (first + n + 7) & ~static_cast<std::size_t>(7);
+    x.resize(end, 0.0);
+    y.resize(end, 0.0);
+    v_x.resize(end, 0.0);
+    v_y.resize(end, 0.0);
+    a_x.resize(end, 0.0);
+    a_y.resize(end, 0.0);
+    mass.resize(end, 0.0);
+    begin.push_back(end);
+    sizes.push_back(n);
+    times.push_back(0.0);
+    step_counts.push_back(0);
+    forces_valid.push_back(0);
+    return sizes.size() - 1;
+}
+
+std::size_t Ensemble::add_system(const std::vector<Body> & bodies) {
+    const std::size_t system = append(bodies.size());
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        set_body(system, i, bodies[i]);
+    }
+    return system;
+}
+
+std::size_t Ensemble::add_systems(std::size_t count, std::size_t n, const double * mass, const double * x,
+                                  const double * y, const double * v_x, const double * v_y) {
+    if (n == 0) {
+        throw std::invalid_argument("an ensemble system needs at least one body");
+    }
+    const std::size_t slots = begin.back() + count * ((n + 7) & ~static_cast<std::size_t>(7));
+    this->x.reserve(slots);
+    this->y.reserve(slots);
+    this->v_x.reserve(slots);
+    this->v_y.reserve(slots);
+    a_x.reserve(slots);
+    a_y.reserve(slots);
+    this->mass.reserve(slots);
+
+    const std::size_t first_system = sizes.size();
+    for (std::size_t s = 0; s < count; ++s) {
+        const std::size_t first = begin[append(n)];
+        for (std::size_t i = 0; i < n; ++i) {
+            this->mass[first + i] = mass[s * n + i];
+            this->x[first + i] = x[s * n + i];
+            this->y[first + i] = y[s * n + i];
+            this->v_x[first + i] = v_x[s * n + i];
+            this->v_y[first + i] = v_y[s * n + i];
+        }
+    }
+    return first_system;
+}
+
+void Ensemble::clear() {
+    x.clear();
+    y.clear();
+    v_x.clear();
+    v_y.clear();
+    a_x.clear();
+    a_y.clear();
+    mass.clear();
+    begin.assign(1, 0);
+    sizes.clear();
+    times.clear();
+    step_counts.clear();
+    forces_valid.clear();
+    system_steps = 0;
+}
+
+void Ensemble::set_integrator(Integrator integrator) {
+    if (integrator == Integrator::Hermite4) {
+        throw std::invalid_argument("Ensemble has no hermite integrator, use Kosmos");
+    }
+    this->integrator = integrator;
+}
+
+void Ensemble::run(long long num_steps, double time_delta) {
+    if (num_steps <= 0) {
+        return;
+    }
+    advance(std::vector<long long>(sizes.size(), num_steps), std::vector<double>(sizes.size(), 0.0), time_delta);
+}
+
+void Ensemble::run_until(const std::vector<double> & end_times, double time_delta) {
+    if (end_times.size() != sizes.size()) {
+        throw std::invalid_argument("run_until needs one end time per system, got " +
+                                    std::to_string(end_times.size()) + " for " + std::to_string(sizes.size()));
+    }
+    if (!(time_delta > 0.0)) {
+        throw std::invalid_argument("run_until needs a positive time_delta");
+    }
+    std::vector<long long> steps(sizes.size(), 0);
+    std::vector<double> last_step(sizes.size(), 0.0);
+    for (std::size_t s = 0; s < sizes.size(); ++s) {
+        const double remaining = end_times[s] - times[s];
+        if (remaining <= 0.0) {
+            continue;
+        }
+        steps[s] = static_cast<long long>(std::floor(remaining / time_delta));
+        last_step[s] = remaining - steps[s] * time_delta;
+        // a sliver left over from rounding is not worth a step
+        if (last_step[s] < 1e-9 * time_delta) {
+            last_step[s] = 0.0;
+        }
+    }
+    advance(steps, last_step, time_delta);
+    for (std::size_t s = 0; s < sizes.size(); ++s) {
+        if (end_times[s] > times[s]) {
+            times[s] = end_times[s];
+        }
+    }
+}
+
+void Ensemble::advance(const std::vector<long long> & steps, const std::vector<double> & last_step,
+                       double time_delta) {
+    const long long count = static_cast<long long>(sizes.size());
+    // small chunks so a slow system near the end cannot hold up the others,
+    // big enough that thousands of 2 body systems do not queue on the counter
+    const long long chunk = std::max(1LL, std::min(64LL, count / (8LL * omp_get_max_threads())));
+    long long taken = 0;
+
+    #pragma omp parallel for schedule(dynamic, chunk) reduction(+:taken)
+    for (long long s = 0; s < count; ++s) {
+        const long long system_taken = steps[s] + (last_step[s] > 0.0 ? 1 : 0);
+        if (system_taken == 0) {
+            continue;
+        }
+        const std::size_t first = begin[s];
+        const System system = {&x[first], &y[first], &v_x[first], &v_y[first], &a_x[first], &a_y[first],
+                               &mass[first], sizes[s]};
+        pick_advance(integrator, sizes[s])(system, forces_valid[s] != 0, steps[s], last_step[s], time_delta);
+        forces_valid[s] = 1;
+
+        // time adds up step by step like SmallKosmos does it
+        double t = times[s];
+        for (long long k = 0; k < steps[s]; ++k) {
+            t += time_delta;
+        }
+        if (last_step[s] > 0.0) {
+            t += last_step[s];
+        }
+        times[s] = t;
+        step_counts[s] += system_taken;
+        taken += system_taken;
+    }
+    system_steps += taken;
+}
+
+void Ensemble::check_system(std::size_t system) const {
+    if (system >= sizes.size()) {
+        throw std::out_of_range("system index " + std::to_string(system) + " out of range for " +
+                                std::to_string(sizes.size()) + " systems");
+    }
+}
+
+std::size_t Ensemble::get_body_count() const {
+    std::size_t total = 0;
+    for (std::size_t s = 0; s < sizes.size(); ++s) {
+        total += sizes[s];
+    }
+    return total;
+}
+
+std::size_t Ensemble::get_system_size(std::size_t system) const {
+    check_system(system);
+    return sizes[system];
+}
+
+double Ensemble::get_time(std::size_t system) const {
+    check_system(system);
+    return times[system];
+}
+
+long long Ensemble::get_step_count(std::size_t system) const {
+    check_system(system);
+    return step_counts[system];
+}
+
+std::vector<Body> Ensemble::get_bodies(std::size_t system) const {
+    check_system(system);
+    std::vector<Body> bodies;
+    bodies.reserve(sizes[system]);
+    for (std::size_t k = begin[system]; k < begin[system] + sizes[system]; ++k) {
+        Body body(mass[k], x[k], y[k], v_x[k], v_y[k]);
+        body.set_a_x(a_x[k]);
+        body.set_a_y(a_y[k]);
+        bodies.push_back(body);
+    }
+    return bodies;
+}
+
+void Ensemble::set_body(std::size_t system, std::size_t i, const Body & body) {
+    check_system(system);
+    if (i >= sizes[system]) {
+        throw std::out_of_range("body index " + std::to_string(i) + " out of range for a system of " +
+                                std::to_string(sizes[system]) + " bodies");
+    }
+    const std::size_t k = begin[system] + i;
+    mass[k] = body.get_mass();
+    x[k] = body.get_x();
+    y[k] = body.get_y();
+    v_x[k] = body.get_v_x();
+    v_y[k] = body.get_v_y();
+    a_x[k] = 0.0;
+    a_y[k] = 0.0;
+    forces_valid[system] = 0;
+}
+
+Diagnostics Ensemble::get_diagnostics(std::size_t system) const {
+    check_system(system);
+    const std::size_t first = begin[system];
+    Diagnostics d = small_diagnostics(sizes[system], &x[first], &y[first], &v_x[first], &v_y[first], &mass[first]);
+    d.step = step_counts[system];
+    d.time = times[system];
+    return d;
+}
+
+std::vector<double> Ensemble::get_energies() const {
+    const long long count = static_cast<long long>(sizes.size());
+    std::vector<double> energies(sizes.size());
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (long long s = 0; s < count; ++s) {
+        const std::size_t first = begin[s];
+        energies[s] = small_diagnostics(sizes[s], &x[first], &y[first], &v_x[first], &v_y[first], &mass[first])
+                          .get_energy();
+    }
+    return energies;
+}
+
+std::vector<std::size_t> Ensemble::get_offsets() const {
+    std::vector<std::size_t> offsets(sizes.size() + 1, 0);
+    for (std::size_t s = 0; s < sizes.size(); ++s) {
+        offsets[s + 1] = offsets[s] + sizes[s];
+    }
+    return offsets;
+}
+
+std::vector<double> Ensemble::packed(const AlignedArray & array) const {
+    std::vector<double> out;
+    out.reserve(get_body_count());
+    for (std::size_t s = 0; s < sizes.size(); ++s) {
+        out.insert(out.end(), array.begin() + begin[s], array.begin() + begin[s] + sizes[s]);
+    }
+    return out;
+}
+
+std::vector<double> Ensemble::get_x() const {
+    return packed(x);
+}
+
+std::vector<double> Ensemble::get_y() const {
+    return packed(y);
+}
+
+std::vector<double> Ensemble::get_v_x() const {
+    return packed(v_x);
+}
+
+std::vector<double> Ensemble::get_v_y() const {
+    return packed(v_y);
+}
+
+std::vector<double> Ensemble::get_mass() const {
+    return packed(mass);
+}
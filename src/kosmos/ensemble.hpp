@@ -0,0 +1,108 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+#include "../body/body.hpp"
+#include "../particles/aligned_allocator.hpp"
+#include "diagnostics.hpp"
+#include "integrators.hpp"
+#include <cstddef>
+#include <vector>
+
+// many independent small systems stepped side by side, say 10k perturbed
+// copies of one few body system for a monte carlo study. all systems share
+// one set of soa arrays, back to back, each one starting on its own cache
+// line so threads working on neighbours never write the same line. a run is
+// one parallel region over the systems (dynamic scheduling, a thread that is
+// done takes the next chunk, so big and small systems or long and short
+// runs balance out), each system is stepped start to end by one thread with
+// the SmallKosmos kernel for its size and never touches openmp itself.
+// systems of up to ENSEMBLE_FIXED_MAX bodies get the unrolled fixed size
+// kernel, bigger ones a plain pair loop. same force and integrators as
+// SmallKosmos (verlet, forest ruth, yoshida 6), a system gives the same
+// numbers as a SmallKosmos of it would
+const int ENSEMBLE_FIXED_MAX = 16;
+
+class Ensemble {
+    AlignedArray x, y; // position
+    AlignedArray v_x, v_y; // velocity
+    AlignedArray a_x, a_y; // acceleration
+    AlignedArray mass;
+    std::vector<std::size_t> begin; // first slot of every system plus one past the last
+    std::vector<std::size_t> sizes;
+    std::vector<double> times;
+    std::vector<long long> step_counts;
+    std::vector<char> forces_valid; // not vector<bool>, threads write neighbouring entries
+    Integrator integrator;
+    long long system_steps; // steps summed over all systems
+
+    public:
+        Ensemble() : integrator(Integrator::Verlet), system_steps(0) {
+            begin.push_back(0);
+        }
+
+        // appends a system and returns its index, throws std::invalid_argument
+        // for an empty one
+        std::size_t add_system(const std::vector<Body> & bodies);
+        // count systems of n bodies each from count x n row major arrays,
+        // returns the index of the first one
+        std::size_t add_systems(std::size_t count, std::size_t n, const double * mass, const double * x,
+                                const double * y, const double * v_x, const double * v_y);
+        void clear();
+
+        // every system num_steps steps of time_delta
+        void run(long long num_steps, double time_delta);
+        // every system from its own time to its own end time in steps of
+        // time_delta, the last one cut to land on it. systems already there
+        // are left alone, throws std::invalid_argument unless there is one
+        // end time per system
+        void run_until(const std::vector<double> & end_times, double time_delta);
+
+        Integrator get_integrator() const {
+            return integrator;
+        }
+        // verlet, forest ruth or yoshida 6, throws std::invalid_argument for hermite
+        void set_integrator(Integrator integrator);
+
+        std::size_t get_system_count() const {
+            return sizes.size();
+        }
+        std::size_t get_body_count() const;
+        // the per system getters and setters throw std::out_of_range
+        std::size_t get_system_size(std::size_t system) const;
+        double get_time(std::size_t system) const;
+        long long get_step_count(std::size_t system) const;
+        std::vector<Body> get_bodies(std::size_t system) const;
+        // drops the cached accelerations of that system
+        void set_body(std::size_t system, std::size_t i, const Body & body);
+        Diagnostics get_diagnostics(std::size_t system) const;
+        // total energy of every system, in parallel
+        std::vector<double> get_energies() const;
+        // steps taken summed over all systems, the work a run did
+        long long get_system_steps() const {
+            return system_steps;
+        }
+
+        // everything packed system after system without the padding, offsets
+        // has the first body of each system plus the total at the end
+        std::vector<std::size_t> get_offsets() const;
+        std::vector<double> get_x() const;
+        std::vector<double> get_y() const;
+        std::vector<double> get_v_x() const;
+        std::vector<double> get_v_y() const;
+        std::vector<double> get_mass() const;
+        std::vector<double> get_times() const {
+            return times;
+        }
+        std::vector<long long> get_step_counts() const {
+            return step_counts;
+        }
+
+    private:
+        std::size_t append(std::size_t n);
+        void check_system(std::size_t system) const;
+        std::vector<double> packed(const AlignedArray & array) const;
+        // steps[s] whole steps of time_delta for system s, then a last one of
+        // last_step[s] when that is above zero
+        void advance(const std::vector<long long> & steps, const std::vector<double> & last_step, double time_delta);
+};
+
+#endif
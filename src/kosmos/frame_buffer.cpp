@@ -0,0 +1,29 @@
+#include "frame_buffer.hpp"
+
+void FrameBuffer::publish() {
+    // acq_rel: the reader that takes this index sees everything written to the frame
+    int previous = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+    if (previous & FRESH) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    back_index = previous & 3;
+    published.fetch_add(1, std::memory_order_relaxed);
+}
+
+const Frame * FrameBuffer::latest() {
+    if (middle.load(std::memory_order_relaxed) & FRESH) {
+        int previous = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = previous & 3;
+        has_front = true;
+    }
+    return has_front ? &frames[front_index] : nullptr;
+}
+
+void FrameBuffer::reset() {
+    back_index = 0;
+    middle.store(1);
+    front_index = 2;
+    has_front = false;
+    published.store(0);
+    dropped.store(0);
+}
@@ -0,0 +1,59 @@
+#ifndef FRAME_BUFFER_HPP
+#define FRAME_BUFFER_HPP
+#include "../particles/particles.hpp"
+#include <atomic>
+
+// one published state of a kosmos, a copy the integrator no longer touches
+struct Frame {
+    long long step; // step_count when it was taken
+    double time; // simulated seconds
+    Particles particles;
+
+    std::vector<Body> get_bodies() const {
+        return particles.to_bodies();
+    }
+};
+
+// triple buffer between one writer (the background integrator) and one reader.
+// the writer fills its back frame and swaps it into the middle slot with a
+// single atomic exchange, the reader swaps the middle into its front frame the
+// same way when something new is there. nobody ever waits on the other side,
+// a frame that is replaced before the reader picked it up counts as dropped
+class FrameBuffer {
+    public:
+        FrameBuffer() {
+            reset();
+        }
+
+        // writer side: fill back() then publish()
+        Frame & back() {
+            return frames[back_index];
+        }
+        void publish();
+
+        // reader side: newest published frame, nullptr until the first publish.
+        // stays valid and unchanged until the next call to latest
+        const Frame * latest();
+
+        long long get_frames_published() const {
+            return published.load();
+        }
+        long long get_frames_dropped() const {
+            return dropped.load();
+        }
+        // forget every frame, only while no writer or reader is active
+        void reset();
+
+    private:
+        static const int FRESH = 4; // middle holds a frame the reader has not seen
+
+        Frame frames[3];
+        std::atomic<int> middle; // frame index | FRESH
+        int back_index; // writer only
+        int front_index; // reader only
+        bool has_front; // reader only
+        std::atomic<long long> published;
+        std::atomic<long long> dropped;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef INTEGRATORS_HPP
+#define INTEGRATORS_HPP
+
+// how Kosmos::step moves the bodies over one time_delta
+enum class Integrator {
+    Verlet, // 2nd order kick drift kick, one force pass per step
+    ForestRuth, // 4th order, three verlet steps (forest-ruth / yoshida), 3 force passes
+    Yoshida6, // 6th order, seven verlet steps (yoshida solution a), 7 force passes
+    Hermite4 // 4th order predictor-corrector with jerk, one (pricier) direct pass
+};
+
+// symplectic composition schemes: a step of dt is a row of verlet steps of
+// weight(k) * dt. the weights sum to one and are symmetric, some are negative
+// (those sub steps go backwards in time). Kosmos::composed_step takes one of
+// these as a template parameter so the stage loop is unrolled per scheme
+struct VerletScheme {
+    static const int stages = 1;
+    static double weight(int) {
+        return 1.0;
+    }
+};
+
+struct ForestRuthScheme {
+    static const int stages = 3;
+    static double weight(int k) {
+        // w1 = 1 / (2 - 2^(1/3)), w0 = 1 - 2 w1
+        return k == 1 ? -1.7024143839193153 : 1.3512071919596578;
+    }
+};
+
+struct Yoshida6Scheme {
+    static const int stages = 7;
+    static double weight(int k) {
+        // yoshida (1990) solution a, w3 w2 w1 w0 w1 w2 w3 with w0 = 1 - 2 (w1 + w2 + w3)
+        static const double weights[4] = {1.3151863206839112, -1.17767998417887, 0.235573213359357, 0.784513610477560};
+        return weights[k < 4 ? 3 - k : k - 3];
+    }
+};
+
+inline const char * integrator_name(Integrator integrator) {
+    switch (integrator) {
+        case Integrator::ForestRuth:
+            return "forest_ruth";
+        case Integrator::Yoshida6:
+            return "yoshida6";
+        case Integrator::Hermite4:
+            return "hermite4";
+        default:
+            return "verlet";
+    }
+}
+
+#endif
@@ -1,79 +1,1278 @@
 #include "kosmos.hpp"
 #include <omp.h> // include multithreadig
 #include "../constants.h"
+#include "../io/checkpoint.hpp"
+#include "../forces/jerk.hpp"
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
+#include <string>
+
+Kosmos::~Kosmos() {
+    // a worker error or a failed final write has nowhere to go from a destructor
+    try {
+        stop();
+    } catch (const std::exception &) {
+    }
+    try {
+        detach_trajectory();
+    } catch (const std::exception &) {
+    }
+}
 
 void Kosmos::calculate_forces() {
-    // Reset all forces
-    #pragma omp parallel for
-    for (size_t i = 0; i < bodies.size(); ++i) {
-        bodies[i].reset_force();
+    NBODY_PROFILE_PHASE(&profiler, Phase::Forces);
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    // the potential rides along only when someone is going to read it
+    double * energy = potential_wanted ? &potential : nullptr;
+    switch (force_solver) {
+        case ForceSolver::DirectSymmetric:
+            symmetric.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), particles.size(),
+                                    particles.a_x.data(), particles.a_y.data(), energy);
+            break;
+        case ForceSolver::BarnesHut:
+            barnes_hut.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), particles.size(),
+                                     particles.a_x.data(), particles.a_y.data(), nullptr, energy);
+            break;
+        case ForceSolver::FMM:
+            fmm.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), particles.size(),
+                              particles.a_x.data(), particles.a_y.data(), energy);
+            break;
+        default:
+            direct.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), particles.size(),
+                                 particles.a_x.data(), particles.a_y.data(), energy);
+            break;
+    }
+    forces_valid = true;
+    jerks_valid = false;
+    potential_valid = potential_wanted;
+    // the bodies may have moved, so the tracers' field is stale too
+    tracer_forces_valid = false;
+    force_evaluations += static_cast<long long>(particles.size());
+    if (phase_timing) {
+        phase_times.forces += omp_get_wtime() - start;
+    }
+}
+
+void Kosmos::calculate_tracer_forces() {
+    NBODY_PROFILE_PHASE(&profiler, Phase::Forces);
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    const size_t n = particles.size();
+    if (n == 0) {
+        std::fill(tracers.a_x.begin(), tracers.a_x.end(), 0.0);
+        std::fill(tracers.a_y.begin(), tracers.a_y.end(), 0.0);
+    } else {
+        // tracers as targets, only the bodies as sources: n x tracers pairs,
+        // threaded over blocks of tracers and vectorized over the bodies
+        direct.accelerations(tracers.x.data(), tracers.y.data(), tracers.size(), particles.x.data(),
+                             particles.y.data(), particles.mass.data(), n, tracers.a_x.data(), tracers.a_y.data());
+    }
+    tracer_forces_valid = true;
+    if (phase_timing) {
+        phase_times.forces += omp_get_wtime() - start;
+    }
+}
+
+void Kosmos::calculate_forces_on(const double * x, const double * y, const uint32_t * active, size_t count) {
+    const size_t n = particles.size();
+    if (count == n) {
+        // everyone is at the end of a step, so x, y are the real positions
+        calculate_forces();
+        return;
+    }
+    NBODY_PROFILE_PHASE(&profiler, Phase::Forces);
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    double * a_x = particles.a_x.data();
+    double * a_y = particles.a_y.data();
+    switch (force_solver) {
+        case ForceSolver::BarnesHut:
+            // the tree is built over everyone, only leaves holding an active body are walked
+            block_mask.assign(n, 0);
+            for (size_t k = 0; k < count; ++k) {
+                block_mask[active[k]] = 1;
+            }
+            barnes_hut.accelerations(x, y, particles.mass.data(), n, a_x, a_y, block_mask.data());
+            break;
+        case ForceSolver::DirectSymmetric:
+        case ForceSolver::FMM:
+            // no way to ask these for a subset (pairs / the expansions cover everyone),
+            // evaluate all of it on the side and keep the active rows
+            block_a_x.resize(n);
+            block_a_y.resize(n);
+            if (force_solver == ForceSolver::FMM) {
+                fmm.accelerations(x, y, particles.mass.data(), n, block_a_x.data(), block_a_y.data());
+            } else {
+                symmetric.accelerations(x, y, particles.mass.data(), n, block_a_x.data(), block_a_y.data());
+            }
+            #pragma omp parallel for
+            for (size_t k = 0; k < count; ++k) {
+                a_x[active[k]] = block_a_x[active[k]];
+                a_y[active[k]] = block_a_y[active[k]];
+            }
+            break;
+        default:
+            // gather the active targets so the tiled kernel sees contiguous rows
+            block_x.resize(count);
+            block_y.resize(count);
+            block_a_x.resize(count);
+            block_a_y.resize(count);
+            #pragma omp parallel for
+            for (size_t k = 0; k < count; ++k) {
+                block_x[k] = x[active[k]];
+                block_y[k] = y[active[k]];
+            }
+            direct.accelerations(block_x.data(), block_y.data(), count, x, y, particles.mass.data(), n,
+                                 block_a_x.data(), block_a_y.data());
+            #pragma omp parallel for
+            for (size_t k = 0; k < count; ++k) {
+                a_x[active[k]] = block_a_x[k];
+                a_y[active[k]] = block_a_y[k];
+            }
+            break;
     }
+    potential_valid = false;
+    force_evaluations += static_cast<long long>(count);
+    if (phase_timing) {
+        phase_times.forces += omp_get_wtime() - start;
+    }
+}
+
+void Kosmos::step(double time_delta) {
+    BusyScope scope(*this, "step");
+    integrate(time_delta);
+}
+
+void Kosmos::integrate(double time_delta) {
+    NBODY_PROFILE_PHASE(&profiler, Phase::Step, step_count + 1);
+    // a step that ends on a diagnostics record sums the potential in its last force pass
+    potential_wanted = diagnostics_every > 0 && (step_count + 1) % diagnostics_every == 0;
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    take_step(time_delta);
+    if (phase_timing) {
+        phase_times.total += omp_get_wtime() - start;
+        ++phase_times.steps;
+    }
+    potential_wanted = false;
+    finish_step(time_delta);
+}
+
+void Kosmos::check_step_setup() const {
+    if (tracers.size() > 0 && (integrator == Integrator::Hermite4 || block_steps.get_max_level() > 0)) {
+        throw std::logic_error("tracers only move with verlet, forest ruth or yoshida 6, not with hermite or block time steps");
+    }
+}
 
-    // Calculate gravitational forces between all pairs of bodies
-    #pragma omp parallel for schedule(guided)
-    for (size_t i = 0; i < bodies.size(); ++i) {
-        double local_f_x = 0.0;
-        double local_f_y = 0.0;
-        
-        for (size_t j = 0; j < bodies.size(); ++j) {
-            if (i == j) continue;
-            
-            Body & bodyA = bodies[i];
-            Body & bodyB = bodies[j];
+void Kosmos::take_step(double time_delta) {
+    check_step_setup();
+    // one switch per step, every scheme gets its own unrolled stage loop
+    switch (integrator) {
+        case Integrator::ForestRuth:
+            composed_step<ForestRuthScheme>(time_delta);
+            break;
+        case Integrator::Yoshida6:
+            composed_step<Yoshida6Scheme>(time_delta);
+            break;
+        case Integrator::Hermite4:
+            hermite_step(time_delta);
+            break;
+        default:
+            if (block_steps.get_max_level() > 0) {
+                block_step(time_delta);
+            } else {
+                verlet_step(time_delta);
+            }
+            break;
+    }
+}
 
-            double dx = bodyB.get_x() - bodyA.get_x();
-            double dy = bodyB.get_y() - bodyA.get_y();
-            double distance_sq = dx * dx + dy * dy;
-            
-            // add softening to avoid interstellar collisions
-            distance_sq += SOFTENING_LENGTH_SQ;
+template <typename Scheme>
+void Kosmos::composed_step(double time_delta) {
+    // the forces at the end of one stage are the start of the next, so each
+    // stage costs one force pass. only the last one needs the potential
+    const bool wanted = potential_wanted;
+    for (int k = 0; k < Scheme::stages; ++k) {
+        potential_wanted = wanted && k == Scheme::stages - 1;
+        verlet_step(Scheme::weight(k) * time_delta);
+    }
+    potential_wanted = wanted;
+}
+
+void Kosmos::calculate_forces_and_jerks() {
+    NBODY_PROFILE_PHASE(&profiler, Phase::Forces);
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    const size_t n = particles.size();
+    j_x.resize(n);
+    j_y.resize(n);
+    direct_accelerations_jerks(particles.x.data(), particles.y.data(), particles.v_x.data(), particles.v_y.data(),
+                               particles.mass.data(), n,
+                               particles.a_x.data(), particles.a_y.data(), j_x.data(), j_y.data(),
+                               potential_wanted ? &potential : nullptr);
+    forces_valid = true;
+    jerks_valid = true;
+    potential_valid = potential_wanted;
+    force_evaluations += static_cast<long long>(n);
+    if (phase_timing) {
+        phase_times.forces += omp_get_wtime() - start;
+    }
+}
 
-            double distance = sqrt(distance_sq);
+void Kosmos::hermite_step(double time_delta) {
+    const size_t n = particles.size();
+    double * x = particles.x.data();
+    double * y = particles.y.data();
+    double * v_x = particles.v_x.data();
+    double * v_y = particles.v_y.data();
+    double * a_x = particles.a_x.data();
+    double * a_y = particles.a_y.data();
 
-            if (distance > 0) {
-                double force_magnitude = (G_CONST * bodyA.get_mass() * bodyB.get_mass()) / distance_sq;
-                double force_x = force_magnitude * (dx / distance);
-                double force_y = force_magnitude * (dy / distance);
+    if (!forces_valid || !jerks_valid) {
+        calculate_forces_and_jerks();
+    }
 
-                local_f_x += force_x;
-                local_f_y += force_y;
+    // predict positions and velocities from a and j, keep the start of the step
+    hermite_start.resize(8 * n);
+    double * x0 = hermite_start.data();
+    double * y0 = x0 + n;
+    double * v_x0 = y0 + n;
+    double * v_y0 = v_x0 + n;
+    double * a_x0 = v_y0 + n;
+    double * a_y0 = a_x0 + n;
+    double * j_x0 = a_y0 + n;
+    double * j_y0 = j_x0 + n;
+    const double dt = time_delta;
+    const double dt2 = dt * dt / 2.0;
+    const double dt3 = dt * dt * dt / 6.0;
+    {
+        NBODY_PROFILE_PHASE(&profiler, Phase::KickDrift);
+        #pragma omp parallel
+        {
+            NBODY_PROFILE_WORKER(&profiler);
+            #pragma omp for nowait
+            for (size_t i = 0; i < n; ++i) {
+                x0[i] = x[i];
+                y0[i] = y[i];
+                v_x0[i] = v_x[i];
+                v_y0[i] = v_y[i];
+                a_x0[i] = a_x[i];
+                a_y0[i] = a_y[i];
+                j_x0[i] = j_x[i];
+                j_y0[i] = j_y[i];
+                x[i] += v_x[i] * dt + a_x[i] * dt2 + j_x[i] * dt3;
+                y[i] += v_y[i] * dt + a_y[i] * dt2 + j_y[i] * dt3;
+                v_x[i] += a_x[i] * dt + j_x[i] * dt2;
+                v_y[i] += a_y[i] * dt + j_y[i] * dt2;
             }
         }
-        
-        // Single write per thread per body
-        bodies[i].set_f_x(local_f_x);
-        bodies[i].set_f_y(local_f_y);
+    }
+
+    // a and j at the predicted state
+    calculate_forces_and_jerks();
+
+    // correct, the 4th order hermite interpolation of a over the step. the new a
+    // and j (taken at the predicted positions) stay cached for the next step
+    const double dt_12 = dt * dt / 12.0;
+    NBODY_PROFILE_PHASE(&profiler, Phase::Kick);
+    #pragma omp parallel
+    {
+        NBODY_PROFILE_WORKER(&profiler);
+        #pragma omp for nowait
+        for (size_t i = 0; i < n; ++i) {
+            v_x[i] = v_x0[i] + 0.5 * (a_x0[i] + a_x[i]) * dt + (j_x0[i] - j_x[i]) * dt_12;
+            v_y[i] = v_y0[i] + 0.5 * (a_y0[i] + a_y[i]) * dt + (j_y0[i] - j_y[i]) * dt_12;
+            x[i] = x0[i] + 0.5 * (v_x0[i] + v_x[i]) * dt + (a_x0[i] - a_x[i]) * dt_12;
+            y[i] = y0[i] + 0.5 * (v_y0[i] + v_y[i]) * dt + (a_y0[i] - a_y[i]) * dt_12;
+        }
     }
 }
 
+void Kosmos::attach_profiler() {
+    direct.set_profiler(&profiler);
+    symmetric.set_profiler(&profiler);
+    barnes_hut.set_profiler(&profiler);
+    fmm.set_profiler(&profiler);
+}
 
+ProfileStats Kosmos::stats() const {
+    check_not_running("stats");
+    return profiler.stats();
+}
 
-void Kosmos::step(double time_delta) {
-    // Calculate current forces and accelerations
-    calculate_forces();
-    #pragma omp parallel for
-    for (size_t i = 0; i < bodies.size(); ++i) {
-        bodies[i].compute_acceleration();
-    }
-    
-    // update
-    #pragma omp parallel for
-    for (size_t i = 0; i < bodies.size(); ++i) {
-        bodies[i].update(time_delta);
-    }
-    
-    // Recalculate forces at new positions
+void Kosmos::reset_stats() {
+    check_not_running("reset_stats");
+    profiler.reset();
+}
+
+void Kosmos::write_trace(const std::string & path) const {
+    check_not_running("write_trace");
+    profiler.write_trace(path);
+}
+
+bool Kosmos::enable_hardware_counters() {
+    check_not_running("enable_hardware_counters");
+    return profiler.enable_hardware_counters();
+}
+
+Diagnostics Kosmos::get_diagnostics() {
+    check_readable("get_diagnostics");
+    BusyScope scope(*this, "get_diagnostics"); // may take a force pass
+    return measure();
+}
+
+Diagnostics Kosmos::measure() {
+    // like the steps, hermite keeps the forces (and so the potential) of its
+    // predicted positions, they differ from the corrected ones at O(dt^4)
+    if (!forces_valid || !potential_valid) {
+        const bool wanted = potential_wanted;
+        potential_wanted = true;
+        calculate_forces();
+        potential_wanted = wanted;
+    }
+    Diagnostics diagnostics = Diagnostics();
+    diagnostics.step = step_count;
+    diagnostics.time = time;
+    diagnostics.potential = potential;
+    measure_kinematics(particles, diagnostics);
+    return diagnostics;
+}
+
+void Kosmos::set_diagnostics_every(long long every) {
+    check_not_running("set_diagnostics_every");
+    if (every < 0) {
+        throw std::invalid_argument("diagnostics every must be >= 0");
+    }
+    diagnostics_every = every;
+}
+
+double Kosmos::get_energy_drift() const {
+    check_readable("get_energy_drift");
+    if (diagnostics_history.size() < 2) {
+        return 0.0;
+    }
+    const double first = diagnostics_history.front().get_energy();
+    const double last = diagnostics_history.back().get_energy();
+    return (last - first) / (first != 0.0 ? std::fabs(first) : 1.0);
+}
+
+void Kosmos::set_integrator(Integrator integrator) {
+    check_not_running("set_integrator");
+    if (integrator != Integrator::Verlet && block_steps.get_max_level() > 0) {
+        throw std::logic_error("block time steps only work with the verlet integrator, set max_level to 0 first");
+    }
+    this->integrator = integrator;
+}
+
+void Kosmos::set_collision_mode(CollisionMode mode) {
+    check_not_running("set_collision_mode");
+    if (mode == CollisionMode::Merge && trajectory) {
+        throw std::logic_error("merging collisions change the body count, detach the trajectory first");
+    }
+    collisions.set_mode(mode);
+}
+
+void Kosmos::set_max_level(int max_level) {
+    check_not_running("set_max_level");
+    if (max_level > 0 && integrator != Integrator::Verlet) {
+        throw std::logic_error("block time steps only work with the verlet integrator");
+    }
+    block_steps.set_max_level(max_level);
+}
+
+void Kosmos::finish_step(double time_delta) {
+    time += time_delta;
+    ++step_count;
+
+    // views alive point at the arrays as they are, the sort waits for them
+    if (reorder_every > 0 && step_count % reorder_every == 0 && !arrays_pinned()) {
+        reorder_storage();
+    }
+
+    if (collisions.get_mode() != CollisionMode::Off) {
+        NBODY_PROFILE_PHASE(&profiler, Phase::Collisions);
+        collisions.resolve(particles, ids, step_count, time);
+        if (collisions.get_last_changed()) {
+            // velocities and positions (with merges the bodies) changed under the
+            // cached forces, a push out of overlap alone moves bodies too
+            forces_valid = false;
+            tracer_forces_valid = false;
+            jerks_valid = false;
+            potential_valid = false;
+            if (collisions.get_last_merged() > 0) {
+                block_steps.reset();
+                if (!by_id.empty()) {
+                    rebuild_by_id();
+                }
+            }
+        }
+    }
+
+    if (diagnostics_every > 0 && step_count % diagnostics_every == 0) {
+        NBODY_PROFILE_PHASE(&profiler, Phase::Diagnostics);
+        diagnostics_history.push_back(measure());
+    }
+
+    if (trajectory && step_count % trajectory->get_every() == 0) {
+        NBODY_PROFILE_PHASE(&profiler, Phase::Output);
+        trajectory->append(step_count, time, get_particles_by_id());
+    }
+}
+
+void Kosmos::set_reorder_every(long long every) {
+    check_not_running("set_reorder_every");
+    if (every < 0) {
+        throw std::invalid_argument("reorder every must be >= 0");
+    }
+    reorder_every = every;
+}
+
+void Kosmos::reorder() {
+    BusyScope scope(*this, "reorder");
+    if (arrays_pinned()) {
+        throw std::logic_error("cannot reorder while views of the particle arrays are alive");
+    }
+    reorder_storage();
+}
+
+void Kosmos::reorder_storage() {
+    NBODY_PROFILE_PHASE(&profiler, Phase::Reorder);
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    const size_t n = particles.size();
+    if (n > 1) {
+        double min_x, min_y, side;
+        bounding_square(particles.x.data(), particles.y.data(), n, min_x, min_y, side);
+        curve_keys(reorder_curve, particles.x.data(), particles.y.data(), n, min_x, min_y, side, reorder_keys);
+        reorder_order.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            reorder_order[i] = static_cast<uint32_t>(i);
+        }
+        radix_sort(reorder_keys, reorder_order);
+
+        // every array is gathered into the scratch, which then takes its place,
+        // the displaced buffer is the scratch for the next one. the accelerations
+        // (and hermite's jerks) move along, so the cached forces stay valid
+        const uint32_t * order = reorder_order.data();
+        AlignedArray * arrays[] = {&particles.x, &particles.y, &particles.v_x, &particles.v_y, &particles.a_x,
+                                   &particles.a_y, &particles.mass, &particles.radius, &j_x, &j_y};
+        reorder_scratch.resize(n);
+        for (AlignedArray * array : arrays) {
+            if (array->size() != n) {
+                continue; // jerks before the first hermite step
+            }
+            const double * src = array->data();
+            double * dst = reorder_scratch.data();
+            #pragma omp parallel for schedule(static) proc_bind(close)
+            for (size_t k = 0; k < n; ++k) {
+                dst[k] = src[order[k]];
+            }
+            array->swap(reorder_scratch);
+        }
+        by_id.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            by_id[k] = ids[order[k]];
+        }
+        ids.swap(by_id);
+        rebuild_by_id();
+        block_steps.permute(reorder_order);
+        ++reorders;
+    }
+    if (phase_timing) {
+        phase_times.reorder += omp_get_wtime() - start;
+    }
+}
+
+void Kosmos::reset_ids() {
+    ids.resize(particles.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ids[i] = static_cast<uint32_t>(i);
+    }
+    next_id = static_cast<uint32_t>(ids.size());
+    by_id.clear();
+}
+
+void Kosmos::rebuild_by_id() {
+    const size_t n = ids.size();
+    bool in_order = true;
+    for (size_t i = 1; i < n && in_order; ++i) {
+        in_order = ids[i - 1] < ids[i];
+    }
+    by_id.clear();
+    if (in_order) {
+        return; // storage order is id order
+    }
+    // ids are unique and below next_id, one scatter and one sweep sort them
+    std::vector<uint32_t> slot(next_id, UINT32_MAX);
+    for (size_t i = 0; i < n; ++i) {
+        slot[ids[i]] = static_cast<uint32_t>(i);
+    }
+    by_id.reserve(n);
+    for (uint32_t index : slot) {
+        if (index != UINT32_MAX) {
+            by_id.push_back(index);
+        }
+    }
+}
+
+void Kosmos::gather_by_id(Particles & out) const {
+    const size_t n = by_id.size();
+    out.resize(n);
+    const AlignedArray * from[] = {&particles.x, &particles.y, &particles.v_x, &particles.v_y, &particles.a_x,
+                                   &particles.a_y, &particles.mass, &particles.radius};
+    AlignedArray * to[] = {&out.x, &out.y, &out.v_x, &out.v_y, &out.a_x, &out.a_y, &out.mass, &out.radius};
+    const uint32_t * order = by_id.data();
+    for (int a = 0; a < 8; ++a) {
+        const double * src = from[a]->data();
+        double * dst = to[a]->data();
+        #pragma omp parallel for schedule(static)
+        for (size_t k = 0; k < n; ++k) {
+            dst[k] = src[order[k]];
+        }
+    }
+}
+
+const Particles & Kosmos::get_particles_by_id() const {
+    if (by_id.empty()) {
+        return particles;
+    }
+    gather_by_id(id_ordered);
+    return id_ordered;
+}
+
+std::vector<Body> Kosmos::get_bodies() const {
+    check_readable("get_bodies");
+    if (by_id.empty()) {
+        return particles.to_bodies();
+    }
+    std::vector<Body> bodies;
+    bodies.reserve(by_id.size());
+    for (uint32_t i : by_id) {
+        bodies.push_back(particles.get_body(i));
+    }
+    return bodies;
+}
+
+std::vector<uint32_t> Kosmos::get_ids() const {
+    check_readable("get_ids");
+    if (by_id.empty()) {
+        return ids;
+    }
+    std::vector<uint32_t> in_order;
+    in_order.reserve(by_id.size());
+    for (uint32_t i : by_id) {
+        in_order.push_back(ids[i]);
+    }
+    return in_order;
+}
+
+void Kosmos::verlet_step(double time_delta) {
+#ifndef NBODY_PROFILE
+    // profile builds keep the separate regions below so every phase shows up on its own
+    if (force_solver == ForceSolver::Direct && particles.size() > 0) {
+        fused_verlet_step(time_delta);
+        return;
+    }
+#endif
+    const size_t n = particles.size();
+    double * x = particles.x.data();
+    double * y = particles.y.data();
+    double * v_x = particles.v_x.data();
+    double * v_y = particles.v_y.data();
+    const double * a_x = particles.a_x.data();
+    const double * a_y = particles.a_y.data();
+    const size_t n_tracers = tracers.size();
+    double * t_x = tracers.x.data();
+    double * t_y = tracers.y.data();
+    double * t_v_x = tracers.v_x.data();
+    double * t_v_y = tracers.v_y.data();
+    const double * t_a_x = tracers.a_x.data();
+    const double * t_a_y = tracers.a_y.data();
+
+    // accelerations at the current positions, normally still there from the
+    // end of the previous step since nothing moved in between
+    if (!forces_valid) {
+        calculate_forces();
+    }
+    if (n_tracers > 0 && !tracer_forces_valid) {
+        calculate_tracer_forces();
+    }
+
+    // update, first half of velocity verlet (same as Body::update)
+    double start = phase_timing ? omp_get_wtime() : 0.0;
+    {
+        NBODY_PROFILE_PHASE(&profiler, Phase::KickDrift);
+        #pragma omp parallel
+        {
+            NBODY_PROFILE_WORKER(&profiler);
+            #pragma omp for nowait
+            for (size_t i = 0; i < n; ++i) {
+                v_x[i] += 0.5 * a_x[i] * time_delta;
+                v_y[i] += 0.5 * a_y[i] * time_delta;
+                x[i] += v_x[i] * time_delta;
+                y[i] += v_y[i] * time_delta;
+            }
+            // the tracers in the same region, a loop of their own
+            #pragma omp for nowait
+            for (size_t i = 0; i < n_tracers; ++i) {
+                t_v_x[i] += 0.5 * t_a_x[i] * time_delta;
+                t_v_y[i] += 0.5 * t_a_y[i] * time_delta;
+                t_x[i] += t_v_x[i] * time_delta;
+                t_y[i] += t_v_y[i] * time_delta;
+            }
+        }
+    }
+    if (phase_timing) {
+        phase_times.kick_drift += omp_get_wtime() - start;
+    }
+
+    // Recalculate accelerations at new positions
     calculate_forces();
+    if (n_tracers > 0) {
+        calculate_tracer_forces();
+    }
+
+    // update again, second half (same as Body::update_velocity)
+    start = phase_timing ? omp_get_wtime() : 0.0;
+    {
+        NBODY_PROFILE_PHASE(&profiler, Phase::Kick);
+        #pragma omp parallel
+        {
+            NBODY_PROFILE_WORKER(&profiler);
+            #pragma omp for nowait
+            for (size_t i = 0; i < n; ++i) {
+                v_x[i] += 0.5 * a_x[i] * time_delta;
+                v_y[i] += 0.5 * a_y[i] * time_delta;
+            }
+            #pragma omp for nowait
+            for (size_t i = 0; i < n_tracers; ++i) {
+                t_v_x[i] += 0.5 * t_a_x[i] * time_delta;
+                t_v_y[i] += 0.5 * t_a_y[i] * time_delta;
+            }
+        }
+    }
+    if (phase_timing) {
+        phase_times.kick += omp_get_wtime() - start;
+    }
+}
+
+void Kosmos::fused_verlet_step(double time_delta) {
+    const size_t n = particles.size();
+    double * x = particles.x.data();
+    double * y = particles.y.data();
+    double * v_x = particles.v_x.data();
+    double * v_y = particles.v_y.data();
+    double * a_x = particles.a_x.data();
+    double * a_y = particles.a_y.data();
+    const double * mass = particles.mass.data();
+    const size_t n_tracers = tracers.size();
+    double * t_x = tracers.x.data();
+    double * t_y = tracers.y.data();
+    double * t_v_x = tracers.v_x.data();
+    double * t_v_y = tracers.v_y.data();
+    double * t_a_x = tracers.a_x.data();
+    double * t_a_y = tracers.a_y.data();
+    const bool forces_first = !forces_valid;
+    // add_body, set_body, invalidate_forces and the solver settings only drop
+    // forces_valid, calculate_forces is what drops the tracers' field with it.
+    // the force pass here does not go through it, so new body forces mean new
+    // tracer forces too
+    const bool tracer_forces_first = n_tracers > 0 && (forces_first || !tracer_forces_valid);
+    const bool with_potential = potential_wanted;
+
+    // one region for the whole step instead of a fork and join per stage. every
+    // thread owns the same targets in the force pass and in the kicks and drift
+    // around it, so the only barriers are the ones the data needs: nobody drifts
+    // before every force pass that reads the old positions is done, nobody reads
+    // the new positions before every drift is done. the kick after the force
+    // pass only touches the thread's own bodies, no barrier before it
+    direct.prepare(x, y, mass, n, with_potential);
+    double stamps[4] = {0.0, 0.0, 0.0, 0.0};
+    const double start = phase_timing ? omp_get_wtime() : 0.0;
+    #pragma omp parallel proc_bind(close)
+    {
+        const int thread = omp_get_thread_num();
+        const int threads = omp_get_num_threads();
+        const TiledDirectSolver::TargetRange bodies = direct.target_range(n, thread, threads);
+        const TiledDirectSolver::TargetRange tracer_range = direct.target_range(n_tracers, thread, threads);
+
+        // accelerations at the current positions, normally still there from the
+        // end of the previous step since nothing moved in between
+        if (forces_first) {
+            direct.evaluate_range(x, y, bodies, x, y, mass, n, a_x, a_y);
+        }
+        if (tracer_forces_first) {
+            direct.evaluate_range(t_x, t_y, tracer_range, x, y, mass, n, t_a_x, t_a_y);
+        }
+        if (forces_first || tracer_forces_first) {
+            #pragma omp barrier
+        }
+        if (phase_timing && thread == 0) {
+            stamps[0] = omp_get_wtime();
+        }
+
+        // first half of velocity verlet (same as Body::update)
+        for (size_t i = bodies.begin; i < bodies.end; ++i) {
+            v_x[i] += 0.5 * a_x[i] * time_delta;
+            v_y[i] += 0.5 * a_y[i] * time_delta;
+            x[i] += v_x[i] * time_delta;
+            y[i] += v_y[i] * time_delta;
+        }
+        for (size_t i = tracer_range.begin; i < tracer_range.end; ++i) {
+            t_v_x[i] += 0.5 * t_a_x[i] * time_delta;
+            t_v_y[i] += 0.5 * t_a_y[i] * time_delta;
+            t_x[i] += t_v_x[i] * time_delta;
+            t_y[i] += t_v_y[i] * time_delta;
+        }
+        #pragma omp barrier
+        if (phase_timing && thread == 0) {
+            stamps[1] = omp_get_wtime();
+        }
+
+        // accelerations at the new positions, then the second half of the kick
+        direct.evaluate_range(x, y, bodies, x, y, mass, n, a_x, a_y, with_potential);
+        if (n_tracers > 0) {
+            direct.evaluate_range(t_x, t_y, tracer_range, x, y, mass, n, t_a_x, t_a_y);
+        }
+        if (phase_timing && thread == 0) {
+            stamps[2] = omp_get_wtime();
+        }
+        for (size_t i = bodies.begin; i < bodies.end; ++i) {
+            v_x[i] += 0.5 * a_x[i] * time_delta;
+            v_y[i] += 0.5 * a_y[i] * time_delta;
+        }
+        for (size_t i = tracer_range.begin; i < tracer_range.end; ++i) {
+            t_v_x[i] += 0.5 * t_a_x[i] * time_delta;
+            t_v_y[i] += 0.5 * t_a_y[i] * time_delta;
+        }
+    }
+    if (with_potential) {
+        potential = direct.potential_sum(mass, n);
+    }
+    forces_valid = true;
+    jerks_valid = false;
+    potential_valid = with_potential;
+    tracer_forces_valid = true;
+    force_evaluations += static_cast<long long>(forces_first ? 2 * n : n);
+    if (phase_timing) {
+        // as thread 0 saw it, waiting at a barrier counts toward the stage before it
+        stamps[3] = omp_get_wtime();
+        phase_times.forces += (stamps[0] - start) + (stamps[2] - stamps[1]);
+        phase_times.kick_drift += stamps[1] - stamps[0];
+        phase_times.kick += stamps[3] - stamps[2];
+    }
+}
+
+void Kosmos::block_step(double time_delta) {
+    const size_t n = particles.size();
+    double * x = particles.x.data();
+    double * y = particles.y.data();
+    double * v_x = particles.v_x.data();
+    double * v_y = particles.v_y.data();
+    const double * a_x = particles.a_x.data();
+    const double * a_y = particles.a_y.data();
+
+    if (!forces_valid) {
+        calculate_forces();
+    }
+    block_steps.assign_levels(particles, time_delta);
+    const int max_level = block_steps.get_max_level();
+    const long long substeps = 1LL << max_level;
+    const double h = time_delta / substeps;
+
+    // opening half kick, each body with its own step
+    {
+        NBODY_PROFILE_PHASE(&profiler, Phase::Kick);
+        #pragma omp parallel for
+        for (size_t i = 0; i < n; ++i) {
+            double dt = std::ldexp(time_delta, -block_steps.level(i));
+            v_x[i] += 0.5 * a_x[i] * dt;
+            v_y[i] += 0.5 * a_y[i] * dt;
+        }
+    }
+
+    seen_x.resize(n);
+    seen_y.resize(n);
+    for (long long s = 0; s < substeps; ++s) {
+        // everyone drifts. a body in the middle of a longer step is seen where a
+        // second order predictor puts it: the drift alone runs ahead by
+        // a t (dt - t) / 2 with the half kicked velocity, t into its step of dt.
+        // without this a moon on a fine level sees its planet wobble by a dt^2 / 8
+        {
+            NBODY_PROFILE_PHASE(&profiler, Phase::KickDrift);
+            #pragma omp parallel for
+            for (size_t i = 0; i < n; ++i) {
+                x[i] += v_x[i] * h;
+                y[i] += v_y[i] * h;
+                const long long sub = 1LL << (max_level - block_steps.level(i));
+                const double t = ((s + 1) % sub) * h;
+                const double lag = 0.5 * t * (t - sub * h);
+                seen_x[i] = x[i] + lag * a_x[i];
+                seen_y[i] = y[i] + lag * a_y[i];
+            }
+        }
+
+        size_t count = 0;
+        const uint32_t * active = block_steps.active(s, count);
+        calculate_forces_on(seen_x.data(), seen_y.data(), active, count);
+
+        // closing half kick of the step that just ended, merged with the opening
+        // half of the next one (same level), except at the end of the block
+        const double kick = s + 1 == substeps ? 0.5 : 1.0;
+        NBODY_PROFILE_PHASE(&profiler, Phase::Kick);
+        #pragma omp parallel for
+        for (size_t k = 0; k < count; ++k) {
+            const size_t i = active[k];
+            double dt = std::ldexp(time_delta, -block_steps.level(i));
+            block_steps.close_step(i, a_x[i], a_y[i], dt);
+            v_x[i] += kick * a_x[i] * dt;
+            v_y[i] += kick * a_y[i] * dt;
+        }
+    }
+    // the last sub step had every body active, the cache is current
+    forces_valid = true;
+}
+
+void Kosmos::step(double time_delta, ForceSolver force_solver) {
+    BusyScope scope(*this, "step");
+    ForceSolver previous = this->force_solver;
+    if (force_solver != previous) {
+        this->force_solver = force_solver;
+        forces_valid = false;
+    }
+    integrate(time_delta);
+    if (force_solver != previous) {
+        this->force_solver = previous;
+        forces_valid = false;
+    }
+}
+
+void Kosmos::run(long long num_steps, double time_delta) {
+    run(num_steps, time_delta, 0, SampleCallback());
+}
+
+long long Kosmos::run(long long num_steps, double time_delta, long long sample_every,
+                      const SampleCallback & callback) {
+    if (sample_every < 0) {
+        throw std::invalid_argument("sample_every must be >= 0");
+    }
+    BusyScope scope(*this, "run");
+    // the cache carries from one step to the next, so only the very first
+    // step (or one right after a mutation) pays for two force passes
+    long long taken = 0;
+    while (taken < num_steps && !cancel_requested.load(std::memory_order_relaxed)) {
+        integrate(time_delta);
+        ++taken;
+        if (callback && sample_every > 0 && taken % sample_every == 0 && !callback(*this)) {
+            break;
+        }
+    }
+    // a cancel only stops the run it was meant for
+    cancel_requested.store(false);
+    return taken;
+}
+
+AdaptiveReport Kosmos::advance(double end_time, const AdaptiveOptions & options) {
+    if (!(options.eta >= 0.0) || !(options.energy_tolerance >= 0.0) || !(options.length > 0.0)) {
+        throw std::invalid_argument("eta and energy_tolerance must be >= 0 and length > 0");
+    }
+    if (options.eta == 0.0 && options.energy_tolerance == 0.0) {
+        throw std::invalid_argument("advance needs eta > 0 or energy_tolerance > 0 to pick a step");
+    }
+    if (options.eta == 0.0 && options.initial_dt <= 0.0) {
+        throw std::invalid_argument("with eta = 0 the first step has to come from initial_dt");
+    }
+    if (!(options.min_dt >= 0.0) || !(options.max_dt > 0.0) || options.min_dt > options.max_dt) {
+        throw std::invalid_argument("need 0 <= min_dt <= max_dt and max_dt > 0");
+    }
+    BusyScope scope(*this, "advance");
+
+    AdaptiveReport report;
+    const bool check_energy = options.energy_tolerance > 0.0;
+    // every force pass sums the potential too, so checking a step costs no extra pass
+    potential_wanted = check_energy;
+    double energy = check_energy ? measure().get_energy() : 0.0;
+    double next_dt = options.initial_dt; // what the energy check allows next, 0 = no limit yet
+    Particles saved; // state before the step, only kept with the energy check
+    Particles saved_tracers;
+    bool saved_forces_valid = false;
+    bool saved_tracer_forces_valid = false;
+
+    while (time < end_time && !cancel_requested.load(std::memory_order_relaxed)) {
+        if (!forces_valid) {
+            calculate_forces();
+        }
+        double time_delta = options.eta > 0.0 ? acceleration_time_step(particles, options.eta, options.length)
+                                              : HUGE_VAL;
+        if (next_dt > 0.0) {
+            time_delta = std::min(time_delta, next_dt);
+        }
+        time_delta = std::max(options.min_dt, std::min(time_delta, options.max_dt));
+        const double remaining = end_time - time;
+        const bool last = time_delta >= remaining;
+        if (last) {
+            time_delta = remaining;
+        }
+
+        if (check_energy) {
+            saved = particles;
+            saved_tracers = tracers;
+            saved_forces_valid = forces_valid;
+            saved_tracer_forces_valid = tracer_forces_valid;
+        }
+        take_step(time_delta);
+
+        double error = 0.0;
+        if (check_energy) {
+            const double new_energy = measure().get_energy();
+            error = std::fabs(new_energy - energy) / (energy != 0.0 ? std::fabs(energy) : 1.0);
+            if (error > options.energy_tolerance && time_delta > options.min_dt) {
+                // undo and retry smaller, the error of a verlet step goes like dt^2
+                RejectedStep rejected = {time, time_delta, error};
+                report.rejected.push_back(rejected);
+                // copied back rather than swapped, numpy views point into the live arrays
+                particles.copy_values(saved);
+                tracers.copy_values(saved_tracers);
+                forces_valid = saved_forces_valid;
+                tracer_forces_valid = saved_tracer_forces_valid;
+                jerks_valid = false;
+                potential_valid = false;
+                block_steps.reset();
+                next_dt = std::max(options.min_dt,
+                                   time_delta * std::max(0.1, 0.9 * std::sqrt(options.energy_tolerance / error)));
+                continue;
+            }
+            energy = new_energy;
+            next_dt = time_delta * (error > 0.0 ? std::min(2.0, 0.9 * std::sqrt(options.energy_tolerance / error)) : 2.0);
+        }
+
+        finish_step(time_delta);
+        if (check_energy && collisions.get_last_changed()) {
+            // a merge, an inelastic bounce or a push changes the energy on purpose,
+            // the next step is checked against what is left
+            energy = measure().get_energy();
+        }
+        report.dt_history.push_back(time_delta);
+        report.energy_errors.push_back(error);
+        if (last) {
+            time = end_time; // no rounding left over
+            break;
+        }
+    }
+    potential_wanted = false;
+    report.finished = time >= end_time;
+    cancel_requested.store(false);
+    return report;
+}
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < bodies.size(); ++i) {
-        bodies[i].compute_acceleration();
+void Kosmos::add_body(const Body & newBody) {
+    BusyScope scope(*this, "add_body");
+    if (trajectory) {
+        throw std::logic_error("cannot add a body while a trajectory is attached, its frames have a fixed size");
     }
-    
-    // update again
-    #pragma omp parallel for
-    for (size_t i = 0; i < bodies.size(); ++i) {
-        bodies[i].update_velocity(time_delta);
+    if (arrays_pinned()) {
+        throw std::runtime_error("cannot add a body while views of the particle arrays are alive");
     }
-}
\ No newline at end of file
+    particles.push_back(newBody);
+    ids.push_back(next_id++);
+    if (!by_id.empty()) {
+        by_id.push_back(static_cast<uint32_t>(particles.size() - 1)); // the newest id sorts last
+    }
+    forces_valid = false;
+}
+
+void Kosmos::set_body(size_t i, const Body & body) {
+    BusyScope scope(*this, "set_body");
+    if (i >= particles.size()) {
+        throw std::out_of_range("body index out of range");
+    }
+    particles.set_body(by_id.empty() ? i : by_id[i], body);
+    forces_valid = false;
+    block_steps.reset();
+}
+
+void Kosmos::add_tracer(const Body & tracer) {
+    BusyScope scope(*this, "add_tracer");
+    tracers.push_back(tracer);
+    tracers.mass.back() = 0.0;
+    tracer_forces_valid = false;
+}
+
+void Kosmos::add_tracers(const Particles & added) {
+    BusyScope scope(*this, "add_tracers");
+    const size_t first = tracers.size();
+    const size_t count = added.size();
+    tracers.resize(first + count);
+    std::copy(added.x.begin(), added.x.end(), tracers.x.begin() + first);
+    std::copy(added.y.begin(), added.y.end(), tracers.y.begin() + first);
+    std::copy(added.v_x.begin(), added.v_x.end(), tracers.v_x.begin() + first);
+    std::copy(added.v_y.begin(), added.v_y.end(), tracers.v_y.begin() + first);
+    tracer_forces_valid = false;
+}
+
+void Kosmos::set_tracer(size_t i, const Body & tracer) {
+    BusyScope scope(*this, "set_tracer");
+    if (i >= tracers.size()) {
+        throw std::out_of_range("tracer index out of range");
+    }
+    tracers.set_body(i, tracer);
+    tracers.mass[i] = 0.0;
+    tracer_forces_valid = false;
+}
+
+void Kosmos::clear_tracers() {
+    BusyScope scope(*this, "clear_tracers");
+    tracers.clear();
+}
+
+void Kosmos::check_not_running(const char * what) const {
+    if (is_running()) {
+        throw std::logic_error(std::string(what) + " is not allowed while the background worker is running, stop it first");
+    }
+    if (busy.load()) {
+        throw std::logic_error(std::string(what) + " is not allowed while a step, run or advance is going on");
+    }
+}
+
+void Kosmos::check_readable(const char * what) const {
+    if (is_running()) {
+        throw std::logic_error(std::string(what) + " reads the state the background worker is changing, "
+                               "read latest_frame instead or stop it first");
+    }
+    if (busy.load()) {
+        throw std::logic_error(std::string(what) + " reads the state a step, run or advance is changing, "
+                               "wait for it to return");
+    }
+}
+
+Kosmos::BusyScope::BusyScope(const Kosmos & kosmos, const char * what) : kosmos(kosmos) {
+    kosmos.check_not_running(what);
+    // two threads past the check at once, only one gets the flag
+    bool idle = false;
+    if (!kosmos.busy.compare_exchange_strong(idle, true)) {
+        throw std::logic_error(std::string(what) + " is not allowed while a step, run or advance is going on");
+    }
+}
+
+Kosmos::BusyScope::~BusyScope() {
+    kosmos.busy.store(false);
+}
+
+void Kosmos::start(double time_delta, long long publish_every) {
+    if (publish_every < 1) {
+        throw std::invalid_argument("publish_every must be >= 1");
+    }
+    check_not_running("start");
+    check_step_setup();
+    // a worker that ended on an error is still to be joined, its error goes out here
+    stop();
+    frames.reset();
+    worker_stop.store(false);
+    worker_paused.store(false);
+    worker_running.store(true);
+    worker = std::thread(&Kosmos::worker_loop, this, time_delta, publish_every);
+}
+
+void Kosmos::stop() {
+    if (!worker.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_stop.store(true);
+    }
+    worker_wake.notify_all();
+    worker.join();
+    worker_paused.store(false);
+    worker_running.store(false);
+    if (worker_error) {
+        std::exception_ptr error;
+        error.swap(worker_error);
+        std::rethrow_exception(error);
+    }
+}
+
+void Kosmos::pause() {
+    worker_paused.store(true);
+}
+
+void Kosmos::resume() {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_paused.store(false);
+    }
+    worker_wake.notify_all();
+}
+
+void Kosmos::publish_frame() {
+    Frame & frame = frames.back();
+    frame.step = step_count;
+    frame.time = time;
+    // same size every time, so no allocations after the first few
+    if (by_id.empty()) {
+        frame.particles = particles;
+    } else {
+        gather_by_id(frame.particles);
+    }
+    frames.publish();
+}
+
+void Kosmos::worker_loop(double time_delta, long long publish_every) {
+    try {
+        // the starting state goes out first so readers have a frame straight away
+        publish_frame();
+        long long since_publish = 0;
+        while (!worker_stop.load()) {
+            if (worker_paused.load()) {
+                std::unique_lock<std::mutex> lock(worker_mutex);
+                worker_wake.wait(lock, [this] { return worker_stop.load() || !worker_paused.load(); });
+                continue;
+            }
+            integrate(time_delta);
+            if (++since_publish == publish_every) {
+                since_publish = 0;
+                publish_frame();
+            }
+        }
+    } catch (...) {
+        // escaping the thread would terminate the whole process, stop() hands it on.
+        // running goes false last, once nothing here touches the state any more
+        worker_error = std::current_exception();
+        worker_running.store(false);
+    }
+}
+
+void Kosmos::attach_trajectory(const std::string & path, unsigned fields, long long every, bool float32) {
+    BusyScope scope(*this, "attach_trajectory");
+    if (collisions.get_mode() == CollisionMode::Merge) {
+        throw std::logic_error("cannot attach a trajectory while collisions merge bodies, its frames have a fixed size");
+    }
+    close_trajectory();
+    trajectory.reset(new TrajectoryWriter(path, particles.size(), fields, every, float32));
+    // the first frame is written before any step, make its accelerations real
+    if ((fields & (TRAJ_A_X | TRAJ_A_Y)) && !forces_valid) {
+        calculate_forces();
+    }
+    trajectory->append(step_count, time, get_particles_by_id());
+}
+
+void Kosmos::detach_trajectory() {
+    // the worker and the steps append to the writer
+    BusyScope scope(*this, "detach_trajectory");
+    close_trajectory();
+}
+
+void Kosmos::close_trajectory() {
+    if (!trajectory) {
+        return;
+    }
+    // drop the writer even if finishing the file throws
+    std::unique_ptr<TrajectoryWriter> writer(trajectory.release());
+    writer->close();
+}
+
+void Kosmos::save_checkpoint(const std::string & path) const {
+    // the worker would be moving the arrays while they are written
+    BusyScope scope(*this, "save_checkpoint");
+    CheckpointHeader header = CheckpointHeader();
+    header.step_count = step_count;
+    header.time = time;
+    header.force_solver = static_cast<uint32_t>(force_solver);
+    header.flags = (forces_valid ? CHECKPOINT_FORCES_VALID : 0) | (get_quadrupole() ? CHECKPOINT_QUADRUPOLE : 0);
+    header.theta = get_theta();
+    header.fmm_order = get_fmm_order();
+    header.tile_size = direct.get_requested_tile_size();
+    header.flags |= direct.get_precision() == Precision::Mixed ? CHECKPOINT_MIXED_PRECISION : 0;
+    header.block_eta = block_steps.get_eta();
+    header.block_max_level = block_steps.get_max_level();
+    header.integrator = static_cast<uint32_t>(integrator);
+    header.flags |= static_cast<uint32_t>(collisions.get_mode()) << CHECKPOINT_COLLISIONS_SHIFT;
+    header.restitution = collisions.get_restitution();
+    header.next_id = next_id;
+    write_checkpoint(path, header, particles, &tracers, &ids);
+}
+
+void Kosmos::load_checkpoint(const std::string & path) {
+    BusyScope scope(*this, "load_checkpoint");
+    if (arrays_pinned()) {
+        throw std::logic_error("cannot load a checkpoint while views of the particle arrays are alive");
+    }
+    if (trajectory) {
+        throw std::logic_error("cannot load a checkpoint while a trajectory is attached, detach it first");
+    }
+
+    CheckpointHeader header;
+    Particles restored, restored_tracers;
+    std::vector<uint32_t> restored_ids;
+    read_checkpoint(path, header, restored, &restored_tracers, &restored_ids);
+    if (header.force_solver > static_cast<uint32_t>(ForceSolver::FMM)) {
+        throw std::runtime_error("checkpoint '" + path + "' names an unknown force solver");
+    }
+    if (header.integrator > static_cast<uint32_t>(Integrator::Hermite4)
+        || (header.integrator != 0 && header.block_max_level > 0)) {
+        throw std::runtime_error("checkpoint '" + path + "' names an unknown integrator setup");
+    }
+    uint32_t restored_next_id = static_cast<uint32_t>(restored.size());
+    if (!restored_ids.empty()) {
+        // every id below next_id and none twice, or the id order cannot be rebuilt
+        restored_next_id = header.next_id;
+        std::vector<unsigned char> seen(restored_next_id, 0);
+        for (uint32_t id : restored_ids) {
+            if (id >= restored_next_id || seen[id]) {
+                throw std::runtime_error("checkpoint '" + path + "' has bad body ids");
+            }
+            seen[id] = 1;
+        }
+    }
+    const uint32_t collision_mode = (header.flags >> CHECKPOINT_COLLISIONS_SHIFT) & 3;
+    if (collision_mode > static_cast<uint32_t>(CollisionMode::Bounce)) {
+        throw std::runtime_error("checkpoint '" + path + "' names an unknown collision mode");
+    }
+
+    // files from before collisions have no radii and no restitution either
+    const double restitution = (header.flags & CHECKPOINT_RADII) ? header.restitution : 1.0;
+    // the setters validate and may throw, so every setting goes through them on
+    // a throwaway object first. past this point nothing throws and a failed
+    // load has left the kosmos as it was
+    BarnesHutSolver checked_tree;
+    checked_tree.set_theta(header.theta);
+    FmmSolver checked_fmm;
+    checked_fmm.set_order(header.fmm_order);
+    TiledDirectSolver checked_direct(header.tile_size);
+    BlockTimesteps checked_steps;
+    if (header.block_eta != 0.0) {
+        checked_steps.set_eta(header.block_eta);
+    }
+    checked_steps.set_max_level(header.block_max_level);
+    Collisions checked_collisions;
+    checked_collisions.set_restitution(restitution);
+
+    barnes_hut.set_theta(header.theta);
+    barnes_hut.set_quadrupole((header.flags & CHECKPOINT_QUADRUPOLE) != 0);
+    fmm.set_order(header.fmm_order);
+    direct.set_tile_size(header.tile_size);
+    direct.set_precision((header.flags & CHECKPOINT_MIXED_PRECISION) ? Precision::Mixed : Precision::Double);
+    if (header.block_eta != 0.0) {
+        block_steps.set_eta(header.block_eta);
+    }
+    block_steps.set_max_level(header.block_max_level);
+    collisions.set_restitution(restitution);
+    collisions.set_mode(static_cast<CollisionMode>(collision_mode));
+    integrator = static_cast<Integrator>(header.integrator);
+    force_solver = static_cast<ForceSolver>(header.force_solver);
+
+    std::swap(particles, restored);
+    std::swap(tracers, restored_tracers);
+    if (restored_ids.empty()) {
+        reset_ids(); // older files, ids in file order
+    } else {
+        ids.swap(restored_ids);
+        next_id = restored_next_id;
+        rebuild_by_id();
+    }
+    tracer_forces_valid = false; // one pass over the bodies brings them back
+    time = header.time;
+    step_count = header.step_count;
+    forces_valid = (header.flags & CHECKPOINT_FORCES_VALID) != 0;
+    jerks_valid = false; // not saved, the next hermite step recomputes them
+    potential_valid = false; // nor is the potential, what is cached belongs to the old bodies
+    // the jerk history is not saved, the first block step after a load sizes
+    // its levels from |v| / |a| instead
+    block_steps.reset();
+}
@@ -1,24 +1,527 @@
 #ifndef KOSMOS_HPP
 #define KOSMOS_HPP
 #include "../body/body.hpp"
+#include "../particles/particles.hpp"
+#include "../forces/barnes_hut.hpp"
+#include "../forces/fmm.hpp"
+#include "../forces/morton.hpp"
+#include "../forces/symmetric.hpp"
+#include "../forces/tiled.hpp"
+#include "adaptive.hpp"
+#include "block_timestep.hpp"
+#include "collisions.hpp"
+#include "diagnostics.hpp"
+#include "phase_times.hpp"
+#include "../profile/profiler.hpp"
+#include "integrators.hpp"
+#include "frame_buffer.hpp"
+#include "../io/trajectory.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>   
+
+// how calculate_forces gets the accelerations
+enum class ForceSolver {
+    Direct, // exact all pairs sum, O(N^2), sources tiled for the cache
+    DirectSymmetric, // exact, each pair once with +-F, per thread buffers
+    BarnesHut, // quadtree, O(N log N), error set by the opening angle theta
+    FMM // fast multipole, O(N), error set by the expansion order
+};
+
 class Kosmos {
-    std::vector<Body> bodies;
+    Particles particles; // soa storage, Body is only the import/export type
+    // massless test particles, own soa storage, mass stays zero. they feel the
+    // bodies' field and add nothing to it
+    Particles tracers;
     float time_delta;
+    ForceSolver force_solver;
+    Integrator integrator;
+    TiledDirectSolver direct;
+    BarnesHutSolver barnes_hut;
+    FmmSolver fmm;
+    SymmetricDirectSolver symmetric;
+    // accelerations in particles match the current positions, so the next
+    // step can skip its first force pass (first same as last)
+    bool forces_valid;
+    bool tracer_forces_valid; // tracer accelerations match the current bodies and tracers
+    AlignedArray j_x, j_y; // jerks for hermite, valid with the forces after a hermite step
+    AlignedArray hermite_start; // x, y, v, a, j at the start of a hermite step
+    bool jerks_valid;
+    // potential energy summed by the last full force pass, valid with the forces
+    // when that pass was asked for it (potential_wanted)
+    double potential;
+    bool potential_valid;
+    bool potential_wanted;
+    long long diagnostics_every; // record diagnostics every this many steps, 0 = never
+    std::vector<Diagnostics> diagnostics_history;
+    double time; // simulated seconds so far
+    long long step_count;
+    // outside views into the particle arrays, see pin_arrays. atomic, the
+    // reorder in finish_step reads it on whichever thread steps
+    std::atomic<int> pinned_views;
+    std::atomic<bool> cancel_requested; // set from any thread, run checks it every step
+    BlockTimesteps block_steps; // per body power of two steps, off unless max_level > 0
+    Collisions collisions; // contacts between bodies with a radius, off by default
+    // body ids: ids[i] is the id (insertion number) of the body stored at i.
+    // by_id has the storage indices in id order, empty while that is just
+    // 0..n-1, which it stays until the first reorder
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> by_id;
+    uint32_t next_id;
+    long long reorder_every; // sort the storage along the curve every this many steps, 0 = never
+    SpaceFillingCurve reorder_curve;
+    long long reorders;
+    std::vector<uint64_t> reorder_keys;
+    std::vector<uint32_t> reorder_order; // storage index of the body going to each slot
+    AlignedArray reorder_scratch;
+    mutable Particles id_ordered; // the bodies in id order, for frames and snapshots
+    long long force_evaluations; // body accelerations computed so far
+    bool phase_timing;
+    PhaseTimes phase_times;
+    Profiler profiler; // only fed in NBODY_PROFILE builds
+    AlignedArray seen_x, seen_y; // predicted positions the block sub step forces use
+    AlignedArray block_x, block_y, block_a_x, block_a_y; // scratch for the active bodies
+    std::vector<unsigned char> block_mask;
+
+    // background mode, a worker thread steps and publishes frames for readers
+    FrameBuffer frames;
+    std::thread worker;
+    std::mutex worker_mutex; // only guards the pause / stop wake up
+    std::condition_variable worker_wake;
+    std::atomic<bool> worker_running;
+    std::atomic<bool> worker_paused;
+    std::atomic<bool> worker_stop;
+    std::exception_ptr worker_error; // what ended the worker early, stop rethrows it
+    // a step, run or advance (or a call that moves or reallocates the arrays)
+    // is going on. the bindings release the gil for those, so other python
+    // threads get refused by check_not_running like with the worker
+    mutable std::atomic<bool> busy;
+
+    std::unique_ptr<TrajectoryWriter> trajectory; // frames go here every few steps when attached
     public:
-        Kosmos(const std::vector<Body> & InitalBodies) : bodies(InitalBodies), time_delta(0.0f) {
-            this -> bodies = InitalBodies;
+        // called by run every sample_every steps, return false to stop the run
+        typedef std::function<bool(const Kosmos &)> SampleCallback;
 
+        Kosmos(const std::vector<Body> & InitalBodies, ForceSolver force_solver = ForceSolver::Direct)
+            : particles(InitalBodies), time_delta(0.0f), force_solver(force_solver),
+              integrator(Integrator::Verlet), forces_valid(false), tracer_forces_valid(false), jerks_valid(false),
+              potential(0.0), potential_valid(false), potential_wanted(false), diagnostics_every(0),
+              time(0.0), step_count(0), pinned_views(0),
+              cancel_requested(false), next_id(0), reorder_every(0), reorder_curve(SpaceFillingCurve::Morton),
+              reorders(0), force_evaluations(0), phase_timing(false),
+              worker_running(false), worker_paused(false), worker_stop(false), busy(false) {
+            particles.first_touch();
+            reset_ids();
+            attach_profiler();
+        }
+        // bulk version, takes the soa arrays as they are
+        Kosmos(const Particles & particles, ForceSolver force_solver = ForceSolver::Direct)
+            : particles(particles), time_delta(0.0f), force_solver(force_solver),
+              integrator(Integrator::Verlet), forces_valid(false), tracer_forces_valid(false), jerks_valid(false),
+              potential(0.0), potential_valid(false), potential_wanted(false), diagnostics_every(0),
+              time(0.0), step_count(0), pinned_views(0),
+              cancel_requested(false), next_id(0), reorder_every(0), reorder_curve(SpaceFillingCurve::Morton),
+              reorders(0), force_evaluations(0), phase_timing(false),
+              worker_running(false), worker_paused(false), worker_stop(false), busy(false) {
+            this->particles.first_touch();
+            reset_ids();
+            attach_profiler();
         }
-        void calculate_forces(); // calculate forces between all bodies
+        ~Kosmos();
+        void calculate_forces(); // calculate accelerations between all bodies
         void step(double time_delta); // step the simulation forward by time_delta seconds
-        const std::vector<Body> & get_bodies() const {
-            return bodies;
+        void step(double time_delta, ForceSolver force_solver); // one step with a different solver
+        void run(long long num_steps, double time_delta); // many steps, one force pass each
+        // same loop, handing the state to callback after every sample_every steps
+        // (0 = never), returns how many steps were taken before it finished or stopped.
+        // the kosmos counts as busy until run returns: callback reads it through
+        // get_particles / get_particles_by_id, the guarded calls throw
+        long long run(long long num_steps, double time_delta, long long sample_every,
+                      const SampleCallback & callback);
+        // steps until end_time with a time step picked every step (see adaptive.hpp),
+        // the last one is cut to land on end_time. stops early on cancel
+        AdaptiveReport advance(double end_time, const AdaptiveOptions & options = AdaptiveOptions());
+        // background mode: a worker thread keeps calling step(time_delta) and
+        // publishes a frame every publish_every steps (plus the starting state).
+        // while it runs everything that reads or changes the state it steps
+        // (steps, bodies, tracers, settings, histories) throws std::logic_error,
+        // the readers pointing at latest_frame.
+        // start throws for a setup step would refuse. if a step throws anyway
+        // (say the trajectory file fills the disk) the worker ends, is_running
+        // turns false and stop rethrows the exception
+        void start(double time_delta, long long publish_every = 1);
+        void stop(); // joins the worker, the kosmos keeps the state it reached
+        void pause();
+        void resume();
+        bool is_running() const {
+            return worker_running.load();
         }
-    private:
-        void addBody(const Body & newBody) {
-            bodies.push_back(newBody);
+        bool is_paused() const {
+            return worker_paused.load();
+        }
+        // newest complete frame, never blocks the worker. one reader thread at a
+        // time, the frame stays valid until that reader calls again or start
+        const Frame * latest_frame() {
+            return frames.latest();
+        }
+        long long get_frames_published() const {
+            return frames.get_frames_published();
+        }
+        // frames the worker replaced before any reader picked them up
+        long long get_frames_dropped() const {
+            return frames.get_frames_dropped();
+        }
+
+        // full state (bodies, cached forces, time, step count, solver settings) to
+        // one binary file and back, see io/checkpoint.hpp. load keeps the current
+        // state if the file is bad and throws std::runtime_error
+        void save_checkpoint(const std::string & path) const;
+        void load_checkpoint(const std::string & path);
+
+        // stream frames to a trajectory file: the current state right away, then
+        // every `every` steps. the body count is fixed while attached
+        void attach_trajectory(const std::string & path, unsigned fields = TRAJ_X | TRAJ_Y,
+                               long long every = 1, bool float32 = false);
+        // waits for the pending writes and finishes the file, throws
+        // std::logic_error while the background worker runs
+        void detach_trajectory();
+        bool has_trajectory() const {
+            return trajectory != nullptr;
+        }
+
+        // ask a run going on in another thread to stop after its current step,
+        // with no run going the next one stops before its first step
+        void cancel() {
+            cancel_requested.store(true);
+        }
+        // in id order (the order they were given in), whatever the storage order
+        std::vector<Body> get_bodies() const;
+        size_t get_body_count() const {
+            check_readable("get_body_count");
+            return particles.size();
+        }
+        // the storage arrays, in storage order (see reorder). unguarded, for
+        // run callbacks and drivers that know no worker is running
+        const Particles & get_particles() const {
+            return particles;
+        }
+        // writes through this must be followed by invalidate_forces
+        Particles & get_particles() {
+            return particles;
+        }
+        // copy of the storage in id order, the particles themselves while the
+        // two agree. valid until the next call, one caller at a time
+        const Particles & get_particles_by_id() const;
+        double get_time() const {
+            return time;
+        }
+        long long get_step_count() const {
+            return step_count;
         }
+        // accelerations of single bodies computed so far, a full force pass adds
+        // the body count, a block sub step only its active bodies
+        long long get_force_evaluations() const {
+            return force_evaluations;
+        }
+        // time every phase of step (forces, kicks, drift), see PhaseTimes
+        void set_phase_timing(bool on) {
+            check_not_running("set_phase_timing");
+            phase_timing = on;
+        }
+        bool get_phase_timing() const {
+            return phase_timing;
+        }
+        const PhaseTimes & get_phase_times() const {
+            check_readable("get_phase_times");
+            return phase_times;
+        }
+        void reset_phase_times() {
+            check_not_running("reset_phase_times");
+            phase_times = PhaseTimes();
+        }
+
+        // per phase and per step timings, load imbalance across the openmp threads
+        // and (after enable_hardware_counters) cycles / instructions / cache misses.
+        // recorded only when built with NBODY_PROFILE (make PROFILE=1), otherwise
+        // stats().enabled is false and everything reads zero
+        ProfileStats stats() const;
+        void reset_stats();
+        // chrome trace json of the recorded phases, open in chrome://tracing or perfetto
+        void write_trace(const std::string & path) const;
+        bool enable_hardware_counters();
+
+        // energy, momentum and angular momentum right now. right after a step
+        // that recorded diagnostics (or inside advance) the potential is already
+        // there, otherwise this costs one force pass
+        Diagnostics get_diagnostics();
+        // record diagnostics every `every` steps (0 = off), the last force pass of
+        // those steps sums the potential alongside the forces, about one more
+        // fma per pair. read the history after stop() in background mode
+        void set_diagnostics_every(long long every);
+        long long get_diagnostics_every() const {
+            return diagnostics_every;
+        }
+        const std::vector<Diagnostics> & get_diagnostics_history() const {
+            check_readable("get_diagnostics_history");
+            return diagnostics_history;
+        }
+        void clear_diagnostics_history() {
+            check_not_running("clear_diagnostics_history");
+            diagnostics_history.clear();
+        }
+        // relative total energy change between the first and last record, 0 with fewer than two
+        double get_energy_drift() const;
+
+        // changing bodies drops the cached accelerations. set_body takes the
+        // position in get_bodies, a new body gets the next id
+        void add_body(const Body & newBody);
+        void set_body(size_t i, const Body & body);
+
+        // reordering: every reorder_every steps (0 = never, the default) the
+        // storage is sorted along a morton or hilbert curve (parallel radix
+        // sort of the curve keys), so bodies close in space sit close in
+        // memory for the tree builds, the mixed precision tiles and the
+        // collision grid. every body keeps its id, its insertion number:
+        // get_bodies, set_body, trajectory frames, background frames and
+        // collision events go by id, get_particles and the numpy views are in
+        // storage order with get_storage_ids saying who sits where. bodies
+        // merged away drop out of the ids. skipped while views are alive
+        long long get_reorder_every() const {
+            return reorder_every;
+        }
+        void set_reorder_every(long long every); // throws std::invalid_argument below 0
+        SpaceFillingCurve get_reorder_curve() const {
+            return reorder_curve;
+        }
+        void set_reorder_curve(SpaceFillingCurve curve) {
+            check_not_running("set_reorder_curve");
+            reorder_curve = curve;
+        }
+        // sort the storage now, whatever the interval. throws std::logic_error
+        // while views of the arrays are alive
+        void reorder();
+        long long get_reorder_count() const {
+            return reorders;
+        }
+        // ids of the bodies in get_bodies order
+        std::vector<uint32_t> get_ids() const;
+        // ids of the bodies in storage order
+        const std::vector<uint32_t> & get_storage_ids() const {
+            check_readable("get_storage_ids");
+            return ids;
+        }
+        void invalidate_forces() {
+            check_not_running("invalidate_forces");
+            forces_valid = false;
+        }
+
+        // tracers: massless test particles (debris, dust, spacecraft) that feel
+        // the bodies' gravity but do not source any. a step costs
+        // bodies x (bodies + tracers) pairs instead of (bodies + tracers)^2, and
+        // the tracer field always comes from the direct sum over the bodies,
+        // whatever the solver. they move with verlet, forest ruth or yoshida 6,
+        // a step with hermite or block time steps throws std::logic_error while
+        // there are any. checkpoints keep them, trajectory frames and
+        // diagnostics are the bodies only. the mass of a Body given is ignored
+        void add_tracer(const Body & tracer);
+        // bulk version, appends the x, y, v_x, v_y of tracers
+        void add_tracers(const Particles & tracers);
+        void set_tracer(size_t i, const Body & tracer); // throws std::out_of_range
+        void clear_tracers();
+        size_t get_tracer_count() const {
+            return tracers.size();
+        }
+        std::vector<Body> get_tracers() const {
+            check_readable("get_tracers");
+            return tracers.to_bodies();
+        }
+        const Particles & get_tracer_particles() const {
+            check_readable("get_tracer_particles");
+            return tracers;
+        }
+
+        // collisions: a body with a radius (Body::radius, 0 = a point) touches
+        // another when their distance drops below the sum of the radii. after
+        // every step a uniform grid broad phase (see SpatialHash, O(N) and
+        // parallel) finds the touching pairs, which then merge (mass, momentum
+        // and volume add up, the arrays shrink in place and the bodies after
+        // a merged one move down) or bounce. every collision goes to a fixed
+        // size log. tracers never collide. merging needs a fixed body count
+        // for trajectories, so it throws std::logic_error while one is attached
+        CollisionMode get_collision_mode() const {
+            return collisions.get_mode();
+        }
+        void set_collision_mode(CollisionMode mode);
+        // bounce restitution, 1 = elastic (default), throws std::invalid_argument outside [0, 1]
+        double get_restitution() const {
+            return collisions.get_restitution();
+        }
+        void set_restitution(double restitution) {
+            check_not_running("set_restitution");
+            collisions.set_restitution(restitution);
+        }
+        // the newest events, oldest first, at most get_collision_log_capacity of them
+        std::vector<CollisionEvent> get_collision_events() const {
+            check_readable("get_collision_events");
+            return collisions.get_log().events();
+        }
+        // every collision so far, including the ones the log no longer holds
+        long long get_collision_count() const {
+            return collisions.get_log().get_total();
+        }
+        void clear_collision_events() {
+            check_not_running("clear_collision_events");
+            collisions.get_log().clear();
+        }
+        size_t get_collision_log_capacity() const {
+            return collisions.get_log().get_capacity();
+        }
+        void set_collision_log_capacity(size_t capacity) {
+            check_not_running("set_collision_log_capacity");
+            collisions.get_log().set_capacity(capacity);
+        }
+
+        // something outside (the numpy views) points into the particle arrays,
+        // while pinned nothing may reallocate them, so add_body throws. pinning
+        // throws std::logic_error while the worker runs or the kosmos is busy.
+        // the count goes up before that check: a step claiming the kosmos at
+        // the same moment either makes the check throw or sees the pin and
+        // skips its reorder
+        void pin_arrays() {
+            ++pinned_views;
+            try {
+                check_not_running("view");
+            } catch (...) {
+                --pinned_views;
+                throw;
+            }
+        }
+        void unpin_arrays() {
+            --pinned_views;
+        }
+        bool arrays_pinned() const {
+            return pinned_views > 0;
+        }
+
+        // higher order integrators take fewer, bigger steps for the same error.
+        // hermite always uses the direct sum (it needs jerks), whatever the solver
+        Integrator get_integrator() const {
+            return integrator;
+        }
+        void set_integrator(Integrator integrator); // throws std::logic_error with block steps on
+
+        // force solver settings
+        ForceSolver get_force_solver() const {
+            return force_solver;
+        }
+        void set_force_solver(ForceSolver force_solver) {
+            check_not_running("set_force_solver");
+            this->force_solver = force_solver;
+            forces_valid = false;
+        }
+        // direct solver source tile, 0 = auto tune, get returns the size in use
+        int get_tile_size() const {
+            return direct.get_tile_size();
+        }
+        void set_tile_size(int tile_size) {
+            check_not_running("set_tile_size");
+            direct.set_tile_size(tile_size);
+        }
+        // pair math of the direct solver, Mixed runs float pairs around a local
+        // origin with double sums, about twice the pairs per second for ~1e-6 force error
+        Precision get_precision() const {
+            return direct.get_precision();
+        }
+        void set_precision(Precision precision) {
+            check_not_running("set_precision");
+            direct.set_precision(precision);
+            forces_valid = false;
+        }
+        double get_theta() const {
+            return barnes_hut.get_theta();
+        }
+        void set_theta(double theta) {
+            check_not_running("set_theta");
+            barnes_hut.set_theta(theta);
+            forces_valid = false;
+        }
+        bool get_quadrupole() const {
+            return barnes_hut.get_quadrupole();
+        }
+        void set_quadrupole(bool quadrupole) {
+            check_not_running("set_quadrupole");
+            barnes_hut.set_quadrupole(quadrupole);
+            forces_valid = false;
+        }
+        int get_fmm_order() const {
+            return fmm.get_order();
+        }
+        void set_fmm_order(int order) {
+            check_not_running("set_fmm_order");
+            fmm.set_order(order);
+            forces_valid = false;
+        }
+
+        // block time steps: with max_level > 0 a step of time_delta is cut into
+        // 2^max_level sub steps and every body kicks with its own time_delta / 2^level,
+        // chosen at the start of the step from eta * |a| / |da/dt|. only the bodies
+        // whose step ends get new forces, direct and barnes hut skip the rest
+        int get_max_level() const {
+            return block_steps.get_max_level();
+        }
+        void set_max_level(int max_level); // throws std::logic_error unless the integrator is verlet
+        double get_eta() const {
+            return block_steps.get_eta();
+        }
+        void set_eta(double eta) {
+            check_not_running("set_eta");
+            block_steps.set_eta(eta);
+        }
+        // bodies on each level during the last block step, finest last
+        const std::vector<long long> & get_level_counts() const {
+            check_readable("get_level_counts");
+            return block_steps.get_level_counts();
+        }
+    private:
+        // accelerations of the listed bodies only (sources at x, y), the others keep theirs
+        void calculate_forces_on(const double * x, const double * y, const uint32_t * active, size_t count);
+        void integrate(double time_delta); // one step (verlet or block), the body of step
+        void take_step(double time_delta); // moves the bodies, nothing else
+        // time, step count, collisions, diagnostics and trajectory after a kept step
+        void finish_step(double time_delta);
+        void verlet_step(double time_delta);
+        // verlet with the direct solver in one parallel region, see kosmos.cpp
+        void fused_verlet_step(double time_delta);
+        template <typename Scheme>
+        void composed_step(double time_delta);
+        void hermite_step(double time_delta);
+        void calculate_forces_and_jerks();
+        void calculate_tracer_forces(); // tracers in the field of the bodies where they are now
+        Diagnostics measure(); // get_diagnostics without the running check
+        void attach_profiler(); // point the solvers' worker scopes at profiler
+        void block_step(double time_delta);
+        void check_not_running(const char * what) const;
+        void check_readable(const char * what) const; // check_not_running for readers, points at latest_frame
+        // claims busy for one call, throws std::logic_error like check_not_running
+        // when the worker runs or another call has it
+        struct BusyScope {
+            const Kosmos & kosmos;
+            BusyScope(const Kosmos & kosmos, const char * what);
+            ~BusyScope();
+        };
+        void close_trajectory(); // detach_trajectory without the checks
+        void check_step_setup() const; // throws std::logic_error for what take_step refuses
+        void publish_frame();
+        void reset_ids(); // ids 0..n-1 in storage order
+        void rebuild_by_id(); // after the storage order or the ids changed
+        void reorder_storage(); // reorder without the checks
+        void gather_by_id(Particles & out) const;
+        void worker_loop(double time_delta, long long publish_every);
     };
 
-#endif 
\ No newline at end of file
+#endif
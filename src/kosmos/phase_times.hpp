@@ -0,0 +1,17 @@
+#ifndef PHASE_TIMES_HPP
+#define PHASE_TIMES_HPP
+
+// wall clock seconds step spent in each phase since the last reset, only
+// counted while phase timing is on (two clock reads per phase, off by default)
+struct PhaseTimes {
+    double forces; // every force pass, whatever the integrator
+    double kick_drift; // opening half kick and drift, fused in one loop (verlet stages)
+    double kick; // closing half kick (verlet stages)
+    double total; // whole steps, what the phases leave over is integrator bookkeeping
+    double reorder; // sorting the storage along the curve, after the steps it follows (not in total)
+    long long steps;
+
+    PhaseTimes() : forces(0.0), kick_drift(0.0), kick(0.0), total(0.0), reorder(0.0), steps(0) {}
+};
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef SMALL_KOSMOS_HPP
+#define SMALL_KOSMOS_HPP
+#include "../body/body.hpp"
+#include "../constants.h"
+#include "diagnostics.hpp"
+#include "integrators.hpp"
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// accelerations of N bodies on each other, G sum m_j r / (r^2 + eps^2)^1.5.
+// every pair once with +-F, the sums live in local arrays the unrolled loops
+// keep in registers. a step of a few bodies is one long dependency chain
+// (positions need the forces need the positions), so the plain sqrt and
+// division with their short latency beat the rsqrt + newton steps of the
+// simd kernels here
+template <int N>
+inline void small_accelerations(const double * x, const double * y, const double * mass, double * a_x, double * a_y) {
+    double sum_x[N], sum_y[N];
+    #pragma GCC unroll 64
+    for (int i = 0; i < N; ++i) {
+        sum_x[i] = 0.0;
+        sum_y[i] = 0.0;
+    }
+    #pragma GCC unroll 64
+    for (int i = 0; i < N; ++i) {
+        #pragma GCC unroll 64
+        for (int j = i + 1; j < N; ++j) {
+            const double dx = x[j] - x[i];
+            const double dy = y[j] - y[i];
+            const double inv = 1.0 / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+            const double inv3 = inv * inv * inv;
+            sum_x[i] += mass[j] * inv3 * dx;
+            sum_y[i] += mass[j] * inv3 * dy;
+            sum_x[j] -= mass[i] * inv3 * dx;
+            sum_y[j] -= mass[i] * inv3 * dy;
+        }
+    }
+    #pragma GCC unroll 64
+    for (int i = 0; i < N; ++i) {
+        a_x[i] = G_CONST * sum_x[i];
+        a_y[i] = G_CONST * sum_y[i];
+    }
+}
+
+// energy, momentum and angular momentum of n bodies, the potential is one
+// more pair sum. step and time are left to the caller
+inline Diagnostics small_diagnostics(std::size_t n, const double * x, const double * y, const double * v_x,
+                                     const double * v_y, const double * mass) {
+    Diagnostics d;
+    d.step = 0;
+    d.time = 0.0;
+    d.kinetic = 0.0;
+    d.potential = 0.0;
+    d.momentum_x = 0.0;
+    d.momentum_y = 0.0;
+    d.angular_momentum = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+        d.kinetic += 0.5 * mass[i] * (v_x[i] * v_x[i] + v_y[i] * v_y[i]);
+        d.momentum_x += mass[i] * v_x[i];
+        d.momentum_y += mass[i] * v_y[i];
+        d.angular_momentum += mass[i] * (x[i] * v_y[i] - y[i] * v_x[i]);
+        for (std::size_t j = i + 1; j < n; ++j) {
+            const double dx = x[j] - x[i];
+            const double dy = y[j] - y[i];
+            d.potential -= G_CONST * mass[i] * mass[j] / std::sqrt(dx * dx + dy * dy + SOFTENING_LENGTH_SQ);
+        }
+    }
+    return d;
+}
+
+// a kosmos of exactly N bodies for the few body case (binaries, the solar
+// system, ensembles of thousands of tiny systems). the state sits in plain
+// arrays inside the object, N is known at compile time so the pair loop is
+// unrolled completely, each pair is visited once with +-F, and nothing ever
+// enters an openmp region. at these sizes the region setup of Kosmos::step
+// costs more than the physics, so per step this is 10x and more faster.
+// same softened force and the same verlet / composition steps as Kosmos, the
+// results agree to rounding. no solvers, block steps, background mode or io,
+// hermite is not offered (use Kosmos for it). header only
+template <int N>
+class SmallKosmos {
+    static_assert(N >= 1 && N <= 64, "SmallKosmos is for 1 to 64 bodies, use Kosmos beyond that");
+
+    double x[N], y[N];
+    double v_x[N], v_y[N];
+    double a_x[N], a_y[N];
+    double mass[N];
+    double time;
+    long long step_count;
+    Integrator integrator;
+    bool forces_valid; // accelerations match the positions, first same as last
+
+    public:
+        static const int size = N;
+
+        // throws std::invalid_argument unless there are exactly N bodies
+        explicit SmallKosmos(const std::vector<Body> & bodies)
+            : time(0.0), step_count(0), integrator(Integrator::Verlet), forces_valid(false) {
+            if (bodies.size() != static_cast<std::size_t>(N)) {
+                throw std::invalid_argument("SmallKosmos<" + std::to_string(N) + "> needs exactly " +
+                                            std::to_string(N) + " bodies, got " + std::to_string(bodies.size()));
+            }
+            for (int i = 0; i < N; ++i) {
+                set_state(i, bodies[i]);
+            }
+        }
+
+        void step(double time_delta) {
+            switch (integrator) {
+                case Integrator::ForestRuth:
+                    composed_step<ForestRuthScheme>(time_delta);
+                    break;
+                case Integrator::Yoshida6:
+                    composed_step<Yoshida6Scheme>(time_delta);
+                    break;
+                default:
+                    verlet_step(time_delta);
+                    break;
+            }
+            time += time_delta;
+            ++step_count;
+        }
+        void run(long long num_steps, double time_delta) {
+            for (long long s = 0; s < num_steps; ++s) {
+                step(time_delta);
+            }
+        }
+
+        Integrator get_integrator() const {
+            return integrator;
+        }
+        // verlet, forest ruth or yoshida 6, throws std::invalid_argument for hermite
+        void set_integrator(Integrator integrator) {
+            if (integrator == Integrator::Hermite4) {
+                throw std::invalid_argument("SmallKosmos has no hermite integrator, use Kosmos");
+            }
+            this->integrator = integrator;
+        }
+
+        // accelerations between all bodies, see small_accelerations
+        void calculate_forces() {
+            small_accelerations<N>(x, y, mass, a_x, a_y);
+            forces_valid = true;
+        }
+
+        // energy, momentum and angular momentum right now
+        Diagnostics get_diagnostics() const {
+            Diagnostics d = small_diagnostics(N, x, y, v_x, v_y, mass);
+            d.step = step_count;
+            d.time = time;
+            return d;
+        }
+
+        Body get_body(std::size_t i) const {
+            check_index(i);
+            Body body(mass[i], x[i], y[i], v_x[i], v_y[i]);
+            body.set_a_x(a_x[i]);
+            body.set_a_y(a_y[i]);
+            return body;
+        }
+        std::vector<Body> get_bodies() const {
+            std::vector<Body> bodies;
+            bodies.reserve(N);
+            for (int i = 0; i < N; ++i) {
+                bodies.push_back(get_body(i));
+            }
+            return bodies;
+        }
+        // drops the cached accelerations, throws std::out_of_range
+        void set_body(std::size_t i, const Body & body) {
+            check_index(i);
+            set_state(static_cast<int>(i), body);
+            forces_valid = false;
+        }
+
+        double get_time() const {
+            return time;
+        }
+        long long get_step_count() const {
+            return step_count;
+        }
+        // straight at the arrays, say for an ensemble copying many systems out
+        const double * get_x() const {
+            return x;
+        }
+        const double * get_y() const {
+            return y;
+        }
+        const double * get_v_x() const {
+            return v_x;
+        }
+        const double * get_v_y() const {
+            return v_y;
+        }
+
+    private:
+        void set_state(int i, const Body & body) {
+            mass[i] = body.get_mass();
+            x[i] = body.get_x();
+            y[i] = body.get_y();
+            v_x[i] = body.get_v_x();
+            v_y[i] = body.get_v_y();
+            a_x[i] = 0.0;
+            a_y[i] = 0.0;
+        }
+        void check_index(std::size_t i) const {
+            if (i >= static_cast<std::size_t>(N)) {
+                throw std::out_of_range("body index " + std::to_string(i) + " out of range for " +
+                                        std::to_string(N) + " bodies");
+            }
+        }
+
+        // kick drift kick, the same arithmetic as Kosmos::verlet_step
+        void verlet_step(double time_delta) {
+            if (!forces_valid) {
+                calculate_forces();
+            }
+            #pragma GCC unroll 64
+            for (int i = 0; i < N; ++i) {
+                v_x[i] += 0.5 * a_x[i] * time_delta;
+                v_y[i] += 0.5 * a_y[i] * time_delta;
+                x[i] += v_x[i] * time_delta;
+                y[i] += v_y[i] * time_delta;
+            }
+            calculate_forces();
+            #pragma GCC unroll 64
+            for (int i = 0; i < N; ++i) {
+                v_x[i] += 0.5 * a_x[i] * time_delta;
+                v_y[i] += 0.5 * a_y[i] * time_delta;
+            }
+        }
+
+        template <typename Scheme>
+        void composed_step(double time_delta) {
+            for (int k = 0; k < Scheme::stages; ++k) {
+                verlet_step(Scheme::weight(k) * time_delta);
+            }
+        }
+};
+
+#endif
@@ -1,7 +1,83 @@
 #include "test/orbit.h"
 #include "test/multithread.h"
 #include "test/solar_system.h"
+#include "test/force_kernel.h"
+#include "test/force_solvers.h"
+#include "test/background.h"
+#include "test/trajectory.h"
+#include "test/checkpoint.h"
+#include "test/block_timestep.h"
+#include "test/adaptive.h"
+#include "test/integrators.h"
+#include "test/diagnostics.h"
+#include "test/benchmark.h"
+#include "test/profiler.h"
+#include "test/precision.h"
+#include "test/small_kosmos.h"
+#include "test/ensemble.h"
+#include "test/tracers.h"
+#include "test/collisions.h"
+#include "test/reorder.h"
+#include "test/fused_step.h"
+#include <cstdio>
+#include <cstring>
 
-int main() {
-    test_solar_system_simulation();
-}
\ No newline at end of file
+// ./nbody_simulator [test], runs the solar system simulation by default
+// ./nbody_simulator bench [options] runs the benchmark suite, see test/benchmark.h
+int main(int argc, char ** argv) {
+    const char * test = argc > 1 ? argv[1] : "solar_system";
+
+    if (strcmp(test, "solar_system") == 0) {
+        test_solar_system_simulation();
+    } else if (strcmp(test, "orbit") == 0) {
+        test_orbit_simulation();
+    } else if (strcmp(test, "multithread") == 0) {
+        test_multithread_performance();
+    } else if (strcmp(test, "force_kernel") == 0) {
+        return test_force_kernel_accuracy() ? 0 : 1;
+    } else if (strcmp(test, "direct_tiling") == 0) {
+        benchmark_direct_tiling();
+    } else if (strcmp(test, "barnes_hut") == 0) {
+        return test_barnes_hut_accuracy() ? 0 : 1;
+    } else if (strcmp(test, "fmm") == 0) {
+        return test_fmm_accuracy() ? 0 : 1;
+    } else if (strcmp(test, "solver_scaling") == 0) {
+        benchmark_force_solvers();
+    } else if (strcmp(test, "background") == 0) {
+        return test_background_simulation() ? 0 : 1;
+    } else if (strcmp(test, "trajectory") == 0) {
+        return test_trajectory_roundtrip() ? 0 : 1;
+    } else if (strcmp(test, "checkpoint") == 0) {
+        return test_checkpoint_restart() ? 0 : 1;
+    } else if (strcmp(test, "block_timestep") == 0) {
+        return test_block_timesteps() ? 0 : 1;
+    } else if (strcmp(test, "adaptive") == 0) {
+        return test_adaptive_steps() ? 0 : 1;
+    } else if (strcmp(test, "integrators") == 0) {
+        return test_integrators() ? 0 : 1;
+    } else if (strcmp(test, "diagnostics") == 0) {
+        return test_diagnostics() ? 0 : 1;
+    } else if (strcmp(test, "profiler") == 0) {
+        return test_profiler() ? 0 : 1;
+    } else if (strcmp(test, "precision") == 0) {
+        return test_mixed_precision() ? 0 : 1;
+    } else if (strcmp(test, "small_kosmos") == 0) {
+        return test_small_kosmos() ? 0 : 1;
+    } else if (strcmp(test, "ensemble") == 0) {
+        return test_ensemble() ? 0 : 1;
+    } else if (strcmp(test, "tracers") == 0) {
+        return test_tracers() ? 0 : 1;
+    } else if (strcmp(test, "collisions") == 0) {
+        return test_collisions() ? 0 : 1;
+    } else if (strcmp(test, "reorder") == 0) {
+        return test_reorder() ? 0 : 1;
+    } else if (strcmp(test, "fused_step") == 0) {
+        return test_fused_step() ? 0 : 1;
+    } else if (strcmp(test, "bench") == 0) {
+        return run_benchmarks(argc - 2, argv + 2);
+    } else {
+        printf("unknown test '%s', expected one of: solar_system orbit multithread force_kernel direct_tiling barnes_hut fmm solver_scaling background trajectory checkpoint block_timestep adaptive integrators diagnostics profiler precision small_kosmos ensemble tracers collisions reorder fused_step bench\n", test);
+        return 1;
+    }
+    return 0;
+}
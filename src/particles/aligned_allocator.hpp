@@ -0,0 +1,65 @@
+#ifndef ALIGNED_ALLOCATOR_HPP
+#define ALIGNED_ALLOCATOR_HPP
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+// allocator that hands out memory aligned to Alignment bytes so the
+// particle arrays start on a cache line (and a full simd register)
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator {
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() {}
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+        T * allocate(std::size_t n) {
+            if (n == 0) {
+                return nullptr;
+            }
+            void * ptr = nullptr;
+            if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T *>(ptr);
+        }
+
+        void deallocate(T * ptr, std::size_t) {
+            free(ptr);
+        }
+
+        // resize(n) default initializes instead of zeroing, so fresh pages stay
+        // untouched until whoever fills them first (see Particles::first_touch)
+        template <typename U>
+        void construct(U * ptr) {
+            ::new (static_cast<void *>(ptr)) U;
+        }
+        template <typename U, typename... Args>
+        void construct(U * ptr, Args &&... args) {
+            ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...);
+        }
+};
+
+template <typename T, typename U, std::size_t A>
+bool operator==(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) {
+    return true;
+}
+
+template <typename T, typename U, std::size_t A>
+bool operator!=(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) {
+    return false;
+}
+
+// cache line aligned array of doubles, the building block of the soa store
+typedef std::vector<double, AlignedAllocator<double, 64>> AlignedArray;
+
+#endif
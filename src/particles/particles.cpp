@@ -0,0 +1,116 @@
+#include "particles.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// copy into a new allocation with a static parallel loop, linux puts each page
+// on the numa node of the thread that writes it first, and the force loops
+// split the bodies the same static way, so each thread reads local memory
+void first_touch_copy(AlignedArray & array) {
+    const std::size_t n = array.size();
+    AlignedArray fresh;
+    fresh.resize(n); // default initialized, nothing touched yet
+    const double * src = array.data();
+    double * dst = fresh.data();
+    #pragma omp parallel for schedule(static) proc_bind(close)
+    for (std::size_t i = 0; i < n; ++i) {
+        dst[i] = src[i];
+    }
+    array.swap(fresh);
+}
+
+} // namespace
+
+Particles::Particles(const std::vector<Body> & bodies) {
+    resize(bodies.size());
+    for (std::size_t i = 0; i < bodies.size(); ++i) {
+        set_body(i, bodies[i]);
+    }
+}
+
+void Particles::reserve(std::size_t n) {
+    x.reserve(n);
+    y.reserve(n);
+    v_x.reserve(n);
+    v_y.reserve(n);
+    a_x.reserve(n);
+    a_y.reserve(n);
+    mass.reserve(n);
+    radius.reserve(n);
+}
+
+void Particles::resize(std::size_t n) {
+    x.resize(n, 0.0);
+    y.resize(n, 0.0);
+    v_x.resize(n, 0.0);
+    v_y.resize(n, 0.0);
+    a_x.resize(n, 0.0);
+    a_y.resize(n, 0.0);
+    mass.resize(n, 0.0);
+    radius.resize(n, 0.0);
+}
+
+void Particles::copy_values(const Particles & other) {
+    if (other.size() != size()) {
+        throw std::invalid_argument("copy_values needs particles of the same size");
+    }
+    std::copy(other.x.begin(), other.x.end(), x.begin());
+    std::copy(other.y.begin(), other.y.end(), y.begin());
+    std::copy(other.v_x.begin(), other.v_x.end(), v_x.begin());
+    std::copy(other.v_y.begin(), other.v_y.end(), v_y.begin());
+    std::copy(other.a_x.begin(), other.a_x.end(), a_x.begin());
+    std::copy(other.a_y.begin(), other.a_y.end(), a_y.begin());
+    std::copy(other.mass.begin(), other.mass.end(), mass.begin());
+    std::copy(other.radius.begin(), other.radius.end(), radius.begin());
+}
+
+void Particles::first_touch() {
+    first_touch_copy(x);
+    first_touch_copy(y);
+    first_touch_copy(v_x);
+    first_touch_copy(v_y);
+    first_touch_copy(a_x);
+    first_touch_copy(a_y);
+    first_touch_copy(mass);
+    first_touch_copy(radius);
+}
+
+void Particles::clear() {
+    resize(0);
+}
+
+void Particles::push_back(const Body & body) {
+    resize(size() + 1);
+    set_body(size() - 1, body);
+}
+
+void Particles::set_body(std::size_t i, const Body & body) {
+    x[i] = body.get_x();
+    y[i] = body.get_y();
+    v_x[i] = body.get_v_x();
+    v_y[i] = body.get_v_y();
+    a_x[i] = body.get_a_x();
+    a_y[i] = body.get_a_y();
+    mass[i] = body.get_mass();
+    radius[i] = body.get_radius();
+}
+
+Body Particles::get_body(std::size_t i) const {
+    Body body(mass[i], x[i], y[i], v_x[i], v_y[i], radius[i]);
+    body.set_a_x(a_x[i]);
+    body.set_a_y(a_y[i]);
+    // forces are not stored, f = ma gives them back
+    body.set_f_x(mass[i] * a_x[i]);
+    body.set_f_y(mass[i] * a_y[i]);
+    return body;
+}
+
+std::vector<Body> Particles::to_bodies() const {
+    std::vector<Body> bodies;
+    bodies.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i) {
+        bodies.push_back(get_body(i));
+    }
+    return bodies;
+}
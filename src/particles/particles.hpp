@@ -0,0 +1,41 @@
+#ifndef PARTICLES_HPP
+#define PARTICLES_HPP
+#include "../body/body.hpp"
+#include "aligned_allocator.hpp"
+#include <cstddef>
+#include <vector>
+
+// structure of arrays storage for every body in a kosmos
+// each quantity lives in its own contiguous, cache line aligned array so the
+// force loop only streams the x, y and mass it actually reads
+class Particles {
+    public:
+        AlignedArray x, y; // position
+        AlignedArray v_x, v_y; // velocity
+        AlignedArray a_x, a_y; // acceleration
+        AlignedArray mass;
+        AlignedArray radius; // collision radius, 0 = never collides
+
+        Particles() {}
+        explicit Particles(const std::vector<Body> & bodies);
+
+        std::size_t size() const {
+            return mass.size();
+        }
+        void reserve(std::size_t n);
+        void resize(std::size_t n);
+        void clear();
+        // every value of other (same size) into the arrays already here, so
+        // pointers into them (numpy views) stay good
+        void copy_values(const Particles & other);
+        // move every array to fresh memory filled by the thread that will use it
+        void first_touch();
+
+        // conversion to and from the aos body type used by the public api
+        void push_back(const Body & body);
+        void set_body(std::size_t i, const Body & body);
+        Body get_body(std::size_t i) const;
+        std::vector<Body> to_bodies() const;
+};
+
+#endif
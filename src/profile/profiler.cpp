@@ -0,0 +1,360 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <omp.h>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+// a counter for the calling thread only, user space, running from now on
+int open_counter(uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+#endif
+
+} // namespace
+
+const char * phase_name(Phase phase) {
+    switch (phase) {
+        case Phase::Step:
+            return "step";
+        case Phase::Forces:
+            return "forces";
+        case Phase::KickDrift:
+            return "kick_drift";
+        case Phase::Kick:
+            return "kick";
+        case Phase::Diagnostics:
+            return "diagnostics";
+        case Phase::Output:
+            return "output";
+        case Phase::Collisions:
+            return "collisions";
+        case Phase::Reorder:
+            return "reorder";
+        default:
+            return "unknown";
+    }
+}
+
+Profiler::Profiler()
+    : epoch(omp_get_wtime()), sample_next(0), step_history(4096), steps(0), trace_limit(1 << 20),
+      counters_on(false), max_team(0) {}
+
+Profiler::~Profiler() {
+    close_counters();
+}
+
+void Profiler::ensure_slots(std::size_t threads) {
+    if (slots.size() >= threads) {
+        return;
+    }
+    const std::size_t old = slots.size();
+    slots.resize(threads);
+    for (std::size_t t = old; t < threads; ++t) {
+        slots[t].busy = 0.0;
+        slots[t].team = 0;
+        for (int c = 0; c < 3; ++c) {
+            slots[t].counters[c] = 0;
+            slots[t].counters_begin[c] = 0;
+            slots[t].fds[c] = -1;
+        }
+    }
+}
+
+void Profiler::begin_phase(Phase phase, long long step) {
+    // slots only grow here, between regions, never while workers write them
+    ensure_slots(static_cast<std::size_t>(omp_get_max_threads()));
+    OpenPhase entry;
+    entry.phase = phase;
+    entry.step = step;
+    entry.start = omp_get_wtime();
+    std::fill(entry.step_phases, entry.step_phases + PHASE_COUNT, 0.0);
+    open.push_back(entry);
+}
+
+void Profiler::end_phase() {
+    if (open.empty()) {
+        return;
+    }
+    const double now = omp_get_wtime();
+    const OpenPhase entry = open.back();
+    open.pop_back();
+    const double seconds = now - entry.start;
+    const int index = static_cast<int>(entry.phase);
+
+    PhaseStats & stats = phases[index];
+    ++stats.calls;
+    stats.total += seconds;
+    stats.max = std::max(stats.max, seconds);
+
+    // whatever the workers reported while this phase was innermost
+    double busy_max = 0.0, busy_sum = 0.0;
+    int team = 0;
+    bool counted = false;
+    long long counters[3] = {0, 0, 0};
+    for (ThreadSlot & slot : slots) {
+        if (slot.team > 0) {
+            busy_max = std::max(busy_max, slot.busy);
+            busy_sum += slot.busy;
+            team = std::max(team, slot.team);
+            if (counters_on) {
+                for (int c = 0; c < 3; ++c) {
+                    counters[c] += slot.counters[c];
+                }
+                counted = true;
+            }
+        }
+        slot.busy = 0.0;
+        slot.team = 0;
+        std::fill(slot.counters, slot.counters + 3, 0LL);
+    }
+    if (team > 0 && busy_sum > 0.0) {
+        // threads of the team that never reported had nothing to do, they count as idle
+        stats.imbalance += busy_max / (busy_sum / team);
+        ++stats.imbalance_samples;
+        stats.worker_busy += busy_sum;
+        max_team = std::max(max_team, team);
+    }
+    if (counted) {
+        long long * totals[3] = {&stats.cycles, &stats.instructions, &stats.cache_misses};
+        for (int c = 0; c < 3; ++c) {
+            *totals[c] = std::max(*totals[c], 0LL) + counters[c];
+        }
+    }
+
+    if (events.size() < trace_limit) {
+        TraceEvent event = {static_cast<short>(index), 0, entry.start - epoch, seconds};
+        events.push_back(event);
+    }
+
+    // the time also belongs to the step around it
+    for (auto it = open.rbegin(); it != open.rend(); ++it) {
+        if (it->phase == Phase::Step) {
+            it->step_phases[index] += seconds;
+            break;
+        }
+    }
+
+    if (entry.phase == Phase::Step) {
+        StepSample sample;
+        sample.step = entry.step;
+        sample.seconds = seconds;
+        std::copy(entry.step_phases, entry.step_phases + PHASE_COUNT, sample.phases);
+        if (samples.size() < step_history) {
+            samples.push_back(sample);
+        } else if (step_history > 0) {
+            samples[sample_next] = sample;
+        }
+        sample_next = step_history > 0 ? (sample_next + 1) % step_history : 0;
+        ++steps;
+    }
+}
+
+void Profiler::worker_begin(int thread) {
+    if (counters_on && thread < static_cast<int>(slots.size())) {
+        read_counters(slots[thread], slots[thread].counters_begin);
+    }
+}
+
+void Profiler::worker_end(int thread, int team_size, double start) {
+    // a region outside any phase, or a thread beyond the slots, has nowhere to go
+    if (open.empty() || thread >= static_cast<int>(slots.size())) {
+        return;
+    }
+    const double now = omp_get_wtime();
+    ThreadSlot & slot = slots[thread];
+    slot.busy += now - start;
+    slot.team = team_size;
+    if (counters_on) {
+        long long values[3];
+        read_counters(slot, values);
+        for (int c = 0; c < 3; ++c) {
+            slot.counters[c] += values[c] - slot.counters_begin[c];
+        }
+    }
+    if (slot.events.size() < trace_limit / slots.size()) {
+        TraceEvent event = {static_cast<short>(open.back().phase), static_cast<short>(1 + thread), start - epoch,
+                            now - start};
+        slot.events.push_back(event);
+    }
+}
+
+ProfileStats Profiler::stats() const {
+    ProfileStats result;
+    result.enabled = profiling_compiled_in();
+    result.hardware_counters = counters_on;
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        result.phases[p] = phases[p];
+        if (phases[p].imbalance_samples > 0) {
+            result.phases[p].imbalance = phases[p].imbalance / phases[p].imbalance_samples;
+        }
+    }
+    result.steps = steps;
+    result.threads = max_team;
+
+    // oldest first: once the ring is full it starts at the next slot to overwrite
+    const std::size_t kept = samples.size();
+    const std::size_t first = kept == step_history ? sample_next : 0;
+    for (std::size_t k = 0; k < kept; ++k) {
+        result.recent.push_back(samples[(first + k) % kept]);
+    }
+    if (kept > 0) {
+        std::vector<double> seconds;
+        double sum = 0.0;
+        for (const StepSample & sample : samples) {
+            seconds.push_back(sample.seconds);
+            sum += sample.seconds;
+        }
+        std::sort(seconds.begin(), seconds.end());
+        result.step_mean = sum / kept;
+        result.step_min = seconds.front();
+        result.step_max = seconds.back();
+        result.step_p50 = seconds[(kept - 1) / 2];
+        result.step_p99 = seconds[static_cast<std::size_t>(0.99 * (kept - 1))];
+    }
+    return result;
+}
+
+void Profiler::reset() {
+    epoch = omp_get_wtime();
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        phases[p] = PhaseStats();
+    }
+    samples.clear();
+    sample_next = 0;
+    steps = 0;
+    events.clear();
+    for (ThreadSlot & slot : slots) {
+        slot.busy = 0.0;
+        slot.team = 0;
+        std::fill(slot.counters, slot.counters + 3, 0LL);
+        slot.events.clear();
+    }
+    max_team = 0;
+}
+
+void Profiler::set_trace_limit(std::size_t events) {
+    trace_limit = events;
+}
+
+void Profiler::set_step_history(std::size_t steps) {
+    step_history = steps;
+    samples.clear();
+    sample_next = 0;
+}
+
+void Profiler::write_trace(const std::string & path) const {
+    FILE * file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error("could not open trace file '" + path + "' for writing");
+    }
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": {\"name\": \"main\"}}");
+    for (std::size_t t = 0; t < slots.size(); ++t) {
+        if (!slots[t].events.empty()) {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %zu, "
+                          "\"args\": {\"name\": \"worker %zu\"}}", t + 1, t);
+        }
+    }
+    auto write_events = [file](const std::vector<TraceEvent> & list) {
+        for (const TraceEvent & event : list) {
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    phase_name(static_cast<Phase>(event.phase)), event.track, event.start * 1e6, event.duration * 1e6);
+        }
+    };
+    write_events(events);
+    for (const ThreadSlot & slot : slots) {
+        write_events(slot.events);
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        throw std::runtime_error("writing trace '" + path + "' failed");
+    }
+}
+
+bool Profiler::enable_hardware_counters() {
+#ifdef __linux__
+    if (counters_on) {
+        return true;
+    }
+    ensure_slots(static_cast<std::size_t>(omp_get_max_threads()));
+    const uint64_t configs[3] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    bool ok = true;
+    // perf counts the thread that opened the counter, so every pool thread opens its own
+    #pragma omp parallel reduction(&&:ok)
+    {
+        ThreadSlot & slot = slots[omp_get_thread_num()];
+        for (int c = 0; c < 3; ++c) {
+            slot.fds[c] = open_counter(configs[c]);
+            ok = ok && slot.fds[c] >= 0;
+        }
+    }
+    if (!ok) {
+        close_counters();
+        return false;
+    }
+    counters_on = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Profiler::disable_hardware_counters() {
+    close_counters();
+}
+
+void Profiler::close_counters() {
+#ifdef __linux__
+    for (ThreadSlot & slot : slots) {
+        for (int c = 0; c < 3; ++c) {
+            if (slot.fds[c] >= 0) {
+                close(slot.fds[c]);
+            }
+            slot.fds[c] = -1;
+        }
+    }
+#endif
+    counters_on = false;
+}
+
+void Profiler::read_counters(ThreadSlot & slot, long long * values) const {
+    for (int c = 0; c < 3; ++c) {
+        values[c] = 0;
+#ifdef __linux__
+        long long value = 0;
+        if (slot.fds[c] >= 0 && read(slot.fds[c], &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value))) {
+            values[c] = value;
+        }
+#endif
+    }
+}
+
+ProfileWorker::ProfileWorker(Profiler * profiler)
+    : profiler(profiler), thread(omp_get_thread_num()), start(omp_get_wtime()) {
+    if (profiler != nullptr) {
+        profiler->worker_begin(thread);
+    }
+}
+
+ProfileWorker::~ProfileWorker() {
+    if (profiler != nullptr) {
+        profiler->worker_end(thread, omp_get_num_threads(), start);
+    }
+}
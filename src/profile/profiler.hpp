@@ -0,0 +1,187 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// hot path instrumentation, only compiled in with -DNBODY_PROFILE (make PROFILE=1).
+// without it the NBODY_PROFILE_* macros are empty statements and the Profiler
+// below is never fed, so the normal build runs exactly the same code as before.
+//
+// NBODY_PROFILE_PHASE(profiler, phase) times the enclosing scope on the calling
+// thread as one phase (phases nest, a step holds its force passes and kicks).
+// NBODY_PROFILE_WORKER(profiler) goes at the top of a parallel region, before an
+// `omp for nowait`, and times how long this thread worked on the innermost open
+// phase. the spread of those busy times is the load imbalance
+
+enum class Phase {
+    Step, // one whole step, integrator bookkeeping included
+    Forces, // every force pass (and jerk pass)
+    KickDrift, // opening half kick + drift, the predictor for hermite and block steps
+    Kick, // closing half kick, the corrector for hermite
+    Diagnostics, // energy / momentum records
+    Output, // trajectory appends
+    Collisions, // contact search and merges / bounces after a step
+    Reorder, // sorting the bodies along a space filling curve
+    Count
+};
+
+const char * phase_name(Phase phase);
+
+const int PHASE_COUNT = static_cast<int>(Phase::Count);
+
+// what a phase has cost since the last reset
+struct PhaseStats {
+    long long calls;
+    double total; // seconds
+    double max; // longest single call
+    // mean over the calls that had workers of max / mean thread busy time,
+    // 1 is perfect balance, 0 when no worker reported
+    double imbalance;
+    long long imbalance_samples;
+    double worker_busy; // busy seconds summed over all threads
+    // hardware counters over the worker scopes of this phase, -1 if not counted
+    long long cycles, instructions, cache_misses;
+
+    PhaseStats()
+        : calls(0), total(0.0), max(0.0), imbalance(0.0), imbalance_samples(0), worker_busy(0.0),
+          cycles(-1), instructions(-1), cache_misses(-1) {}
+};
+
+// one finished step, seconds spent in each phase inside it
+struct StepSample {
+    long long step;
+    double seconds;
+    double phases[PHASE_COUNT];
+};
+
+struct ProfileStats {
+    bool enabled; // compiled with NBODY_PROFILE
+    bool hardware_counters; // perf_event counters running
+    PhaseStats phases[PHASE_COUNT];
+    long long steps;
+    double step_mean, step_min, step_max, step_p50, step_p99; // seconds, over the kept samples
+    std::vector<StepSample> recent; // the last steps, oldest first
+    int threads; // most threads seen in a worker region
+
+    ProfileStats()
+        : enabled(false), hardware_counters(false), steps(0), step_mean(0.0), step_min(0.0), step_max(0.0),
+          step_p50(0.0), step_p99(0.0), threads(0) {}
+};
+
+class Profiler {
+    public:
+        Profiler();
+        ~Profiler();
+        Profiler(const Profiler &) = delete;
+        Profiler & operator=(const Profiler &) = delete;
+
+        // calling thread only, a phase must end before its parent does
+        void begin_phase(Phase phase, long long step = -1);
+        void end_phase();
+        // from inside a parallel region, each thread reports its own busy span
+        void worker_begin(int thread);
+        void worker_end(int thread, int team_size, double start);
+
+        ProfileStats stats() const;
+        void reset();
+        // chrome://tracing / perfetto json, phases on "main", workers on one track per thread
+        void write_trace(const std::string & path) const;
+        // trace events kept, later ones are not recorded (default 1 << 20)
+        void set_trace_limit(std::size_t events);
+        // steps kept for the percentiles and StepSample history (default 4096)
+        void set_step_history(std::size_t steps);
+
+        // cycles, instructions and cache misses per worker through perf_event_open,
+        // opened on every thread of the current openmp team. false (and counting
+        // stays off) when the kernel refuses, say perf_event_paranoid or no linux
+        bool enable_hardware_counters();
+        void disable_hardware_counters();
+        bool has_hardware_counters() const {
+            return counters_on;
+        }
+
+    private:
+        struct OpenPhase {
+            Phase phase;
+            long long step;
+            double start;
+            double step_phases[PHASE_COUNT]; // children, for the step sample
+        };
+        struct TraceEvent {
+            short phase;
+            short track; // 0 = main, 1 + thread for workers
+            double start, duration;
+        };
+        // one cache line per thread, written only by that thread inside a region
+        struct alignas(64) ThreadSlot {
+            double busy;
+            int team;
+            long long counters[3];
+            long long counters_begin[3];
+            int fds[3];
+            std::vector<TraceEvent> events;
+        };
+
+        double epoch;
+        std::vector<OpenPhase> open;
+        PhaseStats phases[PHASE_COUNT];
+        std::vector<StepSample> samples; // ring buffer
+        std::size_t sample_next;
+        std::size_t step_history;
+        long long steps;
+        std::vector<TraceEvent> events; // main track
+        std::vector<ThreadSlot> slots;
+        std::size_t trace_limit;
+        bool counters_on;
+        int max_team;
+
+        void ensure_slots(std::size_t threads);
+        void read_counters(ThreadSlot & slot, long long * values) const;
+        void close_counters();
+};
+
+// raii helpers the macros expand to, null profiler pointers are ignored
+class ProfilePhase {
+    public:
+        ProfilePhase(Profiler * profiler, Phase phase, long long step = -1) : profiler(profiler) {
+            if (profiler != nullptr) profiler->begin_phase(phase, step);
+        }
+        ~ProfilePhase() {
+            if (profiler != nullptr) profiler->end_phase();
+        }
+    private:
+        Profiler * profiler;
+};
+
+class ProfileWorker {
+    public:
+        explicit ProfileWorker(Profiler * profiler);
+        ~ProfileWorker();
+    private:
+        Profiler * profiler;
+        int thread;
+        double start;
+};
+
+#define NBODY_PROFILE_CAT_INNER(a, b) a##b
+#define NBODY_PROFILE_CAT(a, b) NBODY_PROFILE_CAT_INNER(a, b)
+
+#ifdef NBODY_PROFILE
+#define NBODY_PROFILE_PHASE(profiler, ...) ProfilePhase NBODY_PROFILE_CAT(profile_phase_, __LINE__)((profiler), __VA_ARGS__)
+#define NBODY_PROFILE_WORKER(profiler) ProfileWorker NBODY_PROFILE_CAT(profile_worker_, __LINE__)(profiler)
+#else
+#define NBODY_PROFILE_PHASE(profiler, ...) do {} while (0)
+#define NBODY_PROFILE_WORKER(profiler) do {} while (0)
+#endif
+
+// true when this build records anything
+inline bool profiling_compiled_in() {
+#ifdef NBODY_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+#endif
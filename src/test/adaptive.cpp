@@ -0,0 +1,85 @@
+#include "adaptive.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const double YEAR = 365.25 * DAY_TO_SECONDS;
+
+// sun and a comet starting at perihelion, semi major axis 1 AU so one orbit is ~ a year
+std::vector<Body> comet(double eccentricity) {
+    const double perihelion = (1.0 - eccentricity) * AU_M;
+    const double speed = sqrt(G_CONST * SUN_MASS * (1.0 + eccentricity) / perihelion);
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    bodies.push_back(Body(1e14, perihelion, 0.0, 0.0, speed));
+    return bodies;
+}
+
+double comet_distance(const Kosmos & a, const Kosmos & b) {
+    const Particles & p = a.get_particles();
+    const Particles & q = b.get_particles();
+    return hypot((p.x[1] - p.x[0]) - (q.x[1] - q.x[0]), (p.y[1] - p.y[0]) - (q.y[1] - q.y[0]));
+}
+
+} // namespace
+
+bool test_adaptive_steps() {
+    bool passed = true;
+    printf("Adaptive time steps (comet, e = 0.9, one orbit)\n");
+
+    Kosmos reference(comet(0.9));
+    reference.run(525960, 60.0); // one minute steps for a year
+
+    // energy criterion only, the first try is far too big for a perihelion passage
+    Kosmos energy(comet(0.9));
+    AdaptiveOptions options;
+    options.eta = 0.0;
+    options.energy_tolerance = 1e-7;
+    options.initial_dt = 10.0 * DAY_TO_SECONDS;
+    // where a numpy view would point, a rejected step must not move the arrays
+    const double * x_before = energy.get_particles().x.data();
+    AdaptiveReport by_energy = energy.advance(YEAR, options);
+
+    // acceleration criterion only, length picked for planetary scales
+    Kosmos accel(comet(0.9));
+    AdaptiveOptions accel_options;
+    accel_options.eta = 0.02;
+    accel_options.length = 1e9;
+    AdaptiveReport by_accel = accel.advance(YEAR, accel_options);
+
+    // fixed steps, as many as the energy controlled run took
+    const long long steps = by_energy.get_steps();
+    Kosmos fixed(comet(0.9));
+    fixed.run(steps, YEAR / steps);
+
+    const std::vector<double> & dts = by_energy.dt_history;
+    const double smallest = *std::min_element(dts.begin(), dts.end() - 1); // the last one is cut to fit
+    const double largest = *std::max_element(dts.begin(), dts.end());
+    printf("  energy: %lld steps, %zu rejected, dt %.0f s .. %.0f s\n",
+           steps, by_energy.rejected.size(), smallest, largest);
+    printf("  accel:  %lld steps\n", by_accel.get_steps());
+    printf("  comet position error vs 1 minute steps: energy %.3e m, accel %.3e m, fixed %lld steps %.3e m\n",
+           comet_distance(energy, reference), comet_distance(accel, reference), steps,
+           comet_distance(fixed, reference));
+
+    passed &= report("lands on the end time", by_energy.finished && energy.get_time() == YEAR
+                                              && by_accel.finished && accel.get_time() == YEAR);
+    passed &= report("oversized first step rejected", !by_energy.rejected.empty()
+                                                      && by_energy.rejected[0].time_delta == options.initial_dt);
+    passed &= report("rejects keep the arrays in place", energy.get_particles().x.data() == x_before);
+    passed &= report("accepted steps within the tolerance",
+                     *std::max_element(by_energy.energy_errors.begin(), by_energy.energy_errors.end())
+                         <= options.energy_tolerance);
+    passed &= report("dt spans 10x between perihelion and aphelion", largest > 10.0 * smallest);
+    passed &= report("10x closer than fixed steps of the same count",
+                     10.0 * comet_distance(energy, reference) < comet_distance(fixed, reference));
+
+    printf("%s\n", passed ? "all adaptive step checks passed" : "adaptive step checks FAILED");
+    return passed;
+}
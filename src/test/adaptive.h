@@ -0,0 +1,9 @@
+#ifndef ADAPTIVE_TEST_H
+#define ADAPTIVE_TEST_H
+
+// advance with the acceleration and energy criteria on an eccentric comet:
+// lands on the end time, rejects steps that are too big, and gets closer to a
+// fine fixed step run than a fixed step run with as many steps
+bool test_adaptive_steps();
+
+#endif
@@ -0,0 +1,262 @@
+#include "background.h"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+namespace {
+
+// sun and a ring of planets, enough bodies that a step takes a little while
+std::vector<Body> make_ring(int num_bodies) {
+    std::vector<Body> bodies;
+    bodies.push_back(Body(1.989e30, 0.0, 0.0, 0.0, 0.0));
+    for (int i = 1; i < num_bodies; ++i) {
+        double radius = AU_M * (1.0 + 0.05 * (i % 20));
+        double angle = (2.0 * M_PI * i) / (num_bodies - 1);
+        double speed = sqrt(G_CONST * 1.989e30 / radius);
+        bodies.push_back(Body(5.972e24, radius * cos(angle), radius * sin(angle),
+                              -speed * sin(angle), speed * cos(angle)));
+    }
+    return bodies;
+}
+
+// what the reader saw in one frame
+struct Sample {
+    long long step;
+    double time;
+    double x, y; // last body
+};
+
+void sleep_ms(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+} // namespace
+
+bool test_background_simulation() {
+    const int num_bodies = 500;
+    const double time_step = 3600.0;
+    const std::vector<Body> bodies = make_ring(num_bodies);
+    bool passed = true;
+
+    printf("Background simulation, %d bodies\n", num_bodies);
+
+    Kosmos kosmos(bodies);
+    kosmos.start(time_step);
+
+    // read as fast as possible for a while, the worker never waits on us
+    std::vector<Sample> samples;
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    while (std::chrono::steady_clock::now() < until) {
+        const Frame * frame = kosmos.latest_frame();
+        if (frame != nullptr && (samples.empty() || frame->step != samples.back().step)) {
+            const size_t last = frame->particles.size() - 1;
+            Sample sample = {frame->step, frame->time, frame->particles.x[last], frame->particles.y[last]};
+            samples.push_back(sample);
+        }
+    }
+
+    bool blocked = false;
+    try {
+        kosmos.step(time_step);
+    } catch (const std::logic_error &) {
+        blocked = true;
+    }
+    printf("  step while running throws:   %s\n", blocked ? "yes" : "no  FAIL");
+    passed = passed && blocked;
+
+    // the worker writes to the trajectory after its steps, so the writer stays
+    bool detach_blocked = false;
+    try {
+        kosmos.detach_trajectory();
+    } catch (const std::logic_error &) {
+        detach_blocked = true;
+    }
+    printf("  detach while running throws: %s\n", detach_blocked ? "yes" : "no  FAIL");
+    passed = passed && detach_blocked;
+
+    // setters, readers and views of the state the worker steps are refused too, the
+    // readers say where the state can be read instead
+    int refused_calls = 0;
+    bool points_at_frames = false;
+    try {
+        kosmos.get_bodies();
+    } catch (const std::logic_error & error) {
+        ++refused_calls;
+        points_at_frames = std::string(error.what()).find("latest_frame") != std::string::npos;
+    }
+    try {
+        kosmos.set_theta(0.3);
+    } catch (const std::logic_error &) {
+        ++refused_calls;
+    }
+    try {
+        kosmos.invalidate_forces();
+    } catch (const std::logic_error &) {
+        ++refused_calls;
+    }
+    try {
+        kosmos.get_diagnostics_history();
+    } catch (const std::logic_error &) {
+        ++refused_calls;
+    }
+    try {
+        kosmos.pin_arrays(); // what a numpy view does first
+    } catch (const std::logic_error &) {
+        ++refused_calls;
+    }
+    const bool guarded = refused_calls == 5 && points_at_frames && !kosmos.arrays_pinned();
+    printf("  setters, readers, views throw: %s\n", guarded ? "yes" : "no  FAIL");
+    passed = passed && guarded;
+
+    // once paused the published count must stop moving (after the step in flight)
+    kosmos.pause();
+    sleep_ms(50);
+    long long paused_count = kosmos.get_frames_published();
+    sleep_ms(100);
+    bool held = kosmos.get_frames_published() == paused_count;
+    kosmos.resume();
+    sleep_ms(50);
+    bool resumed = kosmos.get_frames_published() > paused_count;
+    printf("  pause holds, resume resumes: %s\n", held && resumed ? "yes" : "no  FAIL");
+    passed = passed && held && resumed;
+
+    kosmos.stop();
+    printf("  frames published %lld, dropped %lld, read %zu, worker reached step %lld\n",
+           kosmos.get_frames_published(), kosmos.get_frames_dropped(), samples.size(), kosmos.get_step_count());
+
+    // every frame must be exactly the state a plain run has after that many steps
+    Kosmos reference(bodies);
+    size_t next = 0;
+    int mismatches = 0;
+    bool ordered = true;
+    for (long long step = 0; next < samples.size(); ++step) {
+        if (step > 0) {
+            reference.step(time_step);
+        }
+        while (next < samples.size() && samples[next].step == step) {
+            const Particles & particles = reference.get_particles();
+            const Sample & sample = samples[next];
+            if (sample.x != particles.x.back() || sample.y != particles.y.back() || sample.time != reference.get_time()) {
+                ++mismatches;
+            }
+            if (next > 0 && sample.step <= samples[next - 1].step) {
+                ordered = false;
+            }
+            ++next;
+        }
+        if (next < samples.size() && samples[next].step < step) {
+            ordered = false; // went backwards
+            break;
+        }
+    }
+    bool consistent = mismatches == 0 && ordered && !samples.empty();
+    printf("  frames match a plain run:    %s (%d mismatches)\n", consistent ? "yes" : "no  FAIL", mismatches);
+    passed = passed && consistent;
+
+    bool kept = kosmos.get_step_count() >= samples.back().step;
+    kosmos.step(time_step); // allowed again after stop
+    printf("  state kept after stop:       %s\n", kept ? "yes" : "no  FAIL");
+    passed = passed && kept;
+
+    // a setup a step would refuse is refused by start, before any thread exists
+    Kosmos refused(bodies);
+    refused.add_tracer(Body(0.0, AU_M, 0.0, 0.0, 30000.0));
+    refused.set_integrator(Integrator::Hermite4);
+    bool start_threw = false;
+    try {
+        refused.start(time_step);
+    } catch (const std::logic_error &) {
+        start_threw = true;
+    }
+    bool checked = start_threw && !refused.is_running();
+    printf("  bad setup refused by start:  %s\n", checked ? "yes" : "no  FAIL");
+    passed = passed && checked;
+
+    // a step that throws in the worker (the trajectory file hits the size
+    // limit a few frames in) ends the worker instead of the process, stop
+    // hands the error on
+    const char * path = "background_test.traj";
+    Kosmos failing(bodies);
+    failing.attach_trajectory(path, TRAJ_X | TRAJ_Y, 1);
+    struct stat info;
+    stat(path, &info);
+    struct rlimit old_limit, limit;
+    getrlimit(RLIMIT_FSIZE, &old_limit);
+    limit = old_limit;
+    limit.rlim_cur = static_cast<rlim_t>(info.st_size) + 10 * 16 * num_bodies;
+    void (*old_handler)(int) = std::signal(SIGXFSZ, SIG_IGN); // failed writes instead of a signal
+    setrlimit(RLIMIT_FSIZE, &limit);
+    failing.start(time_step);
+    for (int wait = 0; wait < 200 && failing.is_running(); ++wait) {
+        sleep_ms(10);
+    }
+    const bool ended = !failing.is_running();
+    bool rethrown = false;
+    try {
+        failing.stop();
+    } catch (const std::runtime_error &) {
+        rethrown = true;
+    }
+    setrlimit(RLIMIT_FSIZE, &old_limit);
+    std::signal(SIGXFSZ, old_handler);
+    try {
+        failing.detach_trajectory();
+    } catch (const std::runtime_error &) {
+        // the file is broken anyway
+    }
+    std::remove(path);
+    failing.step(time_step); // usable again, the error went out once
+    failing.stop();
+    bool handed_on = ended && rethrown;
+    printf("  worker error ends the worker: %s\n", handed_on ? "yes" : "no  FAIL");
+    passed = passed && handed_on;
+
+    // a run on another thread (python releases the gil for it) keeps the
+    // kosmos busy, so the arrays cannot be reallocated or read under it
+    Kosmos busy(bodies);
+    std::atomic<bool> started(false);
+    std::thread runner([&] {
+        busy.run(1000000, time_step, 1, [&](const Kosmos &) {
+            started.store(true);
+            return true;
+        });
+    });
+    while (!started.load()) {
+        sleep_ms(1);
+    }
+    int busy_refused = 0;
+    try {
+        busy.add_body(Body(1e20, 0.0, 2.0 * AU_M, 20000.0, 0.0));
+    } catch (const std::logic_error &) {
+        ++busy_refused;
+    }
+    try {
+        busy.get_bodies();
+    } catch (const std::logic_error &) {
+        ++busy_refused;
+    }
+    try {
+        busy.step(time_step);
+    } catch (const std::logic_error &) {
+        ++busy_refused;
+    }
+    busy.cancel();
+    runner.join();
+    busy.add_body(Body(1e20, 0.0, 2.0 * AU_M, 20000.0, 0.0)); // fine once run returned
+    const bool run_guarded = busy_refused == 3 && busy.get_bodies().size() == bodies.size() + 1;
+    printf("  run on a thread blocks others: %s\n", run_guarded ? "yes" : "no  FAIL");
+    passed = passed && run_guarded;
+
+    printf("\n%s\n", passed ? "Background mode ok" : "Background mode FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+// runs a kosmos in background mode and reads frames while it steps, checks
+// every frame against a plain step by step run and that pause and stop work,
+// returns false on any mismatch
+bool test_background_simulation();
+
+#endif
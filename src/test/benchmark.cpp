@@ -0,0 +1,476 @@
+#include "benchmark.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../forces/direct.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <omp.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// the usual count for one softened pair (3 sub, 3 fma, rsqrt, 3 mul, 2 fma ...),
+// the same convention gpu and cpu nbody codes quote their GFLOP/s with
+const double FLOPS_PER_INTERACTION = 20.0;
+const double TIME_STEP = 3600.0;
+
+struct SolverInfo {
+    const char * name;
+    ForceSolver solver;
+    bool exact; // all pairs, so interactions really are n (n - 1) per pass
+};
+
+const SolverInfo SOLVERS[] = {
+    {"direct", ForceSolver::Direct, true},
+    {"symmetric", ForceSolver::DirectSymmetric, true},
+    {"barnes_hut", ForceSolver::BarnesHut, false},
+    {"fmm", ForceSolver::FMM, false},
+};
+
+struct Options {
+    std::vector<const SolverInfo *> solvers;
+    std::vector<long long> sizes;
+    std::vector<int> threads;
+    std::vector<std::string> modes;
+    int trials;
+    int warmup; // steps thrown away before timing (tile tuning, first touch, the first force pass)
+    double min_trial_seconds; // steps per trial are picked so one trial takes about this long
+    double max_step_seconds; // skip a size predicted to be slower per step than this
+    long long strong_n; // bodies for strong scaling
+    long long weak_n; // bodies per thread for weak scaling
+    const char * json_path;
+    const char * csv_path;
+
+    Options()
+        : trials(5), warmup(2), min_trial_seconds(0.2), max_step_seconds(2.0),
+          strong_n(20000), weak_n(5000), json_path(nullptr), csv_path(nullptr) {}
+};
+
+struct Result {
+    std::string mode; // sweep, strong or weak
+    const SolverInfo * solver;
+    long long n;
+    int threads;
+    long long steps; // per trial
+    int trials;
+    double median, mean, stddev, best; // seconds per step over the trials
+    double forces, kick_drift, kick; // seconds per step in each phase, medians
+    double interactions; // per second, direct sum equivalent: (n - 1) per body acceleration
+    double gflops; // exact solvers only, < 0 otherwise
+    double efficiency; // strong / weak scaling efficiency, < 0 in the sweep
+};
+
+double median_of(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    const std::size_t m = values.size() / 2;
+    return values.size() % 2 == 1 ? values[m] : 0.5 * (values[m - 1] + values[m]);
+}
+
+// uniform disk of equal masses at rest, 20 AU across. a few steps barely move
+// it, so every trial sees the same tree shapes
+Particles make_disk(long long num_bodies) {
+    std::mt19937 rng(42u);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    Particles particles;
+    particles.resize(static_cast<std::size_t>(num_bodies));
+    for (long long i = 0; i < num_bodies; ++i) {
+        double r = 10.0 * AU_M * std::sqrt(unit(rng));
+        double theta = 2.0 * M_PI * unit(rng);
+        particles.x[i] = r * std::cos(theta);
+        particles.y[i] = r * std::sin(theta);
+        particles.v_x[i] = 0.0;
+        particles.v_y[i] = 0.0;
+        particles.a_x[i] = 0.0;
+        particles.a_y[i] = 0.0;
+        particles.mass[i] = 1e24;
+    }
+    return particles;
+}
+
+Result measure(const Options & options, const char * mode, const SolverInfo & solver, long long n, int threads) {
+    omp_set_num_threads(threads);
+    Kosmos kosmos(make_disk(n), solver.solver);
+    kosmos.set_phase_timing(true);
+
+    kosmos.run(std::max(options.warmup - 1, 0), TIME_STEP);
+    auto start = std::chrono::high_resolution_clock::now();
+    kosmos.run(1, TIME_STEP);
+    const double one_step = seconds_since(start);
+    const long long steps = std::max(1LL, std::min(1000LL,
+        static_cast<long long>(std::ceil(options.min_trial_seconds / std::max(one_step, 1e-9)))));
+
+    std::vector<double> per_step, forces, kick_drift, kick, interactions;
+    for (int t = 0; t < options.trials; ++t) {
+        kosmos.reset_phase_times();
+        const long long evaluations = kosmos.get_force_evaluations();
+        start = std::chrono::high_resolution_clock::now();
+        kosmos.run(steps, TIME_STEP);
+        const double elapsed = seconds_since(start);
+        const PhaseTimes & phases = kosmos.get_phase_times();
+        per_step.push_back(elapsed / steps);
+        forces.push_back(phases.forces / steps);
+        kick_drift.push_back(phases.kick_drift / steps);
+        kick.push_back(phases.kick / steps);
+        interactions.push_back(static_cast<double>(kosmos.get_force_evaluations() - evaluations) * (n - 1) / elapsed);
+    }
+
+    Result result;
+    result.mode = mode;
+    result.solver = &solver;
+    result.n = n;
+    result.threads = threads;
+    result.steps = steps;
+    result.trials = options.trials;
+    result.median = median_of(per_step);
+    result.best = *std::min_element(per_step.begin(), per_step.end());
+    double sum = 0.0, sum_sq = 0.0;
+    for (double t : per_step) {
+        sum += t;
+    }
+    result.mean = sum / per_step.size();
+    for (double t : per_step) {
+        sum_sq += (t - result.mean) * (t - result.mean);
+    }
+    result.stddev = per_step.size() > 1 ? std::sqrt(sum_sq / (per_step.size() - 1)) : 0.0;
+    result.forces = median_of(forces);
+    result.kick_drift = median_of(kick_drift);
+    result.kick = median_of(kick);
+    result.interactions = median_of(interactions);
+    result.gflops = solver.exact ? result.interactions * FLOPS_PER_INTERACTION * 1e-9 : -1.0;
+    result.efficiency = -1.0;
+    return result;
+}
+
+void print_header(const char * title) {
+    printf("\n%s\n", title);
+    printf("%-11s %9s %7s %6s %11s %7s %11s %11s %9s %12s %8s %6s\n", "Solver", "Bodies", "Threads", "Steps",
+           "Step (ms)", "+- (%)", "Forces (ms)", "Kick+drift", "Kick", "Inter/s", "GFLOP/s", "Eff");
+}
+
+void print_result(const Result & r) {
+    char gflops[16], efficiency[16];
+    if (r.gflops >= 0.0) {
+        snprintf(gflops, sizeof(gflops), "%.2f", r.gflops);
+    } else {
+        snprintf(gflops, sizeof(gflops), "-");
+    }
+    if (r.efficiency >= 0.0) {
+        snprintf(efficiency, sizeof(efficiency), "%.2f", r.efficiency);
+    } else {
+        snprintf(efficiency, sizeof(efficiency), "-");
+    }
+    printf("%-11s %9lld %7d %6lld %11.3f %7.1f %11.3f %11.4f %9.4f %12.3e %8s %6s\n", r.solver->name, r.n, r.threads,
+           r.steps, r.median * 1e3, r.median > 0.0 ? 100.0 * r.stddev / r.median : 0.0, r.forces * 1e3,
+           r.kick_drift * 1e3, r.kick * 1e3, r.interactions, gflops, efficiency);
+}
+
+// per step time of n bodies guessed from the last size measured, O(N^2) for
+// the exact solvers and about O(N) for the trees
+double predict_step(const SolverInfo & solver, long long last_n, double last_time, long long n) {
+    const double ratio = static_cast<double>(n) / last_n;
+    return last_time * (solver.exact ? ratio * ratio : 1.2 * ratio);
+}
+
+void run_sweep(const Options & options, std::vector<Result> & results) {
+    const int threads = options.threads.back();
+    char title[96];
+    snprintf(title, sizeof(title), "Body count sweep (%d threads, median of %d trials)", threads, options.trials);
+    print_header(title);
+    for (const SolverInfo * solver : options.solvers) {
+        long long last_n = 0;
+        double last_time = 0.0;
+        for (long long n : options.sizes) {
+            if (last_n > 0 && predict_step(*solver, last_n, last_time, n) > options.max_step_seconds) {
+                printf("%-11s %9lld %7d   skipped, about %.1f s per step (--max-step-seconds %.1f)\n", solver->name, n,
+                       threads, predict_step(*solver, last_n, last_time, n), options.max_step_seconds);
+                continue;
+            }
+            Result result = measure(options, "sweep", *solver, n, threads);
+            print_result(result);
+            results.push_back(result);
+            last_n = n;
+            last_time = result.median;
+        }
+    }
+}
+
+// strong: same bodies, more threads, ideal is p times faster.
+// weak: weak_n bodies per thread, ideal keeps the interactions per second per
+// thread (for the exact solvers the work per thread still grows with p)
+void run_scaling(const Options & options, bool strong, std::vector<Result> & results) {
+    char title[96];
+    if (strong) {
+        snprintf(title, sizeof(title), "Strong scaling (%lld bodies)", options.strong_n);
+    } else {
+        snprintf(title, sizeof(title), "Weak scaling (%lld bodies per thread)", options.weak_n);
+    }
+    print_header(title);
+    for (const SolverInfo * solver : options.solvers) {
+        const Result * base = nullptr;
+        const std::size_t first = results.size();
+        for (int threads : options.threads) {
+            const long long n = strong ? options.strong_n : options.weak_n * threads;
+            Result result = measure(options, strong ? "strong" : "weak", *solver, n, threads);
+            if (base == nullptr) {
+                result.efficiency = 1.0;
+            } else if (strong) {
+                result.efficiency = base->median * base->threads / (result.median * threads);
+            } else {
+                result.efficiency = (result.interactions / threads) / (base->interactions / base->threads);
+            }
+            print_result(result);
+            results.push_back(result);
+            base = &results[first];
+        }
+    }
+}
+
+void json_number(FILE * file, double value) {
+    if (value < 0.0 || !std::isfinite(value)) {
+        fprintf(file, "null");
+    } else {
+        fprintf(file, "%.9g", value);
+    }
+}
+
+bool write_json(const char * path, const Options & options, const std::vector<Result> & results, const char * date) {
+    FILE * file = fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "{\n  \"date\": \"%s\",\n", date);
+    fprintf(file, "  \"machine\": {\"max_threads\": %d, \"simd\": \"%s\", \"compiler\": \"%s\"},\n",
+            omp_get_num_procs(), simd_level_name(detect_simd_level()), __VERSION__);
+    fprintf(file, "  \"config\": {\"trials\": %d, \"warmup\": %d, \"time_step\": %g, \"flops_per_interaction\": %g},\n",
+            options.trials, options.warmup, TIME_STEP, FLOPS_PER_INTERACTION);
+    fprintf(file, "  \"results\": [\n");
+    for (std::size_t k = 0; k < results.size(); ++k) {
+        const Result & r = results[k];
+        fprintf(file, "    {\"mode\": \"%s\", \"solver\": \"%s\", \"bodies\": %lld, \"threads\": %d, \"steps\": %lld, "
+                      "\"trials\": %d, ", r.mode.c_str(), r.solver->name, r.n, r.threads, r.steps, r.trials);
+        const char * names[] = {"median_s", "mean_s", "stddev_s", "best_s", "forces_s", "kick_drift_s", "kick_s",
+                                "interactions_per_s", "gflops", "efficiency"};
+        const double values[] = {r.median, r.mean, r.stddev, r.best, r.forces, r.kick_drift, r.kick,
+                                 r.interactions, r.gflops, r.efficiency};
+        for (int f = 0; f < 10; ++f) {
+            fprintf(file, "\"%s\": ", names[f]);
+            json_number(file, values[f]);
+            fprintf(file, f + 1 < 10 ? ", " : "}");
+        }
+        fprintf(file, k + 1 < results.size() ? ",\n" : "\n");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+bool write_csv(const char * path, const std::vector<Result> & results, const char * date) {
+    FILE * file = fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "date,mode,solver,bodies,threads,steps,trials,median_s,mean_s,stddev_s,best_s,"
+                  "forces_s,kick_drift_s,kick_s,interactions_per_s,gflops,efficiency\n");
+    for (const Result & r : results) {
+        fprintf(file, "%s,%s,%s,%lld,%d,%lld,%d,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,", date, r.mode.c_str(),
+                r.solver->name, r.n, r.threads, r.steps, r.trials, r.median, r.mean, r.stddev, r.best, r.forces,
+                r.kick_drift, r.kick, r.interactions);
+        if (r.gflops >= 0.0) {
+            fprintf(file, "%.9g", r.gflops);
+        }
+        fprintf(file, ",");
+        if (r.efficiency >= 0.0) {
+            fprintf(file, "%.9g", r.efficiency);
+        }
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0;
+}
+
+std::vector<std::string> split_list(const char * text) {
+    std::vector<std::string> items;
+    std::string item;
+    for (const char * c = text; ; ++c) {
+        if (*c == ',' || *c == '\0') {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+            item.clear();
+            if (*c == '\0') break;
+        } else {
+            item += *c;
+        }
+    }
+    return items;
+}
+
+void print_usage() {
+    printf("usage: nbody_simulator bench [options]\n"
+           "  --solvers LIST          direct,symmetric,barnes_hut,fmm (default all)\n"
+           "  --sizes LIST            body counts of the sweep (default 1e2,1e3,1e4,1e5,1e6)\n"
+           "  --threads LIST          thread counts for scaling (default powers of two up to the cores)\n"
+           "  --modes LIST            sweep,strong,weak (default all)\n"
+           "  --trials N              timed trials per configuration (default 5)\n"
+           "  --warmup N              untimed steps first (default 2)\n"
+           "  --min-trial-seconds S   steps per trial picked to last about S (default 0.2)\n"
+           "  --max-step-seconds S    skip sweep sizes predicted slower than S per step (default 2)\n"
+           "  --strong-n N            bodies for strong scaling (default 20000)\n"
+           "  --weak-n N              bodies per thread for weak scaling (default 5000)\n"
+           "  --quick                 small sizes and short trials, for a smoke test\n"
+           "  --json PATH, --csv PATH write the results there as well\n");
+}
+
+bool parse_options(int argc, char ** argv, Options & options) {
+    for (int i = 0; i < argc; ++i) {
+        const char * arg = argv[i];
+        if (strcmp(arg, "--quick") == 0) {
+            options.sizes = {100, 1000, 10000};
+            options.trials = 3;
+            options.warmup = 1;
+            options.min_trial_seconds = 0.05;
+            options.strong_n = 4000;
+            options.weak_n = 1000;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf("bench: missing value for %s\n", arg);
+            return false;
+        }
+        const char * value = argv[++i];
+        if (strcmp(arg, "--solvers") == 0) {
+            options.solvers.clear();
+            for (const std::string & name : split_list(value)) {
+                const SolverInfo * found = nullptr;
+                for (const SolverInfo & solver : SOLVERS) {
+                    if (name == solver.name) found = &solver;
+                }
+                if (found == nullptr) {
+                    printf("bench: unknown solver '%s'\n", name.c_str());
+                    return false;
+                }
+                options.solvers.push_back(found);
+            }
+        } else if (strcmp(arg, "--sizes") == 0) {
+            options.sizes.clear();
+            for (const std::string & size : split_list(value)) {
+                options.sizes.push_back(static_cast<long long>(atof(size.c_str())));
+            }
+        } else if (strcmp(arg, "--threads") == 0) {
+            options.threads.clear();
+            for (const std::string & count : split_list(value)) {
+                options.threads.push_back(atoi(count.c_str()));
+            }
+        } else if (strcmp(arg, "--modes") == 0) {
+            options.modes = split_list(value);
+            for (const std::string & mode : options.modes) {
+                if (mode != "sweep" && mode != "strong" && mode != "weak") {
+                    printf("bench: unknown mode '%s'\n", mode.c_str());
+                    return false;
+                }
+            }
+        } else if (strcmp(arg, "--trials") == 0) {
+            options.trials = atoi(value);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            options.warmup = atoi(value);
+        } else if (strcmp(arg, "--min-trial-seconds") == 0) {
+            options.min_trial_seconds = atof(value);
+        } else if (strcmp(arg, "--max-step-seconds") == 0) {
+            options.max_step_seconds = atof(value);
+        } else if (strcmp(arg, "--strong-n") == 0) {
+            options.strong_n = static_cast<long long>(atof(value));
+        } else if (strcmp(arg, "--weak-n") == 0) {
+            options.weak_n = static_cast<long long>(atof(value));
+        } else if (strcmp(arg, "--json") == 0) {
+            options.json_path = value;
+        } else if (strcmp(arg, "--csv") == 0) {
+            options.csv_path = value;
+        } else {
+            printf("bench: unknown option %s\n", arg);
+            return false;
+        }
+    }
+
+    for (long long n : options.sizes) {
+        if (n < 2) {
+            printf("bench: sizes must be at least 2 bodies\n");
+            return false;
+        }
+    }
+    for (int threads : options.threads) {
+        if (threads < 1) {
+            printf("bench: thread counts must be positive\n");
+            return false;
+        }
+    }
+    if (options.trials < 1 || options.warmup < 1 || options.strong_n < 2 || options.weak_n < 2) {
+        printf("bench: trials, warmup, strong-n and weak-n must be positive (n at least 2)\n");
+        return false;
+    }
+    return true;
+}
+
+bool has_mode(const Options & options, const char * mode) {
+    return std::find(options.modes.begin(), options.modes.end(), mode) != options.modes.end();
+}
+
+} // namespace
+
+int run_benchmarks(int argc, char ** argv) {
+    const int max_threads = omp_get_max_threads();
+    Options options;
+    for (const SolverInfo & solver : SOLVERS) {
+        options.solvers.push_back(&solver);
+    }
+    options.sizes = {100, 1000, 10000, 100000, 1000000};
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        options.threads.push_back(threads);
+    }
+    options.threads.push_back(max_threads);
+    options.modes = {"sweep", "strong", "weak"};
+    if (argc > 0 && (strcmp(argv[0], "--help") == 0 || strcmp(argv[0], "-h") == 0)) {
+        print_usage();
+        return 0;
+    }
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    printf("nbody benchmark, %s, %d threads, %s kernels\n", date, max_threads, simd_level_name(detect_simd_level()));
+    printf("times are per step, Inter/s counts n - 1 pair interactions per body acceleration (direct sum equivalent)\n");
+
+    std::vector<Result> results;
+    if (has_mode(options, "sweep")) {
+        run_sweep(options, results);
+    }
+    if (has_mode(options, "strong")) {
+        run_scaling(options, true, results);
+    }
+    if (has_mode(options, "weak")) {
+        run_scaling(options, false, results);
+    }
+    omp_set_num_threads(max_threads);
+
+    bool written = true;
+    if (options.json_path != nullptr) {
+        const bool ok = write_json(options.json_path, options, results, date);
+        printf(ok ? "results written to %s\n" : "bench: could not write %s\n", options.json_path);
+        written &= ok;
+    }
+    if (options.csv_path != nullptr) {
+        const bool ok = write_csv(options.csv_path, results, date);
+        printf(ok ? "results written to %s\n" : "bench: could not write %s\n", options.csv_path);
+        written &= ok;
+    }
+    return written ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// benchmark suite behind `./nbody_simulator bench [options]` and `make bench`:
+// body count sweeps, strong and weak thread scaling, per phase timing, median
+// of repeated trials, optionally written out as json and/or csv so runs can be
+// compared across releases and force solvers. returns the process exit code
+int run_benchmarks(int argc, char ** argv);
+
+#endif
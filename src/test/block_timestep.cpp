@@ -0,0 +1,172 @@
+#include "block_timestep.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::vector<Body> sun_earth_moon() {
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    bodies.push_back(Body(5.972e24, AU_M, 0.0, 0.0, 29780.0));
+    bodies.push_back(Body(7.342e22, AU_M + 3.844e8, 0.0, 0.0, 29780.0 + 1022.0));
+    bodies.push_back(Body(1.898e27, 5.203 * AU_M, 0.0, 0.0, 13070.0));
+    return bodies;
+}
+
+// wide disk around a sun plus a few tight moons, the moons set the step size
+std::vector<Body> clustered(int num_bodies, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> radius(1.0 * AU_M, 20.0 * AU_M);
+    std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    for (int i = 1; i < num_bodies; ++i) {
+        double r = radius(rng);
+        double phi = angle(rng);
+        double speed = sqrt(G_CONST * SUN_MASS / r);
+        double x = r * cos(phi), y = r * sin(phi);
+        double v_x = -speed * sin(phi), v_y = speed * cos(phi);
+        if (i % 100 == 1 && i + 1 < num_bodies) {
+            // a heavy planet and its moon, 1 in 100 bodies
+            const double planet_mass = 1e25;
+            const double moon_r = 1e8;
+            const double moon_speed = sqrt(G_CONST * planet_mass / moon_r);
+            bodies.push_back(Body(planet_mass, x, y, v_x, v_y));
+            bodies.push_back(Body(1e20, x + moon_r, y, v_x, v_y + moon_speed));
+            ++i;
+        } else {
+            bodies.push_back(Body(1e18, x, y, v_x, v_y));
+        }
+    }
+    return bodies;
+}
+
+// distance between where the moon (body 2) ends up in two runs, relative to its orbit
+double moon_error(const Kosmos & a, const Kosmos & b) {
+    const Particles & p = a.get_particles();
+    const Particles & q = b.get_particles();
+    double dx = (p.x[2] - p.x[1]) - (q.x[2] - q.x[1]);
+    double dy = (p.y[2] - p.y[1]) - (q.y[2] - q.y[1]);
+    return sqrt(dx * dx + dy * dy) / 3.844e8;
+}
+
+double largest_difference(const Kosmos & a, const Kosmos & b) {
+    const Particles & p = a.get_particles();
+    const Particles & q = b.get_particles();
+    double worst = 0.0;
+    for (size_t i = 0; i < p.size(); ++i) {
+        double dx = p.x[i] - q.x[i];
+        double dy = p.y[i] - q.y[i];
+        worst = std::max(worst, sqrt(dx * dx + dy * dy));
+    }
+    return worst;
+}
+
+} // namespace
+
+bool test_block_timesteps() {
+    bool passed = true;
+    printf("Block time steps\n");
+
+    // level 0 is the plain verlet step
+    {
+        Kosmos plain(clustered(300, 1u));
+        Kosmos blocks(clustered(300, 1u));
+        blocks.set_max_level(0);
+        plain.run(20, 3600.0);
+        blocks.run(20, 3600.0);
+        const Particles & p = plain.get_particles();
+        const Particles & q = blocks.get_particles();
+        passed &= report("max_level 0 matches step bit for bit",
+                         p.x == q.x && p.y == q.y && p.v_x == q.v_x && p.v_y == q.v_y);
+    }
+
+    // a year of sun, earth, moon and jupiter with one day base steps. the moon
+    // needs finer steps than the planets, compare against a shared step 64x smaller
+    {
+        const double day = 86400.0;
+        const int days = 365;
+        Kosmos reference(sun_earth_moon());
+        reference.run(64LL * days, day / 64.0);
+        Kosmos coarse(sun_earth_moon());
+        coarse.run(days, day);
+        Kosmos blocks(sun_earth_moon());
+        blocks.set_max_level(6);
+        blocks.set_eta(0.01);
+        const double energy_start = total_energy(blocks.get_particles());
+        blocks.run(days, day);
+        const double drift = fabs((total_energy(blocks.get_particles()) - energy_start) / energy_start);
+
+        const double coarse_error = moon_error(coarse, reference);
+        const double block_error = moon_error(blocks, reference);
+        printf("  moon error after a year: shared 1 day %.2e, blocks %.2e (of its orbit radius)\n",
+               coarse_error, block_error);
+        printf("  levels of sun / earth / moon / jupiter:");
+        const std::vector<long long> & counts = blocks.get_level_counts();
+        for (size_t l = 0; l < counts.size(); ++l) {
+            if (counts[l] > 0) {
+                printf(" %lld on %zu", counts[l], l);
+            }
+        }
+        printf("\n  force evaluations: blocks %lld, reference %lld, energy drift %.2e\n",
+               blocks.get_force_evaluations(), reference.get_force_evaluations(), drift);
+        passed &= report("blocks beat the shared coarse step on the moon", block_error < 0.1 * coarse_error);
+        passed &= report("moon within 0.1 orbit radii of the fine step", block_error < 0.1);
+        passed &= report("fewer force evaluations than the fine step",
+                         blocks.get_force_evaluations() < reference.get_force_evaluations());
+        passed &= report("energy drift < 1e-6", drift < 1e-6);
+    }
+
+    // 1% of the bodies are tight moons, the rest is a slow disk. the first block
+    // step has no jerk yet and runs everyone on the finest level
+    {
+        const int num_bodies = 2000;
+        const double base_step = 86400.0;
+        const int max_level = 6;
+        const int steps = 8;
+
+        Kosmos shared(clustered(num_bodies, 7u));
+        auto start = std::chrono::high_resolution_clock::now();
+        shared.run(steps << max_level, base_step / (1 << max_level));
+        const double shared_seconds = seconds_since(start);
+
+        Kosmos blocks(clustered(num_bodies, 7u));
+        blocks.set_max_level(max_level);
+        start = std::chrono::high_resolution_clock::now();
+        blocks.run(steps, base_step);
+        const double block_seconds = seconds_since(start);
+
+        Kosmos tree(clustered(num_bodies, 7u), ForceSolver::BarnesHut);
+        tree.set_max_level(max_level);
+        start = std::chrono::high_resolution_clock::now();
+        tree.run(steps, base_step);
+        const double tree_seconds = seconds_since(start);
+
+        printf("  %d bodies, %d days, finest step base / %d\n", num_bodies, steps, 1 << max_level);
+        printf("  %-22s %14s %10s\n", "", "evaluations", "seconds");
+        printf("  %-22s %14lld %10.3f\n", "shared fine step", shared.get_force_evaluations(), shared_seconds);
+        printf("  %-22s %14lld %10.3f\n", "blocks, direct", blocks.get_force_evaluations(), block_seconds);
+        printf("  %-22s %14lld %10.3f\n", "blocks, barnes hut", tree.get_force_evaluations(), tree_seconds);
+
+        Kosmos coarse(clustered(num_bodies, 7u));
+        coarse.run(steps, base_step);
+
+        const double worst = largest_difference(blocks, shared);
+        const double coarse_worst = largest_difference(coarse, shared);
+        printf("  largest position difference to the fine step: blocks %.3e m, shared base step %.3e m\n",
+               worst, coarse_worst);
+        passed &= report("at least 5x fewer force evaluations",
+                         5 * blocks.get_force_evaluations() < shared.get_force_evaluations());
+        passed &= report("positions 100x closer than the base step", 100 * worst < coarse_worst);
+    }
+
+    printf("%s\n", passed ? "all block time step checks passed" : "block time step checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef BLOCK_TIMESTEP_TEST_H
+#define BLOCK_TIMESTEP_TEST_H
+
+// block time steps: max_level 0 matches plain steps bit for bit, the moon
+// stays on track with a coarse base step, and a clustered system needs far
+// fewer force evaluations than a shared step small enough for its tight pairs
+bool test_block_timesteps();
+
+#endif
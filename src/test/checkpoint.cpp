@@ -0,0 +1,178 @@
+#include "checkpoint.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../io/checkpoint.hpp"
+#include "../constants.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+bool same_state(const Kosmos & a, const Kosmos & b) {
+    const Particles & p = a.get_particles();
+    const Particles & q = b.get_particles();
+    return p.size() == q.size() && p.x == q.x && p.y == q.y && p.v_x == q.v_x && p.v_y == q.v_y
+           && p.a_x == q.a_x && p.a_y == q.a_y && p.mass == q.mass
+           && a.get_time() == b.get_time() && a.get_step_count() == b.get_step_count();
+}
+
+} // namespace
+
+bool test_checkpoint_restart() {
+    const char * path = "test_checkpoint.nbc";
+    const double time_step = 3600.0;
+    bool passed = true;
+
+    printf("Checkpoint / restart\n");
+
+    // barnes hut with non default settings, so the settings have to come back too
+    Kosmos original(orbiting_disk(2000, 3u, 20.0, 1e22), ForceSolver::BarnesHut);
+    original.set_theta(0.4);
+    original.set_quadrupole(true);
+    original.run(20, time_step);
+    original.save_checkpoint(path);
+
+    Kosmos restored(std::vector<Body>{});
+    restored.load_checkpoint(path);
+    bool settings = restored.get_force_solver() == ForceSolver::BarnesHut && restored.get_theta() == 0.4
+                    && restored.get_quadrupole() && restored.get_fmm_order() == original.get_fmm_order();
+    passed &= report("state and settings restored", same_state(original, restored) && settings);
+
+    original.run(20, time_step);
+    restored.run(20, time_step);
+    passed &= report("restored run continues bit for bit", same_state(original, restored));
+
+    // flip one byte in the payload, the load has to fail and leave the kosmos alone
+    FILE * file = std::fopen(path, "r+b");
+    std::fseek(file, 4096, SEEK_SET);
+    int byte = std::fgetc(file);
+    std::fseek(file, 4096, SEEK_SET);
+    std::fputc(byte ^ 0x10, file);
+    std::fclose(file);
+    bool refused = false;
+    try {
+        restored.load_checkpoint(path);
+    } catch (const std::runtime_error &) {
+        refused = true;
+    }
+    passed &= report("corrupted file refused, state untouched", refused && same_state(original, restored));
+
+    // a tracer count whose payload size wraps around to the real one, with the
+    // checksum redone the way the reader sums it (the wrapped tracer arrays
+    // come to 0 bytes), so only the size check stands between the load and
+    // 2^61 tracers
+    original.save_checkpoint(path);
+    bool read_back = false;
+    {
+        file = std::fopen(path, "rb");
+        std::fseek(file, 0, SEEK_END);
+        std::vector<char> bytes(static_cast<std::size_t>(std::ftell(file)));
+        std::rewind(file);
+        read_back = std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        std::fclose(file);
+        CheckpointHeader header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        header.num_tracers = uint64_t(1) << 61; // 7 * 8 * 2^61 is 0 mod 2^64
+        header.checksum = 0;
+        const std::size_t n = header.num_bodies;
+        const int blocks = 7 + ((header.flags & CHECKPOINT_RADII) ? 1 : 0) + ((header.flags & CHECKPOINT_IDS) ? 1 : 0);
+        uint64_t sum = checksum64(&header, sizeof(header));
+        for (int b = 0; b < blocks; ++b) {
+            sum = checksum64(bytes.data() + sizeof(header) + b * n * sizeof(double), n * sizeof(double), sum);
+        }
+        for (int a = 0; a < 7; ++a) {
+            sum = checksum64(bytes.data(), 0, sum);
+        }
+        header.checksum = sum;
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        file = std::fopen(path, "wb");
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fclose(file);
+    }
+    refused = false;
+    try {
+        restored.load_checkpoint(path);
+    } catch (const std::runtime_error &) {
+        refused = true;
+    }
+    passed &= report("wrapping size refused, state untouched",
+                     read_back && refused && same_state(original, restored));
+
+    // loaded over a kosmos that already holds another system, nothing it had
+    // cached may leak into the loaded one
+    original.save_checkpoint(path);
+    Kosmos other(orbiting_disk(300, 9u, 20.0, 1e22));
+    other.set_diagnostics_every(1);
+    other.step(time_step);
+    const double other_potential = other.get_diagnostics().potential;
+    other.load_checkpoint(path);
+    Kosmos empty(std::vector<Body>{});
+    empty.load_checkpoint(path);
+    const double loaded_potential = other.get_diagnostics().potential;
+    passed &= report("loading over another system", same_state(original, other)
+                                                    && loaded_potential == empty.get_diagnostics().potential
+                                                    && loaded_potential != other_potential);
+
+    // a file that passes its checksum but holds a setting the setters refuse:
+    // nothing of it may be applied, not even the settings before the bad one
+    {
+        CheckpointHeader header = CheckpointHeader();
+        header.theta = 0.3;
+        header.fmm_order = 4;
+        header.block_max_level = 99;
+        write_checkpoint(path, header, Particles(orbiting_disk(10, 2u, 20.0, 1e22)));
+    }
+    refused = false;
+    try {
+        restored.load_checkpoint(path);
+    } catch (const std::invalid_argument &) {
+        refused = true;
+    }
+    passed &= report("bad setting refused, settings untouched", refused && same_state(original, restored)
+                                                                && restored.get_theta() == 0.4
+                                                                && restored.get_fmm_order() == original.get_fmm_order());
+
+    // the direct solver's precision and an explicit tile size come back too
+    Kosmos mixed(orbiting_disk(500, 4u, 20.0, 1e22));
+    mixed.set_precision(Precision::Mixed);
+    mixed.set_tile_size(256);
+    mixed.run(5, time_step);
+    mixed.save_checkpoint(path);
+    Kosmos mixed_restored(std::vector<Body>{});
+    mixed_restored.load_checkpoint(path);
+    // get_tile_size reads the mixed tile while mixed, the requested one is the double tile
+    const bool mixed_settings = mixed_restored.get_precision() == Precision::Mixed;
+    mixed_restored.set_precision(Precision::Double);
+    const bool tile_kept = mixed_restored.get_tile_size() == 256;
+    mixed_restored.set_precision(Precision::Mixed);
+    passed &= report("precision and tile size restored", mixed_settings && tile_kept);
+    mixed.run(5, time_step);
+    mixed_restored.run(5, time_step);
+    passed &= report("mixed run continues bit for bit", same_state(mixed, mixed_restored));
+
+    // a big state, what a restart actually costs
+    {
+        const int num_bodies = 1000000;
+        Kosmos big(orbiting_disk(num_bodies, 5u, 20.0, 1e22), ForceSolver::FMM);
+        auto start = std::chrono::high_resolution_clock::now();
+        big.save_checkpoint(path);
+        double save_seconds = seconds_since(start);
+        Kosmos loaded(std::vector<Body>{});
+        start = std::chrono::high_resolution_clock::now();
+        loaded.load_checkpoint(path);
+        double load_seconds = seconds_since(start);
+        passed &= report("1M bodies round trip", same_state(big, loaded));
+        printf("  1M bodies (%.0f MB): save %.3f s, load %.3f s\n", 7.0 * 8.0 * num_bodies / 1e6,
+               save_seconds, load_seconds);
+    }
+
+    std::remove(path);
+    printf("\n%s\n", passed ? "Checkpoint restart ok" : "Checkpoint restart FAILED");
+    return passed;
+}
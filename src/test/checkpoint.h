@@ -0,0 +1,8 @@
+#ifndef CHECKPOINT_TEST_H
+#define CHECKPOINT_TEST_H
+
+// saves a running kosmos, restores it into another one and checks both carry
+// on bit for bit, that damaged files are refused, and times a big save / load
+bool test_checkpoint_restart();
+
+#endif
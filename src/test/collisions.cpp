@@ -0,0 +1,262 @@
+#include "collisions.h"
+#include "test_util.hpp"
+#include "solar_system.h"
+#include "../kosmos/kosmos.hpp"
+#include "../kosmos/collisions.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef std::vector<std::pair<uint32_t, uint32_t>> PairList;
+
+double relative(double a, double b) {
+    return std::fabs(a - b) / std::max(std::fabs(b), 1e-300);
+}
+
+// n bodies spread uniformly over a square of side `side`, radii up to
+// max_radius, every fifth one a point. positions straddle zero so negative
+// cells get exercised
+Particles field(std::size_t n, double side, double max_radius, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> position(-0.5 * side, 0.5 * side);
+    std::uniform_real_distribution<double> size(0.0, max_radius);
+    Particles particles;
+    particles.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        particles.x[i] = position(rng);
+        particles.y[i] = position(rng);
+        particles.mass[i] = 1.0;
+        particles.radius[i] = i % 5 == 0 ? 0.0 : size(rng);
+    }
+    return particles;
+}
+
+PairList brute_force_pairs(const Particles & p) {
+    PairList pairs;
+    for (std::size_t i = 0; i < p.size(); ++i) {
+        for (std::size_t j = i + 1; j < p.size(); ++j) {
+            const double reach = p.radius[i] + p.radius[j];
+            const double dx = p.x[j] - p.x[i];
+            const double dy = p.y[j] - p.y[i];
+            if (dx * dx + dy * dy < reach * reach) {
+                pairs.push_back(std::make_pair(static_cast<uint32_t>(i), static_cast<uint32_t>(j)));
+            }
+        }
+    }
+    return pairs;
+}
+
+// seconds per body of one broad phase pass, best of 3
+double grid_seconds_per_body(SpatialHash & grid, const Particles & particles, PairList & pairs) {
+    grid.overlapping_pairs(particles, pairs);
+    double best = -1.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        grid.overlapping_pairs(particles, pairs);
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (best < 0.0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best / particles.size();
+}
+
+double kinetic(const std::vector<Body> & bodies) {
+    double sum = 0.0;
+    for (const Body & b : bodies) {
+        sum += 0.5 * b.get_mass() * (b.get_v_x() * b.get_v_x() + b.get_v_y() * b.get_v_y());
+    }
+    return sum;
+}
+
+} // namespace
+
+bool test_collisions() {
+    bool passed = true;
+
+    // small masses well inside the softening length, gravity barely matters
+    printf("Merge, head on (1e20 kg at -100 m/s into 3e20 kg at 50 m/s)\n");
+    std::vector<Body> pair;
+    pair.push_back(Body(1e20, -5000.0, 0.0, 100.0, 0.0, 1000.0));
+    pair.push_back(Body(3e20, 5000.0, 10.0, -50.0, 0.0, 2000.0));
+    const double momentum = 1e20 * 100.0 + 3e20 * -50.0;
+    Kosmos merging(pair);
+    merging.set_collision_mode(CollisionMode::Merge);
+    const double * x_before = merging.get_particles().x.data();
+    merging.run(100, 1.0);
+    const std::vector<Body> merged = merging.get_bodies();
+    const std::vector<CollisionEvent> merge_events = merging.get_collision_events();
+    passed &= report("one body left", merged.size() == 1);
+    passed &= report("mass and momentum kept", merged[0].get_mass() == 4e20 &&
+                                                  relative(merged[0].get_mass() * merged[0].get_v_x(), momentum) < 1e-9);
+    passed &= report("volume kept", relative(merged[0].get_radius(), std::cbrt(9e9)) < 1e-12);
+    // 7 km of gap at 150 m/s, the contact falls in step 47
+    passed &= report("event logged", merge_events.size() == 1 && merge_events[0].step == 47 &&
+                                         merge_events[0].first == 1 && merge_events[0].second == 0 &&
+                                         merge_events[0].kind == CollisionMode::Merge &&
+                                         relative(merge_events[0].relative_speed, 150.0) < 1e-3);
+    passed &= report("arrays compacted in place", merging.get_particles().x.data() == x_before &&
+                                                      merging.get_particles().x.capacity() >= 2);
+
+    printf("Merge, a touching chain of 5 at rest\n");
+    std::vector<Body> chain;
+    for (int k = 0; k < 5; ++k) {
+        chain.push_back(Body(1e20 * (1 + (k == 3)), 1500.0 * k, 0.0, 0.0, 0.0, 1000.0));
+    }
+    chain.push_back(Body(5e20, 1e9, 0.0, 0.0, 0.0, 1000.0)); // far away, stays
+    Kosmos chained(chain);
+    chained.set_collision_mode(CollisionMode::Merge);
+    chained.step(1.0);
+    const std::vector<Body> rest = chained.get_bodies();
+    // the heaviest (index 3) survives and lands on the centre of mass, 1500 * 13 / 6
+    passed &= report("one survivor plus the bystander", rest.size() == 2 && rest[0].get_mass() == 6e20 &&
+                                                            std::fabs(rest[0].get_x() - 3250.0) < 1e-3 &&
+                                                            std::fabs(rest[1].get_x() - 1e9) < 1.0);
+    passed &= report("four events, all into the heaviest", chained.get_collision_count() == 4 &&
+                                                               chained.get_collision_events()[0].first == 3);
+
+    printf("Bounce, equal masses head on\n");
+    std::vector<Body> billiards;
+    billiards.push_back(Body(1e10, -5000.0, 0.0, 100.0, 0.0, 1000.0));
+    billiards.push_back(Body(1e10, 5000.0, 0.0, -100.0, 0.0, 1000.0));
+    Kosmos elastic(billiards);
+    elastic.set_collision_mode(CollisionMode::Bounce);
+    const double kinetic_before = kinetic(billiards);
+    elastic.run(100, 1.0);
+    const std::vector<Body> bounced = elastic.get_bodies();
+    passed &= report("velocities swapped", std::fabs(bounced[0].get_v_x() + 100.0) < 1e-6 &&
+                                               std::fabs(bounced[1].get_v_x() - 100.0) < 1e-6);
+    passed &= report("kinetic energy kept", relative(kinetic(bounced), kinetic_before) < 1e-9);
+    passed &= report("apart again, one event", bounced[1].get_x() - bounced[0].get_x() > 2000.0 &&
+                                                   elastic.get_collision_count() == 1);
+
+    Kosmos inelastic(billiards);
+    inelastic.set_collision_mode(CollisionMode::Bounce);
+    inelastic.set_restitution(0.5);
+    inelastic.run(100, 1.0);
+    const std::vector<Body> damped = inelastic.get_bodies();
+    passed &= report("restitution 0.5 halves the closing speed",
+                     std::fabs(damped[1].get_v_x() - damped[0].get_v_x() - 100.0) < 1e-6 &&
+                         std::fabs(damped[0].get_v_x() + damped[1].get_v_x()) < 1e-9);
+    bool threw = false;
+    try {
+        inelastic.set_restitution(1.5);
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    passed &= report("restitution outside [0, 1] throws", threw);
+
+    // a pair created overlapping and already moving apart is only pushed out,
+    // no event, but the bodies moved: the next step must not kick with the
+    // forces of where they were before the push
+    std::vector<Body> overlapping;
+    overlapping.push_back(Body(1e20, -500.0, 0.0, -1.0, 0.0, 1000.0));
+    overlapping.push_back(Body(1e20, 500.0, 0.0, 1.0, 0.0, 1000.0));
+    Kosmos pushed(overlapping);
+    pushed.set_collision_mode(CollisionMode::Bounce);
+    pushed.step(1.0);
+    Kosmos fresh(pushed.get_bodies());
+    fresh.set_collision_mode(CollisionMode::Bounce);
+    pushed.step(1.0);
+    fresh.step(1.0);
+    const std::vector<Body> after_push = pushed.get_bodies();
+    const std::vector<Body> after_fresh = fresh.get_bodies();
+    passed &= report("push out of overlap drops the cached forces",
+                     pushed.get_collision_count() == 0 && after_push[0].get_v_x() == after_fresh[0].get_v_x() &&
+                         after_push[1].get_x() == after_fresh[1].get_x());
+
+    printf("Broad phase against all pairs\n");
+    SpatialHash grid;
+    PairList found;
+    bool same = true;
+    // dense with many contacts, then sparse with one big body among tiny ones
+    const double max_radii[] = {40.0, 3.0};
+    for (double max_radius : max_radii) {
+        Particles particles = field(20000, 1e5, max_radius, 11);
+        particles.radius[17] = 5000.0;
+        grid.overlapping_pairs(particles, found);
+        const PairList expected = brute_force_pairs(particles);
+        printf("    max radius %5.0f m: %zu pairs, grid %zu\n", max_radius, expected.size(), found.size());
+        same &= found == expected && !expected.empty();
+    }
+    passed &= report("same pairs as brute force", same);
+    Particles points = field(1000, 1e5, 0.0, 3);
+    grid.overlapping_pairs(points, found);
+    passed &= report("points never touch", found.empty());
+
+    printf("Broad phase cost, constant density\n");
+    const std::size_t sizes[] = {100000, 1000000};
+    double per_body[2];
+    for (int k = 0; k < 2; ++k) {
+        const Particles particles = field(sizes[k], 1e5 * std::sqrt(sizes[k] / 20000.0), 40.0, 5);
+        per_body[k] = grid_seconds_per_body(grid, particles, found);
+        printf("    %8zu bodies: %6.1f ns per body, %zu pairs\n", sizes[k], 1e9 * per_body[k], found.size());
+    }
+    passed &= report("linear in the body count", per_body[1] < 2.0 * per_body[0]);
+
+    printf("Log and setup\n");
+    Kosmos logged(chain);
+    logged.set_collision_mode(CollisionMode::Merge);
+    logged.set_collision_log_capacity(2);
+    logged.step(1.0);
+    const std::vector<CollisionEvent> newest = logged.get_collision_events();
+    passed &= report("ring keeps the newest", newest.size() == 2 && logged.get_collision_count() == 4 &&
+                                                  newest[0].second == 2 && newest[1].second == 4);
+    logged.clear_collision_events();
+    passed &= report("clear", logged.get_collision_events().empty() && logged.get_collision_count() == 0);
+
+    Kosmos guarded(solar_system_bodies());
+    guarded.set_collision_mode(CollisionMode::Merge);
+    threw = false;
+    try {
+        guarded.attach_trajectory("collisions_test.traj");
+    } catch (const std::logic_error &) {
+        threw = true;
+    }
+    guarded.set_collision_mode(CollisionMode::Bounce);
+    guarded.attach_trajectory("collisions_test.traj");
+    try {
+        guarded.set_collision_mode(CollisionMode::Merge);
+        threw = false;
+    } catch (const std::logic_error &) {
+    }
+    guarded.detach_trajectory();
+    std::remove("collisions_test.traj");
+    passed &= report("merging refused with a trajectory", threw);
+
+    // without radii nothing changes, not even the last bit
+    Kosmos off(solar_system_bodies());
+    Kosmos on(solar_system_bodies());
+    on.set_collision_mode(CollisionMode::Merge);
+    off.run(365, DAY_TO_SECONDS);
+    on.run(365, DAY_TO_SECONDS);
+    const std::vector<Body> a = off.get_bodies(), b = on.get_bodies();
+    bool identical = a.size() == b.size();
+    for (std::size_t i = 0; identical && i < a.size(); ++i) {
+        identical = a[i].get_x() == b[i].get_x() && a[i].get_v_y() == b[i].get_v_y();
+    }
+    passed &= report("point bodies unaffected", identical);
+
+    // radii, mode and restitution survive a checkpoint
+    Kosmos saved(billiards);
+    saved.set_collision_mode(CollisionMode::Bounce);
+    saved.set_restitution(0.0);
+    saved.save_checkpoint("collisions_test.ckpt");
+    Kosmos restored(solar_system_bodies());
+    restored.load_checkpoint("collisions_test.ckpt");
+    std::remove("collisions_test.ckpt");
+    passed &= report("checkpoint keeps radii and settings", restored.get_bodies()[1].get_radius() == 1000.0 &&
+                                                                restored.get_collision_mode() == CollisionMode::Bounce &&
+                                                                restored.get_restitution() == 0.0);
+
+    printf("%s\n", passed ? "all collisions checks passed" : "collisions checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef COLLISIONS_TEST_H
+#define COLLISIONS_TEST_H
+
+// collisions: merges keep mass, momentum and volume, bounces swap head on
+// velocities, the grid broad phase finds exactly the brute force pairs and
+// scales linearly, plus the event log, trajectory guard and checkpoints
+bool test_collisions();
+
+#endif
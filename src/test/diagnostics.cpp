@@ -0,0 +1,138 @@
+#include "diagnostics.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+} // namespace
+
+bool test_diagnostics() {
+    bool passed = true;
+    const std::vector<Body> bodies = orbiting_disk(2000, 7);
+
+    printf("Energy from the force pass vs the exact pair sum (2000 bodies)\n");
+    const ForceSolver solvers[] = {ForceSolver::Direct, ForceSolver::DirectSymmetric,
+                                   ForceSolver::BarnesHut, ForceSolver::FMM};
+    const char * names[] = {"direct", "symmetric", "barnes_hut", "fmm"};
+    const double tolerances[] = {1e-12, 1e-12, 1e-2, 1e-3};
+    for (int s = 0; s < 4; ++s) {
+        Kosmos kosmos(bodies);
+        kosmos.set_force_solver(solvers[s]);
+        const double exact = total_energy(kosmos.get_particles());
+        const double energy = kosmos.get_diagnostics().get_energy();
+        const double error = std::fabs(energy - exact) / std::fabs(exact);
+        printf("    %-10s relative error %.2e\n", names[s], error);
+        passed &= report(names[s], error < tolerances[s]);
+    }
+    // opening every cell leaves only the exact pairs, so whatever barnes hut is
+    // off by above is its approximation and not the bookkeeping
+    Kosmos opened(bodies);
+    opened.set_force_solver(ForceSolver::BarnesHut);
+    opened.set_theta(0.0);
+    const double opened_exact = total_energy(opened.get_particles());
+    passed &= report("barnes_hut theta = 0 is exact",
+                     std::fabs(opened.get_diagnostics().get_energy() - opened_exact) < 1e-12 * std::fabs(opened_exact));
+
+    // two bodies on the same spot are still a pair worth G m^2 / eps, only a
+    // body's own term is left out, whichever pass sums the potential
+    printf("Two bodies on the same spot\n");
+    std::vector<Body> stacked = orbiting_disk(200, 11);
+    const double stacked_speed = sqrt(G_CONST * SUN_MASS / (3.0 * AU_M));
+    stacked.push_back(Body(1e27, 3.0 * AU_M, 0.0, 0.0, stacked_speed));
+    stacked.push_back(Body(1e27, 3.0 * AU_M, 0.0, 0.0, stacked_speed));
+    const char * stacked_names[] = {"same spot, direct", "same spot, symmetric", "same spot, barnes_hut",
+                                    "same spot, fmm", "same spot, mixed", "same spot, hermite",
+                                    "same spot, 64 body tiles"};
+    const double stacked_tolerances[] = {1e-12, 1e-12, 1e-2, 1e-3, 1e-6, 1e-12, 1e-12};
+    for (int s = 0; s < 7; ++s) {
+        Kosmos kosmos(stacked);
+        if (s < 4) {
+            kosmos.set_force_solver(solvers[s]);
+        } else if (s == 4) {
+            kosmos.set_precision(Precision::Mixed);
+        } else if (s == 5) {
+            kosmos.set_integrator(Integrator::Hermite4);
+        } else {
+            kosmos.set_tile_size(64); // the stacked pair ends up in different tiles and blocks
+        }
+        const double exact = total_energy(kosmos.get_particles());
+        const double error = std::fabs(kosmos.get_diagnostics().get_energy() - exact) / std::fabs(exact);
+        passed &= report(stacked_names[s], error < stacked_tolerances[s]);
+    }
+
+    printf("Recording every 10 steps\n");
+    Kosmos kosmos(bodies);
+    kosmos.set_diagnostics_every(10);
+    kosmos.run(100, 3600.0);
+    const std::vector<Diagnostics> & history = kosmos.get_diagnostics_history();
+    passed &= report("one record every 10 steps", history.size() == 10 && history.back().step == 100);
+
+    // the recorded potential is the one the last force pass summed, so it has
+    // to agree with a fresh exact sum at the same positions
+    const double exact = total_energy(kosmos.get_particles());
+    passed &= report("record matches the state it was taken at",
+                     std::fabs(history.back().get_energy() - exact) < 1e-12 * std::fabs(exact));
+
+    // pairwise forces cancel, so momentum only moves by rounding
+    double momentum_scale = 0.0;
+    for (const Body & body : bodies) {
+        momentum_scale += body.get_mass() * hypot(body.get_v_x(), body.get_v_y());
+    }
+    const double dp = hypot(history.back().momentum_x - history.front().momentum_x,
+                            history.back().momentum_y - history.front().momentum_y);
+    const double dl = std::fabs(history.back().angular_momentum - history.front().angular_momentum);
+    printf("    |dP| / sum m|v| %.2e, |dL| / L %.2e, energy drift %.2e\n",
+           dp / momentum_scale, dl / std::fabs(history.front().angular_momentum), kosmos.get_energy_drift());
+    passed &= report("momentum conserved", dp < 1e-12 * momentum_scale);
+    passed &= report("angular momentum conserved", dl < 1e-10 * std::fabs(history.front().angular_momentum));
+    passed &= report("energy drift small", std::fabs(kosmos.get_energy_drift()) < 1e-6);
+
+    // composed and hermite steps record the potential of their final pass too
+    const Integrator integrators[] = {Integrator::ForestRuth, Integrator::Hermite4};
+    for (Integrator integrator : integrators) {
+        Kosmos other(orbiting_disk(200, 3));
+        other.set_integrator(integrator);
+        other.set_diagnostics_every(5);
+        other.run(20, 3600.0);
+        const Diagnostics last = other.get_diagnostics_history().back();
+        const double other_exact = total_energy(other.get_particles());
+        // hermite keeps the forces of its predicted positions, O(dt^4) away
+        const double error = std::fabs(last.get_energy() - other_exact) / std::fabs(other_exact);
+        printf("    %-12s record vs exact %.2e\n", integrator_name(integrator), error);
+        passed &= report(integrator_name(integrator), other.get_diagnostics_history().size() == 4 && error < 1e-9);
+    }
+
+    printf("Cost of recording (2000 bodies, 50 steps)\n");
+    Kosmos plain(bodies);
+    plain.run(1, 3600.0);
+    auto start = std::chrono::high_resolution_clock::now();
+    plain.run(50, 3600.0);
+    const double plain_time = seconds_since(start);
+
+    Kosmos every(bodies);
+    every.set_diagnostics_every(1);
+    every.run(1, 3600.0);
+    start = std::chrono::high_resolution_clock::now();
+    every.run(50, 3600.0);
+    const double every_time = seconds_since(start);
+
+    // what recording used to cost: a separate pair sum after every step
+    start = std::chrono::high_resolution_clock::now();
+    for (int k = 0; k < 50; ++k) {
+        total_energy(plain.get_particles());
+    }
+    const double separate_time = seconds_since(start);
+
+    printf("    plain %.3f s, recording every step %.3f s (+%.1f%%), separate pair sums %.3f s\n",
+           plain_time, every_time, 100.0 * (every_time / plain_time - 1.0), separate_time);
+    passed &= report("recording every step costs < 25% more", every_time < 1.25 * plain_time);
+
+    printf("%s\n", passed ? "all diagnostics checks passed" : "diagnostics checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef DIAGNOSTICS_TEST_H
+#define DIAGNOSTICS_TEST_H
+
+// energy from the force pass against the exact pair sum for every solver,
+// momentum and angular momentum conservation, the every k steps history, and
+// what recording costs next to plain steps and the separate O(N^2) sum
+bool test_diagnostics();
+
+#endif
@@ -0,0 +1,227 @@
+#include "ensemble.h"
+#include "test_util.hpp"
+#include "solar_system.h"
+#include "../kosmos/ensemble.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../kosmos/small_kosmos.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <omp.h>
+
+namespace {
+
+// a sun and n - 1 planets on circular orbits 0.4 AU apart, every copy gets
+// its speeds scaled by 1 + kick (a monte carlo perturbation)
+std::vector<Body> planetary_system(int n, double kick) {
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    for (int k = 1; k < n; ++k) {
+        const double r = 0.4 * k * AU_M;
+        const double phi = 2.4 * k;
+        const double speed = (1.0 + kick * k) * sqrt(G_CONST * SUN_MASS / r);
+        bodies.push_back(Body(1e24 * k, r * cos(phi), r * sin(phi), -speed * sin(phi), speed * cos(phi)));
+    }
+    return bodies;
+}
+
+template <typename Call>
+bool throws(Call call) {
+    try {
+        call();
+    } catch (const std::exception &) {
+        return true;
+    }
+    return false;
+}
+
+// the bodies of an ensemble system and of a SmallKosmos agree to the last bit
+template <int N>
+bool same_state(const Ensemble & ensemble, std::size_t system, const SmallKosmos<N> & small) {
+    const std::vector<Body> bodies = ensemble.get_bodies(system);
+    for (int i = 0; i < N; ++i) {
+        const Body body = small.get_body(i);
+        if (bodies[i].get_x() != body.get_x() || bodies[i].get_y() != body.get_y() ||
+            bodies[i].get_v_x() != body.get_v_x() || bodies[i].get_v_y() != body.get_v_y()) {
+            return false;
+        }
+    }
+    return ensemble.get_time(system) == small.get_time() && ensemble.get_step_count(system) == small.get_step_count();
+}
+
+// copies of an N body system, run as an ensemble and one by one as SmallKosmos
+template <int N>
+bool matches_small_kosmos(Integrator integrator) {
+    const int copies = 5;
+    Ensemble ensemble;
+    ensemble.set_integrator(integrator);
+    for (int c = 0; c < copies; ++c) {
+        ensemble.add_system(planetary_system(N, 1e-3 * c));
+    }
+    ensemble.run(500, 3600.0);
+    ensemble.run(500, 3600.0);
+    bool same = ensemble.get_system_steps() == 1000LL * copies;
+    for (int c = 0; c < copies; ++c) {
+        SmallKosmos<N> small(planetary_system(N, 1e-3 * c));
+        small.set_integrator(integrator);
+        small.run(1000, 3600.0);
+        same &= same_state(ensemble, c, small);
+    }
+    return same;
+}
+
+// systems-steps per second of an ensemble of 3 body systems, best of 3
+double ensemble_rate(int systems, long long steps) {
+    Ensemble ensemble;
+    for (int s = 0; s < systems; ++s) {
+        ensemble.add_system(planetary_system(3, 1e-6 * s));
+    }
+    ensemble.run(1, 3600.0);
+    double best = 0.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        ensemble.run(steps, 3600.0);
+        best = std::max(best, systems * steps / seconds_since(start));
+    }
+    return best;
+}
+
+// the same with one Kosmos per system stepped one after another, the way a
+// python loop over Kosmos objects does it
+double kosmos_rate(int systems, long long steps) {
+    std::vector<std::unique_ptr<Kosmos>> kosmoi;
+    for (int s = 0; s < systems; ++s) {
+        kosmoi.push_back(std::unique_ptr<Kosmos>(new Kosmos(planetary_system(3, 1e-6 * s))));
+        kosmoi.back()->run(1, 3600.0);
+    }
+    double best = 0.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (int s = 0; s < systems; ++s) {
+            kosmoi[s]->run(steps, 3600.0);
+        }
+        best = std::max(best, systems * steps / seconds_since(start));
+    }
+    return best;
+}
+
+} // namespace
+
+bool test_ensemble() {
+    bool passed = true;
+
+    printf("Ensemble setup\n");
+    passed &= report("empty system throws", throws([] {
+        Ensemble ensemble;
+        ensemble.add_system(std::vector<Body>());
+    }));
+    passed &= report("hermite refused", throws([] {
+        Ensemble ensemble;
+        ensemble.set_integrator(Integrator::Hermite4);
+    }));
+    passed &= report("run_until needs one end time per system", throws([] {
+        Ensemble ensemble;
+        ensemble.add_system(planetary_system(2, 0.0));
+        ensemble.run_until(std::vector<double>(2, 1.0), 1.0);
+    }));
+    passed &= report("bad system index throws", throws([] {
+        Ensemble ensemble;
+        ensemble.add_system(planetary_system(2, 0.0));
+        ensemble.get_bodies(1);
+    }));
+
+    // bulk arrays, 3 systems of 2 bodies, then the packed copies back out
+    Ensemble bulk;
+    const double mass[] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+    const double xs[] = {0.0, 1.0, 2.0, 3.0, 4.0, 5.0};
+    const double zeros[] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    bulk.add_system(planetary_system(5, 0.0));
+    const std::size_t first = bulk.add_systems(3, 2, mass, xs, zeros, zeros, zeros);
+    const std::vector<std::size_t> offsets = bulk.get_offsets();
+    const std::vector<double> packed_x = bulk.get_x();
+    passed &= report("add_systems and packed arrays",
+                     first == 1 && bulk.get_system_count() == 4 && bulk.get_body_count() == 11 &&
+                         offsets.size() == 5 && offsets[1] == 5 && offsets[4] == 11 && packed_x.size() == 11 &&
+                         packed_x[5] == 0.0 && packed_x[10] == 5.0 && bulk.get_mass()[8] == 4.0 &&
+                         bulk.get_system_size(2) == 2);
+
+    printf("Mixed sizes against SmallKosmos, 1000 steps of 1 hour\n");
+    const Integrator integrators[] = {Integrator::Verlet, Integrator::ForestRuth, Integrator::Yoshida6};
+    for (Integrator integrator : integrators) {
+        // 2, 3 and 16 bodies take the unrolled kernels, 20 the plain loop
+        const bool same = matches_small_kosmos<2>(integrator) && matches_small_kosmos<3>(integrator) &&
+                          matches_small_kosmos<16>(integrator) && matches_small_kosmos<20>(integrator);
+        passed &= report(integrator_name(integrator), same);
+    }
+
+    // the solar system as one member of a mixed ensemble, energy against Kosmos
+    Ensemble mixed;
+    mixed.add_system(planetary_system(2, 0.0));
+    mixed.add_system(solar_system_bodies());
+    mixed.add_system(planetary_system(7, 0.0));
+    Kosmos kosmos(solar_system_bodies());
+    mixed.run(3653, DAY_TO_SECONDS);
+    kosmos.run(3653, DAY_TO_SECONDS);
+    const double energy = mixed.get_energies()[1];
+    const double kosmos_energy = kosmos.get_diagnostics().get_energy();
+    printf("    solar system after 10 years: energy %.2e off Kosmos\n",
+           std::fabs(energy - kosmos_energy) / std::fabs(kosmos_energy));
+    passed &= report("solar system member", std::fabs(energy - kosmos_energy) < 1e-10 * std::fabs(kosmos_energy) &&
+                                                mixed.get_diagnostics(1).step == 3653);
+
+    printf("run_until with a different end time per system\n");
+    Ensemble lifetimes;
+    std::vector<double> end_times;
+    for (int s = 0; s < 6; ++s) {
+        lifetimes.add_system(planetary_system(3, 1e-3 * s));
+        end_times.push_back(3600.0 * (100 + 250 * s) + 600.5 * s);
+    }
+    lifetimes.set_integrator(Integrator::ForestRuth);
+    lifetimes.run_until(end_times, 3600.0);
+    bool landed = true;
+    for (int s = 0; s < 6; ++s) {
+        SmallKosmos<3> small(planetary_system(3, 1e-3 * s));
+        small.set_integrator(Integrator::ForestRuth);
+        small.run(100 + 250 * s, 3600.0);
+        if (s > 0) {
+            small.step(600.5 * s);
+        }
+        const std::vector<Body> bodies = lifetimes.get_bodies(s);
+        landed &= lifetimes.get_time(s) == end_times[s] && lifetimes.get_step_count(s) == small.get_step_count() &&
+                  bodies[1].get_x() == small.get_body(1).get_x() && bodies[2].get_v_y() == small.get_body(2).get_v_y();
+    }
+    lifetimes.run_until(end_times, 3600.0);
+    passed &= report("every system lands on its end time", landed);
+    passed &= report("systems already there stay put", lifetimes.get_system_steps() == 6 * 100 + 250 * 15 + 5);
+
+    printf("Throughput, 3 body systems\n");
+    const int procs = omp_get_num_procs();
+    const int saved_threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    const double loop_rate = kosmos_rate(1000, 100);
+    const double one_thread = ensemble_rate(10000, 100);
+    printf("    Kosmos per system, 1 thread  %10.3e systems-steps/s\n", loop_rate);
+    printf("    Ensemble,          1 thread  %10.3e systems-steps/s, %5.1fx\n", one_thread, one_thread / loop_rate);
+    passed &= report("ensemble 5x a loop of Kosmos", one_thread >= 5.0 * loop_rate);
+    double efficiency = 1.0;
+    for (int threads = 2; threads <= procs; threads *= 2) {
+        omp_set_num_threads(threads);
+        const double rate = ensemble_rate(10000, 100);
+        efficiency = rate / (threads * one_thread);
+        printf("    Ensemble,        %3d threads %10.3e systems-steps/s, efficiency %.2f\n", threads, rate, efficiency);
+    }
+    omp_set_num_threads(saved_threads);
+    if (procs > 1) {
+        passed &= report("scales with threads (efficiency > 0.7)", efficiency > 0.7);
+    } else {
+        printf("    one core here, scaling not measured\n");
+    }
+
+    printf("%s\n", passed ? "all ensemble checks passed" : "ensemble checks FAILED");
+    return passed;
+}
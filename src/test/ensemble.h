@@ -0,0 +1,9 @@
+#ifndef ENSEMBLE_TEST_H
+#define ENSEMBLE_TEST_H
+
+// Ensemble of mixed size systems against SmallKosmos runs of each one (the
+// same numbers), run_until with a different end time per system, and the
+// systems-steps per second against stepping a Kosmos per system, per thread count
+bool test_ensemble();
+
+#endif
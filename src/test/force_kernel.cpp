@@ -0,0 +1,202 @@
+#include "force_kernel.h"
+#include "../body/body.hpp"
+#include "../forces/direct.hpp"
+#include "../forces/symmetric.hpp"
+#include "../forces/tiled.hpp"
+#include "../particles/particles.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <omp.h>
+#include <random>
+#include <vector>
+
+namespace {
+
+// the pre-soa calculate_forces loop, kept verbatim as the reference:
+// getters, i == j branch, sqrt and two divisions per pair, then a = f / m
+void reference_accelerations(std::vector<Body> & bodies) {
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        double local_f_x = 0.0;
+        double local_f_y = 0.0;
+        for (size_t j = 0; j < bodies.size(); ++j) {
+            if (i == j) continue;
+            Body & bodyA = bodies[i];
+            Body & bodyB = bodies[j];
+            double dx = bodyB.get_x() - bodyA.get_x();
+            double dy = bodyB.get_y() - bodyA.get_y();
+            double distance_sq = dx * dx + dy * dy + SOFTENING_LENGTH_SQ;
+            double distance = sqrt(distance_sq);
+            double force_magnitude = (G_CONST * bodyA.get_mass() * bodyB.get_mass()) / distance_sq;
+            local_f_x += force_magnitude * (dx / distance);
+            local_f_y += force_magnitude * (dy / distance);
+        }
+        bodies[i].set_f_x(local_f_x);
+        bodies[i].set_f_y(local_f_y);
+        bodies[i].compute_acceleration();
+    }
+}
+
+// sun plus a disk of planets, with a few bodies closer than the softening length
+std::vector<Body> make_disk(int num_bodies, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> radius(0.3 * AU_M, 30.0 * AU_M);
+    std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+    std::uniform_real_distribution<double> mass(1e22, 1e27);
+
+    std::vector<Body> bodies;
+    bodies.push_back(Body(1.989e30, 0.0, 0.0));
+    for (int i = 1; i < num_bodies; ++i) {
+        double r = radius(rng);
+        double theta = angle(rng);
+        bodies.push_back(Body(mass(rng), r * cos(theta), r * sin(theta)));
+    }
+    // near coincident pair inside the softening length
+    bodies.push_back(Body(7.342e22, AU_M, 0.0));
+    bodies.push_back(Body(7.342e22, AU_M + 1e5, 0.0));
+    return bodies;
+}
+
+// worst relative error of |a| over all bodies
+double max_relative_error(const std::vector<Body> & reference, const Particles & particles) {
+    double worst = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        double ref_x = reference[i].get_a_x();
+        double ref_y = reference[i].get_a_y();
+        double err_x = particles.a_x[i] - ref_x;
+        double err_y = particles.a_y[i] - ref_y;
+        double err = sqrt(err_x * err_x + err_y * err_y) / sqrt(ref_x * ref_x + ref_y * ref_y);
+        if (err > worst) worst = err;
+    }
+    return worst;
+}
+
+} // namespace
+
+bool test_force_kernel_accuracy() {
+    const double tolerance = 1e-12;
+    const SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512};
+    const int sizes[] = {13, 1003, 4096}; // odd sizes exercise the vector tails
+    bool passed = true;
+
+    printf("Direct force kernel accuracy (runtime level: %s)\n", simd_level_name(detect_simd_level()));
+    printf("%-10s %8s %16s %16s\n", "Level", "Bodies", "Max rel error", "Pairs/s");
+    printf("%-10s %8s %16s %16s\n", "---", "---", "---", "---");
+
+    for (int num_bodies : sizes) {
+        std::vector<Body> reference = make_disk(num_bodies, 42u + num_bodies);
+        Particles particles(reference);
+        reference_accelerations(reference);
+        const size_t n = particles.size();
+
+        for (SimdLevel level : levels) {
+            if (level != SimdLevel::Scalar && static_cast<int>(level) > static_cast<int>(detect_simd_level())) {
+                printf("%-10s %8zu %16s %16s\n", simd_level_name(level), n, "unsupported", "-");
+                continue;
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            direct_accelerations(level, particles.x.data(), particles.y.data(), n,
+                                 particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                                 particles.a_x.data(), particles.a_y.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            double seconds = std::chrono::duration<double>(end - start).count();
+
+            double error = max_relative_error(reference, particles);
+            bool ok = error < tolerance;
+            passed = passed && ok;
+            printf("%-10s %8zu %16.3e %16.3e%s\n", simd_level_name(level), n, error,
+                   (double)n * n / seconds, ok ? "" : "  FAIL");
+        }
+
+        // pair once kernel, rates count both halves of each pair to compare with the rows above
+        SymmetricDirectSolver symmetric;
+        auto start = std::chrono::high_resolution_clock::now();
+        symmetric.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                                particles.a_x.data(), particles.a_y.data());
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double error = max_relative_error(reference, particles);
+        bool ok = error < tolerance;
+        passed = passed && ok;
+        printf("%-10s %8zu %16.3e %16.3e%s\n", "symmetric", n, error, (double)n * n / seconds, ok ? "" : "  FAIL");
+
+        // small fixed tile so every size above is split into several source tiles
+        TiledDirectSolver tiled(256);
+        start = std::chrono::high_resolution_clock::now();
+        tiled.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                            particles.a_x.data(), particles.a_y.data());
+        end = std::chrono::high_resolution_clock::now();
+        seconds = std::chrono::duration<double>(end - start).count();
+        error = max_relative_error(reference, particles);
+        ok = error < tolerance;
+        passed = passed && ok;
+        printf("%-10s %8zu %16.3e %16.3e%s\n", "tiled", n, error, (double)n * n / seconds, ok ? "" : "  FAIL");
+    }
+
+    // galaxy scale, r^2 well past what a float holds (the avx2 estimate is
+    // single precision), every level has to give the scalar forces
+    {
+        std::vector<Body> far;
+        for (int k = 0; k < 8; ++k) {
+            far.push_back(Body(2e41, 3e20 * k, 1e20 * (k % 3), 0.0, 0.0));
+        }
+        Particles particles(far);
+        const size_t n = particles.size();
+        std::vector<double> scalar_x(n), scalar_y(n);
+        direct_accelerations(SimdLevel::Scalar, particles.x.data(), particles.y.data(), n, particles.x.data(),
+                             particles.y.data(), particles.mass.data(), n, scalar_x.data(), scalar_y.data());
+        for (SimdLevel level : levels) {
+            if (level == SimdLevel::Scalar || static_cast<int>(level) > static_cast<int>(detect_simd_level())) {
+                continue;
+            }
+            direct_accelerations(level, particles.x.data(), particles.y.data(), n, particles.x.data(),
+                                 particles.y.data(), particles.mass.data(), n, particles.a_x.data(),
+                                 particles.a_y.data());
+            double error = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                error = std::max(error, std::fabs(particles.a_x[i] - scalar_x[i]) / std::fabs(scalar_x[i]));
+            }
+            bool ok = error < tolerance;
+            passed = passed && ok;
+            printf("%-10s %8s %16.3e %16s%s\n", simd_level_name(level), "far", error, "-", ok ? "" : "  FAIL");
+        }
+    }
+
+    printf("\n%s (tolerance %.0e)\n", passed ? "All levels match the scalar path" : "Kernel mismatch", tolerance);
+    return passed;
+}
+
+void benchmark_direct_tiling() {
+    const int sizes[] = {4096, 16384, 65536};
+
+    printf("Direct sum, one source tile vs auto tuned tiles (%d threads)\n", omp_get_max_threads());
+    printf("%8s %14s %14s %10s %10s\n", "Bodies", "Untiled (ms)", "Tiled (ms)", "Tile", "Speedup");
+    printf("%8s %14s %14s %10s %10s\n", "---", "---", "---", "---", "---");
+
+    for (int num_bodies : sizes) {
+        Particles particles(make_disk(num_bodies, 7u));
+        particles.first_touch();
+        const size_t n = particles.size();
+
+        TiledDirectSolver untiled(static_cast<int>(n));
+        auto start = std::chrono::high_resolution_clock::now();
+        untiled.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                              particles.a_x.data(), particles.a_y.data());
+        double untiled_ms = 1e3 * std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        // first call tunes, the second one is the steady state that gets timed
+        TiledDirectSolver tiled;
+        tiled.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                            particles.a_x.data(), particles.a_y.data());
+        start = std::chrono::high_resolution_clock::now();
+        tiled.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                            particles.a_x.data(), particles.a_y.data());
+        double tiled_ms = 1e3 * std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        printf("%8zu %14.2f %14.2f %10d %9.2fx\n", n, untiled_ms, tiled_ms, tiled.get_tile_size(),
+               untiled_ms / tiled_ms);
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef FORCE_KERNEL_H
+#define FORCE_KERNEL_H
+
+// checks every simd level of the direct kernel against the original scalar
+// body loop, returns false if any level is off by more than the tolerance
+bool test_force_kernel_accuracy();
+
+// untiled vs tiled direct sum at growing sizes, prints the tile the auto tuner picked
+void benchmark_direct_tiling();
+
+#endif
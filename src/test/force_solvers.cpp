@@ -0,0 +1,192 @@
+#include "force_solvers.h"
+#include "test_util.hpp"
+#include "../forces/barnes_hut.hpp"
+#include "../forces/direct.hpp"
+#include "../forces/fmm.hpp"
+#include "../particles/particles.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <omp.h>
+#include <random>
+#include <vector>
+
+namespace {
+
+// self gravitating disk of comparable masses, no dominant sun to hide tree errors
+Particles make_cluster_disk(int num_bodies, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    Particles particles;
+    particles.resize(num_bodies);
+    for (int i = 0; i < num_bodies; ++i) {
+        // a few dense clumps on top of an exponential disk
+        double r = -5.0 * AU_M * log(1.0 - 0.999 * unit(rng));
+        double theta = 2.0 * M_PI * unit(rng);
+        double cx = 0.0, cy = 0.0;
+        if (i % 5 == 0) {
+            cx = 10.0 * AU_M * ((i / 5) % 3 - 1);
+            cy = 6.0 * AU_M * ((i / 15) % 3 - 1);
+            r *= 0.05;
+        }
+        particles.x[i] = cx + r * cos(theta);
+        particles.y[i] = cy + r * sin(theta);
+        particles.mass[i] = 1e24 * (0.5 + unit(rng));
+    }
+    return particles;
+}
+
+// rms and max of |a - a_ref| / |a_ref|
+void relative_errors(const std::vector<double> & ref_x, const std::vector<double> & ref_y,
+                     const std::vector<double> & a_x, const std::vector<double> & a_y,
+                     double & rms, double & worst) {
+    double sum = 0.0;
+    worst = 0.0;
+    for (size_t i = 0; i < ref_x.size(); ++i) {
+        double ex = a_x[i] - ref_x[i];
+        double ey = a_y[i] - ref_y[i];
+        double err = sqrt((ex * ex + ey * ey) / (ref_x[i] * ref_x[i] + ref_y[i] * ref_y[i]));
+        sum += err * err;
+        if (err > worst) worst = err;
+    }
+    rms = sqrt(sum / ref_x.size());
+}
+
+// reference accelerations from the simd direct kernel, threaded over target blocks
+double direct_reference(const Particles & particles, std::vector<double> & ref_x, std::vector<double> & ref_y) {
+    const size_t n = particles.size();
+    ref_x.resize(n);
+    ref_y.resize(n);
+    auto start = std::chrono::high_resolution_clock::now();
+    const size_t block = 64;
+    #pragma omp parallel for schedule(guided)
+    for (size_t b = 0; b < (n + block - 1) / block; ++b) {
+        size_t begin = b * block;
+        size_t count = (begin + block < n) ? block : n - begin;
+        direct_accelerations(particles.x.data() + begin, particles.y.data() + begin, count,
+                             particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                             ref_x.data() + begin, ref_y.data() + begin);
+    }
+    return seconds_since(start);
+}
+
+} // namespace
+
+bool test_barnes_hut_accuracy() {
+    const int sizes[] = {5000, 50000};
+    const double thetas[] = {0.3, 0.5, 0.8};
+    // rms error should fall off like theta^2 for monopoles and theta^3 with quadrupoles
+    const double rms_scale[2] = {0.1, 0.01};
+    bool passed = true;
+
+    printf("Barnes-Hut accuracy against the direct sum\n");
+    printf("%-8s %6s %6s %14s %14s %12s %10s\n", "Bodies", "Theta", "Quad", "RMS rel err", "Max rel err", "Time (ms)", "Speedup");
+    printf("%-8s %6s %6s %14s %14s %12s %10s\n", "---", "---", "---", "---", "---", "---", "---");
+
+    for (int num_bodies : sizes) {
+        Particles particles = make_cluster_disk(num_bodies, 7u);
+        const size_t n = particles.size();
+        std::vector<double> ref_x, ref_y, a_x(n), a_y(n);
+        double direct_time = direct_reference(particles, ref_x, ref_y);
+        printf("%-8zu %6s %6s %14s %14s %12.2f %10s\n", n, "-", "-", "direct", "-", direct_time * 1e3, "1.00x");
+
+        for (double theta : thetas) {
+            for (int quad = 0; quad < 2; ++quad) {
+                BarnesHutSolver solver(theta, quad == 1);
+                auto start = std::chrono::high_resolution_clock::now();
+                solver.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                                     a_x.data(), a_y.data());
+                double time = seconds_since(start);
+
+                double rms, worst;
+                relative_errors(ref_x, ref_y, a_x, a_y, rms, worst);
+                bool ok = rms < rms_scale[quad] * pow(theta, quad == 1 ? 3 : 2);
+                passed = passed && ok;
+                printf("%-8zu %6.2f %6s %14.3e %14.3e %12.2f %9.2fx%s\n", n, theta, quad ? "yes" : "no",
+                       rms, worst, time * 1e3, direct_time / time, ok ? "" : "  FAIL");
+            }
+        }
+        printf("\n");
+    }
+
+    printf("%s\n", passed ? "Barnes-Hut force error within bounds" : "Barnes-Hut force error out of bounds");
+    return passed;
+}
+
+bool test_fmm_accuracy() {
+    const int num_bodies = 50000;
+    const int orders[] = {2, 4, 6, 8, 10};
+    bool passed = true;
+
+    Particles particles = make_cluster_disk(num_bodies, 7u);
+    const size_t n = particles.size();
+    std::vector<double> ref_x, ref_y, a_x(n), a_y(n);
+    double direct_time = direct_reference(particles, ref_x, ref_y);
+
+    printf("FMM accuracy against the direct sum, %zu bodies, theta 0.5\n", n);
+    printf("%-6s %14s %14s %12s %10s\n", "Order", "RMS rel err", "Max rel err", "Time (ms)", "Speedup");
+    printf("%-6s %14s %14s %12s %10s\n", "---", "---", "---", "---", "---");
+    printf("%-6s %14s %14s %12.2f %10s\n", "direct", "-", "-", direct_time * 1e3, "1.00x");
+
+    double previous_rms = 1.0;
+    for (int order : orders) {
+        FmmSolver solver(order);
+        auto start = std::chrono::high_resolution_clock::now();
+        solver.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n, a_x.data(), a_y.data());
+        double time = seconds_since(start);
+
+        double rms, worst;
+        relative_errors(ref_x, ref_y, a_x, a_y, rms, worst);
+        // every two orders should buy at least a factor of 2 in accuracy
+        bool ok = rms < 0.5 * previous_rms && rms < 0.5 * pow(0.5, order);
+        passed = passed && ok;
+        previous_rms = rms;
+        printf("%-6d %14.3e %14.3e %12.2f %9.2fx%s\n", order, rms, worst, time * 1e3, direct_time / time, ok ? "" : "  FAIL");
+    }
+
+    printf("\n%s\n", passed ? "FMM error shrinks with the expansion order" : "FMM error out of bounds");
+    return passed;
+}
+
+void benchmark_force_solvers() {
+    const int sizes[] = {1000, 4000, 16000, 64000, 256000, 1048576};
+    const int direct_limit = 64000; // direct sum beyond this takes minutes
+    const int repeats = 3;
+
+    printf("Force solver scaling (one force evaluation, best of %d, %d threads)\n", repeats, omp_get_max_threads());
+    printf("Barnes-Hut: theta 0.5 quadrupole, FMM: order 6 theta 0.5 (similar accuracy)\n");
+    printf("%-10s %14s %14s %14s %12s %12s\n", "Bodies", "Direct (ms)", "BH (ms)", "FMM (ms)", "BH rms err", "FMM rms err");
+    printf("%-10s %14s %14s %14s %12s %12s\n", "---", "---", "---", "---", "---", "---");
+
+    BarnesHutSolver barnes_hut(0.5, true);
+    FmmSolver fmm(6, 0.5);
+    for (int num_bodies : sizes) {
+        Particles particles = make_cluster_disk(num_bodies, 11u);
+        const size_t n = particles.size();
+        std::vector<double> ref_x, ref_y, bh_x(n), bh_y(n), fmm_x(n), fmm_y(n);
+
+        double direct_time = HUGE_VAL, bh_time = HUGE_VAL, fmm_time = HUGE_VAL;
+        for (int r = 0; r < repeats; ++r) {
+            if (num_bodies <= direct_limit) {
+                direct_time = std::min(direct_time, direct_reference(particles, ref_x, ref_y));
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+            barnes_hut.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n, bh_x.data(), bh_y.data());
+            bh_time = std::min(bh_time, seconds_since(start));
+            start = std::chrono::high_resolution_clock::now();
+            fmm.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n, fmm_x.data(), fmm_y.data());
+            fmm_time = std::min(fmm_time, seconds_since(start));
+        }
+
+        if (num_bodies <= direct_limit) {
+            double bh_rms, fmm_rms, worst;
+            relative_errors(ref_x, ref_y, bh_x, bh_y, bh_rms, worst);
+            relative_errors(ref_x, ref_y, fmm_x, fmm_y, fmm_rms, worst);
+            printf("%-10zu %14.2f %14.2f %14.2f %12.2e %12.2e\n", n, direct_time * 1e3, bh_time * 1e3, fmm_time * 1e3, bh_rms, fmm_rms);
+        } else {
+            printf("%-10zu %14s %14.2f %14.2f %12s %12s\n", n, "skipped", bh_time * 1e3, fmm_time * 1e3, "-", "-");
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef FORCE_SOLVERS_H
+#define FORCE_SOLVERS_H
+
+// barnes hut against the direct sum over a range of opening angles,
+// returns false if the force error is not bounded as expected
+bool test_barnes_hut_accuracy();
+
+// fmm against the direct sum for a range of expansion orders,
+// returns false if the error does not shrink with the order as expected
+bool test_fmm_accuracy();
+
+// time per force evaluation of direct, barnes hut and fmm over a sweep of
+// body counts, shows where each solver overtakes the others
+void benchmark_force_solvers();
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FUSED_STEP_TEST_H
+#define FUSED_STEP_TEST_H
+
+// the one region direct verlet step against the same step done as separate
+// passes: same bits at every thread count, and what the saved fork / joins
+// are worth for small systems
+bool test_fused_step();
+
+#endif
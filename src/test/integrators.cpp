@@ -0,0 +1,98 @@
+#include "integrators.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+// sun and a planet at perihelion of an e = 0.5 orbit with a 1 AU semi major axis
+std::vector<Body> kepler() {
+    const double e = 0.5;
+    const double perihelion = (1.0 - e) * AU_M;
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    bodies.push_back(Body(1e20, perihelion, 0.0, 0.0, sqrt(G_CONST * SUN_MASS * (1.0 + e) / perihelion)));
+    return bodies;
+}
+
+double orbit_period() {
+    return 2.0 * M_PI * sqrt(AU_M * AU_M * AU_M / (G_CONST * SUN_MASS));
+}
+
+struct Result {
+    double energy_error; // largest relative energy error seen over the run
+    long long force_evaluations;
+};
+
+Result run_orbits(Integrator integrator, int steps_per_orbit, int orbits) {
+    Kosmos kosmos(kepler());
+    kosmos.set_integrator(integrator);
+    const double start = total_energy(kosmos.get_particles());
+    double worst = 0.0;
+    kosmos.run(static_cast<long long>(steps_per_orbit) * orbits, orbit_period() / steps_per_orbit, 1,
+               [&](const Kosmos & k) {
+                   worst = std::max(worst, fabs((total_energy(k.get_particles()) - start) / start));
+                   return true;
+               });
+    Result result = {worst, kosmos.get_force_evaluations() / 2};
+    return result;
+}
+
+} // namespace
+
+bool test_integrators() {
+    const Integrator integrators[] = {Integrator::Verlet, Integrator::ForestRuth, Integrator::Yoshida6,
+                                      Integrator::Hermite4};
+    const int orders[] = {2, 4, 6, 4};
+    const int steps[] = {25, 50, 100, 200, 400};
+    const int orbits = 10;
+    bool passed = true;
+
+    printf("Integrators, e = 0.5 kepler orbit, %d orbits, largest relative energy error\n", orbits);
+    printf("  %-12s", "steps/orbit");
+    for (int s : steps) {
+        printf(" %10d", s);
+    }
+    printf("\n");
+
+    Result results[4][5];
+    for (int k = 0; k < 4; ++k) {
+        printf("  %-12s", integrator_name(integrators[k]));
+        for (int s = 0; s < 5; ++s) {
+            results[k][s] = run_orbits(integrators[k], steps[s], orbits);
+            printf(" %10.2e", results[k][s].energy_error);
+        }
+        printf("   (%lld force passes at %d steps)\n", results[k][4].force_evaluations, steps[4]);
+    }
+
+    // order from the two finest runs that are still well above round off, the
+    // coarse ones are not in the asymptotic range yet
+    for (int k = 0; k < 4; ++k) {
+        int s = 3;
+        while (s > 0 && results[k][s + 1].energy_error < 1e-12) {
+            --s;
+        }
+        const double measured = log2(results[k][s].energy_error / results[k][s + 1].energy_error);
+        char name[64];
+        snprintf(name, sizeof(name), "%s order %.1f (expect %d)", integrator_name(integrators[k]), measured, orders[k]);
+        passed &= report(name, measured > orders[k] - 0.7);
+    }
+
+    // coarsest step that matches verlet at its finest
+    const double target = results[0][4].energy_error;
+    for (int k = 1; k < 4; ++k) {
+        int s = 0;
+        while (s < 4 && results[k][s].energy_error > target) {
+            ++s;
+        }
+        printf("  %-12s matches verlet at %d steps/orbit with %d steps/orbit (%.0fx larger, %.1fx fewer force passes)\n",
+               integrator_name(integrators[k]), steps[4], steps[s], steps[4] / (double)steps[s],
+               results[0][4].force_evaluations / (double)results[k][s].force_evaluations);
+    }
+
+    printf("%s\n", passed ? "all integrator checks passed" : "integrator checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef INTEGRATORS_TEST_H
+#define INTEGRATORS_TEST_H
+
+// every integrator on an eccentric kepler orbit at a few step sizes: checks the
+// energy error falls with the expected order and prints how much bigger the
+// steps of the higher order ones can be for verlet's error
+bool test_integrators();
+
+#endif
@@ -9,7 +9,8 @@
 #include <vector>
 
 // Run simulation with multithreading enabled
-double run_simulation_with_threads(int num_bodies, int num_steps, bool use_threads, int num_threads) {
+double run_simulation_with_threads(int num_bodies, int num_steps, bool use_threads, int num_threads,
+                                   ForceSolver solver = ForceSolver::Direct) {
     if (!use_threads) {
         omp_set_num_threads(1);  // Force single thread
     } else {
@@ -42,7 +43,7 @@ double run_simulation_with_threads(int num_bodies, int num_steps, bool use_threa
         bodies.push_back(Body(mass, x, y, v_x, v_y));
     }
     
-    Kosmos kosmos(bodies);
+    Kosmos kosmos(bodies, solver);
     
     // Time the simulation
     auto start = std::chrono::high_resolution_clock::now();
@@ -53,9 +54,8 @@ double run_simulation_with_threads(int num_bodies, int num_steps, bool use_threa
     }
     
     auto end = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    
-    return duration.count();
+    // fractional milliseconds, whole ones round the small runs to nothing
+    return std::chrono::duration<double, std::milli>(end - start).count();
 }
 
 void test_multithread_performance() {
@@ -92,16 +92,25 @@ void test_multithread_performance() {
         printf("%-30s %12.2f %12.2fx %12.1f%%\n", 
                thread_config, multi_time, speedup, efficiency);
         
+        // pair once kernel at the same two thread counts, speedup is against the guided loop
+        double single_symmetric = run_simulation_with_threads(num_bodies, num_steps, false, 1, ForceSolver::DirectSymmetric);
+        printf("%-30s %12.2f %12.2fx %12s\n", "Symmetric (1 thread)",
+               single_symmetric, single_time / single_symmetric, "-");
+        double multi_symmetric = run_simulation_with_threads(num_bodies, num_steps, true, opt_threads, ForceSolver::DirectSymmetric);
+        sprintf(thread_config, "Symmetric (%d threads)", opt_threads);
+        printf("%-30s %12.2f %12.2fx %12s\n", thread_config,
+               multi_symmetric, multi_time / multi_symmetric, "-");
+        
         printf("\n");
         
         // Analysis
         if (speedup > 2.0) {
-            printf("ts Speedup: %.2fx\n", speedup);
+            printf("Good speedup: %.2fx\n", speedup);
         } else if (speedup > 1.0) {
-            printf("not as bad(%.2fx)\n", speedup);
+            printf("Modest speedup: %.2fx\n", speedup);
         } else {
-            printf("YOur bad\n");
+            printf("No speedup (%.2fx), too few bodies per thread to pay for the threading\n", speedup);
         }
-        printf("\n");
+        printf("See ./nbody_simulator bench for the full scaling suite\n\n");
     }
 }
\ No newline at end of file
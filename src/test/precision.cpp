@@ -0,0 +1,234 @@
+#include "precision.h"
+#include "test_util.hpp"
+#include "solar_system.h"
+#include "../kosmos/kosmos.hpp"
+#include "../forces/direct.hpp"
+#include "../forces/precision.hpp"
+#include "../forces/tiled.hpp"
+#include "../constants.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Forces {
+    std::vector<double> a_x, a_y;
+    double potential;
+};
+
+Forces direct_forces(const Particles & particles, Precision precision) {
+    const std::size_t n = particles.size();
+    TiledDirectSolver solver;
+    solver.set_precision(precision);
+    Forces forces;
+    forces.a_x.resize(n);
+    forces.a_y.resize(n);
+    solver.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                         forces.a_x.data(), forces.a_y.data(), &forces.potential);
+    return forces;
+}
+
+// the same block and origin scheme as mixed but in double, what the local origin alone costs
+Forces local_double_forces(const Particles & particles) {
+    const std::size_t n = particles.size();
+    LocalBlock<double> block;
+    block.load(particles.x.data(), particles.y.data(), particles.mass.data(), n, particles.x[0], particles.y[0]);
+    Forces forces;
+    forces.a_x.assign(n, 0.0);
+    forces.a_y.assign(n, 0.0);
+    local_accelerations_add(block, block, forces.a_x.data(), forces.a_y.data(), nullptr);
+    return forces;
+}
+
+// relative error |a - a_ref| / |a_ref| per body
+std::vector<double> errors(const Forces & forces, const Forces & reference) {
+    std::vector<double> result;
+    for (std::size_t i = 0; i < reference.a_x.size(); ++i) {
+        result.push_back(hypot(forces.a_x[i] - reference.a_x[i], forces.a_y[i] - reference.a_y[i]) /
+                         hypot(reference.a_x[i], reference.a_y[i]));
+    }
+    return result;
+}
+
+double max_of(const std::vector<double> & values) {
+    double result = 0.0;
+    for (double value : values) {
+        result = std::max(result, value);
+    }
+    return result;
+}
+
+double rms_of(const std::vector<double> & values) {
+    double sum = 0.0;
+    for (double value : values) {
+        sum += value * value;
+    }
+    return sqrt(sum / values.size());
+}
+
+// the solar system with its starting positions rounded to float, a nudge the
+// size of what mixed precision loses in one pair
+std::vector<Body> rounded_solar_system() {
+    std::vector<Body> bodies = solar_system_bodies();
+    for (Body & body : bodies) {
+        body.set_x(static_cast<float>(body.get_x()));
+        body.set_y(static_cast<float>(body.get_y()));
+    }
+    return bodies;
+}
+
+void run_solar_system(Kosmos & kosmos, Precision precision, long long steps, double time_delta) {
+    kosmos.set_precision(precision);
+    kosmos.set_diagnostics_every(steps / 100);
+    kosmos.run(steps, time_delta);
+}
+
+// |dr| / r of every body against the reference run, r measured from the sun.
+// prints the table and returns the worst planet (the sun and the moon left out,
+// r means little for either)
+double compare_runs(const Particles & reference, const Particles & other) {
+    printf("    %-10s %16s %16s\n", "body", "|dr| (AU)", "|dr| / r");
+    double worst = 0.0;
+    for (std::size_t i = 0; i < reference.size(); ++i) {
+        const double dr = hypot(other.x[i] - reference.x[i], other.y[i] - reference.y[i]);
+        const double r = hypot(reference.x[i] - reference.x[0], reference.y[i] - reference.y[0]);
+        printf("    %-10s %16.3e %16.3e\n", SOLAR_SYSTEM_NAMES[i], dr / AU_M, i == 0 ? 0.0 : dr / r);
+        if (i != 0 && i != 4) {
+            worst = std::max(worst, dr / r);
+        }
+    }
+    return worst;
+}
+
+double seconds_per_pass(Particles & particles, Precision precision) {
+    const std::size_t n = particles.size();
+    TiledDirectSolver solver;
+    solver.set_precision(precision);
+    solver.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                         particles.a_x.data(), particles.a_y.data());
+    double best = -1.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        auto start = std::chrono::high_resolution_clock::now();
+        solver.accelerations(particles.x.data(), particles.y.data(), particles.mass.data(), n,
+                             particles.a_x.data(), particles.a_y.data());
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        if (best < 0.0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+bool test_mixed_precision() {
+    bool passed = true;
+
+    printf("Solar system forces, mixed vs double\n");
+    Particles solar(solar_system_bodies());
+    const Forces reference = direct_forces(solar, Precision::Double);
+    const Forces mixed = direct_forces(solar, Precision::Mixed);
+    const std::vector<double> local_error = errors(local_double_forces(solar), reference);
+    const std::vector<double> mixed_error = errors(mixed, reference);
+    printf("    %-10s %14s %14s\n", "body", "local double", "mixed");
+    for (std::size_t i = 0; i < solar.size(); ++i) {
+        printf("    %-10s %14.2e %14.2e\n", SOLAR_SYSTEM_NAMES[i], local_error[i], mixed_error[i]);
+    }
+    const double potential_error = std::fabs(mixed.potential - reference.potential) / std::fabs(reference.potential);
+    printf("    potential energy %.2e\n", potential_error);
+    passed &= report("local origin alone is exact", max_of(local_error) < 1e-12);
+    // the moon is 3.8e5 km from the earth at 1 AU, float keeps ~1e-7 of the 1 AU
+    passed &= report("mixed force error < 1e-4 on every body", max_of(mixed_error) < 1e-4);
+    passed &= report("mixed potential error < 1e-6", potential_error < 1e-6);
+
+    // every float kernel this cpu runs against the portable loop, on an odd
+    // source count so the simd tails are used too
+    printf("Float kernels (1001 bodies around one origin)\n");
+    {
+        Particles some(orbiting_disk(1001, 3));
+        LocalBlock<float> block;
+        block.load(some.x.data(), some.y.data(), some.mass.data(), some.size(), some.x[0], some.y[0]);
+        const std::size_t n = some.size();
+        std::vector<double> ref_x(n, 0.0), ref_y(n, 0.0), ref_phi(n, 0.0);
+        local_accelerations_add(SimdLevel::Scalar, block, block, ref_x.data(), ref_y.data(), ref_phi.data(), 0);
+        const SimdLevel levels[] = {SimdLevel::AVX2, SimdLevel::AVX512};
+        for (SimdLevel level : levels) {
+            if (static_cast<int>(level) > static_cast<int>(detect_simd_level())) {
+                printf("    %-8s not supported here, skipped\n", simd_level_name(level));
+                continue;
+            }
+            std::vector<double> a_x(n, 0.0), a_y(n, 0.0), phi(n, 0.0);
+            local_accelerations_add(level, block, block, a_x.data(), a_y.data(), phi.data(), 0);
+            double worst = 0.0, worst_phi = 0.0;
+            for (std::size_t i = 0; i < n; ++i) {
+                worst = std::max(worst, hypot(a_x[i] - ref_x[i], a_y[i] - ref_y[i]) / hypot(ref_x[i], ref_y[i]));
+                worst_phi = std::max(worst_phi, std::fabs(phi[i] - ref_phi[i]) / std::fabs(ref_phi[i]));
+            }
+            printf("    %-8s force %.2e, potential %.2e\n", simd_level_name(level), worst, worst_phi);
+            passed &= report(simd_level_name(level), worst < 1e-4 && worst_phi < 1e-5);
+        }
+    }
+
+    printf("Disk forces (20000 bodies), mixed vs double\n");
+    Particles many(orbiting_disk(20000, 7));
+    const Forces many_reference = direct_forces(many, Precision::Double);
+    const Forces many_mixed = direct_forces(many, Precision::Mixed);
+    const std::vector<double> many_error = errors(many_mixed, many_reference);
+    const double many_potential = std::fabs(many_mixed.potential - many_reference.potential) /
+                                  std::fabs(many_reference.potential);
+    printf("    max %.2e, rms %.2e, potential energy %.2e\n", max_of(many_error), rms_of(many_error), many_potential);
+    passed &= report("rms force error < 1e-5", rms_of(many_error) < 1e-5);
+    passed &= report("max force error < 1e-3", max_of(many_error) < 1e-3);
+
+    // the solar system test itself takes 7 * 365.25 * 60 steps of 100 days, which
+    // the inner planets and the moon cannot follow: they get flung out, and where
+    // to depends on the details of close passes. so there mixed is set next to
+    // a double run started from positions rounded to float
+    const long long test_steps = static_cast<long long>(7.0 * 365.25 * 60);
+    printf("Solar system test run (%lld steps of 100 days)\n", test_steps);
+    Kosmos test_double(solar_system_bodies()), test_mixed(solar_system_bodies()),
+        test_nudged(rounded_solar_system());
+    run_solar_system(test_double, Precision::Double, test_steps, 100.0 * DAY_TO_SECONDS);
+    run_solar_system(test_mixed, Precision::Mixed, test_steps, 100.0 * DAY_TO_SECONDS);
+    run_solar_system(test_nudged, Precision::Double, test_steps, 100.0 * DAY_TO_SECONDS);
+    printf("  mixed vs double\n");
+    const double test_mixed_worst = compare_runs(test_double.get_particles(), test_mixed.get_particles());
+    printf("  double from float rounded positions vs double\n");
+    const double test_nudged_worst = compare_runs(test_double.get_particles(), test_nudged.get_particles());
+    printf("    worst planet: mixed %.2e, rounded start %.2e, energy drift double %.2e mixed %.2e\n",
+           test_mixed_worst, test_nudged_worst, test_double.get_energy_drift(), test_mixed.get_energy_drift());
+
+    // with steps the orbits resolve, the difference is what float pairs cost.
+    // it is measured against what the step size alone costs in double
+    const long long daily_steps = static_cast<long long>(7.0 * 365.25);
+    printf("Solar system, 7 years of 1 day steps, mixed vs double\n");
+    Kosmos daily_double(solar_system_bodies()), daily_mixed(solar_system_bodies()),
+        daily_half(solar_system_bodies());
+    run_solar_system(daily_double, Precision::Double, daily_steps, DAY_TO_SECONDS);
+    run_solar_system(daily_mixed, Precision::Mixed, daily_steps, DAY_TO_SECONDS);
+    run_solar_system(daily_half, Precision::Double, 2 * daily_steps, 0.5 * DAY_TO_SECONDS);
+    const double daily_worst = compare_runs(daily_double.get_particles(), daily_mixed.get_particles());
+    printf("  half day steps (double) vs double\n");
+    const double step_worst = compare_runs(daily_double.get_particles(), daily_half.get_particles());
+    printf("    worst planet: mixed %.2e, half the step %.2e, energy drift double %.2e mixed %.2e\n", daily_worst,
+           step_worst, daily_double.get_energy_drift(), daily_mixed.get_energy_drift());
+    passed &= report("mixed error 10x below the step error", 10.0 * daily_worst < step_worst);
+    passed &= report("mixed energy drift like double", std::fabs(daily_mixed.get_energy_drift()) <
+                                                          2.0 * std::fabs(daily_double.get_energy_drift()) + 1e-7);
+
+    printf("Speed (20000 bodies, best of 3 force passes, %s)\n", simd_level_name(detect_simd_level()));
+    const double double_seconds = seconds_per_pass(many, Precision::Double);
+    const double mixed_seconds = seconds_per_pass(many, Precision::Mixed);
+    const double pairs = static_cast<double>(many.size()) * many.size();
+    printf("    double %.1f ms (%.2e pairs/s), mixed %.1f ms (%.2e pairs/s), %.2fx\n", 1e3 * double_seconds,
+           pairs / double_seconds, 1e3 * mixed_seconds, pairs / mixed_seconds, double_seconds / mixed_seconds);
+    if (detect_simd_level() != SimdLevel::Scalar) {
+        passed &= report("mixed is faster", mixed_seconds < double_seconds);
+    }
+
+    printf("%s\n", passed ? "all precision checks passed" : "precision checks FAILED");
+    return passed;
+}
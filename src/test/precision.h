@@ -0,0 +1,9 @@
+#ifndef PRECISION_TEST_H
+#define PRECISION_TEST_H
+
+// mixed precision direct sum against the all double one: force errors on the
+// solar system and a big disk, where the solar system test ends up after its
+// 7 years in each mode, and the pairs per second both get
+bool test_mixed_precision();
+
+#endif
@@ -0,0 +1,119 @@
+#include "profiler.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <omp.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const PhaseStats & phase(const ProfileStats & stats, Phase p) {
+    return stats.phases[static_cast<int>(p)];
+}
+
+void print_stats(const ProfileStats & stats) {
+    printf("    %lld steps on %d threads, step p50 %.3f ms p99 %.3f ms max %.3f ms\n", stats.steps, stats.threads,
+           1e3 * stats.step_p50, 1e3 * stats.step_p99, 1e3 * stats.step_max);
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        const PhaseStats & s = stats.phases[p];
+        if (s.calls == 0) {
+            continue;
+        }
+        printf("    %-12s %5lld calls %9.3f ms  imbalance %.2f", phase_name(static_cast<Phase>(p)), s.calls,
+               1e3 * s.total, s.imbalance);
+        if (s.cycles >= 0) {
+            printf("  %lld cycles, ipc %.2f, %lld cache misses", s.cycles,
+                   s.cycles > 0 ? static_cast<double>(s.instructions) / s.cycles : 0.0, s.cache_misses);
+        }
+        printf("\n");
+    }
+}
+
+} // namespace
+
+bool test_profiler() {
+    bool passed = true;
+    const std::vector<Body> bodies = orbiting_disk(2000, 1);
+
+    if (!profiling_compiled_in()) {
+        printf("Profiler (not compiled in, build with make PROFILE=1 to record)\n");
+        Kosmos kosmos(bodies);
+        kosmos.run(5, 3600.0);
+        const ProfileStats stats = kosmos.stats();
+        passed &= report("stats report disabled", !stats.enabled);
+        passed &= report("nothing recorded", stats.steps == 0 && phase(stats, Phase::Forces).calls == 0);
+        printf("%s\n", passed ? "all profiler checks passed" : "profiler checks FAILED");
+        return passed;
+    }
+
+    const ForceSolver solvers[] = {ForceSolver::Direct, ForceSolver::DirectSymmetric, ForceSolver::BarnesHut,
+                                   ForceSolver::FMM};
+    const char * names[] = {"direct", "symmetric", "barnes_hut", "fmm"};
+    for (int k = 0; k < 4; ++k) {
+        printf("Profiler, %s (2000 bodies, 20 steps)\n", names[k]);
+        Kosmos kosmos(bodies, solvers[k]);
+        kosmos.set_diagnostics_every(5);
+        kosmos.run(20, 3600.0);
+        const ProfileStats stats = kosmos.stats();
+        print_stats(stats);
+
+        const PhaseStats & step = phase(stats, Phase::Step);
+        const PhaseStats & forces = phase(stats, Phase::Forces);
+        passed &= report("enabled, one sample per step", stats.enabled && stats.steps == 20 && step.calls == 20 &&
+                                                             stats.recent.size() == 20);
+        // verlet: one force pass for the very first step, then one per step
+        passed &= report("force passes counted", forces.calls == 21);
+        passed &= report("kicks counted", phase(stats, Phase::KickDrift).calls == 20 &&
+                                              phase(stats, Phase::Kick).calls == 20);
+        passed &= report("diagnostics every 5 steps", phase(stats, Phase::Diagnostics).calls == 4);
+        double inner = 0.0;
+        for (int p = 1; p < PHASE_COUNT; ++p) {
+            inner += stats.phases[p].total;
+        }
+        passed &= report("phases fit inside the steps", inner <= step.total);
+        passed &= report("percentiles ordered", stats.step_min <= stats.step_p50 &&
+                                                    stats.step_p50 <= stats.step_p99 &&
+                                                    stats.step_p99 <= stats.step_max);
+        // max / mean busy time over the team, 1 for a single thread. the symmetric
+        // solver runs serially (no worker region) when there is only one thread
+        const bool serial = solvers[k] == ForceSolver::DirectSymmetric && omp_get_max_threads() == 1;
+        passed &= report("force imbalance measured", forces.imbalance_samples > 0 ? forces.imbalance >= 1.0 : serial);
+
+        kosmos.reset_stats();
+        const ProfileStats cleared = kosmos.stats();
+        passed &= report("reset clears", cleared.steps == 0 && phase(cleared, Phase::Forces).calls == 0);
+    }
+
+    printf("Trace and hardware counters\n");
+    Kosmos kosmos(bodies);
+    const bool counters = kosmos.enable_hardware_counters();
+    kosmos.run(10, 3600.0);
+    const ProfileStats stats = kosmos.stats();
+    if (counters) {
+        print_stats(stats);
+        passed &= report("hardware counters read", phase(stats, Phase::Forces).cycles > 0 &&
+                                                       phase(stats, Phase::Forces).instructions > 0);
+    } else {
+        printf("    perf_event_open refused (perf_event_paranoid or no hardware pmu), counters skipped\n");
+        passed &= report("counters off when unavailable", !stats.hardware_counters &&
+                                                              phase(stats, Phase::Forces).cycles == -1);
+    }
+
+    const std::string path = "profiler_test_trace.json";
+    kosmos.write_trace(path);
+    std::ifstream file(path);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::remove(path.c_str());
+    passed &= report("trace written", text.compare(0, 18, "{\"displayTimeUnit\"") == 0 &&
+                                          text.find("\"name\": \"forces\"") != std::string::npos &&
+                                          text.find("\"tid\": 1") != std::string::npos);
+
+    printf("%s\n", passed ? "all profiler checks passed" : "profiler checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef PROFILER_TEST_H
+#define PROFILER_TEST_H
+
+// the NBODY_PROFILE instrumentation: step and phase counts, phases nesting in
+// their step, load imbalance, the chrome trace dump and (where the kernel lets
+// us) hardware counters. a normal build only checks that nothing is recorded
+bool test_profiler();
+
+#endif
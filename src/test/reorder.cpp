@@ -0,0 +1,243 @@
+#include "reorder.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../io/trajectory.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// largest |r_a - r_b| / |r_b|
+double position_difference(const std::vector<Body> & a, const std::vector<Body> & b) {
+    double worst = a.size() == b.size() ? 0.0 : HUGE_VAL;
+    for (std::size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        const double r = hypot(b[i].get_x(), b[i].get_y());
+        const double d = hypot(a[i].get_x() - b[i].get_x(), a[i].get_y() - b[i].get_y());
+        worst = std::max(worst, r > 0.0 ? d / r : d);
+    }
+    return worst;
+}
+
+bool same_bodies(const std::vector<Body> & a, const std::vector<Body> & b) {
+    for (std::size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        if (a[i].get_x() != b[i].get_x() || a[i].get_y() != b[i].get_y() || a[i].get_v_x() != b[i].get_v_x() ||
+            a[i].get_v_y() != b[i].get_v_y() || a[i].get_a_x() != b[i].get_a_x() || a[i].get_mass() != b[i].get_mass()) {
+            return false;
+        }
+    }
+    return a.size() == b.size();
+}
+
+// seconds per step, best of 3
+double step_seconds(Kosmos & kosmos, int steps) {
+    double best = -1.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        kosmos.run(steps, 3600.0);
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / steps;
+        if (best < 0.0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+// largest |a - a_exact| / |a_exact| of a mixed precision pass, bodies by id
+double mixed_precision_error(Kosmos & kosmos) {
+    kosmos.set_precision(Precision::Double);
+    kosmos.calculate_forces();
+    const std::vector<Body> exact = kosmos.get_bodies();
+    kosmos.set_precision(Precision::Mixed);
+    kosmos.calculate_forces();
+    const std::vector<Body> mixed = kosmos.get_bodies();
+    double worst = 0.0;
+    for (std::size_t i = 0; i < exact.size(); ++i) {
+        const double a = hypot(exact[i].get_a_x(), exact[i].get_a_y());
+        const double d = hypot(mixed[i].get_a_x() - exact[i].get_a_x(), mixed[i].get_a_y() - exact[i].get_a_y());
+        worst = std::max(worst, d / a);
+    }
+    return worst;
+}
+
+} // namespace
+
+bool test_reorder() {
+    bool passed = true;
+    const std::vector<Body> bodies = orbiting_disk(3000, 5);
+
+    const SpaceFillingCurve curves[] = {SpaceFillingCurve::Morton, SpaceFillingCurve::Hilbert};
+    const char * curve_names[] = {"morton", "hilbert"};
+    for (int c = 0; c < 2; ++c) {
+        printf("Reordering along the %s curve every 10 steps, 3000 bodies, 50 steps\n", curve_names[c]);
+        Kosmos sorted(bodies);
+        Kosmos plain(bodies);
+        sorted.set_reorder_curve(curves[c]);
+        sorted.set_reorder_every(10);
+        sorted.run(50, 3600.0);
+        plain.run(50, 3600.0);
+
+        const std::vector<uint32_t> & storage = sorted.get_storage_ids();
+        std::size_t moved = 0;
+        for (std::size_t i = 0; i < storage.size(); ++i) {
+            moved += storage[i] != i;
+        }
+        const std::vector<uint32_t> ids = sorted.get_ids();
+        bool ids_in_order = ids.size() == bodies.size();
+        for (std::size_t i = 0; ids_in_order && i < ids.size(); ++i) {
+            ids_in_order = ids[i] == i;
+        }
+        const double difference = position_difference(sorted.get_bodies(), plain.get_bodies());
+        printf("    %zu of %zu bodies moved in storage, positions vs unsorted %.2e\n", moved, storage.size(),
+               difference);
+        passed &= report("storage sorted, 5 reorders", moved > bodies.size() / 2 && sorted.get_reorder_count() == 5);
+        passed &= report("get_bodies and get_ids keep the id order", ids_in_order && difference < 1e-12);
+    }
+
+    printf("Ids and forces under the permutation\n");
+    {
+        Kosmos unsorted(bodies);
+        Kosmos permuted(bodies);
+        permuted.set_reorder_curve(SpaceFillingCurve::Hilbert);
+        permuted.reorder();
+        permuted.add_body(Body(1e20, 0.0, 4.0 * AU_M, -15000.0, 0.0));
+        unsorted.add_body(Body(1e20, 0.0, 4.0 * AU_M, -15000.0, 0.0));
+        permuted.set_reorder_curve(SpaceFillingCurve::Morton);
+        permuted.reorder();
+
+        // every storage slot holds the body get_bodies lists under its id, and
+        // every id shows up exactly once
+        const Particles & storage = permuted.get_particles();
+        const std::vector<uint32_t> & storage_ids = permuted.get_storage_ids();
+        const std::vector<Body> by_id = permuted.get_bodies();
+        std::vector<int> seen(by_id.size(), 0);
+        bool round_trip = storage_ids.size() == by_id.size();
+        for (std::size_t s = 0; round_trip && s < storage_ids.size(); ++s) {
+            const uint32_t id = storage_ids[s];
+            round_trip = id < by_id.size() && ++seen[id] == 1 && storage.x[s] == by_id[id].get_x() &&
+                         storage.v_y[s] == by_id[id].get_v_y() && storage.mass[s] == by_id[id].get_mass();
+        }
+        passed &= report("storage ids and id order round trip", round_trip);
+
+        // forces recomputed in the new order, per id, against the old order.
+        // the sum runs over the sources in another order, so not bit for bit
+        unsorted.calculate_forces();
+        permuted.invalidate_forces();
+        permuted.calculate_forces();
+        const std::vector<Body> expected = unsorted.get_bodies();
+        const std::vector<Body> got = permuted.get_bodies();
+        double worst = 0.0;
+        for (std::size_t i = 0; i < expected.size(); ++i) {
+            const double a = hypot(expected[i].get_a_x(), expected[i].get_a_y());
+            worst = std::max(worst, hypot(got[i].get_a_x() - expected[i].get_a_x(),
+                                          got[i].get_a_y() - expected[i].get_a_y()) / a);
+        }
+        printf("    largest force change %.2e\n", worst);
+        passed &= report("forces unchanged by the permutation", worst < 1e-12);
+    }
+
+    printf("Identity\n");
+    Kosmos sorted(bodies);
+    Kosmos plain(bodies);
+    plain.calculate_forces();
+    sorted.calculate_forces();
+    sorted.reorder();
+    passed &= report("cached forces move with the bodies", same_bodies(sorted.get_bodies(), plain.get_bodies()));
+    const Body replacement(2e24, 3.0 * AU_M, 0.0, 0.0, 17000.0);
+    sorted.set_body(123, replacement);
+    plain.set_body(123, replacement);
+    sorted.add_body(Body(1e20, 0.0, 4.0 * AU_M, -15000.0, 0.0));
+    plain.add_body(Body(1e20, 0.0, 4.0 * AU_M, -15000.0, 0.0));
+    sorted.run(5, 3600.0);
+    plain.run(5, 3600.0);
+    const std::vector<uint32_t> grown = sorted.get_ids();
+    passed &= report("set_body and add_body by id", position_difference(sorted.get_bodies(), plain.get_bodies()) < 1e-13 &&
+                                                        grown.size() == 3001 && grown.back() == 3000);
+
+    // frames are written in id order, whatever the storage
+    sorted.set_reorder_every(1);
+    sorted.attach_trajectory("reorder_test.traj", TRAJ_X | TRAJ_Y);
+    sorted.run(3, 3600.0);
+    sorted.detach_trajectory();
+    bool frames_by_id = false;
+    {
+        TrajectoryReader reader("reorder_test.traj");
+        const std::vector<Body> now = sorted.get_bodies();
+        frames_by_id = reader.get_num_frames() == 4;
+        for (std::size_t i = 0; frames_by_id && i < now.size(); ++i) {
+            frames_by_id = reader.value(3, TRAJ_X, i) == now[i].get_x();
+        }
+    }
+    std::remove("reorder_test.traj");
+    passed &= report("trajectory frames in id order", frames_by_id);
+
+    // a restart carries the storage order and the ids, so it continues bit for bit
+    sorted.save_checkpoint("reorder_test.ckpt");
+    Kosmos restarted(orbiting_disk(10, 1));
+    restarted.load_checkpoint("reorder_test.ckpt");
+    std::remove("reorder_test.ckpt");
+    const bool same_storage = restarted.get_storage_ids() == sorted.get_storage_ids();
+    restarted.set_reorder_every(1);
+    sorted.run(5, 3600.0);
+    restarted.run(5, 3600.0);
+    passed &= report("checkpoint restart exact", same_storage && same_bodies(restarted.get_bodies(), sorted.get_bodies()));
+
+    // collision events name ids, not storage slots
+    std::vector<Body> pair = orbiting_disk(200, 9);
+    pair[150] = Body(1e20, 5.0 * AU_M, 0.0, 100.0, 0.0, 1000.0);
+    pair[40] = Body(3e20, 5.0 * AU_M + 10000.0, 0.0, -50.0, 0.0, 2000.0);
+    Kosmos crash(pair);
+    crash.set_collision_mode(CollisionMode::Merge);
+    crash.set_reorder_every(1);
+    crash.run(100, 1.0);
+    const std::vector<CollisionEvent> events = crash.get_collision_events();
+    const std::vector<uint32_t> left = crash.get_ids();
+    passed &= report("collision events by id", events.size() == 1 && events[0].first == 40 &&
+                                                   events[0].second == 150 && left.size() == 199 &&
+                                                   std::find(left.begin(), left.end(), 150u) == left.end());
+
+    bool threw = false;
+    try {
+        sorted.set_reorder_every(-1);
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    passed &= report("negative interval throws", threw);
+
+    printf("Locality, 100000 bodies in random order\n");
+    const std::vector<Body> big = orbiting_disk(100000, 3);
+    Kosmos tree_plain(big, ForceSolver::BarnesHut);
+    Kosmos tree_sorted(big, ForceSolver::BarnesHut);
+    tree_sorted.set_reorder_every(10);
+    tree_sorted.set_phase_timing(true);
+    tree_plain.step(3600.0);
+    tree_sorted.reorder();
+    tree_sorted.step(3600.0);
+    const double plain_seconds = step_seconds(tree_plain, 10);
+    const double sorted_seconds = step_seconds(tree_sorted, 10);
+    const PhaseTimes & times = tree_sorted.get_phase_times();
+    const double reorder_each = times.reorder / tree_sorted.get_reorder_count();
+    printf("    barnes hut step: unsorted %.1f ms, sorted every 10 steps %.1f ms (%.2fx), one reorder %.2f ms\n",
+           1e3 * plain_seconds, 1e3 * sorted_seconds, plain_seconds / sorted_seconds, 1e3 * reorder_each);
+    // the tree sorts its bodies along morton itself, the storage order only
+    // changes how far its gathers and scatters jump, so the timing is reported
+    // but too close to the noise to decide anything
+    passed &= report("reorder cost in the phase times", times.reorder > 0.0);
+
+    Kosmos precision_plain(orbiting_disk(20000, 4));
+    Kosmos precision_sorted(orbiting_disk(20000, 4));
+    precision_sorted.reorder();
+    const double error_plain = mixed_precision_error(precision_plain);
+    const double error_sorted = mixed_precision_error(precision_sorted);
+    printf("    mixed precision force error, 20000 bodies: unsorted %.2e, sorted %.2e\n", error_plain, error_sorted);
+    passed &= report("sorted tiles give a smaller mixed error", error_sorted < error_plain);
+
+    printf("%s\n", passed ? "all reorder checks passed" : "reorder checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef REORDER_TEST_H
+#define REORDER_TEST_H
+
+// space filling curve reordering: the storage gets sorted while get_bodies,
+// set_body, trajectories, checkpoints and collision events keep going by id,
+// plus what the locality buys the tree and the mixed precision tiles
+bool test_reorder();
+
+#endif
@@ -0,0 +1,124 @@
+#include "small_kosmos.h"
+#include "test_util.hpp"
+#include "solar_system.h"
+#include "../kosmos/kosmos.hpp"
+#include "../kosmos/small_kosmos.hpp"
+#include "../constants.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// a sun and n - 1 planets on circular orbits 0.4 AU apart, spread in angle
+std::vector<Body> planetary_system(int n) {
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    for (int k = 1; k < n; ++k) {
+        const double r = 0.4 * k * AU_M;
+        const double phi = 2.4 * k;
+        const double speed = sqrt(G_CONST * SUN_MASS / r);
+        bodies.push_back(Body(1e24 * k, r * cos(phi), r * sin(phi), -speed * sin(phi), speed * cos(phi)));
+    }
+    return bodies;
+}
+
+// largest |r_small - r_kosmos| / |r_kosmos| over the bodies
+template <int N>
+double position_difference(const SmallKosmos<N> & small, const Kosmos & kosmos) {
+    const std::vector<Body> bodies = kosmos.get_bodies();
+    double worst = 0.0;
+    for (int i = 0; i < N; ++i) {
+        const Body body = small.get_body(i);
+        const double r = hypot(bodies[i].get_x(), bodies[i].get_y());
+        if (r > 0.0) {
+            worst = std::max(worst, hypot(body.get_x() - bodies[i].get_x(), body.get_y() - bodies[i].get_y()) / r);
+        }
+    }
+    return worst;
+}
+
+// per step seconds of Kosmos and SmallKosmos<N> on the same system, best of 3
+template <int N>
+double speedup(long long steps) {
+    const std::vector<Body> bodies = planetary_system(N);
+    Kosmos kosmos(bodies);
+    SmallKosmos<N> small(bodies);
+    kosmos.run(10, 3600.0);
+    small.run(10, 3600.0);
+    double kosmos_best = -1.0, small_best = -1.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        auto start = std::chrono::high_resolution_clock::now();
+        kosmos.run(steps, 3600.0);
+        const double kosmos_seconds = seconds_since(start) / steps;
+        start = std::chrono::high_resolution_clock::now();
+        small.run(steps, 3600.0);
+        const double small_seconds = seconds_since(start) / steps;
+        if (kosmos_best < 0.0 || kosmos_seconds < kosmos_best) {
+            kosmos_best = kosmos_seconds;
+        }
+        if (small_best < 0.0 || small_seconds < small_best) {
+            small_best = small_seconds;
+        }
+    }
+    printf("    %2d bodies: Kosmos %8.1f ns/step, SmallKosmos %7.1f ns/step, %6.1fx\n", N, 1e9 * kosmos_best,
+           1e9 * small_best, kosmos_best / small_best);
+    return kosmos_best / small_best;
+}
+
+} // namespace
+
+bool test_small_kosmos() {
+    bool passed = true;
+
+    printf("SmallKosmos construction\n");
+    bool threw = false;
+    try {
+        SmallKosmos<3> wrong(planetary_system(4));
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    passed &= report("wrong body count throws", threw);
+    threw = false;
+    try {
+        SmallKosmos<2> binary(planetary_system(2));
+        binary.set_integrator(Integrator::Hermite4);
+    } catch (const std::invalid_argument &) {
+        threw = true;
+    }
+    passed &= report("hermite refused", threw);
+
+    printf("Solar system, 10 years of 1 day steps, against Kosmos\n");
+    const Integrator integrators[] = {Integrator::Verlet, Integrator::ForestRuth, Integrator::Yoshida6};
+    for (Integrator integrator : integrators) {
+        SmallKosmos<10> small(solar_system_bodies());
+        Kosmos kosmos(solar_system_bodies());
+        small.set_integrator(integrator);
+        kosmos.set_integrator(integrator);
+        small.run(3653, DAY_TO_SECONDS);
+        kosmos.run(3653, DAY_TO_SECONDS);
+        const double difference = position_difference(small, kosmos);
+        const Diagnostics small_d = small.get_diagnostics();
+        const Diagnostics kosmos_d = kosmos.get_diagnostics();
+        const double energy = std::fabs(small_d.get_energy() - kosmos_d.get_energy()) / std::fabs(kosmos_d.get_energy());
+        printf("    %-12s positions %.2e, energy %.2e\n", integrator_name(integrator), difference, energy);
+        // the moon's orbit amplifies rounding the most, 3650 days are ~135 of them
+        passed &= report(integrator_name(integrator), difference < 1e-8 && energy < 1e-10 &&
+                                                          small.get_step_count() == 3653 &&
+                                                          small.get_time() == kosmos.get_time());
+    }
+
+    printf("Per step time (1 thread each way, Kosmos as configured)\n");
+    const double speedup_2 = speedup<2>(200000);
+    const double speedup_3 = speedup<3>(200000);
+    const double speedup_4 = speedup<4>(100000);
+    const double speedup_10 = speedup<10>(50000);
+    const double speedup_16 = speedup<16>(20000);
+    passed &= report("2 to 4 bodies 10x faster", speedup_2 >= 10.0 && speedup_3 >= 10.0 && speedup_4 >= 10.0);
+    passed &= report("10 and 16 bodies faster", speedup_10 > 1.0 && speedup_16 > 1.0);
+
+    printf("%s\n", passed ? "all small_kosmos checks passed" : "small_kosmos checks FAILED");
+    return passed;
+}
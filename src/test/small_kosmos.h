@@ -0,0 +1,8 @@
+#ifndef SMALL_KOSMOS_TEST_H
+#define SMALL_KOSMOS_TEST_H
+
+// SmallKosmos<N> against Kosmos on the same few body systems: same orbits to
+// rounding, same diagnostics, and the per step time of both for 2 to 16 bodies
+bool test_small_kosmos();
+
+#endif
@@ -19,12 +19,7 @@
 #define URANUS_MASS 8.681e25
 #define NEPTUNE_MASS 1.024e26
 
-void test_solar_system_simulation() {
-    printf("========================================\n");
-    printf("  Solar System Simulation Test\n");
-    printf("========================================\n\n");
-    
-    // Create solar system bodies
+std::vector<Body> solar_system_bodies() {
     std::vector<Body> bodies;
     
     // Sun at origin
@@ -58,6 +53,17 @@ void test_solar_system_simulation() {
     // Neptune
     bodies.push_back(Body(NEPTUNE_MASS, 30.069*AU_M, 0.0, 0.0, 5430.0));
     
+    return bodies;
+}
+
+void test_solar_system_simulation() {
+    printf("========================================\n");
+    printf("  Solar System Simulation Test\n");
+    printf("========================================\n\n");
+    
+    // Create solar system bodies
+    std::vector<Body> bodies = solar_system_bodies();
+    
     Kosmos kosmos(bodies);
     
     printf("Initial Configuration:\n");
@@ -155,7 +161,6 @@ void test_solar_system_simulation() {
         double y_au = final_bodies[i].get_y() / AU_M;
         double dist = sqrt(x_au*x_au + y_au*y_au);
         
-        const char* names[] = {"Sun", "Mercury", "Venus", "Earth", "Moon", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune"};
-        printf("%-10s %16.6f %16.6f %16.6f\n", names[i], x_au, y_au, dist);
+        printf("%-10s %16.6f %16.6f %16.6f\n", SOLAR_SYSTEM_NAMES[i], x_au, y_au, dist);
     }
 }
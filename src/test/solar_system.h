@@ -1,6 +1,14 @@
 #ifndef SOLAR_SYSTEM_H
 #define SOLAR_SYSTEM_H
 
+#include "../body/body.hpp"
+#include <vector>
+
+// sun, the eight planets and the moon on the x axis, circular speeds
+std::vector<Body> solar_system_bodies();
+const char * const SOLAR_SYSTEM_NAMES[] = {"Sun", "Mercury", "Venus", "Earth", "Moon", "Mars", "Jupiter", "Saturn",
+                                           "Uranus", "Neptune"};
+
 void test_solar_system_simulation();
 
 #endif
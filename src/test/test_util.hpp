@@ -0,0 +1,44 @@
+#ifndef TEST_UTIL_HPP
+#define TEST_UTIL_HPP
+#include "../body/body.hpp"
+#include "../constants.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// helpers the test files share
+
+const double SUN_MASS = 1.989e30;
+
+// one line per check, returns ok so checks chain into passed &= report(...)
+inline bool report(const char * name, bool ok) {
+    printf("  %-44s %s\n", name, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+inline double seconds_since(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// sun and a disk of light bodies on circular orbits between 0.5 AU and
+// outer_au, in random angular order so neighbours in the list are far apart
+// in space
+inline std::vector<Body> orbiting_disk(int num_bodies, unsigned seed, double outer_au = 10.0,
+                                       double body_mass = 1e24) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> radius(0.5 * AU_M, outer_au * AU_M);
+    std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+    std::vector<Body> bodies;
+    bodies.push_back(Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    for (int i = 1; i < num_bodies; ++i) {
+        double r = radius(rng);
+        double phi = angle(rng);
+        double speed = sqrt(G_CONST * SUN_MASS / r);
+        bodies.push_back(Body(body_mass, r * cos(phi), r * sin(phi), -speed * sin(phi), speed * cos(phi)));
+    }
+    return bodies;
+}
+
+#endif
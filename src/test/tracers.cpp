@@ -0,0 +1,168 @@
+#include "tracers.h"
+#include "test_util.hpp"
+#include "solar_system.h"
+#include "../kosmos/kosmos.hpp"
+#include "../constants.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// debris on circular orbits around the sun between 0.3 and 35 AU, as zero mass bodies
+std::vector<Body> debris(std::size_t count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> radius(0.3 * AU_M, 35.0 * AU_M);
+    std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+    std::vector<Body> bodies;
+    bodies.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const double r = radius(rng);
+        const double phi = angle(rng);
+        const double speed = sqrt(G_CONST * SUN_MASS / r);
+        bodies.push_back(Body(0.0, r * cos(phi), r * sin(phi), -speed * sin(phi), speed * cos(phi)));
+    }
+    return bodies;
+}
+
+// a sun and n - 1 heavy planets, the massive part of the cost runs
+std::vector<Body> massive_disk(std::size_t n) {
+    std::vector<Body> bodies(1, Body(SUN_MASS, 0.0, 0.0, 0.0, 0.0));
+    std::vector<Body> planets = debris(n - 1, 7);
+    for (const Body & planet : planets) {
+        bodies.push_back(Body(1e25, planet.get_x(), planet.get_y(), planet.get_v_x(), planet.get_v_y()));
+    }
+    return bodies;
+}
+
+// largest |r_a - r_b| / |r_b|
+double position_difference(const std::vector<Body> & a, const std::vector<Body> & b) {
+    double worst = 0.0;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        const double r = hypot(b[i].get_x(), b[i].get_y());
+        worst = std::max(worst, hypot(a[i].get_x() - b[i].get_x(), a[i].get_y() - b[i].get_y()) / r);
+    }
+    return worst;
+}
+
+bool same_bodies(const std::vector<Body> & a, const std::vector<Body> & b) {
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (a[i].get_x() != b[i].get_x() || a[i].get_y() != b[i].get_y() || a[i].get_v_x() != b[i].get_v_x() ||
+            a[i].get_v_y() != b[i].get_v_y()) {
+            return false;
+        }
+    }
+    return a.size() == b.size();
+}
+
+// seconds per step, best of 3 after one warm up step
+double step_seconds(Kosmos & kosmos, int steps) {
+    kosmos.step(3600.0);
+    double best = -1.0;
+    for (int trial = 0; trial < 3; ++trial) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        kosmos.run(steps, 3600.0);
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / steps;
+        if (best < 0.0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+bool test_tracers() {
+    bool passed = true;
+
+    printf("Tracers against zero mass bodies, solar system + 500 debris, 1 year of 1 day steps\n");
+    const std::vector<Body> dust = debris(500, 1);
+    const Integrator integrators[] = {Integrator::Verlet, Integrator::Yoshida6};
+    for (Integrator integrator : integrators) {
+        Kosmos with_tracers(solar_system_bodies());
+        Kosmos plain(solar_system_bodies());
+        std::vector<Body> everyone = solar_system_bodies();
+        everyone.insert(everyone.end(), dust.begin(), dust.end());
+        Kosmos as_bodies(everyone);
+        for (const Body & d : dust) {
+            with_tracers.add_tracer(d);
+        }
+        with_tracers.set_integrator(integrator);
+        plain.set_integrator(integrator);
+        as_bodies.set_integrator(integrator);
+        with_tracers.run(365, DAY_TO_SECONDS);
+        plain.run(365, DAY_TO_SECONDS);
+        as_bodies.run(365, DAY_TO_SECONDS);
+
+        const std::vector<Body> all = as_bodies.get_bodies();
+        const std::vector<Body> as_tracers(all.begin() + 10, all.end());
+        const double difference = position_difference(with_tracers.get_tracers(), as_tracers);
+        printf("    %-9s tracers vs zero mass bodies %.2e\n", integrator_name(integrator), difference);
+        passed &= report(integrator_name(integrator), difference < 1e-9 && with_tracers.get_tracer_count() == 500);
+        passed &= report("  bodies untouched by the tracers", same_bodies(with_tracers.get_bodies(), plain.get_bodies()));
+    }
+
+    printf("Setup\n");
+    Kosmos refused(solar_system_bodies());
+    refused.add_tracer(dust[0]);
+    refused.set_integrator(Integrator::Hermite4);
+    bool threw = false;
+    try {
+        refused.step(3600.0);
+    } catch (const std::logic_error &) {
+        threw = true;
+    }
+    passed &= report("hermite with tracers throws", threw);
+    refused.clear_tracers();
+    refused.step(3600.0);
+    passed &= report("hermite fine once they are gone", refused.get_tracer_count() == 0 && refused.get_step_count() == 1);
+
+    Kosmos bulk(solar_system_bodies());
+    Particles added(dust);
+    bulk.add_tracers(added);
+    bulk.set_tracer(3, Body(5e20, AU_M, 0.0, 0.0, 1e4));
+    const std::vector<Body> tracers = bulk.get_tracers();
+    passed &= report("add_tracers and set_tracer", tracers.size() == 500 && tracers[3].get_x() == AU_M &&
+                                                       tracers[3].get_mass() == 0.0 &&
+                                                       tracers[499].get_y() == dust[499].get_y());
+
+    // the checkpoint keeps the tracers, the restart follows the same path
+    const char * path = "test_tracers.nbc";
+    bulk.run(10, DAY_TO_SECONDS);
+    bulk.save_checkpoint(path);
+    Kosmos restored(std::vector<Body>{});
+    restored.load_checkpoint(path);
+    bulk.run(10, DAY_TO_SECONDS);
+    restored.run(10, DAY_TO_SECONDS);
+    std::remove(path);
+    passed &= report("checkpoint round trip", restored.get_tracer_count() == 500 &&
+                                                  same_bodies(restored.get_tracers(), bulk.get_tracers()) &&
+                                                  same_bodies(restored.get_bodies(), bulk.get_bodies()));
+
+    printf("Step cost, 200 bodies\n");
+    const std::vector<Body> heavy = massive_disk(200);
+    double seconds[2];
+    for (int k = 0; k < 2; ++k) {
+        Kosmos kosmos(heavy);
+        kosmos.add_tracers(Particles(debris(20000 * (k + 1), 3)));
+        seconds[k] = step_seconds(kosmos, 5);
+        printf("    %6d tracers           %8.2f ms/step\n", 20000 * (k + 1), 1e3 * seconds[k]);
+    }
+    std::vector<Body> everyone = heavy;
+    const std::vector<Body> more = debris(20000, 3);
+    everyone.insert(everyone.end(), more.begin(), more.end());
+    Kosmos all_pairs(everyone);
+    const double all_pairs_seconds = step_seconds(all_pairs, 2);
+    printf("    20000 zero mass bodies   %8.2f ms/step, %.0fx the tracers\n", 1e3 * all_pairs_seconds,
+           all_pairs_seconds / seconds[0]);
+    passed &= report("20x cheaper than all pairs", all_pairs_seconds > 20.0 * seconds[0]);
+    passed &= report("linear in the tracers", seconds[1] < 2.6 * seconds[0] && seconds[1] > 1.4 * seconds[0]);
+
+    printf("%s\n", passed ? "all tracer checks passed" : "tracer checks FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef TRACERS_TEST_H
+#define TRACERS_TEST_H
+
+// massless tracers: the same paths as zero mass bodies, no effect on the
+// bodies, checkpoint round trip, and the step cost against bodies + tracers
+// as one all pairs system
+bool test_tracers();
+
+#endif
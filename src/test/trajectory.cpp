@@ -0,0 +1,176 @@
+#include "trajectory.h"
+#include "test_util.hpp"
+#include "../kosmos/kosmos.hpp"
+#include "../io/trajectory.hpp"
+#include "../constants.h"
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+std::vector<Body> make_ring(int num_bodies) {
+    std::vector<Body> bodies;
+    bodies.push_back(Body(1.989e30, 0.0, 0.0, 0.0, 0.0));
+    for (int i = 1; i < num_bodies; ++i) {
+        double radius = AU_M * (1.0 + 0.07 * (i % 13));
+        double angle = (2.0 * M_PI * i) / (num_bodies - 1);
+        double speed = sqrt(G_CONST * 1.989e30 / radius);
+        bodies.push_back(Body(5.972e24, radius * cos(angle), radius * sin(angle),
+                              -speed * sin(angle), speed * cos(angle)));
+    }
+    return bodies;
+}
+
+// state the kosmos had at one sampled step
+struct Snapshot {
+    long long step;
+    double time;
+    std::vector<double> x, y, v_x, a_x;
+};
+
+Snapshot take(const Kosmos & kosmos) {
+    const Particles & p = kosmos.get_particles();
+    Snapshot snapshot;
+    snapshot.step = kosmos.get_step_count();
+    snapshot.time = kosmos.get_time();
+    snapshot.x.assign(p.x.begin(), p.x.end());
+    snapshot.y.assign(p.y.begin(), p.y.end());
+    snapshot.v_x.assign(p.v_x.begin(), p.v_x.end());
+    snapshot.a_x.assign(p.a_x.begin(), p.a_x.end());
+    return snapshot;
+}
+
+// runs a kosmos with a trajectory attached and records what it should contain
+std::vector<Snapshot> simulate(const char * path, unsigned fields, long long every, bool float32, int num_steps) {
+    Kosmos kosmos(make_ring(300));
+    kosmos.attach_trajectory(path, fields, every, float32);
+    std::vector<Snapshot> expected(1, take(kosmos));
+    kosmos.run(num_steps, 3600.0, every, [&](const Kosmos & k) {
+        expected.push_back(take(k));
+        return true;
+    });
+    kosmos.detach_trajectory();
+    return expected;
+}
+
+// largest relative difference between the file and the recorded states, -1 on a structural mismatch
+double compare(const TrajectoryReader & reader, const std::vector<Snapshot> & expected, std::size_t num_frames) {
+    if (reader.get_num_frames() != num_frames || reader.get_num_bodies() != expected[0].x.size()) {
+        return -1.0;
+    }
+    double worst = 0.0;
+    for (std::size_t k = 0; k < num_frames; ++k) {
+        const Snapshot & s = expected[k];
+        if (reader.get_step(k) != s.step || reader.get_time(k) != s.time) {
+            return -1.0;
+        }
+        for (std::size_t i = 0; i < s.x.size(); ++i) {
+            const double want[] = {s.x[i], s.y[i], s.v_x[i], s.a_x[i]};
+            const TrajectoryField fields[] = {TRAJ_X, TRAJ_Y, TRAJ_V_X, TRAJ_A_X};
+            for (int f = 0; f < 4; ++f) {
+                if (!reader.has_field(fields[f])) {
+                    continue;
+                }
+                double got = reader.value(k, fields[f], i);
+                double scale = std::fabs(want[f]) > 0.0 ? std::fabs(want[f]) : 1.0;
+                worst = std::max(worst, std::fabs(got - want[f]) / scale);
+            }
+        }
+    }
+    return worst;
+}
+
+// writes header over the one in path and reports whether opening the file is refused
+bool header_refused(const char * path, const TrajectoryHeader & header) {
+    FILE * file = std::fopen(path, "r+b");
+    const bool written = file != nullptr && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+    try {
+        TrajectoryReader reader(path);
+    } catch (const std::runtime_error &) {
+        return written;
+    }
+    return false;
+}
+
+} // namespace
+
+bool test_trajectory_roundtrip() {
+    const char * path = "test_trajectory.nbt";
+    const int num_steps = 100;
+    const long long every = 5;
+    const std::size_t num_frames = num_steps / every + 1;
+    bool passed = true;
+
+    printf("Trajectory files, 300 bodies, %d steps, a frame every %lld\n", num_steps, every);
+
+    {
+        std::vector<Snapshot> expected = simulate(path, TRAJ_X | TRAJ_Y | TRAJ_V_X | TRAJ_A_X, every, false, num_steps);
+        TrajectoryReader reader(path);
+        passed &= report("double frames read back exactly", reader.has_index() && compare(reader, expected, num_frames) == 0.0);
+
+        // one body over time straight from the mapping, frame_size bytes apart
+        const std::size_t body = 17;
+        const char * series = static_cast<const char *>(reader.series_data(TRAJ_Y, body));
+        const char * times = reinterpret_cast<const char *>(reader.times_data());
+        bool series_ok = true;
+        for (std::size_t k = 0; k < reader.get_num_frames(); ++k) {
+            double y = *reinterpret_cast<const double *>(series + k * reader.get_frame_size());
+            double t = *reinterpret_cast<const double *>(times + k * reader.get_index_stride());
+            series_ok = series_ok && y == expected[k].y[body] && t == expected[k].time;
+        }
+        passed &= report("strided body series matches", series_ok);
+    }
+
+    // a run that died never wrote its index, and may have half a frame at the end
+    {
+        std::vector<Snapshot> expected = simulate(path, TRAJ_X | TRAJ_Y, every, false, num_steps);
+        std::size_t frame_size = 0;
+        {
+            TrajectoryReader reader(path);
+            frame_size = reader.get_frame_size();
+        }
+        const off_t cut = static_cast<off_t>(sizeof(TrajectoryHeader) + (num_frames - 1) * frame_size + frame_size / 2);
+        bool truncated = truncate(path, cut) == 0;
+        TrajectoryReader reader(path);
+        passed &= report("file without index reads whole frames",
+                         truncated && !reader.has_index() && compare(reader, expected, num_frames - 1) == 0.0);
+    }
+
+    {
+        std::vector<Snapshot> expected = simulate(path, TRAJ_X | TRAJ_Y, every, true, num_steps);
+        TrajectoryReader reader(path);
+        double error = compare(reader, expected, num_frames);
+        passed &= report("float32 frames within float precision", reader.is_float32() && error >= 0.0 && error < 1e-7);
+    }
+
+    // headers whose sizes do not follow from num_bodies, fields and value_size
+    // would send the reader past the mapping, they are refused when opened
+    {
+        simulate(path, TRAJ_X | TRAJ_Y, every, false, num_steps);
+        TrajectoryHeader good;
+        FILE * file = std::fopen(path, "rb");
+        const bool read_back = file != nullptr && std::fread(&good, sizeof(good), 1, file) == 1;
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+        TrajectoryHeader odd_value = good, more_bodies = good, bad_frame = good;
+        odd_value.value_size = 2;
+        more_bodies.num_bodies = 1000 * good.num_bodies;
+        bad_frame.frame_size = good.frame_size + 8;
+        bool refused = read_back && header_refused(path, odd_value) && header_refused(path, more_bodies)
+                       && header_refused(path, bad_frame);
+        // and the untouched header still opens
+        refused = refused && !header_refused(path, good);
+        passed &= report("inconsistent header sizes refused", refused);
+    }
+
+    std::remove(path);
+    printf("\n%s\n", passed ? "Trajectory round trip ok" : "Trajectory round trip FAILED");
+    return passed;
+}
@@ -0,0 +1,9 @@
+#ifndef TRAJECTORY_TEST_H
+#define TRAJECTORY_TEST_H
+
+// writes trajectories from a running kosmos and reads them back through the
+// memory mapped reader (double, float32 and a file cut off mid run),
+// returns false if anything read back differs from what was simulated
+bool test_trajectory_roundtrip();
+
+#endif